@@ -39,6 +39,7 @@ extern "C" {
         .lru_purge_enable   = false,                    \
         .recv_wait_timeout  = 5,                        \
         .send_wait_timeout  = 5,                        \
+        .worker_count       = 0,                        \
 };
 
 #define ESP_ERR_HTTPD_BASE              (0x8000)                    /*!< Starting number of HTTPD error codes */
@@ -99,6 +100,16 @@ typedef struct httpd_config {
     bool        lru_purge_enable;   /*!< Purge "Least Recently Used" connection */
     uint16_t    recv_wait_timeout;  /*!< Timeout for recv function (in seconds)*/
     uint16_t    send_wait_timeout;  /*!< Timeout for send function (in seconds)*/
+
+    /**
+     * Number of worker tasks processing requests, with the same stack size and
+     * priority as the server task. If 0, requests are processed by the server
+     * task itself. Otherwise the server task only waits for requests and hands
+     * them to the workers, so a slow URI handler doesn't hold up other sessions.
+     * Handlers may then run concurrently, but requests of the same session are
+     * always processed one at a time, in order.
+     */
+    uint16_t    worker_count;
 } httpd_config_t;
 
 /**
@@ -385,6 +396,27 @@ typedef int (*httpd_send_func_t)(int sockfd, const char *buf, size_t buf_len, in
  */
 typedef int (*httpd_recv_func_t)(int sockfd, char *buf, size_t buf_len, int flags);
 
+struct iovec;
+
+/**
+ * @brief  Prototype for HTTPDs low-level vectored send function
+ *
+ * Sends the buffers described by iov, in order, like sendmsg() of the
+ * BSD socket API. It may send only part of the data, as send() may.
+ *
+ * @note   User specified send function must handle errors internally,
+ *         depending upon the set value of errno, and return specific
+ *         HTTPD_SOCK_ERR_ codes, which will eventually be conveyed as
+ *         return value of the response send APIs
+ *
+ * @return
+ *  - Bytes : The number of bytes sent successfully
+ *  - HTTPD_SOCK_ERR_INVALID  : Invalid arguments
+ *  - HTTPD_SOCK_ERR_TIMEOUT  : Timeout/interrupted while calling socket send()
+ *  - HTTPD_SOCK_ERR_FAIL     : Unrecoverable error while calling socket send()
+ */
+typedef int (*httpd_sendv_func_t)(int sockfd, const struct iovec *iov, int iovcnt, int flags);
+
 /** End of TX / RX
  * @}
  */
@@ -420,7 +452,8 @@ esp_err_t httpd_set_recv_override(httpd_req_t *r, httpd_recv_func_t recv_func);
  * @brief   Override web server's send function
  *
  * This function overrides the web server's send function. This same function is
- * used to send out any response to any HTTP request.
+ * used to send out any response to any HTTP request. It also replaces the
+ * vectored send function, see httpd_set_sendv_override().
  *
  * @note    This API is supposed to be called only from the context of
  *          a URI handler where httpd_req_t* request pointer is valid.
@@ -435,6 +468,28 @@ esp_err_t httpd_set_recv_override(httpd_req_t *r, httpd_recv_func_t recv_func);
  */
 esp_err_t httpd_set_send_override(httpd_req_t *r, httpd_send_func_t send_func);
 
+/**
+ * @brief   Override web server's vectored send function
+ *
+ * The response send APIs hand the header section and the content of a
+ * response to this function together, so that they may be sent with a
+ * single call. Setting a send function with httpd_set_send_override()
+ * removes this override, and responses are then sent with the send
+ * function alone, one buffer at a time.
+ *
+ * @note    This API is supposed to be called only from the context of
+ *          a URI handler where httpd_req_t* request pointer is valid.
+ *
+ * @param[in] r          The request being responded to
+ * @param[in] sendv_func The vectored send function to be set for this request
+ *
+ * @return
+ *  - ESP_OK : On successfully registering override
+ *  - ESP_ERR_INVALID_ARG : Null arguments
+ *  - ESP_ERR_HTTPD_INVALID_REQ : Invalid request pointer
+ */
+esp_err_t httpd_set_sendv_override(httpd_req_t *r, httpd_sendv_func_t sendv_func);
+
 /**
  * @brief   Get the Socket Descriptor from the HTTP request
  *
@@ -985,6 +1040,26 @@ typedef void (*httpd_work_fn_t)(void *arg);
  */
 esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void *arg);
 
+/**
+ * @brief   Queue execution of a function in the context of a worker task
+ *
+ * Like httpd_queue_work(), but the function is executed by one of the worker
+ * tasks (see worker_count in httpd_config_t), after the requests already
+ * handed to it. It should not block for long, as this holds up the sessions
+ * handled by this worker.
+ *
+ * @param[in] handle    Handle to server returned by httpd_start
+ * @param[in] worker    Index of the worker, from 0 to worker_count - 1
+ * @param[in] work      Pointer to the function to be executed in the worker's context
+ * @param[in] arg       Pointer to the arguments that should be passed to this function
+ *
+ * @return
+ *  - ESP_OK   : On successfully queueing the work
+ *  - ESP_FAIL : The queue of the worker is full
+ *  - ESP_ERR_INVALID_ARG : Null arguments or no such worker
+ */
+esp_err_t httpd_queue_worker_work(httpd_handle_t handle, int worker, httpd_work_fn_t work, void *arg);
+
 /** End of Group Work Queue
  * @}
  */
@@ -26,6 +26,23 @@
 #include <esp_http_server.h>
 #include "osal.h"
 
+/* The sockets of the server are waited on with select() by default, as
+ * that is what LWIP supports. On Linux hosts epoll is used instead, and
+ * poll() can be selected by defining HTTPD_POLL_POLL. */
+#if !defined(HTTPD_POLL_SELECT) && !defined(HTTPD_POLL_POLL) && !defined(HTTPD_POLL_EPOLL)
+#ifdef __linux__
+#define HTTPD_POLL_EPOLL
+#else
+#define HTTPD_POLL_SELECT
+#endif
+#endif
+
+#if defined(HTTPD_POLL_POLL)
+#include <poll.h>
+#elif defined(HTTPD_POLL_EPOLL)
+#include <sys/epoll.h>
+#endif
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -122,9 +139,33 @@ struct sock_db {
     httpd_free_sess_ctx_fn_t free_ctx;      /*!< Function for freeing the context */
     httpd_send_func_t send_fn;              /*!< Send function for this socket */
     httpd_recv_func_t recv_fn;              /*!< Send function for this socket */
+    httpd_sendv_func_t sendv_fn;            /*!< Vectored send function for this socket, NULL to use send_fn */
     int64_t timestamp;                      /*!< Timestamp indicating when the socket was last used */
     char pending_data[PARSER_BLOCK_SIZE];   /*!< Buffer for pending data to be received */
     size_t pending_len;                     /*!< Length of pending data to be received */
+    bool pending_queued;                    /*!< Queued for processing because of pending data */
+    bool busy;                              /*!< Handed to a worker, which is processing a request */
+    bool close_pending;                     /*!< Close requested while busy, done when the worker is finished */
+};
+
+/**
+ * @brief   Set of descriptors waited on by the server thread, and the
+ *          descriptors found ready by the last wait
+ */
+struct httpd_poll {
+    int max_fds;                            /*!< Maximum number of descriptors in the set */
+    int fd_cnt;                             /*!< Number of descriptors in the set */
+    int *ready_fds;                         /*!< Descriptors ready after httpd_poll_wait() */
+#if defined(HTTPD_POLL_EPOLL)
+    int epoll_fd;                           /*!< The epoll instance */
+    struct epoll_event *events;             /*!< Events returned by epoll_wait() */
+#elif defined(HTTPD_POLL_POLL)
+    struct pollfd *pfds;                    /*!< Descriptors passed to poll() */
+#else
+    fd_set fds;                             /*!< Descriptors passed to select() */
+    int *fd_list;                           /*!< Same descriptors, to check only those after select() */
+    int max_fd;                             /*!< Highest descriptor in fds */
+#endif
 };
 
 /**
@@ -147,6 +188,43 @@ struct httpd_req_aux {
     struct http_parser_url url_parse_res;           /*!< URL parsing result, used for retrieving URL elements */
 };
 
+/**
+ * @brief   Message to a worker task
+ */
+struct httpd_worker_msg {
+    enum {
+        HTTPD_WORKER_SESS,                  /*!< Process a request of the session */
+        HTTPD_WORKER_WORK,                  /*!< Execute a work function */
+        HTTPD_WORKER_STOP,                  /*!< Exit the worker */
+    } type;
+    struct sock_db *sd;                     /*!< Session with a request to process */
+    httpd_work_fn_t work;                   /*!< Work function */
+    void *arg;                              /*!< Argument of the work function */
+};
+
+/**
+ * @brief   A session returned by a worker, once its request is processed
+ */
+struct httpd_worker_done {
+    struct sock_db *sd;                     /*!< The session */
+    esp_err_t ret;                          /*!< Result of httpd_sess_process_req() */
+    int worker;                             /*!< Index of the worker */
+};
+
+/**
+ * @brief   Worker task data, with its own request structures so that
+ *          workers can process requests concurrently
+ */
+struct httpd_worker {
+    struct httpd_data *hd;                  /*!< Server instance data */
+    int index;                              /*!< Index of this worker */
+    struct thread_data td;                  /*!< Information for the worker thread */
+    oqueue_t queue;                         /*!< Messages for this worker */
+    unsigned load;                          /*!< Sessions handed to this worker and not returned yet */
+    struct httpd_req req;                   /*!< The current request of this worker */
+    struct httpd_req_aux req_aux;           /*!< Additional data about the request kept unexposed */
+};
+
 /**
  * @brief   Server data for each instance. This is exposed publicaly as
  *          httpd_handle_t but internal structure/members are kept private.
@@ -158,6 +236,20 @@ struct httpd_data {
     int msg_fd;                             /*!< Ctrl message sender FD */
     struct thread_data hd_td;               /*!< Information for the HTTPd thread */
     struct sock_db *hd_sd;                  /*!< The socket database */
+    int *hd_sd_table;                       /*!< Hash table of indices into hd_sd, by descriptor (-1 if empty) */
+    unsigned hd_sd_table_mask;              /*!< Size of hd_sd_table minus 1, the size is a power of 2 */
+    int *hd_sd_free;                        /*!< Stack of unused indices into hd_sd */
+    int hd_sd_free_cnt;                     /*!< Number of unused indices */
+    int *hd_pending_fds;                    /*!< Sessions queued for processing because of pending data */
+    int hd_pending_cnt;                     /*!< Number of queued sessions */
+    struct httpd_poll hd_poll;              /*!< Descriptors waited on by the server thread */
+    struct httpd_worker *hd_workers;        /*!< Worker tasks, NULL if there are none */
+    omutex_t hd_sd_lock;                    /*!< Protects hd_sd_table from lookups by workers while it changes */
+    omutex_t hd_done_lock;                  /*!< Protects the sessions returned by the workers */
+    struct httpd_worker_done *hd_done;      /*!< Sessions returned by the workers */
+    int hd_done_cnt;                        /*!< Number of sessions returned by the workers */
+    bool hd_done_wake;                      /*!< The server thread has been woken up to take the returned sessions */
+    bool hd_accept_paused;                  /*!< The listening socket isn't waited on, all the sessions are busy */
     httpd_uri_t **hd_calls;                 /*!< Registered URI handlers */
     struct httpd_req hd_req;                /*!< The current HTTPD request */
     struct httpd_req_aux hd_req_aux;        /*!< Additional data about the HTTPD request kept unexposed */
@@ -170,11 +262,36 @@ struct httpd_data {
  */
 
 /**
- * @brief   Initializes an http session by resetting the sockets database.
+ * @brief   Initializes an http session by resetting the sockets database,
+ *          and allocates the table for looking up sessions by descriptor.
+ *
+ * @param[in] hd    Server instance data
+ *
+ * @return
+ *  - ESP_OK                 : on success
+ *  - ESP_ERR_HTTPD_ALLOC_MEM : if memory couldn't be allocated
+ */
+esp_err_t httpd_sess_init(struct httpd_data *hd);
+
+/**
+ * @brief   Frees the memory allocated by httpd_sess_init()
+ *
+ * @param[in] hd    Server instance data
+ */
+void httpd_sess_deinit(struct httpd_data *hd);
+
+/**
+ * @brief   Looks up the session of a descriptor
+ *
+ * @note    Only the server thread may call this without holding hd_sd_lock,
+ *          as only it adds and removes sessions.
  *
  * @param[in] hd    Server instance data
+ * @param[in] fd    Client descriptor
+ *
+ * @return  The session, or NULL if there is none for this descriptor
  */
-void httpd_sess_init(struct httpd_data *hd);
+struct sock_db *httpd_sess_get(struct httpd_data *hd, int fd);
 
 /**
  * @brief   Starts a new session for client requesting connection and adds
@@ -192,15 +309,49 @@ esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd);
 /**
  * @brief   Processes incoming HTTP requests
  *
+ * If data of the next request is left pending after this, the session
+ * is queued to be processed again by httpd_sess_process_pending().
+ *
  * @param[in] hd    Server instance data
  * @param[in] clifd Descriptor of the client from which data is to be received
  *
  * @return
- *  - ESP_OK    : on successfully receiving, parsing and responding to a request
- *  - ESP_FAIL  : in case of failure in any of the stages of processing
+ *  - ESP_OK             : on successfully receiving, parsing and responding to a request
+ *  - ESP_ERR_NOT_FOUND  : if there is no session for this descriptor
+ *  - ESP_FAIL           : in case of failure in any of the stages of processing
  */
 esp_err_t httpd_sess_process(struct httpd_data *hd, int clifd);
 
+/**
+ * @brief   Receives, parses and responds to one request of a session
+ *
+ * This is the part of httpd_sess_process() which doesn't access the
+ * session database, so it is also used by worker threads, each with their
+ * own request structures.
+ *
+ * @param[in] hd    Server instance data
+ * @param[in] sd    Session with a request to process
+ * @param[in] r     Request structure to use
+ * @param[in] ra    Auxiliary request structure to use
+ *
+ * @return
+ *  - ESP_OK    : on successfully processing the request
+ *  - ESP_FAIL  : in case of failure, after which the session should be closed
+ */
+esp_err_t httpd_sess_process_req(struct httpd_data *hd, struct sock_db *sd,
+                                 struct httpd_req *r, struct httpd_req_aux *ra);
+
+/**
+ * @brief   Processes the sessions queued by httpd_sess_process() because
+ *          they have pending data, which select() wouldn't report.
+ *
+ * Sessions which fail are closed. Sessions which still have pending data
+ * afterwards are queued again.
+ *
+ * @param[in] hd    Server instance data
+ */
+void httpd_sess_process_pending(struct httpd_data *hd);
+
 /**
  * @brief   Remove client descriptor from the session / socket database
  *          and close the connection for this client.
@@ -220,17 +371,6 @@ esp_err_t httpd_sess_process(struct httpd_data *hd, int clifd);
  */
 int httpd_sess_delete(struct httpd_data *hd, int clifd);
 
-/**
- * @brief   Add descriptors present in the socket database to an fd_set and
- *          update the value of maxfd which are needed by the select function
- *          for looking through all available sockets for incoming data.
- *
- * @param[in]  hd    Server instance data
- * @param[out] fdset File descriptor set to be updated.
- * @param[out] maxfd Maximum value among all file descriptors.
- */
-void httpd_sess_set_descriptors(struct httpd_data *hd, fd_set *fdset, int *maxfd);
-
 /**
  * @brief   Iterates through the list of client fds in the session /socket database.
  *          Passing the value of a client fd returns the fd for the next client
@@ -288,6 +428,7 @@ bool httpd_sess_pending(struct httpd_data *hd, int fd);
  *
  * @return
  *  - ESP_OK    : if session closure initiated successfully
+ *  - ESP_ERR_NOT_FOUND : if all the sessions are busy in workers
  *  - ESP_FAIL  : if failed
  */
 esp_err_t httpd_sess_close_lru(struct httpd_data *hd);
@@ -296,6 +437,131 @@ esp_err_t httpd_sess_close_lru(struct httpd_data *hd);
  * @}
  */
 
+/****************** Group : Polling ********************/
+/** @name Polling
+ * Waiting for activity on the descriptors of the server. Descriptors are
+ * added and removed as sessions open and close, so the cost of a wait
+ * doesn't include rebuilding the set, and (with epoll) is proportional to
+ * the number of ready descriptors rather than open ones.
+ * @{
+ */
+
+/**
+ * @brief   Initializes an empty set of descriptors
+ *
+ * @param[in] hp      Descriptor set
+ * @param[in] max_fds Maximum number of descriptors in the set
+ *
+ * @return
+ *  - ESP_OK                  : on success
+ *  - ESP_ERR_HTTPD_ALLOC_MEM : if memory couldn't be allocated
+ *  - ESP_FAIL                : if the poller couldn't be created
+ */
+esp_err_t httpd_poll_init(struct httpd_poll *hp, int max_fds);
+
+/**
+ * @brief   Frees the resources of a descriptor set
+ *
+ * @param[in] hp      Descriptor set
+ */
+void httpd_poll_deinit(struct httpd_poll *hp);
+
+/**
+ * @brief   Adds a descriptor to wait for incoming data on
+ *
+ * @param[in] hp      Descriptor set
+ * @param[in] fd      Descriptor to add
+ *
+ * @return
+ *  - ESP_OK   : on success
+ *  - ESP_FAIL : if the set is full or the descriptor is invalid
+ */
+esp_err_t httpd_poll_add(struct httpd_poll *hp, int fd);
+
+/**
+ * @brief   Removes a descriptor. This must be called before it is closed.
+ *
+ * @param[in] hp      Descriptor set
+ * @param[in] fd      Descriptor to remove
+ */
+void httpd_poll_del(struct httpd_poll *hp, int fd);
+
+/**
+ * @brief   Waits until data (or an error) is available on any descriptor
+ *          of the set
+ *
+ * @param[in] hp         Descriptor set
+ * @param[in] timeout_ms Maximum time to wait, 0 to return immediately or -1
+ *                       to wait forever
+ *
+ * @return
+ *  - Number of ready descriptors, which are stored in hp->ready_fds
+ *  - -1 : on error (errno is set)
+ */
+int httpd_poll_wait(struct httpd_poll *hp, int timeout_ms);
+
+/** End of Group : Polling
+ * @}
+ */
+
+/****************** Group : Workers ********************/
+/** @name Workers
+ * Processing requests in worker threads (see worker_count in httpd_config_t).
+ * The server thread removes a session with a request from the poller and
+ * hands it to the least loaded worker, which returns it when it is done.
+ * Only then is the session waited on again, so its requests are processed
+ * one at a time, in order.
+ * @{
+ */
+
+/**
+ * @brief   Creates the worker threads, if any are configured
+ *
+ * @param[in] hd    Server instance data
+ *
+ * @return
+ *  - ESP_OK                  : on success
+ *  - ESP_ERR_HTTPD_ALLOC_MEM : if memory couldn't be allocated
+ *  - ESP_ERR_HTTPD_TASK      : if a thread couldn't be created
+ */
+esp_err_t httpd_workers_start(struct httpd_data *hd);
+
+/**
+ * @brief   Stops the worker threads, after they are done with the messages
+ *          already queued to them, and frees their resources
+ *
+ * @param[in] hd    Server instance data
+ */
+void httpd_workers_stop(struct httpd_data *hd);
+
+/**
+ * @brief   Hands a session with a request to a worker
+ *
+ * The descriptor is removed from the poller until the worker returns the
+ * session.
+ *
+ * @param[in] hd    Server instance data
+ * @param[in] fd    Client descriptor
+ *
+ * @return
+ *  - ESP_OK            : on success
+ *  - ESP_ERR_NOT_FOUND : if there is no session for this descriptor
+ */
+esp_err_t httpd_workers_dispatch(struct httpd_data *hd, int fd);
+
+/**
+ * @brief   Takes back the sessions returned by the workers. Failed ones are
+ *          closed, the others are waited on again, or handed to a worker
+ *          again if they have pending data.
+ *
+ * @param[in] hd    Server instance data
+ */
+void httpd_workers_process_done(struct httpd_data *hd);
+
+/** End of Group : Workers
+ * @}
+ */
+
 /****************** Group : URI Handling ********************/
 /** @name URI Handling
  * Methods for accessing URI handlers
@@ -307,12 +573,13 @@ esp_err_t httpd_sess_close_lru(struct httpd_data *hd);
  *          and invokes the appropriate one if found
  *
  * @param[in] hd  Server instance data for which handler needs to be invoked
+ * @param[in] req The parsed request
  *
  * @return
  *  - ESP_OK    : if handler found and executed successfully
  *  - ESP_FAIL  : otherwise
  */
-esp_err_t httpd_uri(struct httpd_data *hd);
+esp_err_t httpd_uri(struct httpd_data *hd, httpd_req_t *req);
 
 /**
  * @brief   Deregister all URI handlers
@@ -352,25 +619,28 @@ bool httpd_valid_req(httpd_req_t *r);
  * http_recv() after this reads the body of the request.
  *
  * @param[in] hd  Server instance data
+ * @param[in] r   Request structure to fill
+ * @param[in] ra  Auxiliary request structure, attached to r
  * @param[in] sd  Pointer to socket which is needed for receiving TCP packets.
  *
  * @return
  *  - ESP_OK    : if request packet is valid
  *  - ESP_FAIL  : otherwise
  */
-esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd);
+esp_err_t httpd_req_new(struct httpd_data *hd, struct httpd_req *r,
+                        struct httpd_req_aux *ra, struct sock_db *sd);
 
 /**
  * @brief   For an HTTP request, resets the resources allocated for it and
  *          purges any data left to be received
  *
- * @param[in] hd  Server instance data
+ * @param[in] r   The request
  *
  * @return
  *  - ESP_OK    : if request packet deleted and resources cleaned.
  *  - ESP_FAIL  : otherwise.
  */
-esp_err_t httpd_req_delete(struct httpd_data *hd);
+esp_err_t httpd_req_delete(struct httpd_req *r);
 
 /** End of Group : Parsing
  * @}
@@ -465,6 +735,22 @@ size_t httpd_unrecv(struct httpd_req *r, const char *buf, size_t buf_len);
  */
 int httpd_default_send(int sockfd, const char *buf, size_t buf_len, int flags);
 
+/**
+ * @brief   This is the low level default vectored send function of the HTTPD.
+ *          This should NEVER be called directly. The semantics of this is
+ *          exactly similar to sendmsg() of the BSD socket API.
+ *
+ * @param[in] sockfd  Socket descriptor for sending data
+ * @param[in] iov     Buffers to be sent, in order
+ * @param[in] iovcnt  Number of buffers
+ * @param[in] flags   Flags for mode selection
+ *
+ * @return
+ *  - Length of data : if successful
+ *  - -1             : if failed (appropriate errno is set)
+ */
+int httpd_default_sendv(int sockfd, const struct iovec *iov, int iovcnt, int flags);
+
 /**
  * @brief   This is the low level default recv function of the HTTPD. This should
  *          NEVER be called directly. The semantics of this is exactly similar to
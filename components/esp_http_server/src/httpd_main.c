@@ -32,7 +32,16 @@ static esp_err_t httpd_accept_conn(struct httpd_data *hd, int listen_fd)
     if (hd->config.lru_purge_enable == true) {
         if (!httpd_is_sess_available(hd)) {
             /* Queue asynchronous closure of the least recently used session */
-            return httpd_sess_close_lru(hd);
+            esp_err_t ret = httpd_sess_close_lru(hd);
+            if (ret == ESP_ERR_NOT_FOUND) {
+                /* All the sessions are busy in workers. The listening socket
+                 * would stay ready meanwhile, so stop waiting on it until
+                 * httpd_workers_process_done() gets one back */
+                httpd_poll_del(&hd->hd_poll, listen_fd);
+                hd->hd_accept_paused = true;
+                return ESP_OK;
+            }
+            return ret;
             /* Returning from this allowes the main server thread to process
              * the queued asynchronous control message for closing LRU session.
              * Since connection request hasn't been addressed yet using accept()
@@ -144,20 +153,13 @@ static void httpd_process_ctrl_msg(struct httpd_data *hd)
 /* Manage in-coming connection or data requests */
 static esp_err_t httpd_server(struct httpd_data *hd)
 {
-    fd_set read_set;
-    FD_ZERO(&read_set);
-    FD_SET(hd->listen_fd, &read_set);
-    FD_SET(hd->ctrl_fd, &read_set);
-
-    int tmp_max_fd;
-    httpd_sess_set_descriptors(hd, &read_set, &tmp_max_fd);
-    int maxfd = MAX(hd->listen_fd, tmp_max_fd);
-    tmp_max_fd = maxfd;
-    maxfd = MAX(hd->ctrl_fd, tmp_max_fd);
-
-    ESP_LOGD(TAG, LOG_FMT("doing select maxfd+1 = %d"), maxfd + 1);
-    int active_cnt = select(maxfd + 1, &read_set, NULL, NULL, NULL);
+    /* Don't block if sessions with pending data are waiting to be processed */
+    int timeout_ms = hd->hd_pending_cnt > 0 ? 0 : -1;
+    int active_cnt = httpd_poll_wait(&hd->hd_poll, timeout_ms);
     if (active_cnt < 0) {
+        if (errno == EINTR) {
+            return ESP_OK;
+        }
         ESP_LOGE(TAG, LOG_FMT("error in select (%d)"), errno);
         /* Assert, as it's not possible to recover from this point onwards,
          * and there is no way to notify the main thread that server handle
@@ -165,36 +167,56 @@ static esp_err_t httpd_server(struct httpd_data *hd)
         assert(false);
         return ESP_FAIL;
     }
+    const int *ready_fds = hd->hd_poll.ready_fds;
+    bool listen_ready = false;
+    int i;
 
     /* Case0: Do we have a control message? */
-    if (FD_ISSET(hd->ctrl_fd, &read_set)) {
-        ESP_LOGD(TAG, LOG_FMT("processing ctrl message"));
-        httpd_process_ctrl_msg(hd);
-        if (hd->hd_td.status == THREAD_STOPPING) {
-            ESP_LOGD(TAG, LOG_FMT("stopping thread"));
-            return ESP_FAIL;
+    for (i = 0; i < active_cnt; i++) {
+        if (ready_fds[i] == hd->ctrl_fd) {
+            ESP_LOGD(TAG, LOG_FMT("processing ctrl message"));
+            httpd_process_ctrl_msg(hd);
+            if (hd->hd_td.status == THREAD_STOPPING) {
+                ESP_LOGD(TAG, LOG_FMT("stopping thread"));
+                return ESP_FAIL;
+            }
+            break;
         }
     }
 
+    /* Take back the sessions the workers are done with, in case
+     * their wake up message was lost */
+    httpd_workers_process_done(hd);
+
     /* Case1: Do we have any activity on the current data
-     * sessions? */
-    int fd = -1;
-    while ((fd = httpd_sess_iterate(hd, fd)) != -1) {
-        if (FD_ISSET(fd, &read_set) || (httpd_sess_pending(hd, fd))) {
-            ESP_LOGD(TAG, LOG_FMT("processing socket %d"), fd);
-            if (httpd_sess_process(hd, fd) != ESP_OK) {
-                ESP_LOGD(TAG, LOG_FMT("closing socket %d"), fd);
-                close(fd);
-                /* Delete session and update fd to that
-                 * preceding the one being deleted */
-                fd = httpd_sess_delete(hd, fd);
-            }
+     * sessions? Only the ready ones are visited. */
+    for (i = 0; i < active_cnt; i++) {
+        int fd = ready_fds[i];
+        if (fd == hd->ctrl_fd) {
+            continue;
+        }
+        if (fd == hd->listen_fd) {
+            listen_ready = true;
+            continue;
+        }
+        if (hd->hd_workers != NULL) {
+            httpd_workers_dispatch(hd, fd);
+            continue;
+        }
+        ESP_LOGD(TAG, LOG_FMT("processing socket %d"), fd);
+        esp_err_t ret = httpd_sess_process(hd, fd);
+        /* The session may have been closed by a control message */
+        if (ret != ESP_OK && ret != ESP_ERR_NOT_FOUND) {
+            ESP_LOGD(TAG, LOG_FMT("closing socket %d"), fd);
+            httpd_sess_delete(hd, fd);
+            close(fd);
         }
     }
+    httpd_sess_process_pending(hd);
 
     /* Case2: Do we have any incoming connection requests to
      * process? */
-    if (FD_ISSET(hd->listen_fd, &read_set)) {
+    if (listen_ready) {
         ESP_LOGD(TAG, LOG_FMT("processing listen socket %d"), hd->listen_fd);
         if (httpd_accept_conn(hd, hd->listen_fd) != ESP_OK) {
             ESP_LOGW(TAG, LOG_FMT("error accepting new connection"));
@@ -203,6 +225,15 @@ static esp_err_t httpd_server(struct httpd_data *hd)
     return ESP_OK;
 }
 
+/* Release the sockets and poller created by httpd_server_init() */
+static void httpd_server_deinit(struct httpd_data *hd)
+{
+    httpd_poll_deinit(&hd->hd_poll);
+    close(hd->msg_fd);
+    cs_free_ctrl_sock(hd->ctrl_fd);
+    close(hd->listen_fd);
+}
+
 /* The main HTTPD thread */
 static void httpd_thread(void *arg)
 {
@@ -219,10 +250,9 @@ static void httpd_thread(void *arg)
     }
 
     ESP_LOGD(TAG, LOG_FMT("web server exiting"));
-    close(hd->msg_fd);
-    cs_free_ctrl_sock(hd->ctrl_fd);
+    httpd_workers_stop(hd);
     httpd_close_all_sessions(hd);
-    close(hd->listen_fd);
+    httpd_server_deinit(hd);
     hd->hd_td.status = THREAD_STOPPED;
     httpd_os_thread_delete();
 }
@@ -271,6 +301,23 @@ static esp_err_t httpd_server_init(struct httpd_data *hd)
         return ESP_FAIL;
     }
 
+    /* Sessions, and the listen and control sockets */
+    if (httpd_poll_init(&hd->hd_poll, hd->config.max_open_sockets + 2) != ESP_OK) {
+        ESP_LOGE(TAG, LOG_FMT("error in creating poller"));
+        close(fd);
+        close(ctrl_fd);
+        close(msg_fd);
+        return ESP_FAIL;
+    }
+    if (httpd_poll_add(&hd->hd_poll, fd) != ESP_OK ||
+        httpd_poll_add(&hd->hd_poll, ctrl_fd) != ESP_OK) {
+        httpd_poll_deinit(&hd->hd_poll);
+        close(fd);
+        close(ctrl_fd);
+        close(msg_fd);
+        return ESP_FAIL;
+    }
+
     hd->listen_fd = fd;
     hd->ctrl_fd = ctrl_fd;
     hd->msg_fd  = msg_fd;
@@ -314,6 +361,7 @@ static void httpd_delete(struct httpd_data *hd)
     struct httpd_req_aux *ra = &hd->hd_req_aux;
     /* Free memory of httpd instance data */
     free(ra->resp_hdrs);
+    httpd_sess_deinit(hd);
     free(hd->hd_sd);
 
     /* Free registered URI handlers */
@@ -339,12 +387,26 @@ esp_err_t httpd_start(httpd_handle_t *handle, const httpd_config_t *config)
         return ESP_FAIL;
     }
 
-    httpd_sess_init(hd);
+    if (httpd_sess_init(hd) != ESP_OK) {
+        httpd_server_deinit(hd);
+        httpd_delete(hd);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+
+    esp_err_t ret = httpd_workers_start(hd);
+    if (ret != ESP_OK) {
+        httpd_server_deinit(hd);
+        httpd_delete(hd);
+        return ret;
+    }
+
     if (httpd_os_thread_create(&hd->hd_td.handle, "httpd",
                                hd->config.stack_size,
                                hd->config.task_priority,
                                httpd_thread, hd) != ESP_OK) {
         /* Failed to launch task */
+        httpd_workers_stop(hd);
+        httpd_server_deinit(hd);
         httpd_delete(hd);
         return ESP_ERR_HTTPD_TASK;
     }
@@ -493,9 +493,8 @@ static void parse_init(httpd_req_t *r, http_parser *parser, parser_data_t *data)
 
 /* Function that receives TCP data and runs parser on it
  */
-static esp_err_t httpd_parse_req(struct httpd_data *hd)
+static esp_err_t httpd_parse_req(struct httpd_data *hd, httpd_req_t *r)
 {
-    httpd_req_t *r = &hd->hd_req;
     int blk_len,  offset;
     http_parser   parser;
     parser_data_t parser_data;
@@ -524,7 +523,7 @@ static esp_err_t httpd_parse_req(struct httpd_data *hd)
     } while (parser_data.status != PARSING_COMPLETE);
 
     ESP_LOGD(TAG, LOG_FMT("parsing complete"));
-    return httpd_uri(hd);
+    return httpd_uri(hd, r);
 }
 
 static void init_req(httpd_req_t *r, httpd_config_t *config)
@@ -555,15 +554,14 @@ static void init_req_aux(struct httpd_req_aux *ra, httpd_config_t *config)
 /* Function that processes incoming TCP data and
  * updates the http request data httpd_req_t
  */
-esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
+esp_err_t httpd_req_new(struct httpd_data *hd, httpd_req_t *r,
+                        struct httpd_req_aux *ra, struct sock_db *sd)
 {
-    httpd_req_t *r = &hd->hd_req;
     init_req(r, &hd->config);
-    init_req_aux(&hd->hd_req_aux, &hd->config);
+    init_req_aux(ra, &hd->config);
     r->handle = hd;
-    r->aux = &hd->hd_req_aux;
+    r->aux = ra;
     /* Associate the request to the socket */
-    struct httpd_req_aux *ra  = r->aux;
     ra->sd = sd;
     /* Set defaults */
     ra->status = (char *)HTTPD_200;
@@ -573,14 +571,13 @@ esp_err_t httpd_req_new(struct httpd_data *hd, struct sock_db *sd)
     r->sess_ctx = sd->ctx;
     r->free_ctx = sd->free_ctx;
     /* Parse request */
-    return httpd_parse_req(hd);
+    return httpd_parse_req(hd, r);
 }
 
 /* Function that resets the http request data
  */
-esp_err_t httpd_req_delete(struct httpd_data *hd)
+esp_err_t httpd_req_delete(httpd_req_t *r)
 {
-    httpd_req_t *r = &hd->hd_req;
     struct httpd_req_aux *ra = r->aux;
 
     /* Finish off reading any pending/leftover data */
@@ -619,9 +616,19 @@ bool httpd_valid_req(httpd_req_t *r)
         if (hd) {
             /* Check if this function is running in the context of
              * the correct httpd server thread */
-            if (httpd_os_thread_handle() == hd->hd_td.handle) {
+            othread_t thread = httpd_os_thread_handle();
+            if (thread == hd->hd_td.handle) {
                 return true;
             }
+            /* Or of the worker thread processing this request */
+            if (hd->hd_workers != NULL) {
+                int i;
+                for (i = 0; i < hd->config.worker_count; i++) {
+                    if (r == &hd->hd_workers[i].req && thread == hd->hd_workers[i].td.handle) {
+                        return true;
+                    }
+                }
+            }
         }
     }
     return false;
@@ -0,0 +1,218 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include <esp_http_server.h>
+#include "esp_httpd_priv.h"
+
+static const char *TAG = "httpd_poll";
+
+#if defined(HTTPD_POLL_EPOLL)
+
+esp_err_t httpd_poll_init(struct httpd_poll *hp, int max_fds)
+{
+    hp->max_fds = max_fds;
+    hp->fd_cnt = 0;
+    hp->ready_fds = calloc(max_fds, sizeof(int));
+    hp->events = calloc(max_fds, sizeof(struct epoll_event));
+    if (hp->ready_fds == NULL || hp->events == NULL) {
+        free(hp->ready_fds);
+        free(hp->events);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    hp->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (hp->epoll_fd < 0) {
+        ESP_LOGE(TAG, LOG_FMT("error in epoll_create1 (%d)"), errno);
+        free(hp->ready_fds);
+        free(hp->events);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+void httpd_poll_deinit(struct httpd_poll *hp)
+{
+    close(hp->epoll_fd);
+    free(hp->ready_fds);
+    free(hp->events);
+}
+
+esp_err_t httpd_poll_add(struct httpd_poll *hp, int fd)
+{
+    struct epoll_event ev = {
+        .events  = EPOLLIN,
+        .data.fd = fd,
+    };
+    if (hp->fd_cnt == hp->max_fds) {
+        return ESP_FAIL;
+    }
+    if (epoll_ctl(hp->epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        ESP_LOGW(TAG, LOG_FMT("error in epoll_ctl (%d)"), errno);
+        return ESP_FAIL;
+    }
+    hp->fd_cnt++;
+    return ESP_OK;
+}
+
+void httpd_poll_del(struct httpd_poll *hp, int fd)
+{
+    if (epoll_ctl(hp->epoll_fd, EPOLL_CTL_DEL, fd, NULL) == 0) {
+        hp->fd_cnt--;
+    }
+}
+
+int httpd_poll_wait(struct httpd_poll *hp, int timeout_ms)
+{
+    int cnt = epoll_wait(hp->epoll_fd, hp->events, hp->max_fds, timeout_ms);
+    for (int i = 0; i < cnt; i++) {
+        hp->ready_fds[i] = hp->events[i].data.fd;
+    }
+    return cnt;
+}
+
+#elif defined(HTTPD_POLL_POLL)
+
+esp_err_t httpd_poll_init(struct httpd_poll *hp, int max_fds)
+{
+    hp->max_fds = max_fds;
+    hp->fd_cnt = 0;
+    hp->ready_fds = calloc(max_fds, sizeof(int));
+    hp->pfds = calloc(max_fds, sizeof(struct pollfd));
+    if (hp->ready_fds == NULL || hp->pfds == NULL) {
+        free(hp->ready_fds);
+        free(hp->pfds);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    return ESP_OK;
+}
+
+void httpd_poll_deinit(struct httpd_poll *hp)
+{
+    free(hp->ready_fds);
+    free(hp->pfds);
+}
+
+esp_err_t httpd_poll_add(struct httpd_poll *hp, int fd)
+{
+    if (hp->fd_cnt == hp->max_fds || fd < 0) {
+        return ESP_FAIL;
+    }
+    hp->pfds[hp->fd_cnt].fd = fd;
+    hp->pfds[hp->fd_cnt].events = POLLIN;
+    hp->pfds[hp->fd_cnt].revents = 0;
+    hp->fd_cnt++;
+    return ESP_OK;
+}
+
+void httpd_poll_del(struct httpd_poll *hp, int fd)
+{
+    for (int i = 0; i < hp->fd_cnt; i++) {
+        if (hp->pfds[i].fd == fd) {
+            /* Order doesn't matter, move the last one here */
+            hp->pfds[i] = hp->pfds[--hp->fd_cnt];
+            return;
+        }
+    }
+}
+
+int httpd_poll_wait(struct httpd_poll *hp, int timeout_ms)
+{
+    int active_cnt = poll(hp->pfds, hp->fd_cnt, timeout_ms);
+    int cnt = 0;
+    for (int i = 0; i < hp->fd_cnt && cnt < active_cnt; i++) {
+        if (hp->pfds[i].revents != 0) {
+            hp->ready_fds[cnt++] = hp->pfds[i].fd;
+        }
+    }
+    return active_cnt < 0 ? active_cnt : cnt;
+}
+
+#else /* HTTPD_POLL_SELECT */
+
+esp_err_t httpd_poll_init(struct httpd_poll *hp, int max_fds)
+{
+    hp->max_fds = max_fds;
+    hp->fd_cnt = 0;
+    hp->max_fd = -1;
+    FD_ZERO(&hp->fds);
+    hp->ready_fds = calloc(max_fds, sizeof(int));
+    hp->fd_list = calloc(max_fds, sizeof(int));
+    if (hp->ready_fds == NULL || hp->fd_list == NULL) {
+        free(hp->ready_fds);
+        free(hp->fd_list);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    return ESP_OK;
+}
+
+void httpd_poll_deinit(struct httpd_poll *hp)
+{
+    free(hp->ready_fds);
+    free(hp->fd_list);
+}
+
+esp_err_t httpd_poll_add(struct httpd_poll *hp, int fd)
+{
+    if (hp->fd_cnt == hp->max_fds || fd < 0 || fd >= FD_SETSIZE) {
+        return ESP_FAIL;
+    }
+    FD_SET(fd, &hp->fds);
+    hp->fd_list[hp->fd_cnt++] = fd;
+    hp->max_fd = MAX(hp->max_fd, fd);
+    return ESP_OK;
+}
+
+void httpd_poll_del(struct httpd_poll *hp, int fd)
+{
+    for (int i = 0; i < hp->fd_cnt; i++) {
+        if (hp->fd_list[i] == fd) {
+            FD_CLR(fd, &hp->fds);
+            /* Order doesn't matter, move the last one here */
+            hp->fd_list[i] = hp->fd_list[--hp->fd_cnt];
+            break;
+        }
+    }
+    if (fd == hp->max_fd) {
+        hp->max_fd = -1;
+        for (int i = 0; i < hp->fd_cnt; i++) {
+            hp->max_fd = MAX(hp->max_fd, hp->fd_list[i]);
+        }
+    }
+}
+
+int httpd_poll_wait(struct httpd_poll *hp, int timeout_ms)
+{
+    fd_set read_set = hp->fds;
+    struct timeval tv = {
+        .tv_sec  = timeout_ms / 1000,
+        .tv_usec = (timeout_ms % 1000) * 1000,
+    };
+
+    ESP_LOGD(TAG, LOG_FMT("doing select maxfd+1 = %d"), hp->max_fd + 1);
+    int active_cnt = select(hp->max_fd + 1, &read_set, NULL, NULL, timeout_ms < 0 ? NULL : &tv);
+    int cnt = 0;
+    for (int i = 0; i < hp->fd_cnt && cnt < active_cnt; i++) {
+        if (FD_ISSET(hp->fd_list[i], &read_set)) {
+            hp->ready_fds[cnt++] = hp->fd_list[i];
+        }
+    }
+    return active_cnt < 0 ? active_cnt : cnt;
+}
+
+#endif
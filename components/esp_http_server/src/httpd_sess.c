@@ -14,6 +14,7 @@
 
 
 #include <stdlib.h>
+#include <string.h>
 #include <esp_log.h>
 #include <esp_err.h>
 
@@ -24,24 +25,68 @@ static const char *TAG = "httpd_sess";
 
 bool httpd_is_sess_available(struct httpd_data *hd)
 {
-    int i;
-    for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd == -1) {
-            return true;
-        }
+    return hd->hd_sd_free_cnt > 0;
+}
+
+/* Sessions are looked up by descriptor in a hash table with linear
+ * probing. Descriptors are small consecutive integers, so they are used
+ * as their own hash. */
+static unsigned httpd_sess_slot(struct httpd_data *hd, int fd)
+{
+    unsigned slot = (unsigned) fd & hd->hd_sd_table_mask;
+    while (hd->hd_sd_table[slot] != -1 && hd->hd_sd[hd->hd_sd_table[slot]].fd != fd) {
+        slot = (slot + 1) & hd->hd_sd_table_mask;
     }
-    return false;
+    return slot;
 }
 
-static struct sock_db *httpd_sess_get(struct httpd_data *hd, int newfd)
+/* With workers, the lookup table is locked while the server thread
+ * changes it, and while other threads look up sessions */
+static void httpd_sess_lock(struct httpd_data *hd)
 {
-    int i;
-    for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd == newfd) {
-            return &hd->hd_sd[i];
+    if (hd->hd_workers != NULL) {
+        httpd_os_mutex_lock(hd->hd_sd_lock);
+    }
+}
+
+static void httpd_sess_unlock(struct httpd_data *hd)
+{
+    if (hd->hd_workers != NULL) {
+        httpd_os_mutex_unlock(hd->hd_sd_lock);
+    }
+}
+
+struct sock_db *httpd_sess_get(struct httpd_data *hd, int newfd)
+{
+    if (newfd < 0) {
+        return NULL;
+    }
+    int index = hd->hd_sd_table[httpd_sess_slot(hd, newfd)];
+    return index == -1 ? NULL : &hd->hd_sd[index];
+}
+
+static void httpd_sess_table_remove(struct httpd_data *hd, int fd)
+{
+    unsigned mask = hd->hd_sd_table_mask;
+    unsigned hole = httpd_sess_slot(hd, fd);
+    unsigned slot = hole;
+
+    /* Move entries following the removed one back into the hole,
+     * if that's still on (or after) their home slot, so that lookups
+     * don't stop at the hole before finding them */
+    while (true) {
+        slot = (slot + 1) & mask;
+        int index = hd->hd_sd_table[slot];
+        if (index == -1) {
+            break;
+        }
+        unsigned home = (unsigned) hd->hd_sd[index].fd & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+            hd->hd_sd_table[hole] = index;
+            hole = slot;
         }
     }
-    return NULL;
+    hd->hd_sd_table[hole] = -1;
 }
 
 esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd)
@@ -53,19 +98,27 @@ esp_err_t httpd_sess_new(struct httpd_data *hd, int newfd)
         return ESP_FAIL;
     }
 
-    int i;
-    for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd == -1) {
-            memset(&hd->hd_sd[i], 0, sizeof(hd->hd_sd[i]));
-            hd->hd_sd[i].fd = newfd;
-            hd->hd_sd[i].handle = (httpd_handle_t) hd;
-            hd->hd_sd[i].send_fn = httpd_default_send;
-            hd->hd_sd[i].recv_fn = httpd_default_recv;
-            return ESP_OK;
-        }
+    if (hd->hd_sd_free_cnt == 0) {
+        ESP_LOGD(TAG, LOG_FMT("unable to launch session for fd = %d"), newfd);
+        return ESP_FAIL;
     }
-    ESP_LOGD(TAG, LOG_FMT("unable to launch session for fd = %d"), newfd);
-    return ESP_FAIL;
+
+    if (httpd_poll_add(&hd->hd_poll, newfd) != ESP_OK) {
+        ESP_LOGD(TAG, LOG_FMT("unable to wait for data on fd = %d"), newfd);
+        return ESP_FAIL;
+    }
+
+    int i = hd->hd_sd_free[--hd->hd_sd_free_cnt];
+    memset(&hd->hd_sd[i], 0, sizeof(hd->hd_sd[i]));
+    hd->hd_sd[i].fd = newfd;
+    hd->hd_sd[i].handle = (httpd_handle_t) hd;
+    hd->hd_sd[i].send_fn = httpd_default_send;
+    hd->hd_sd[i].recv_fn = httpd_default_recv;
+    hd->hd_sd[i].sendv_fn = httpd_default_sendv;
+    httpd_sess_lock(hd);
+    hd->hd_sd_table[httpd_sess_slot(hd, newfd)] = i;
+    httpd_sess_unlock(hd);
+    return ESP_OK;
 }
 
 void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
@@ -75,64 +128,93 @@ void *httpd_sess_get_ctx(httpd_handle_t handle, int sockfd)
     }
 
     struct httpd_data *hd = (struct httpd_data *) handle;
+    httpd_sess_lock(hd);
     struct sock_db    *sd = httpd_sess_get(hd, sockfd);
+    void *ctx = sd ? sd->ctx : NULL;
+    httpd_sess_unlock(hd);
+    return ctx;
+}
+
+int httpd_sess_delete(struct httpd_data *hd, int fd)
+{
+    ESP_LOGD(TAG, LOG_FMT("fd = %d"), fd);
+    struct sock_db *sd = httpd_sess_get(hd, fd);
     if (sd == NULL) {
-        return NULL;
+        return -1;
     }
 
-    return sd->ctx;
-}
+    int i = sd - hd->hd_sd;
+    httpd_sess_lock(hd);
+    httpd_sess_table_remove(hd, fd);
+    sd->fd = -1;
+    httpd_sess_unlock(hd);
+    httpd_poll_del(&hd->hd_poll, fd);
+    hd->hd_sd_free[hd->hd_sd_free_cnt++] = i;
 
-void httpd_sess_set_descriptors(struct httpd_data *hd,
-                                fd_set *fdset, int *maxfd)
-{
-    int i;
-    *maxfd = -1;
-    for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd != -1) {
-            FD_SET(hd->hd_sd[i].fd, fdset);
-            if (hd->hd_sd[i].fd > *maxfd) {
-                *maxfd = hd->hd_sd[i].fd;
-            }
+    sd->pending_queued = false;
+    sd->busy = false;
+    sd->close_pending = false;
+    if (sd->ctx) {
+        if (sd->free_ctx) {
+            sd->free_ctx(sd->ctx);
+        } else {
+            free(sd->ctx);
         }
+        sd->ctx = NULL;
+        sd->free_ctx = NULL;
     }
-}
 
-int httpd_sess_delete(struct httpd_data *hd, int fd)
-{
-    ESP_LOGD(TAG, LOG_FMT("fd = %d"), fd);
-    int i;
-    int pre_sess_fd = -1;
-    for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd == fd) {
-            hd->hd_sd[i].fd = -1;
-            if (hd->hd_sd[i].ctx) {
-                if (hd->hd_sd[i].free_ctx) {
-                    hd->hd_sd[i].free_ctx(hd->hd_sd[i].ctx);
-                } else {
-                    free(hd->hd_sd[i].ctx);
-                }
-                hd->hd_sd[i].ctx = NULL;
-                hd->hd_sd[i].free_ctx = NULL;
-            }
-            break;
-        } else if (hd->hd_sd[i].fd != -1) {
-            /* Return the fd just preceding the one being
-             * deleted so that iterator can continue from
-             * the correct fd */
-            pre_sess_fd = hd->hd_sd[i].fd;
+    /* Return the fd just preceding the one being
+     * deleted so that iterator can continue from
+     * the correct fd */
+    while (--i >= 0) {
+        if (hd->hd_sd[i].fd != -1) {
+            return hd->hd_sd[i].fd;
         }
     }
-    return pre_sess_fd;
+    return -1;
 }
 
-void httpd_sess_init(struct httpd_data *hd)
+esp_err_t httpd_sess_init(struct httpd_data *hd)
 {
     int i;
+    unsigned table_size = 8;
+
+    /* Keep the hash table at most half full */
+    while (table_size < 2 * hd->config.max_open_sockets) {
+        table_size *= 2;
+    }
+    hd->hd_sd_table = malloc(table_size * sizeof(int));
+    hd->hd_sd_free = calloc(hd->config.max_open_sockets, sizeof(int));
+    hd->hd_pending_fds = calloc(2 * hd->config.max_open_sockets, sizeof(int));
+    if (hd->hd_sd_table == NULL || hd->hd_sd_free == NULL || hd->hd_pending_fds == NULL) {
+        httpd_sess_deinit(hd);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+    hd->hd_sd_table_mask = table_size - 1;
+    for (i = 0; i < table_size; i++) {
+        hd->hd_sd_table[i] = -1;
+    }
+
     for (i = 0; i < hd->config.max_open_sockets; i++) {
         hd->hd_sd[i].fd = -1;
         hd->hd_sd[i].ctx = NULL;
+        /* Use the lowest indices first */
+        hd->hd_sd_free[i] = hd->config.max_open_sockets - 1 - i;
     }
+    hd->hd_sd_free_cnt = hd->config.max_open_sockets;
+    hd->hd_pending_cnt = 0;
+    return ESP_OK;
+}
+
+void httpd_sess_deinit(struct httpd_data *hd)
+{
+    free(hd->hd_sd_table);
+    free(hd->hd_sd_free);
+    free(hd->hd_pending_fds);
+    hd->hd_sd_table = NULL;
+    hd->hd_sd_free = NULL;
+    hd->hd_pending_fds = NULL;
 }
 
 bool httpd_sess_pending(struct httpd_data *hd, int fd)
@@ -149,19 +231,15 @@ bool httpd_sess_pending(struct httpd_data *hd, int fd)
  * value is returned, everything related to this socket will be
  * cleaned up and the socket will be closed.
  */
-esp_err_t httpd_sess_process(struct httpd_data *hd, int newfd)
+esp_err_t httpd_sess_process_req(struct httpd_data *hd, struct sock_db *sd,
+                                 struct httpd_req *r, struct httpd_req_aux *ra)
 {
-    struct sock_db *sd = httpd_sess_get(hd, newfd);
-    if (! sd) {
-        return ESP_FAIL;
-    }
-
     ESP_LOGD(TAG, LOG_FMT("httpd_req_new"));
-    if (httpd_req_new(hd, sd) != ESP_OK) {
+    if (httpd_req_new(hd, r, ra, sd) != ESP_OK) {
         return ESP_FAIL;
     }
     ESP_LOGD(TAG, LOG_FMT("httpd_req_delete"));
-    if (httpd_req_delete(hd) != ESP_OK) {
+    if (httpd_req_delete(r) != ESP_OK) {
         return ESP_FAIL;
     }
     ESP_LOGD(TAG, LOG_FMT("success"));
@@ -169,6 +247,51 @@ esp_err_t httpd_sess_process(struct httpd_data *hd, int newfd)
     return ESP_OK;
 }
 
+esp_err_t httpd_sess_process(struct httpd_data *hd, int newfd)
+{
+    struct sock_db *sd = httpd_sess_get(hd, newfd);
+    if (! sd) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    if (httpd_sess_process_req(hd, sd, &hd->hd_req, &hd->hd_req_aux) != ESP_OK) {
+        return ESP_FAIL;
+    }
+
+    /* If the next request has already been received into the pending
+     * buffer, the socket may not become readable again */
+    if (sd->pending_len != 0 && !sd->pending_queued) {
+        sd->pending_queued = true;
+        hd->hd_pending_fds[hd->hd_pending_cnt++] = newfd;
+    }
+    return ESP_OK;
+}
+
+void httpd_sess_process_pending(struct httpd_data *hd)
+{
+    /* Sessions processed here may be queued again, after the ones
+     * being processed, which are moved out of the way afterwards */
+    int cnt = hd->hd_pending_cnt;
+    int i;
+    for (i = 0; i < cnt; i++) {
+        int fd = hd->hd_pending_fds[i];
+        struct sock_db *sd = httpd_sess_get(hd, fd);
+        if (sd == NULL || !sd->pending_queued) {
+            /* Closed since it was queued */
+            continue;
+        }
+        sd->pending_queued = false;
+        ESP_LOGD(TAG, LOG_FMT("processing pending data of socket %d"), fd);
+        if (httpd_sess_process(hd, fd) != ESP_OK) {
+            ESP_LOGD(TAG, LOG_FMT("closing socket %d"), fd);
+            httpd_sess_delete(hd, fd);
+            close(fd);
+        }
+    }
+    hd->hd_pending_cnt -= cnt;
+    memmove(hd->hd_pending_fds, &hd->hd_pending_fds[cnt], hd->hd_pending_cnt * sizeof(int));
+}
+
 esp_err_t httpd_sess_update_timestamp(httpd_handle_t handle, int sockfd)
 {
     if (handle == NULL) {
@@ -177,14 +300,15 @@ esp_err_t httpd_sess_update_timestamp(httpd_handle_t handle, int sockfd)
 
     /* Search for the socket database entry */
     struct httpd_data *hd = (struct httpd_data *) handle;
-    int i;
-    for (i = 0; i < hd->config.max_open_sockets; i++) {
-        if (hd->hd_sd[i].fd == sockfd) {
-            hd->hd_sd[i].timestamp = httpd_os_get_timestamp();
-            return ESP_OK;
-        }
+    esp_err_t ret = ESP_ERR_NOT_FOUND;
+    httpd_sess_lock(hd);
+    struct sock_db *sd = httpd_sess_get(hd, sockfd);
+    if (sd != NULL) {
+        sd->timestamp = httpd_os_get_timestamp();
+        ret = ESP_OK;
     }
-    return ESP_ERR_NOT_FOUND;
+    httpd_sess_unlock(hd);
+    return ret;
 }
 
 esp_err_t httpd_sess_close_lru(struct httpd_data *hd)
@@ -200,11 +324,19 @@ esp_err_t httpd_sess_close_lru(struct httpd_data *hd)
         if (hd->hd_sd[i].fd == -1) {
             return ESP_OK;
         }
+        /* Sessions being processed by a worker aren't idle */
+        if (hd->hd_sd[i].busy) {
+            continue;
+        }
         if (hd->hd_sd[i].timestamp < timestamp) {
             timestamp = hd->hd_sd[i].timestamp;
             lru_fd = hd->hd_sd[i].fd;
         }
     }
+    if (lru_fd == -1) {
+        ESP_LOGD(TAG, LOG_FMT("all sessions busy"));
+        return ESP_ERR_NOT_FOUND;
+    }
     ESP_LOGD(TAG, LOG_FMT("fd = %d"), lru_fd);
     return httpd_trigger_sess_close(hd, lru_fd);
 }
@@ -216,11 +348,9 @@ int httpd_sess_iterate(struct httpd_data *hd, int start_fd)
 
     if (start_fd != -1) {
         /* Take our index to where this fd is stored */
-        for (i = 0; i < hd->config.max_open_sockets; i++) {
-            if (hd->hd_sd[i].fd == start_fd) {
-                start_index = i + 1;
-                break;
-            }
+        struct sock_db *sd = httpd_sess_get(hd, start_fd);
+        if (sd != NULL) {
+            start_index = sd - hd->hd_sd + 1;
         }
     }
 
@@ -238,6 +368,11 @@ static void httpd_sess_close(void *arg)
     if (sock_db) {
         int fd = sock_db->fd;
         struct httpd_data *hd = (struct httpd_data *) sock_db->handle;
+        if (sock_db->busy) {
+            /* Closed when the worker returns it */
+            sock_db->close_pending = true;
+            return;
+        }
         httpd_sess_delete(hd, fd);
         close(fd);
     }
@@ -250,7 +385,9 @@ esp_err_t httpd_trigger_sess_close(httpd_handle_t handle, int sockfd)
     }
 
     struct httpd_data *hd = (struct httpd_data *) handle;
+    httpd_sess_lock(hd);
     struct sock_db *sock_db = httpd_sess_get(hd, sockfd);
+    httpd_sess_unlock(hd);
     if (sock_db) {
         return httpd_queue_work(handle, httpd_sess_close, sock_db);
     }
@@ -34,6 +34,23 @@ esp_err_t httpd_set_send_override(httpd_req_t *r, httpd_send_func_t send_func)
 
     struct httpd_req_aux *ra = r->aux;
     ra->sd->send_fn = send_func;
+    /* The vectored send function would bypass it */
+    ra->sd->sendv_fn = NULL;
+    return ESP_OK;
+}
+
+esp_err_t httpd_set_sendv_override(httpd_req_t *r, httpd_sendv_func_t sendv_func)
+{
+    if (r == NULL || sendv_func == NULL) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if (!httpd_valid_req(r)) {
+        return ESP_ERR_HTTPD_INVALID_REQ;
+    }
+
+    struct httpd_req_aux *ra = r->aux;
+    ra->sd->sendv_fn = sendv_func;
     return ESP_OK;
 }
 
@@ -89,6 +106,43 @@ static esp_err_t httpd_send_all(httpd_req_t *r, const char *buf, size_t buf_len)
     return ESP_OK;
 }
 
+/* Sends the buffers in order, modifying iov to keep track of what is left */
+static esp_err_t httpd_sendv_all(httpd_req_t *r, struct iovec *iov, int iovcnt)
+{
+    struct httpd_req_aux *ra = r->aux;
+    int ret;
+
+    if (ra->sd->sendv_fn == NULL) {
+        /* Only the send function is overridden */
+        for (int i = 0; i < iovcnt; i++) {
+            if (httpd_send_all(r, iov[i].iov_base, iov[i].iov_len) != ESP_OK) {
+                return ESP_FAIL;
+            }
+        }
+        return ESP_OK;
+    }
+
+    while (iovcnt > 0) {
+        ret = ra->sd->sendv_fn(ra->sd->fd, iov, iovcnt, 0);
+        if (ret < 0) {
+            ESP_LOGD(TAG, LOG_FMT("error in sendv_fn"));
+            return ESP_FAIL;
+        }
+        ESP_LOGD(TAG, LOG_FMT("sent = %d"), ret);
+        /* Skip the buffers sent, and what was sent of the next one */
+        while (iovcnt > 0 && (size_t) ret >= iov->iov_len) {
+            ret -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + ret;
+            iov->iov_len -= ret;
+        }
+    }
+    return ESP_OK;
+}
+
 static size_t httpd_recv_pending(httpd_req_t *r, char *buf, size_t buf_len)
 {
     struct httpd_req_aux *ra = r->aux;
@@ -231,6 +285,47 @@ esp_err_t httpd_resp_set_type(httpd_req_t *r, const char *type)
     return ESP_OK;
 }
 
+/* Appends to the header section being assembled in the scratch buffer,
+ * sending out what is already there first if it doesn't fit */
+static esp_err_t httpd_resp_hdr_append(httpd_req_t *r, size_t *hdr_len, const char *buf, size_t buf_len)
+{
+    struct httpd_req_aux *ra = r->aux;
+
+    if (*hdr_len + buf_len > sizeof(ra->scratch)) {
+        if (httpd_send_all(r, ra->scratch, *hdr_len) != ESP_OK) {
+            return ESP_FAIL;
+        }
+        *hdr_len = 0;
+        if (buf_len > sizeof(ra->scratch)) {
+            return httpd_send_all(r, buf, buf_len);
+        }
+    }
+    memcpy(ra->scratch + *hdr_len, buf, buf_len);
+    *hdr_len += buf_len;
+    return ESP_OK;
+}
+
+/* Completes the header section following the essential headers
+ * in the scratch buffer, with those set by httpd_resp_set_hdr() */
+static esp_err_t httpd_resp_hdrs_end(httpd_req_t *r, size_t *hdr_len)
+{
+    struct httpd_req_aux *ra = r->aux;
+    const char *colon_separator = ": ";
+    const char *cr_lf_seperator = "\r\n";
+
+    for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
+        if (httpd_resp_hdr_append(r, hdr_len, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK ||
+            httpd_resp_hdr_append(r, hdr_len, colon_separator, strlen(colon_separator)) != ESP_OK ||
+            httpd_resp_hdr_append(r, hdr_len, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK ||
+            httpd_resp_hdr_append(r, hdr_len, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
+            return ESP_FAIL;
+        }
+    }
+
+    /* End header section */
+    return httpd_resp_hdr_append(r, hdr_len, cr_lf_seperator, strlen(cr_lf_seperator));
+}
+
 esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, size_t buf_len)
 {
     if (r == NULL) {
@@ -243,54 +338,30 @@ esp_err_t httpd_resp_send(httpd_req_t *r, const char *buf, size_t buf_len)
 
     struct httpd_req_aux *ra = r->aux;
     const char *httpd_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nContent-Length: %d\r\n";
-    const char *colon_separator = ": ";
-    const char *cr_lf_seperator = "\r\n";
 
     /* Request headers are no longer available */
     ra->req_hdrs_count = 0;
 
     /* Size of essential headers is limited by scratch buffer size */
-    if (snprintf(ra->scratch, sizeof(ra->scratch), httpd_hdr_str,
-                 ra->status, ra->content_type, buf_len) >= sizeof(ra->scratch)) {
+    int ret = snprintf(ra->scratch, sizeof(ra->scratch), httpd_hdr_str,
+                       ra->status, ra->content_type, buf_len);
+    if (ret >= sizeof(ra->scratch)) {
         return ESP_ERR_HTTPD_RESP_HDR;
     }
 
-    /* Sending essential headers */
-    if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
+    size_t hdr_len = ret;
+    if (httpd_resp_hdrs_end(r, &hdr_len) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
     }
 
-    /* Sending additional headers based on set_header */
-    for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
-        /* Send header field */
-        if (httpd_send_all(r, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-        /* Send ': ' */
-        if (httpd_send_all(r, colon_separator, strlen(colon_separator)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-        /* Send header value */
-        if (httpd_send_all(r, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-        /* Send CR + LF */
-        if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-    }
-
-    /* End header section */
-    if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
+    /* Sending headers and content together */
+    struct iovec iov[] = {
+        { .iov_base = ra->scratch,  .iov_len = hdr_len },
+        { .iov_base = (void *) buf, .iov_len = buf ? buf_len : 0 },
+    };
+    if (httpd_sendv_all(r, iov, sizeof(iov) / sizeof(iov[0])) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
     }
-
-    /* Sending content */
-    if (buf && buf_len) {
-        if (httpd_send_all(r, buf, buf_len) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-    }
     return ESP_OK;
 }
 
@@ -306,66 +377,37 @@ esp_err_t httpd_resp_send_chunk(httpd_req_t *r, const char *buf, size_t buf_len)
 
     struct httpd_req_aux *ra = r->aux;
     const char *httpd_chunked_hdr_str = "HTTP/1.1 %s\r\nContent-Type: %s\r\nTransfer-Encoding: chunked\r\n";
-    const char *colon_separator = ": ";
-    const char *cr_lf_seperator = "\r\n";
+    size_t hdr_len = 0;
 
     /* Request headers are no longer available */
     ra->req_hdrs_count = 0;
 
     if (!ra->first_chunk_sent) {
         /* Size of essential headers is limited by scratch buffer size */
-        if (snprintf(ra->scratch, sizeof(ra->scratch), httpd_chunked_hdr_str,
-                     ra->status, ra->content_type) >= sizeof(ra->scratch)) {
+        int ret = snprintf(ra->scratch, sizeof(ra->scratch), httpd_chunked_hdr_str,
+                           ra->status, ra->content_type);
+        if (ret >= sizeof(ra->scratch)) {
             return ESP_ERR_HTTPD_RESP_HDR;
         }
 
-        /* Sending essential headers */
-        if (httpd_send_all(r, ra->scratch, strlen(ra->scratch)) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-
-        /* Sending additional headers based on set_header */
-        for (unsigned i = 0; i < ra->resp_hdrs_count; i++) {
-            /* Send header field */
-            if (httpd_send_all(r, ra->resp_hdrs[i].field, strlen(ra->resp_hdrs[i].field)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send ': ' */
-            if (httpd_send_all(r, colon_separator, strlen(colon_separator)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send header value */
-            if (httpd_send_all(r, ra->resp_hdrs[i].value, strlen(ra->resp_hdrs[i].value)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-            /* Send CR + LF */
-            if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
-                return ESP_ERR_HTTPD_RESP_SEND;
-            }
-        }
-
-        /* End header section */
-        if (httpd_send_all(r, cr_lf_seperator, strlen(cr_lf_seperator)) != ESP_OK) {
+        hdr_len = ret;
+        if (httpd_resp_hdrs_end(r, &hdr_len) != ESP_OK) {
             return ESP_ERR_HTTPD_RESP_SEND;
         }
         ra->first_chunk_sent = true;
     }
 
-    /* Sending chunked content */
+    /* Sending chunked content, after the headers if not yet sent */
     char len_str[10];
     snprintf(len_str, sizeof(len_str), "%x\r\n", buf_len);
-    if (httpd_send_all(r, len_str, strlen(len_str)) != ESP_OK) {
-        return ESP_ERR_HTTPD_RESP_SEND;
-    }
-
-    if (buf) {
-        if (httpd_send_all(r, buf, buf_len) != ESP_OK) {
-            return ESP_ERR_HTTPD_RESP_SEND;
-        }
-    }
-
-    /* Indicate end of chunk */
-    if (httpd_send_all(r, "\r\n", strlen("\r\n")) != ESP_OK) {
+    struct iovec iov[] = {
+        { .iov_base = ra->scratch,  .iov_len = hdr_len },
+        { .iov_base = len_str,      .iov_len = strlen(len_str) },
+        { .iov_base = (void *) buf, .iov_len = buf ? buf_len : 0 },
+        /* Indicate end of chunk */
+        { .iov_base = (void *) "\r\n", .iov_len = strlen("\r\n") },
+    };
+    if (httpd_sendv_all(r, iov, sizeof(iov) / sizeof(iov[0])) != ESP_OK) {
         return ESP_ERR_HTTPD_RESP_SEND;
     }
     return ESP_OK;
@@ -495,7 +537,7 @@ static int httpd_sock_err(const char *ctx, int sockfd)
 {
     int errval;
     int sock_err;
-    size_t sock_err_len = sizeof(sock_err);
+    socklen_t sock_err_len = sizeof(sock_err);
 
     if (getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &sock_err, &sock_err_len) < 0) {
         ESP_LOGE(TAG, LOG_FMT("error calling getsockopt : %d"), errno);
@@ -533,6 +575,23 @@ int httpd_default_send(int sockfd, const char *buf, size_t buf_len, int flags)
     return ret;
 }
 
+int httpd_default_sendv(int sockfd, const struct iovec *iov, int iovcnt, int flags)
+{
+    if (iov == NULL) {
+        return HTTPD_SOCK_ERR_INVALID;
+    }
+
+    struct msghdr msg = {
+        .msg_iov    = (struct iovec *) iov,
+        .msg_iovlen = iovcnt,
+    };
+    int ret = sendmsg(sockfd, &msg, flags);
+    if (ret < 0) {
+        return httpd_sock_err("sendmsg", sockfd);
+    }
+    return ret;
+}
+
 int httpd_default_recv(int sockfd, char *buf, size_t buf_len, int flags)
 {
     if (buf == NULL) {
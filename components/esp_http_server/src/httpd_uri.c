@@ -179,11 +179,11 @@ static httpd_uri_t* httpd_find_uri_handler2(httpd_err_resp_t *err,
     return NULL;
 }
 
-esp_err_t httpd_uri(struct httpd_data *hd)
+esp_err_t httpd_uri(struct httpd_data *hd, httpd_req_t *req)
 {
     httpd_uri_t            *uri = NULL;
-    httpd_req_t            *req = &hd->hd_req;
-    struct http_parser_url *res = &hd->hd_req_aux.url_parse_res;
+    struct httpd_req_aux   *ra  = req->aux;
+    struct http_parser_url *res = &ra->url_parse_res;
 
     /* For conveying URI not found/method not allowed */
     httpd_err_resp_t err = 0;
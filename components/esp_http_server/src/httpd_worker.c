@@ -0,0 +1,320 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <esp_log.h>
+#include <esp_err.h>
+
+#include <esp_http_server.h>
+#include "esp_httpd_priv.h"
+
+static const char *TAG = "httpd_worker";
+
+/* Room for work queued with httpd_queue_worker_work(), in addition
+ * to the sessions, which can all be handed to the same worker */
+#define HTTPD_WORKER_WORK_QUEUE_LEN 4
+
+/* Interval between attempts to wake up the server thread */
+#define HTTPD_WORKER_WAKE_RETRY_MS  10
+
+/* Executed by the server thread when woken up by a worker */
+static void httpd_workers_wake_work(void *arg)
+{
+    httpd_workers_process_done((struct httpd_data *) arg);
+}
+
+/* Returns a session to the server thread */
+static void httpd_worker_return(struct httpd_worker *w, struct sock_db *sd, esp_err_t ret)
+{
+    struct httpd_data *hd = w->hd;
+    bool wake;
+
+    httpd_os_mutex_lock(hd->hd_done_lock);
+    hd->hd_done[hd->hd_done_cnt].sd = sd;
+    hd->hd_done[hd->hd_done_cnt].ret = ret;
+    hd->hd_done[hd->hd_done_cnt].worker = w->index;
+    hd->hd_done_cnt++;
+    /* One wake up message is enough for all the sessions returned
+     * until the server thread takes them */
+    wake = !hd->hd_done_wake;
+    hd->hd_done_wake = true;
+    httpd_os_mutex_unlock(hd->hd_done_lock);
+
+    if (!wake) {
+        return;
+    }
+    /* The server thread may be waiting for nothing else, so keep trying,
+     * until it is stopping, which closes the sessions anyway */
+    while (httpd_queue_work(hd, httpd_workers_wake_work, hd) != ESP_OK) {
+        if (hd->hd_td.status != THREAD_RUNNING) {
+            break;
+        }
+        httpd_os_thread_sleep(HTTPD_WORKER_WAKE_RETRY_MS);
+    }
+}
+
+/* The worker threads */
+static void httpd_worker_thread(void *arg)
+{
+    struct httpd_worker *w = (struct httpd_worker *) arg;
+    struct httpd_worker_msg msg;
+    w->td.status = THREAD_RUNNING;
+
+    ESP_LOGD(TAG, LOG_FMT("worker %d started"), w->index);
+    while (1) {
+        httpd_os_queue_receive(w->queue, &msg);
+        if (msg.type == HTTPD_WORKER_STOP) {
+            break;
+        }
+        if (msg.type == HTTPD_WORKER_WORK) {
+            ESP_LOGD(TAG, LOG_FMT("work"));
+            (*msg.work)(msg.arg);
+            continue;
+        }
+        ESP_LOGD(TAG, LOG_FMT("processing socket %d"), msg.sd->fd);
+        esp_err_t ret = httpd_sess_process_req(w->hd, msg.sd, &w->req, &w->req_aux);
+        httpd_worker_return(w, msg.sd, ret);
+    }
+
+    ESP_LOGD(TAG, LOG_FMT("worker %d exiting"), w->index);
+    w->td.status = THREAD_STOPPED;
+    httpd_os_thread_delete();
+}
+
+/* Stops the first cnt workers, which must have been started */
+static void httpd_workers_join(struct httpd_worker *workers, int cnt)
+{
+    struct httpd_worker_msg msg = {
+        .type = HTTPD_WORKER_STOP,
+    };
+    int i;
+
+    /* Workers finish the messages queued before this */
+    for (i = 0; i < cnt; i++) {
+        httpd_os_queue_send(workers[i].queue, &msg, -1);
+    }
+    for (i = 0; i < cnt; i++) {
+        while (workers[i].td.status != THREAD_STOPPED) {
+            httpd_os_thread_sleep(10);
+        }
+    }
+}
+
+static void httpd_workers_free(struct httpd_data *hd, struct httpd_worker *workers)
+{
+    int i;
+
+    if (workers != NULL) {
+        for (i = 0; i < hd->config.worker_count; i++) {
+            free(workers[i].req_aux.resp_hdrs);
+            if (workers[i].queue != NULL) {
+                httpd_os_queue_delete(workers[i].queue);
+            }
+        }
+        free(workers);
+    }
+    if (hd->hd_sd_lock != NULL) {
+        httpd_os_mutex_delete(hd->hd_sd_lock);
+        hd->hd_sd_lock = NULL;
+    }
+    if (hd->hd_done_lock != NULL) {
+        httpd_os_mutex_delete(hd->hd_done_lock);
+        hd->hd_done_lock = NULL;
+    }
+    free(hd->hd_done);
+    hd->hd_done = NULL;
+    hd->hd_done_cnt = 0;
+}
+
+esp_err_t httpd_workers_start(struct httpd_data *hd)
+{
+    int cnt = hd->config.worker_count;
+    int i;
+
+    if (cnt == 0) {
+        return ESP_OK;
+    }
+
+    struct httpd_worker *workers = calloc(cnt, sizeof(struct httpd_worker));
+    hd->hd_done = calloc(hd->config.max_open_sockets, sizeof(struct httpd_worker_done));
+    hd->hd_sd_lock = httpd_os_mutex_create();
+    hd->hd_done_lock = httpd_os_mutex_create();
+    hd->hd_done_cnt = 0;
+    hd->hd_done_wake = false;
+    if (workers == NULL || hd->hd_done == NULL ||
+        hd->hd_sd_lock == NULL || hd->hd_done_lock == NULL) {
+        ESP_LOGE(TAG, LOG_FMT("error in allocating workers"));
+        httpd_workers_free(hd, workers);
+        return ESP_ERR_HTTPD_ALLOC_MEM;
+    }
+
+    for (i = 0; i < cnt; i++) {
+        struct httpd_worker *w = &workers[i];
+        w->hd = hd;
+        w->index = i;
+        w->req_aux.resp_hdrs = calloc(hd->config.max_resp_headers, sizeof(struct resp_hdr));
+        w->queue = httpd_os_queue_create(hd->config.max_open_sockets + HTTPD_WORKER_WORK_QUEUE_LEN,
+                                         sizeof(struct httpd_worker_msg));
+        if (w->req_aux.resp_hdrs == NULL || w->queue == NULL) {
+            ESP_LOGE(TAG, LOG_FMT("error in allocating workers"));
+            httpd_workers_free(hd, workers);
+            return ESP_ERR_HTTPD_ALLOC_MEM;
+        }
+    }
+
+    /* Workers are looked up by httpd_valid_req() from now on */
+    hd->hd_workers = workers;
+    for (i = 0; i < cnt; i++) {
+        if (httpd_os_thread_create(&workers[i].td.handle, "httpd_worker",
+                                   hd->config.stack_size,
+                                   hd->config.task_priority,
+                                   httpd_worker_thread, &workers[i]) != ESP_OK) {
+            ESP_LOGE(TAG, LOG_FMT("error in creating worker %d"), i);
+            httpd_workers_join(workers, i);
+            hd->hd_workers = NULL;
+            httpd_workers_free(hd, workers);
+            return ESP_ERR_HTTPD_TASK;
+        }
+    }
+    return ESP_OK;
+}
+
+void httpd_workers_stop(struct httpd_data *hd)
+{
+    struct httpd_worker *workers = hd->hd_workers;
+    if (workers == NULL) {
+        return;
+    }
+
+    httpd_workers_join(workers, hd->config.worker_count);
+    /* The sessions they returned are closed with all the others */
+    hd->hd_workers = NULL;
+    httpd_workers_free(hd, workers);
+}
+
+static void httpd_workers_send(struct httpd_data *hd, struct sock_db *sd)
+{
+    struct httpd_worker *workers = hd->hd_workers;
+    struct httpd_worker_msg msg = {
+        .type = HTTPD_WORKER_SESS,
+        .sd   = sd,
+    };
+    int best = 0;
+    int i;
+
+    /* The least loaded worker is the one most likely to be idle */
+    for (i = 1; i < hd->config.worker_count; i++) {
+        if (workers[i].load < workers[best].load) {
+            best = i;
+        }
+    }
+    sd->busy = true;
+    workers[best].load++;
+    /* This only waits if the queue is full of work items */
+    httpd_os_queue_send(workers[best].queue, &msg, -1);
+}
+
+esp_err_t httpd_workers_dispatch(struct httpd_data *hd, int fd)
+{
+    struct sock_db *sd = httpd_sess_get(hd, fd);
+    if (sd == NULL) {
+        return ESP_ERR_NOT_FOUND;
+    }
+    if (sd->busy) {
+        /* Reported ready before it was removed from the poller */
+        return ESP_OK;
+    }
+
+    ESP_LOGD(TAG, LOG_FMT("dispatching socket %d"), fd);
+    httpd_poll_del(&hd->hd_poll, fd);
+    httpd_workers_send(hd, sd);
+    return ESP_OK;
+}
+
+void httpd_workers_process_done(struct httpd_data *hd)
+{
+    struct httpd_worker_done done[8];
+    int cnt;
+    int i;
+
+    if (hd->hd_workers == NULL) {
+        return;
+    }
+
+    do {
+        /* Take a few at a time, so that the workers can return more
+         * sessions meanwhile */
+        httpd_os_mutex_lock(hd->hd_done_lock);
+        cnt = MIN(hd->hd_done_cnt, sizeof(done) / sizeof(done[0]));
+        hd->hd_done_cnt -= cnt;
+        memcpy(done, &hd->hd_done[hd->hd_done_cnt], cnt * sizeof(done[0]));
+        if (hd->hd_done_cnt == 0) {
+            hd->hd_done_wake = false;
+        }
+        httpd_os_mutex_unlock(hd->hd_done_lock);
+
+        for (i = 0; i < cnt; i++) {
+            struct sock_db *sd = done[i].sd;
+            int fd = sd->fd;
+
+            hd->hd_workers[done[i].worker].load--;
+            sd->busy = false;
+            if (done[i].ret != ESP_OK || sd->close_pending) {
+                ESP_LOGD(TAG, LOG_FMT("closing socket %d"), fd);
+                httpd_sess_delete(hd, fd);
+                close(fd);
+            } else if (sd->pending_len != 0) {
+                /* The next request has already been received, the
+                 * socket may not become readable again */
+                httpd_workers_send(hd, sd);
+            } else if (httpd_poll_add(&hd->hd_poll, fd) != ESP_OK) {
+                ESP_LOGW(TAG, LOG_FMT("unable to wait for data on fd = %d"), fd);
+                httpd_sess_delete(hd, fd);
+                close(fd);
+            }
+        }
+
+        /* A session is either closed or can be, as the least recently used */
+        if (cnt > 0 && hd->hd_accept_paused) {
+            ESP_LOGD(TAG, LOG_FMT("waiting for connections again"));
+            if (httpd_poll_add(&hd->hd_poll, hd->listen_fd) != ESP_OK) {
+                ESP_LOGE(TAG, LOG_FMT("unable to wait for connections"));
+            }
+            hd->hd_accept_paused = false;
+        }
+    } while (cnt > 0);
+}
+
+esp_err_t httpd_queue_worker_work(httpd_handle_t handle, int worker, httpd_work_fn_t work, void *arg)
+{
+    struct httpd_data *hd = (struct httpd_data *) handle;
+    if (hd == NULL || work == NULL || hd->hd_workers == NULL ||
+        worker < 0 || worker >= hd->config.worker_count) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    struct httpd_worker_msg msg = {
+        .type = HTTPD_WORKER_WORK,
+        .work = work,
+        .arg  = arg,
+    };
+    /* Don't wait, the worker may be the caller */
+    if (httpd_os_queue_send(hd->hd_workers[worker].queue, &msg, 0) != ESP_OK) {
+        ESP_LOGW(TAG, LOG_FMT("failed to queue work"));
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
@@ -17,6 +17,8 @@
 
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
 #include <unistd.h>
 #include <stdint.h>
 #include <esp_timer.h>
@@ -29,6 +31,8 @@ extern "C" {
 #define OS_FAIL    ESP_FAIL
 
 typedef TaskHandle_t othread_t;
+typedef SemaphoreHandle_t omutex_t;
+typedef QueueHandle_t oqueue_t;
 
 static inline int httpd_os_thread_create(othread_t *thread,
                                  const char *name, uint16_t stacksize, int prio,
@@ -62,6 +66,52 @@ static inline othread_t httpd_os_thread_handle()
     return xTaskGetCurrentTaskHandle();
 }
 
+static inline omutex_t httpd_os_mutex_create()
+{
+    return xSemaphoreCreateMutex();
+}
+
+static inline void httpd_os_mutex_delete(omutex_t mutex)
+{
+    vSemaphoreDelete(mutex);
+}
+
+static inline void httpd_os_mutex_lock(omutex_t mutex)
+{
+    xSemaphoreTake(mutex, portMAX_DELAY);
+}
+
+static inline void httpd_os_mutex_unlock(omutex_t mutex)
+{
+    xSemaphoreGive(mutex);
+}
+
+static inline oqueue_t httpd_os_queue_create(unsigned len, size_t item_size)
+{
+    return xQueueCreate(len, item_size);
+}
+
+static inline void httpd_os_queue_delete(oqueue_t queue)
+{
+    vQueueDelete(queue);
+}
+
+/* A wait of -1 blocks until there is space in the queue */
+static inline int httpd_os_queue_send(oqueue_t queue, const void *item, int wait_ms)
+{
+    TickType_t ticks = wait_ms < 0 ? portMAX_DELAY : wait_ms / portTICK_RATE_MS;
+    if (xQueueSend(queue, item, ticks) == pdTRUE) {
+        return OS_SUCCESS;
+    }
+    return OS_FAIL;
+}
+
+/* Blocks until an item is received */
+static inline void httpd_os_queue_receive(oqueue_t queue, void *item)
+{
+    xQueueReceive(queue, item, portMAX_DELAY);
+}
+
 #ifdef __cplusplus
 }
 #endif
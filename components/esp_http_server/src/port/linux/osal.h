@@ -0,0 +1,218 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef _OSAL_H_
+#define _OSAL_H_
+
+/* POSIX port, used to run the server on a Linux host (see test_httpd_host) */
+
+#include <pthread.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define OS_SUCCESS ESP_OK
+#define OS_FAIL    ESP_FAIL
+
+typedef pthread_t othread_t;
+typedef pthread_mutex_t *omutex_t;
+typedef struct httpd_os_queue *oqueue_t;
+
+struct httpd_os_thread_start {
+    void (*thread_routine)(void *arg);
+    void *arg;
+};
+
+static inline void *httpd_os_thread_main(void *arg)
+{
+    struct httpd_os_thread_start start = *(struct httpd_os_thread_start *) arg;
+    free(arg);
+    start.thread_routine(start.arg);
+    return NULL;
+}
+
+/* The stack size and priority are for FreeRTOS, the defaults of the host are used instead */
+static inline int httpd_os_thread_create(othread_t *thread,
+                                 const char *name, uint16_t stacksize, int prio,
+                                 void (*thread_routine)(void *arg), void *arg)
+{
+    struct httpd_os_thread_start *start = (struct httpd_os_thread_start *) malloc(sizeof(struct httpd_os_thread_start));
+    if (start == NULL) {
+        return OS_FAIL;
+    }
+    start->thread_routine = thread_routine;
+    start->arg = arg;
+    if (pthread_create(thread, NULL, httpd_os_thread_main, start) != 0) {
+        free(start);
+        return OS_FAIL;
+    }
+    pthread_detach(*thread);
+    return OS_SUCCESS;
+}
+
+/* Only self delete is supported */
+static inline void httpd_os_thread_delete()
+{
+    pthread_exit(NULL);
+}
+
+static inline void httpd_os_thread_sleep(int msecs)
+{
+    usleep(msecs * 1000);
+}
+
+static inline int64_t httpd_os_get_timestamp()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static inline othread_t httpd_os_thread_handle()
+{
+    return pthread_self();
+}
+
+static inline omutex_t httpd_os_mutex_create()
+{
+    pthread_mutex_t *mutex = (pthread_mutex_t *) malloc(sizeof(pthread_mutex_t));
+    if (mutex != NULL) {
+        pthread_mutex_init(mutex, NULL);
+    }
+    return mutex;
+}
+
+static inline void httpd_os_mutex_delete(omutex_t mutex)
+{
+    pthread_mutex_destroy(mutex);
+    free(mutex);
+}
+
+static inline void httpd_os_mutex_lock(omutex_t mutex)
+{
+    pthread_mutex_lock(mutex);
+}
+
+static inline void httpd_os_mutex_unlock(omutex_t mutex)
+{
+    pthread_mutex_unlock(mutex);
+}
+
+/* Fixed size queue of items copied in and out, like a FreeRTOS queue */
+struct httpd_os_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t  not_empty;
+    pthread_cond_t  not_full;
+    size_t          item_size;
+    unsigned        len;
+    unsigned        head;
+    unsigned        cnt;
+    char           *items;
+};
+
+static inline oqueue_t httpd_os_queue_create(unsigned len, size_t item_size)
+{
+    struct httpd_os_queue *queue = (struct httpd_os_queue *) malloc(sizeof(struct httpd_os_queue) + len * item_size);
+    if (queue == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->item_size = item_size;
+    queue->len = len;
+    queue->head = 0;
+    queue->cnt = 0;
+    queue->items = (char *) (queue + 1);
+    return queue;
+}
+
+static inline void httpd_os_queue_delete(oqueue_t queue)
+{
+    pthread_cond_destroy(&queue->not_full);
+    pthread_cond_destroy(&queue->not_empty);
+    pthread_mutex_destroy(&queue->lock);
+    free(queue);
+}
+
+/* A wait of -1 blocks until there is space in the queue */
+static inline int httpd_os_queue_send(oqueue_t queue, const void *item, int wait_ms)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += wait_ms / 1000;
+    deadline.tv_nsec += (wait_ms % 1000) * 1000000L;
+    if (deadline.tv_nsec >= 1000000000L) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    pthread_mutex_lock(&queue->lock);
+    while (queue->cnt == queue->len) {
+        if (wait_ms < 0) {
+            pthread_cond_wait(&queue->not_full, &queue->lock);
+        } else if (pthread_cond_timedwait(&queue->not_full, &queue->lock, &deadline) == ETIMEDOUT) {
+            pthread_mutex_unlock(&queue->lock);
+            return OS_FAIL;
+        }
+    }
+    unsigned tail = (queue->head + queue->cnt) % queue->len;
+    memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    queue->cnt++;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return OS_SUCCESS;
+}
+
+/* Blocks until an item is received */
+static inline void httpd_os_queue_receive(oqueue_t queue, void *item)
+{
+    pthread_mutex_lock(&queue->lock);
+    while (queue->cnt == 0) {
+        pthread_cond_wait(&queue->not_empty, &queue->lock);
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->len;
+    queue->cnt--;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+}
+
+#if defined(__GLIBC__) && !__GLIBC_PREREQ(2, 38)
+/* Older glibc doesn't have strlcpy(), which newlib does */
+static inline size_t httpd_os_strlcpy(char *dst, const char *src, size_t size)
+{
+    size_t len = strlen(src);
+    if (size > 0) {
+        size_t n = len < size - 1 ? len : size - 1;
+        memcpy(dst, src, n);
+        dst[n] = '\0';
+    }
+    return len;
+}
+#define strlcpy httpd_os_strlcpy
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ! _OSAL_H_ */
@@ -0,0 +1,308 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Load test for the HTTP server on the host.
+ *
+ * Each workload starts a server on the loopback interface and opens a number
+ * of keep-alive connections to it, each driven by its own client thread which
+ * sends a request as soon as it has read the previous response. Results are
+ * printed to stdout as one JSON object per workload and line:
+ *
+ *     ./bench_httpd [seconds per workload] > bench_httpd.json
+ *
+ * Build with POLLER=select, poll or epoll to compare the pollers. The worker
+ * workloads compare processing requests in the server task with processing
+ * them in 1 to 4 worker tasks, with a handler which spends some CPU time on
+ * each request, as one computing a response would. The send workloads
+ * compare sending small responses with a few headers through the vectored
+ * send function with sending them through a send override, which is given
+ * the header section and the content separately. The handler counts the
+ * calls to either function, which are one socket send each. Latency is
+ * measured by the clients, from sending a request to reading all of its
+ * response, so it includes the time spent in the client threads. The handler
+ * disables Nagle's algorithm on the server side of each connection.
+ */
+
+#include <esp_http_server.h>
+#include "esp_httpd_priv.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <sys/uio.h>
+
+#if defined(HTTPD_POLL_EPOLL)
+#define POLLER_NAME "epoll"
+#elif defined(HTTPD_POLL_POLL)
+#define POLLER_NAME "poll"
+#else
+#define POLLER_NAME "select"
+#endif
+
+using Clock = std::chrono::steady_clock;
+
+struct Workload {
+    const char* name;
+    int clients;
+    size_t bodySize;
+    int workers;
+    unsigned handlerUs;     // CPU time spent by the handler on each request
+    int headers;            // headers set by the handler in addition to the essential ones
+    bool sendOverride;      // send with a send override instead of the vectored send function
+};
+
+static const Workload s_workloads[] = {
+    { "single-client",      1,   16, 0,  0, 0, false },
+    { "clients-16",        16,   16, 0,  0, 0, false },
+    { "clients-128",      128,   16, 0,  0, 0, false },
+    { "clients-256",      256,   16, 0,  0, 0, false },
+    { "clients-128-4k",   128, 4096, 0,  0, 0, false },
+    { "clients-128-w1",   128,   16, 1,  0, 0, false },
+    { "clients-128-w4",   128,   16, 4,  0, 0, false },
+    { "cpu-handler-w0",   128,   16, 0, 50, 0, false },
+    { "cpu-handler-w1",   128,   16, 1, 50, 0, false },
+    { "cpu-handler-w2",   128,   16, 2, 50, 0, false },
+    { "cpu-handler-w4",   128,   16, 4, 50, 0, false },
+    { "send-sendv-1",       1,   16, 0,  0, 4, false },
+    { "send-override-1",    1,   16, 0,  0, 4, true },
+    { "send-sendv-16",     16,   16, 0,  0, 4, false },
+    { "send-override-16",  16,   16, 0,  0, 4, true },
+};
+
+struct HandlerCtx {
+    std::vector<char> body;
+    unsigned handlerUs;
+    int headers;
+    bool sendOverride;
+};
+
+static const char* const s_header_values[] = { "no-cache", "keep-alive", "*", "nosniff" };
+static const char* const s_header_fields[] = {
+    "Cache-Control", "Connection", "Access-Control-Allow-Origin", "X-Content-Type-Options"
+};
+
+static std::atomic<size_t> s_send_calls;
+
+static int counting_send(int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    s_send_calls.fetch_add(1, std::memory_order_relaxed);
+    return httpd_default_send(sockfd, buf, buf_len, flags);
+}
+
+static int counting_sendv(int sockfd, const struct iovec *iov, int iovcnt, int flags)
+{
+    s_send_calls.fetch_add(1, std::memory_order_relaxed);
+    return httpd_default_sendv(sockfd, iov, iovcnt, flags);
+}
+
+static const char s_request[] = "GET /bench HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static esp_err_t bench_handler(httpd_req_t *req)
+{
+    const HandlerCtx* ctx = static_cast<const HandlerCtx*>(req->user_ctx);
+    // With a send override headers and body are sent separately, so with Nagle's algorithm every response would
+    // wait for a delayed ACK
+    int one = 1;
+    setsockopt(httpd_req_to_sockfd(req), IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    if (ctx->sendOverride) {
+        httpd_set_send_override(req, counting_send);
+    } else {
+        httpd_set_sendv_override(req, counting_sendv);
+    }
+    for (int i = 0; i < ctx->headers; i++) {
+        httpd_resp_set_hdr(req, s_header_fields[i], s_header_values[i]);
+    }
+    if (ctx->handlerUs > 0) {
+        auto end = Clock::now() + std::chrono::microseconds(ctx->handlerUs);
+        while (Clock::now() < end) {
+        }
+    }
+    return httpd_resp_send(req, ctx->body.data(), ctx->body.size());
+}
+
+static int connect_to(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Reads one response with a body of the expected size, leaving anything after it in buf
+static bool read_response(int fd, std::vector<char>& buf, size_t& buffered, size_t bodySize)
+{
+    for (;;) {
+        const char* end = static_cast<const char*>(memmem(buf.data(), buffered, "\r\n\r\n", 4));
+        if (end != nullptr) {
+            size_t total = end + 4 - buf.data() + bodySize;
+            if (buffered >= total) {
+                if (strncmp(buf.data(), "HTTP/1.1 200", 12) != 0) {
+                    return false;
+                }
+                memmove(buf.data(), buf.data() + total, buffered - total);
+                buffered -= total;
+                return true;
+            }
+        }
+        if (buffered == buf.size()) {
+            return false;
+        }
+        ssize_t len = recv(fd, buf.data() + buffered, buf.size() - buffered, 0);
+        if (len <= 0) {
+            return false;
+        }
+        buffered += len;
+    }
+}
+
+struct ClientResult {
+    size_t requests = 0;
+    size_t errors = 0;
+    std::vector<uint32_t> latencies;    // microseconds
+};
+
+static void client_thread(int fd, size_t bodySize, std::atomic<bool>* stop, ClientResult* result)
+{
+    std::vector<char> buf(bodySize + 1024);
+    size_t buffered = 0;
+    while (!stop->load(std::memory_order_relaxed)) {
+        auto start = Clock::now();
+        if (send(fd, s_request, sizeof(s_request) - 1, 0) != (ssize_t) sizeof(s_request) - 1 ||
+            !read_response(fd, buf, buffered, bodySize)) {
+            result->errors++;
+            break;
+        }
+        auto us = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+        result->latencies.push_back(static_cast<uint32_t>(us));
+        result->requests++;
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t>& sorted, double p)
+{
+    if (sorted.empty()) {
+        return 0;
+    }
+    return sorted[std::min(sorted.size() - 1, static_cast<size_t>(p * sorted.size()))];
+}
+
+static bool run_workload(const Workload& w, uint16_t port, double seconds)
+{
+    HandlerCtx ctx = { std::vector<char>(w.bodySize, 'x'), w.handlerUs, w.headers, w.sendOverride };
+    s_send_calls = 0;
+
+    httpd_handle_t server;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.ctrl_port = port + 1;
+    config.max_open_sockets = w.clients;
+    config.backlog_conn = w.clients;
+    config.worker_count = w.workers;
+    if (httpd_start(&server, &config) != ESP_OK) {
+        return false;
+    }
+    httpd_uri_t uri = {
+        .uri      = "/bench",
+        .method   = HTTP_GET,
+        .handler  = bench_handler,
+        .user_ctx = &ctx,
+    };
+    httpd_register_uri_handler(server, &uri);
+
+    std::vector<int> fds;
+    for (int i = 0; i < w.clients; i++) {
+        int fd = connect_to(port);
+        if (fd < 0) {
+            break;
+        }
+        fds.push_back(fd);
+    }
+
+    std::atomic<bool> stop(false);
+    std::vector<ClientResult> results(fds.size());
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t i = 0; i < fds.size(); i++) {
+        threads.emplace_back(client_thread, fds[i], w.bodySize, &stop, &results[i]);
+    }
+    std::this_thread::sleep_for(std::chrono::duration<double>(seconds));
+    stop = true;
+    for (std::thread& t : threads) {
+        t.join();
+    }
+    double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    httpd_stop(server);
+
+    size_t requests = 0;
+    size_t errors = w.clients - fds.size();
+    std::vector<uint32_t> latencies;
+    for (const ClientResult& r : results) {
+        requests += r.requests;
+        errors += r.errors;
+        latencies.insert(latencies.end(), r.latencies.begin(), r.latencies.end());
+    }
+    std::sort(latencies.begin(), latencies.end());
+
+    printf("{\"workload\": \"%s\", \"poller\": \"%s\", \"clients\": %d, \"body_size\": %zu, "
+           "\"workers\": %d, \"handler_us\": %u, \"headers\": %d, \"send_override\": %s, "
+           "\"seconds\": %.2f, \"requests\": %zu, \"errors\": %zu, \"requests_per_sec\": %.0f, \"sends_per_request\": %.2f, "
+           "\"latency_p50_us\": %u, \"latency_p99_us\": %u, \"latency_max_us\": %u}\n",
+           w.name, POLLER_NAME, w.clients, w.bodySize, w.workers, w.handlerUs, w.headers,
+           w.sendOverride ? "true" : "false", elapsed, requests, errors, requests / elapsed,
+           requests ? (double) s_send_calls / requests : 0.0,
+           percentile(latencies, 0.50), percentile(latencies, 0.99),
+           latencies.empty() ? 0 : latencies.back());
+    fflush(stdout);
+    return errors == 0;
+}
+
+int main(int argc, char** argv)
+{
+    double seconds = (argc > 1) ? atof(argv[1]) : 2.0;
+    uint16_t port = 18200;
+    bool ok = true;
+    for (const Workload& w : s_workloads) {
+        // a new port each time, the previous one may still be in TIME_WAIT
+        ok = run_workload(w, port, seconds) && ok;
+        port += 2;
+    }
+    return ok ? 0 : 1;
+}
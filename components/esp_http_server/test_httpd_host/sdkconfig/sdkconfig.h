@@ -0,0 +1,5 @@
+#pragma once
+
+#define CONFIG_HTTPD_MAX_REQ_HDR_LEN 512
+#define CONFIG_HTTPD_MAX_URI_LEN 512
+#define CONFIG_LOG_DEFAULT_LEVEL 2
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Only what esp_http_server.h needs */
+#define tskIDLE_PRIORITY 0
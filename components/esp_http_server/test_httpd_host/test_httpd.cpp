@@ -0,0 +1,561 @@
+#include "catch.hpp"
+
+#include <esp_http_server.h>
+#include "esp_httpd_priv.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+static bool is_ready(struct httpd_poll *hp, int cnt, int fd)
+{
+    return std::find(hp->ready_fds, hp->ready_fds + cnt, fd) != hp->ready_fds + cnt;
+}
+
+TEST_CASE("poller reports the descriptors with data", "[httpd]")
+{
+    const int PAIRS = 8;
+    int fds[PAIRS][2];
+    struct httpd_poll hp;
+    REQUIRE(httpd_poll_init(&hp, PAIRS) == ESP_OK);
+
+    for (int i = 0; i < PAIRS; i++) {
+        REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds[i]) == 0);
+        REQUIRE(httpd_poll_add(&hp, fds[i][0]) == ESP_OK);
+    }
+    /* The set is full */
+    REQUIRE(httpd_poll_add(&hp, fds[0][1]) == ESP_FAIL);
+
+    /* Nothing to read yet */
+    REQUIRE(httpd_poll_wait(&hp, 0) == 0);
+
+    REQUIRE(write(fds[2][1], "x", 1) == 1);
+    REQUIRE(write(fds[5][1], "x", 1) == 1);
+    int cnt = httpd_poll_wait(&hp, 1000);
+    REQUIRE(cnt == 2);
+    REQUIRE(is_ready(&hp, cnt, fds[2][0]));
+    REQUIRE(is_ready(&hp, cnt, fds[5][0]));
+
+    /* Removed descriptors aren't reported, even with data */
+    httpd_poll_del(&hp, fds[5][0]);
+    cnt = httpd_poll_wait(&hp, 1000);
+    REQUIRE(cnt == 1);
+    REQUIRE(hp.ready_fds[0] == fds[2][0]);
+
+    /* Closing the other end is reported, so the session can be closed */
+    char c;
+    REQUIRE(read(fds[2][0], &c, 1) == 1);
+    close(fds[7][1]);
+    cnt = httpd_poll_wait(&hp, 1000);
+    REQUIRE(cnt == 1);
+    REQUIRE(hp.ready_fds[0] == fds[7][0]);
+
+    /* There is room again after removing one */
+    REQUIRE(httpd_poll_add(&hp, fds[5][1]) == ESP_OK);
+
+    httpd_poll_deinit(&hp);
+    for (int i = 0; i < PAIRS; i++) {
+        close(fds[i][0]);
+        if (i != 7) {
+            close(fds[i][1]);
+        }
+    }
+}
+
+TEST_CASE("session table finds sessions by descriptor", "[httpd]")
+{
+    const int SESSIONS = 100;
+    struct httpd_data *hd = (struct httpd_data *) calloc(1, sizeof(struct httpd_data));
+    hd->config.max_open_sockets = SESSIONS;
+    hd->hd_sd = (struct sock_db *) calloc(SESSIONS, sizeof(struct sock_db));
+    REQUIRE(httpd_poll_init(&hd->hd_poll, SESSIONS) == ESP_OK);
+    REQUIRE(httpd_sess_init(hd) == ESP_OK);
+    httpd_handle_t handle = (httpd_handle_t) hd;
+
+    std::vector<int> fds;
+    for (int i = 0; i < SESSIONS; i++) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        REQUIRE(fd >= 0);
+        fds.push_back(fd);
+    }
+
+    std::mt19937 rng(1);
+    for (int round = 0; round < 20; round++) {
+        std::vector<int> open;
+        for (int fd : fds) {
+            REQUIRE(httpd_is_sess_available(hd));
+            REQUIRE(httpd_sess_new(hd, fd) == ESP_OK);
+            open.push_back(fd);
+        }
+        REQUIRE(!httpd_is_sess_available(hd));
+        REQUIRE(httpd_sess_new(hd, fds[0]) == ESP_FAIL);
+
+        /* Close sessions in a random order, checking the lookups of all of them */
+        std::shuffle(open.begin(), open.end(), rng);
+        while (!open.empty()) {
+            int fd = open.back();
+            open.pop_back();
+            httpd_sess_delete(hd, fd);
+            REQUIRE(httpd_sess_update_timestamp(handle, fd) == ESP_ERR_NOT_FOUND);
+            for (int other : open) {
+                REQUIRE(httpd_sess_update_timestamp(handle, other) == ESP_OK);
+            }
+
+            /* The iterator visits the remaining ones */
+            size_t visited = 0;
+            int it = -1;
+            while ((it = httpd_sess_iterate(hd, it)) != -1) {
+                REQUIRE(std::find(open.begin(), open.end(), it) != open.end());
+                visited++;
+            }
+            REQUIRE(visited == open.size());
+        }
+    }
+
+    for (int fd : fds) {
+        close(fd);
+    }
+    httpd_sess_deinit(hd);
+    httpd_poll_deinit(&hd->hd_poll);
+    free(hd->hd_sd);
+    free(hd);
+}
+
+static esp_err_t hello_handler(httpd_req_t *req)
+{
+    const char *resp = (const char *) req->user_ctx;
+    return httpd_resp_send(req, resp, strlen(resp));
+}
+
+static httpd_handle_t start_server(uint16_t port, uint16_t max_open_sockets, uint16_t worker_count = 0)
+{
+    httpd_handle_t server;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.ctrl_port = port + 1;
+    config.max_open_sockets = max_open_sockets;
+    config.backlog_conn = max_open_sockets;
+    config.worker_count = worker_count;
+    REQUIRE(httpd_start(&server, &config) == ESP_OK);
+
+    static httpd_uri_t hello = {
+        .uri      = "/hello",
+        .method   = HTTP_GET,
+        .handler  = hello_handler,
+        .user_ctx = (void *) "Hello World!",
+    };
+    REQUIRE(httpd_register_uri_handler(server, &hello) == ESP_OK);
+    return server;
+}
+
+static int connect_to(uint16_t port)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    REQUIRE(fd >= 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    REQUIRE(connect(fd, (struct sockaddr *) &addr, sizeof(addr)) == 0);
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+/* Read one response, returns its body */
+static std::string read_response(int fd, std::string &buffered)
+{
+    char buf[512];
+    size_t header_end;
+    while ((header_end = buffered.find("\r\n\r\n")) == std::string::npos) {
+        int len = recv(fd, buf, sizeof(buf), 0);
+        REQUIRE(len > 0);
+        buffered.append(buf, len);
+    }
+    REQUIRE(buffered.compare(0, 15, "HTTP/1.1 200 OK") == 0);
+    size_t length_pos = buffered.find("Content-Length: ");
+    REQUIRE(length_pos < header_end);
+    size_t body_len = atoi(buffered.c_str() + length_pos + 16);
+    while (buffered.size() < header_end + 4 + body_len) {
+        int len = recv(fd, buf, sizeof(buf), 0);
+        REQUIRE(len > 0);
+        buffered.append(buf, len);
+    }
+    std::string body = buffered.substr(header_end + 4, body_len);
+    buffered.erase(0, header_end + 4 + body_len);
+    return body;
+}
+
+static const char request[] = "GET /hello HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+static void check_keep_alive_clients(uint16_t port, uint16_t worker_count)
+{
+    const int CLIENTS = 150;
+    httpd_handle_t server = start_server(port, CLIENTS, worker_count);
+
+    std::vector<int> clients;
+    std::vector<std::string> buffered(CLIENTS);
+    for (int i = 0; i < CLIENTS; i++) {
+        clients.push_back(connect_to(port));
+    }
+
+    /* Every client sends requests on its connection, interleaved with the others */
+    for (int round = 0; round < 3; round++) {
+        for (int i = 0; i < CLIENTS; i++) {
+            REQUIRE(send(clients[i], request, strlen(request), 0) == (ssize_t) strlen(request));
+        }
+        for (int i = 0; i < CLIENTS; i++) {
+            REQUIRE(read_response(clients[i], buffered[i]) == "Hello World!");
+        }
+    }
+
+    for (int fd : clients) {
+        close(fd);
+    }
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+TEST_CASE("server handles many keep-alive clients", "[httpd]")
+{
+    check_keep_alive_clients(18080, 0);
+}
+
+TEST_CASE("workers handle many keep-alive clients", "[httpd]")
+{
+    check_keep_alive_clients(18100, 4);
+}
+
+static void check_pipelined_requests(uint16_t port, uint16_t worker_count)
+{
+    httpd_handle_t server = start_server(port, 4, worker_count);
+
+    int fd = connect_to(port);
+    std::string buffered;
+    /* Both requests arrive together, the second one is left in the pending buffer */
+    std::string two = std::string(request) + request;
+    REQUIRE(send(fd, two.c_str(), two.size(), 0) == (ssize_t) two.size());
+    REQUIRE(read_response(fd, buffered) == "Hello World!");
+    REQUIRE(read_response(fd, buffered) == "Hello World!");
+    REQUIRE(buffered.empty());
+
+    close(fd);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+TEST_CASE("server processes pipelined requests without more data arriving", "[httpd]")
+{
+    check_pipelined_requests(18090, 0);
+    check_pipelined_requests(18092, 2);
+}
+
+static esp_err_t slow_handler(httpd_req_t *req)
+{
+    usleep(500 * 1000);
+    return hello_handler(req);
+}
+
+static std::atomic<bool> s_blocked_started;
+static std::atomic<bool> s_blocked_released;
+static std::atomic<bool> s_blocked_timed_out;
+
+/* Blocks until the test releases it, gives up after a few seconds so that a failure doesn't hang the test */
+static esp_err_t blocked_handler(httpd_req_t *req)
+{
+    s_blocked_started = true;
+    for (int i = 0; i < 500 && !s_blocked_released; i++) {
+        usleep(10 * 1000);
+    }
+    s_blocked_timed_out = !s_blocked_released;
+    return hello_handler(req);
+}
+
+TEST_CASE("slow handler in a worker doesn't hold up other sessions", "[httpd]")
+{
+    const uint16_t port = 18110;
+    httpd_handle_t server = start_server(port, 4, 2);
+    httpd_uri_t slow = {
+        .uri      = "/slow",
+        .method   = HTTP_GET,
+        .handler  = blocked_handler,
+        .user_ctx = (void *) "Slow",
+    };
+    REQUIRE(httpd_register_uri_handler(server, &slow) == ESP_OK);
+    s_blocked_started = false;
+    s_blocked_released = false;
+    s_blocked_timed_out = false;
+
+    int slow_fd = connect_to(port);
+    int fast_fd = connect_to(port);
+    std::string slow_buffered, fast_buffered;
+    const char slow_request[] = "GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    REQUIRE(send(slow_fd, slow_request, strlen(slow_request), 0) == (ssize_t) strlen(slow_request));
+    for (int i = 0; i < 500 && !s_blocked_started; i++) {
+        usleep(10 * 1000);
+    }
+    REQUIRE(s_blocked_started);
+
+    /* The slow handler only returns once the fast response has arrived */
+    REQUIRE(send(fast_fd, request, strlen(request), 0) == (ssize_t) strlen(request));
+    REQUIRE(read_response(fast_fd, fast_buffered) == "Hello World!");
+    s_blocked_released = true;
+    REQUIRE(read_response(slow_fd, slow_buffered) == "Slow");
+    CHECK_FALSE(s_blocked_timed_out);
+
+    close(slow_fd);
+    close(fast_fd);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+static esp_err_t close_handler(httpd_req_t *req)
+{
+    /* The session is busy, so it is closed once the response is sent */
+    httpd_trigger_sess_close(req->handle, httpd_req_to_sockfd(req));
+    return hello_handler(req);
+}
+
+TEST_CASE("worker handler can close its session", "[httpd]")
+{
+    /* The server closes the connection, which leaves its port in TIME_WAIT,
+     * so that it can't be bound again by the next run for a while */
+    const uint16_t port = 19000 + 2 * (getpid() % 500);
+    httpd_handle_t server = start_server(port, 4, 2);
+    httpd_uri_t bye = {
+        .uri      = "/bye",
+        .method   = HTTP_GET,
+        .handler  = close_handler,
+        .user_ctx = (void *) "Bye",
+    };
+    REQUIRE(httpd_register_uri_handler(server, &bye) == ESP_OK);
+
+    int fd = connect_to(port);
+    std::string buffered;
+    REQUIRE(send(fd, request, strlen(request), 0) == (ssize_t) strlen(request));
+    REQUIRE(read_response(fd, buffered) == "Hello World!");
+    const char bye_request[] = "GET /bye HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    REQUIRE(send(fd, bye_request, strlen(bye_request), 0) == (ssize_t) strlen(bye_request));
+    REQUIRE(read_response(fd, buffered) == "Bye");
+    char c;
+    REQUIRE(recv(fd, &c, 1, 0) == 0);
+
+    close(fd);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+/* Measures CPU time, so it is not run by "make test" */
+TEST_CASE("server doesn't spin while all the sessions are busy in workers", "[httpd][timing]")
+{
+    /* The least recently used session is closed, see above */
+    const uint16_t port = 20000 + 2 * (getpid() % 500);
+    httpd_handle_t server;
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.server_port = port;
+    config.ctrl_port = port + 1;
+    config.max_open_sockets = 1;
+    config.worker_count = 1;
+    config.lru_purge_enable = true;
+    REQUIRE(httpd_start(&server, &config) == ESP_OK);
+    httpd_uri_t uris[] = {
+        { .uri = "/hello", .method = HTTP_GET, .handler = hello_handler, .user_ctx = (void *) "Hello World!" },
+        { .uri = "/slow",  .method = HTTP_GET, .handler = slow_handler,  .user_ctx = (void *) "Slow" },
+    };
+    for (const httpd_uri_t &uri : uris) {
+        REQUIRE(httpd_register_uri_handler(server, &uri) == ESP_OK);
+    }
+
+    int busy_fd = connect_to(port);
+    std::string busy_buffered, new_buffered;
+    const char slow_request[] = "GET /slow HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    REQUIRE(send(busy_fd, slow_request, strlen(slow_request), 0) == (ssize_t) strlen(slow_request));
+    usleep(50 * 1000);
+
+    /* No session can be closed for this connection until the handler returns */
+    struct rusage start, end;
+    getrusage(RUSAGE_SELF, &start);
+    int new_fd = connect_to(port);
+    REQUIRE(read_response(busy_fd, busy_buffered) == "Slow");
+    getrusage(RUSAGE_SELF, &end);
+    int64_t cpu_us = (end.ru_utime.tv_sec - start.ru_utime.tv_sec) * 1000000LL +
+                     (end.ru_utime.tv_usec - start.ru_utime.tv_usec) +
+                     (end.ru_stime.tv_sec - start.ru_stime.tv_sec) * 1000000LL +
+                     (end.ru_stime.tv_usec - start.ru_stime.tv_usec);
+    CHECK(cpu_us < 200 * 1000);
+
+    /* Then the idle session makes room for the new connection */
+    char c;
+    REQUIRE(recv(busy_fd, &c, 1, 0) == 0);
+    REQUIRE(send(new_fd, request, strlen(request), 0) == (ssize_t) strlen(request));
+    REQUIRE(read_response(new_fd, new_buffered) == "Hello World!");
+
+    close(busy_fd);
+    close(new_fd);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+static std::atomic<int> s_work_done;
+
+static void record_work(void *arg)
+{
+    /* Work runs in a worker, not the thread which queued it */
+    if (!pthread_equal(pthread_self(), *(pthread_t *) arg)) {
+        s_work_done++;
+    }
+}
+
+TEST_CASE("work can be queued to a worker", "[httpd]")
+{
+    const uint16_t port = 18130;
+    pthread_t self = pthread_self();
+    httpd_handle_t server = start_server(port, 4);
+    REQUIRE(httpd_queue_worker_work(server, 0, record_work, &self) == ESP_ERR_INVALID_ARG);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+
+    server = start_server(port + 2, 4, 2);
+    REQUIRE(httpd_queue_worker_work(server, 2, record_work, &self) == ESP_ERR_INVALID_ARG);
+    REQUIRE(httpd_queue_worker_work(server, -1, record_work, &self) == ESP_ERR_INVALID_ARG);
+    s_work_done = 0;
+    REQUIRE(httpd_queue_worker_work(server, 0, record_work, &self) == ESP_OK);
+    REQUIRE(httpd_queue_worker_work(server, 1, record_work, &self) == ESP_OK);
+    for (int i = 0; i < 100 && s_work_done < 2; i++) {
+        usleep(10 * 1000);
+    }
+    REQUIRE(s_work_done == 2);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+
+static std::atomic<int> s_sendv_calls;
+static std::atomic<int> s_send_calls;
+
+static int counting_sendv(int sockfd, const struct iovec *iov, int iovcnt, int flags)
+{
+    s_sendv_calls++;
+    return httpd_default_sendv(sockfd, iov, iovcnt, flags);
+}
+
+static int counting_send(int sockfd, const char *buf, size_t buf_len, int flags)
+{
+    s_send_calls++;
+    return httpd_default_send(sockfd, buf, buf_len, flags);
+}
+
+/* Value of the X-Long response header */
+static std::string s_long_value;
+
+static esp_err_t headers_handler(httpd_req_t *req)
+{
+    if (req->user_ctx != NULL) {
+        httpd_set_send_override(req, counting_send);
+    } else {
+        httpd_set_sendv_override(req, counting_sendv);
+    }
+    httpd_resp_set_hdr(req, "X-First", "1");
+    httpd_resp_set_hdr(req, "X-Long", s_long_value.c_str());
+    httpd_resp_set_hdr(req, "X-Last", "3");
+    return httpd_resp_send(req, "Headers", strlen("Headers"));
+}
+
+static esp_err_t chunked_handler(httpd_req_t *req)
+{
+    httpd_set_sendv_override(req, counting_sendv);
+    httpd_resp_set_hdr(req, "X-First", "1");
+    if (httpd_resp_send_chunk(req, "Hello ", strlen("Hello ")) != ESP_OK ||
+        httpd_resp_send_chunk(req, "World!", strlen("World!")) != ESP_OK) {
+        return ESP_FAIL;
+    }
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+/* Sends a request for uri and returns the next len bytes received */
+static std::string exchange(int fd, const char *uri, size_t len)
+{
+    std::string req = std::string("GET ") + uri + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    REQUIRE(send(fd, req.c_str(), req.size(), 0) == (ssize_t) req.size());
+    std::string received;
+    char buf[512];
+    while (received.size() < len) {
+        int ret = recv(fd, buf, std::min(sizeof(buf), len - received.size()), 0);
+        REQUIRE(ret > 0);
+        received.append(buf, ret);
+    }
+    return received;
+}
+
+static std::string headers_response(void)
+{
+    return "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nContent-Length: 7\r\n"
+           "X-First: 1\r\nX-Long: " + s_long_value + "\r\nX-Last: 3\r\n\r\nHeaders";
+}
+
+static httpd_handle_t start_headers_server(uint16_t port)
+{
+    httpd_handle_t server = start_server(port, 4);
+    httpd_uri_t uris[] = {
+        { .uri = "/sendv",   .method = HTTP_GET, .handler = headers_handler, .user_ctx = NULL },
+        { .uri = "/send",    .method = HTTP_GET, .handler = headers_handler, .user_ctx = (void *) "send" },
+        { .uri = "/chunked", .method = HTTP_GET, .handler = chunked_handler, .user_ctx = NULL },
+    };
+    for (const httpd_uri_t &uri : uris) {
+        REQUIRE(httpd_register_uri_handler(server, &uri) == ESP_OK);
+    }
+    return server;
+}
+
+TEST_CASE("response is sent with a single vectored send", "[httpd]")
+{
+    const uint16_t port = 18140;
+    httpd_handle_t server = start_headers_server(port);
+    int fd = connect_to(port);
+
+    s_long_value.assign(16, 'v');
+    s_sendv_calls = 0;
+    std::string expected = headers_response();
+    CHECK(exchange(fd, "/sendv", expected.size()) == expected);
+    CHECK(s_sendv_calls == 1);
+
+    /* Headers go out with the first chunk, each chunk with its framing */
+    s_sendv_calls = 0;
+    expected = "HTTP/1.1 200 OK\r\nContent-Type: text/html\r\nTransfer-Encoding: chunked\r\n"
+               "X-First: 1\r\n\r\n6\r\nHello \r\n6\r\nWorld!\r\n0\r\n\r\n";
+    CHECK(exchange(fd, "/chunked", expected.size()) == expected);
+    CHECK(s_sendv_calls == 3);
+
+    close(fd);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
+
+TEST_CASE("long headers and send overrides don't change the response", "[httpd]")
+{
+    const uint16_t port = 18150;
+    httpd_handle_t server = start_headers_server(port);
+    int fd = connect_to(port);
+
+    /* Longer than the scratch buffer the headers are assembled in */
+    s_long_value.assign(1500, 'v');
+    std::string expected = headers_response();
+    CHECK(exchange(fd, "/sendv", expected.size()) == expected);
+
+    /* The send override replaces the vectored send for the session */
+    s_long_value.assign(16, 'v');
+    s_sendv_calls = 0;
+    s_send_calls = 0;
+    expected = headers_response();
+    CHECK(exchange(fd, "/send", expected.size()) == expected);
+    CHECK(s_send_calls == 2);
+    CHECK(exchange(fd, "/sendv", expected.size()) == expected);
+    CHECK(s_sendv_calls == 1);
+
+    close(fd);
+    REQUIRE(httpd_stop(server) == ESP_OK);
+}
@@ -75,6 +75,9 @@ DRESULT ff_wl_ioctl (BYTE pdrv, BYTE cmd, void *buff)
     assert(wl_handle + 1);
     switch (cmd) {
     case CTRL_SYNC:
+        if (wl_sync(wl_handle) != ESP_OK) {
+            return RES_ERROR;
+        }
         return RES_OK;
     case GET_SECTOR_COUNT:
         *((DWORD *) buff) = wl_size(wl_handle) / wl_sector_size(wl_handle);
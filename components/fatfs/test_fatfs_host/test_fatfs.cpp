@@ -6,10 +6,12 @@
 #include "wear_levelling.h"
 #include "diskio.h"
 #include "diskio_wl.h"
+#include "SpiFlash.h"
 
 #include "catch.hpp"
 
 extern "C" void init_spi_flash(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin);
+extern SpiFlash spiflash;
 
 TEST_CASE("create volume, open file, write and read back data", "[fatfs]")
 {
@@ -91,3 +93,67 @@ TEST_CASE("create volume, open file, write and read back data", "[fatfs]")
     free(read);
     free(data);
 }
+
+TEST_CASE("flash operations of file write and read", "[fatfs][bench]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    FRESULT fr_result;
+    BYTE pdrv;
+    FATFS fs;
+    FIL file;
+    UINT bw;
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_DATA_FAT, "storage");
+
+    wl_handle_t wl_handle;
+    REQUIRE(wl_mount(partition, &wl_handle) == ESP_OK);
+    REQUIRE(ff_diskio_get_drive(&pdrv) == ESP_OK);
+    REQUIRE(ff_diskio_register_wl_partition(pdrv, wl_handle) == ESP_OK);
+
+    // Other test cases may have left the default volume registered
+    char drv[3] = {(char)('0' + pdrv), ':', 0};
+    char path[16];
+    snprintf(path, sizeof(path), "%s/bench.bin", drv);
+
+    DWORD part_list[] = {100, 0, 0, 0};
+    BYTE work_area[FF_MAX_SS];
+    REQUIRE(f_fdisk(pdrv, part_list, work_area) == FR_OK);
+    REQUIRE(f_mkfs(drv, FM_ANY, 0, work_area, sizeof(work_area)) == FR_OK);
+    REQUIRE(f_mount(&fs, drv, 0) == FR_OK);
+    REQUIRE(f_open(&file, path, FA_OPEN_ALWAYS | FA_READ | FA_WRITE) == FR_OK);
+
+    uint32_t data_size = 100000;
+    char *data = (char*) malloc(data_size);
+    char *read = (char*) malloc(data_size);
+    for(uint32_t i = 0; i < data_size; i += sizeof(i))
+    {
+        *((uint32_t*)(data + i)) = i;
+    }
+
+    // Data is only guaranteed to be on flash after f_sync
+    spiflash.reset_stats();
+    fr_result = f_write(&file, data, data_size, &bw);
+    REQUIRE(fr_result == FR_OK);
+    REQUIRE(bw == data_size);
+    REQUIRE(f_sync(&file) == FR_OK);
+    spiflash.print_stats("fatfs write", data_size);
+
+    REQUIRE(f_lseek(&file, 0) == FR_OK);
+
+    spiflash.reset_stats();
+    fr_result = f_read(&file, read, data_size, &bw);
+    REQUIRE(fr_result == FR_OK);
+    REQUIRE(bw == data_size);
+    spiflash.print_stats("fatfs read", data_size);
+
+    REQUIRE(memcmp(data, read, data_size) == 0);
+
+    REQUIRE(f_close(&file) == FR_OK);
+    REQUIRE(f_mount(0, drv, 0) == FR_OK);
+    ff_diskio_unregister(pdrv);
+    REQUIRE(wl_unmount(wl_handle) == ESP_OK);
+
+    free(read);
+    free(data);
+}
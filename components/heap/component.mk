@@ -2,7 +2,11 @@
 # Component Makefile
 #
 
-COMPONENT_OBJS := heap_caps_init.o heap_caps.o multi_heap.o heap_trace.o
+COMPONENT_OBJS := heap_caps_init.o heap_caps.o multi_heap.o heap_pool.o heap_trace.o
+
+ifdef CONFIG_HEAP_PER_CORE_CACHE
+COMPONENT_OBJS += heap_cache.o
+endif
 
 ifndef CONFIG_HEAP_POISONING_DISABLED
 COMPONENT_OBJS += multi_heap_poisoning.o
@@ -14,6 +18,8 @@ endif
 
 ifdef CONFIG_HEAP_TRACING
 
+COMPONENT_OBJS += heap_trace_sampling.o
+
 WRAP_FUNCTIONS = calloc malloc free realloc heap_caps_malloc heap_caps_free heap_caps_realloc heap_caps_malloc_default heap_caps_realloc_default
 WRAP_ARGUMENT := -Wl,--wrap=
 
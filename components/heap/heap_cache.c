@@ -0,0 +1,152 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <multi_heap.h>
+#include "multi_heap_internal.h"
+#include "multi_heap_config.h"
+#include "heap_cache.h"
+
+static const uint32_t class_size[HEAP_CACHE_NUM_CLASSES] = HEAP_CACHE_CLASS_SIZES;
+
+/* Smallest class which can hold 'size' bytes, or -1 if the size isn't cached */
+static inline int alloc_class(size_t size)
+{
+    if (size == 0 || size > HEAP_CACHE_MAX_SIZE) {
+        return -1;
+    }
+    for (int i = 0; i < HEAP_CACHE_NUM_CLASSES; i++) {
+        if (size <= class_size[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/* Largest class which a freed block of 'size' bytes can serve, or -1 if
+   the block shouldn't be cached.
+
+   A block may be bigger than the size it was allocated with (if it wasn't
+   worth splitting), but blocks which would waste a third or more of their
+   size in the class they'd be cached in go back to the heap.
+*/
+static inline int free_class(size_t size)
+{
+    if (size >= HEAP_CACHE_MAX_FREE_SIZE) {
+        return -1;
+    }
+    for (int i = HEAP_CACHE_NUM_CLASSES - 1; i >= 0; i--) {
+        if (size >= class_size[i]) {
+            return (size < class_size[i] + class_size[i] / 2) ? i : -1;
+        }
+    }
+    return -1;
+}
+
+void heap_cache_init(heap_cache_t *cache, multi_heap_handle_t heap)
+{
+    memset(cache, 0, sizeof(heap_cache_t));
+    cache->heap = heap;
+}
+
+/* Take up to HEAP_CACHE_BATCH blocks for an empty bin from the heap, holding the heap lock once */
+static void refill_bin(heap_cache_t *cache, int cls)
+{
+    heap_cache_bin_t *bin = &cache->bins[cls];
+    multi_heap_internal_lock(cache->heap);
+    while (bin->count < HEAP_CACHE_BATCH) {
+        void *p = multi_heap_malloc(cache->heap, class_size[cls]);
+        if (p == NULL) {
+            break;
+        }
+        bin->blocks[bin->count++] = p;
+    }
+    multi_heap_internal_unlock(cache->heap);
+    cache->refills++;
+}
+
+/* Return the 'count' oldest blocks of a bin to the heap, holding the heap lock once */
+static void flush_bin(heap_cache_t *cache, int cls, uint32_t count)
+{
+    heap_cache_bin_t *bin = &cache->bins[cls];
+    multi_heap_internal_lock(cache->heap);
+    for (uint32_t i = 0; i < count; i++) {
+        multi_heap_free(cache->heap, bin->blocks[i]);
+    }
+    multi_heap_internal_unlock(cache->heap);
+    bin->count -= count;
+    memmove(&bin->blocks[0], &bin->blocks[count], bin->count * sizeof(void *));
+    cache->flushes++;
+}
+
+void *heap_cache_malloc(heap_cache_t *cache, size_t size)
+{
+    int cls = alloc_class(size);
+    if (cls < 0) {
+        return multi_heap_malloc(cache->heap, size);
+    }
+
+    heap_cache_bin_t *bin = &cache->bins[cls];
+    if (bin->count == 0) {
+        refill_bin(cache, cls);
+        if (bin->count == 0) {
+            return NULL;
+        }
+    }
+    return bin->blocks[--bin->count];
+}
+
+void heap_cache_free(heap_cache_t *cache, void *p)
+{
+    if (p == NULL) {
+        return;
+    }
+
+#ifdef MULTI_HEAP_POISONING
+    /* the block may be bigger than its poisoned region, only the latter can be handed out again */
+    size_t size = multi_heap_internal_get_poisoned_size(p);
+#else
+    size_t size = multi_heap_get_allocated_size(cache->heap, p);
+#endif
+    int cls = free_class(size);
+    if (cls < 0) {
+        multi_heap_free(cache->heap, p);
+        return;
+    }
+
+    heap_cache_bin_t *bin = &cache->bins[cls];
+    if (bin->count == HEAP_CACHE_BIN_DEPTH) {
+        flush_bin(cache, cls, HEAP_CACHE_BATCH);
+    }
+    bin->blocks[bin->count++] = p;
+}
+
+void heap_cache_flush(heap_cache_t *cache)
+{
+    for (int i = 0; i < HEAP_CACHE_NUM_CLASSES; i++) {
+        if (cache->bins[i].count > 0) {
+            flush_bin(cache, i, cache->bins[i].count);
+        }
+    }
+}
+
+size_t heap_cache_cached_size(const heap_cache_t *cache)
+{
+    size_t size = 0;
+    for (int i = 0; i < HEAP_CACHE_NUM_CLASSES; i++) {
+        size += cache->bins[i].count * class_size[i];
+    }
+    return size;
+}
@@ -0,0 +1,82 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "multi_heap.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Small block caches in front of a multi_heap heap
+
+   A heap_cache_t keeps a few free blocks of each small size class, so most
+   small allocations and frees don't touch the heap (or its lock) at all.
+   Bins are refilled from and flushed to the heap in batches, taking the heap
+   lock once per batch.
+
+   The cache itself has no locking. Each cache must only be used by one
+   context at a time: heap_caps.c keeps one cache per CPU core per heap,
+   the host tests keep one cache per thread.
+
+   Blocks sitting in a cache count as allocated in the heap's statistics.
+*/
+
+/* Number of size classes and the block size of each one */
+#define HEAP_CACHE_NUM_CLASSES 6
+#define HEAP_CACHE_CLASS_SIZES { 16, 24, 32, 48, 64, 128 }
+
+/* Largest allocation served from a cache */
+#define HEAP_CACHE_MAX_SIZE 128
+
+/* Freed blocks of this size or bigger always go back to the heap */
+#define HEAP_CACHE_MAX_FREE_SIZE (HEAP_CACHE_MAX_SIZE + HEAP_CACHE_MAX_SIZE / 2)
+
+/* Number of blocks each bin can hold, and the number of blocks moved
+   to/from the heap at once when a bin runs empty or full. */
+#define HEAP_CACHE_BIN_DEPTH 16
+#define HEAP_CACHE_BATCH 8
+
+typedef struct {
+    uint32_t count;
+    void *blocks[HEAP_CACHE_BIN_DEPTH];
+} heap_cache_bin_t;
+
+typedef struct {
+    multi_heap_handle_t heap;
+    heap_cache_bin_t bins[HEAP_CACHE_NUM_CLASSES];
+    uint32_t refills;   ///< Number of batches taken from the heap
+    uint32_t flushes;   ///< Number of batches returned to the heap
+} heap_cache_t;
+
+/* Set up an empty cache in front of 'heap' */
+void heap_cache_init(heap_cache_t *cache, multi_heap_handle_t heap);
+
+/* Allocate a block, from the cache if it is small enough, otherwise directly from the heap */
+void *heap_cache_malloc(heap_cache_t *cache, size_t size);
+
+/* Free a block which was allocated from the cache's heap, keeping it in the cache if it is small */
+void heap_cache_free(heap_cache_t *cache, void *p);
+
+/* Return all cached blocks to the heap */
+void heap_cache_flush(heap_cache_t *cache);
+
+/* Number of bytes held in the cache (not including block headers) */
+size_t heap_cache_cached_size(const heap_cache_t *cache);
+
+#ifdef __cplusplus
+}
+#endif
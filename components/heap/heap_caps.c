@@ -18,6 +18,7 @@
 #include <sys/param.h>
 #include "esp_attr.h"
 #include "esp_heap_caps.h"
+#include "esp_heap_pool.h"
 #include "multi_heap.h"
 #include "esp_log.h"
 #include "heap_private.h"
@@ -55,6 +56,57 @@ IRAM_ATTR static void *dram_alloc_to_iram_addr(void *addr, size_t len)
     return (void *)(iptr + 1);
 }
 
+#ifdef CONFIG_HEAP_PER_CORE_CACHE
+/*
+  Small allocations go through a per-core cache in front of each heap, so they usually don't take the heap's
+  lock at all. Each cache is protected by its own mux, which is only ever contended if a task migrates to the other
+  core in the middle of an allocation.
+*/
+IRAM_ATTR static void flush_caches(heap_t *heap)
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        portENTER_CRITICAL(&heap->cache_mux[i]);
+        heap_cache_flush(&heap->cache[i]);
+        portEXIT_CRITICAL(&heap->cache_mux[i]);
+    }
+}
+
+IRAM_ATTR static void *cached_malloc(heap_t *heap, size_t size)
+{
+    void *ret;
+    if (size > HEAP_CACHE_MAX_SIZE) {
+        ret = multi_heap_malloc(heap->heap, size);
+    } else {
+        int core = xPortGetCoreID();
+        portENTER_CRITICAL(&heap->cache_mux[core]);
+        ret = heap_cache_malloc(&heap->cache[core], size);
+        portEXIT_CRITICAL(&heap->cache_mux[core]);
+    }
+    if (ret == NULL) {
+        //The free memory may be sitting in the caches, or be split up by cached blocks, or the heap may be too
+        //fragmented to refill a whole batch. Give all cached blocks back and try the heap directly.
+        flush_caches(heap);
+        ret = multi_heap_malloc(heap->heap, size);
+    }
+    return ret;
+}
+
+IRAM_ATTR static void cached_free(heap_t *heap, void *ptr)
+{
+    if (multi_heap_get_allocated_size(heap->heap, ptr) >= HEAP_CACHE_MAX_FREE_SIZE) {
+        multi_heap_free(heap->heap, ptr);
+        return;
+    }
+    int core = xPortGetCoreID();
+    portENTER_CRITICAL(&heap->cache_mux[core]);
+    heap_cache_free(&heap->cache[core], ptr);
+    portEXIT_CRITICAL(&heap->cache_mux[core]);
+}
+#else
+#define cached_malloc(HEAP, SIZE) multi_heap_malloc((HEAP)->heap, (SIZE))
+#define cached_free(HEAP, PTR) multi_heap_free((HEAP)->heap, (PTR))
+#endif
+
 bool heap_caps_match(const heap_t *heap, uint32_t caps)
 {
     return heap->heap != NULL && ((get_all_caps(heap) & caps) == caps);
@@ -107,7 +159,7 @@ IRAM_ATTR void *heap_caps_malloc( size_t size, uint32_t caps )
                         }
                     } else {
                         //Just try to alloc, nothing special.
-                        ret = multi_heap_malloc(heap->heap, size);
+                        ret = cached_malloc(heap, size);
                         if (ret != NULL) {
                             return ret;
                         }
@@ -266,7 +318,7 @@ IRAM_ATTR void heap_caps_free( void *ptr)
 
     heap_t *heap = find_containing_heap(ptr);
     assert(heap != NULL && "free() target pointer is outside heap areas");
-    multi_heap_free(heap->heap, ptr);
+    cached_free(heap, ptr);
 }
 
 IRAM_ATTR void *heap_caps_realloc( void *ptr, size_t size, int caps)
@@ -401,6 +453,57 @@ void heap_caps_print_heap_info( uint32_t caps )
     printf("    free %d allocated %d min_free %d largest_free_block %d\n", info.total_free_bytes, info.total_allocated_bytes, info.minimum_free_bytes, info.largest_free_block);
 }
 
+static void add_histogram(uint32_t *sum, const uint32_t *histogram)
+{
+    for (int i = 0; i < MULTI_HEAP_HISTOGRAM_BUCKETS; i++) {
+        sum[i] += histogram[i];
+    }
+}
+
+esp_err_t heap_caps_get_stats( multi_heap_stats_t *stats, uint32_t caps )
+{
+    bzero(stats, sizeof(multi_heap_stats_t));
+
+    heap_t *heap;
+    SLIST_FOREACH(heap, &registered_heaps, next) {
+        if (heap_caps_match(heap, caps)) {
+            multi_heap_stats_t hstats;
+            if (!multi_heap_get_stats(heap->heap, &hstats)) {
+                return ESP_ERR_NOT_SUPPORTED;
+            }
+
+            stats->total_free_bytes += hstats.total_free_bytes;
+            stats->largest_free_block = MAX(stats->largest_free_block,
+                                            hstats.largest_free_block);
+            stats->minimum_free_bytes += hstats.minimum_free_bytes;
+            stats->free_blocks += hstats.free_blocks;
+            add_histogram(stats->free_block_sizes, hstats.free_block_sizes);
+            add_histogram(stats->alloc_sizes, hstats.alloc_sizes);
+            add_histogram(stats->malloc_time, hstats.malloc_time);
+            add_histogram(stats->free_time, hstats.free_time);
+            stats->mallocs += hstats.mallocs;
+            stats->failed_mallocs += hstats.failed_mallocs;
+            stats->frees += hstats.frees;
+        }
+    }
+#ifndef CONFIG_HEAP_STATS
+    /* also reached if no heap matches */
+    return ESP_ERR_NOT_SUPPORTED;
+#else
+    return ESP_OK;
+#endif
+}
+
+void heap_caps_reset_stats( uint32_t caps )
+{
+    heap_t *heap;
+    SLIST_FOREACH(heap, &registered_heaps, next) {
+        if (heap_caps_match(heap, caps)) {
+            multi_heap_reset_stats(heap->heap);
+        }
+    }
+}
+
 bool heap_caps_check_integrity(uint32_t caps, bool print_errors)
 {
     bool all_heaps = caps & MALLOC_CAP_INVALID;
@@ -447,3 +550,37 @@ void heap_caps_dump_all()
 {
     heap_caps_dump(MALLOC_CAP_INVALID);
 }
+
+void heap_caps_flush_caches()
+{
+#ifdef CONFIG_HEAP_PER_CORE_CACHE
+    heap_t *heap;
+    SLIST_FOREACH(heap, &registered_heaps, next) {
+        if (heap->heap != NULL) {
+            flush_caches(heap);
+        }
+    }
+#endif
+}
+
+static void *heap_caps_pool_slab_alloc(void *ctx, size_t size)
+{
+    return heap_caps_malloc(size, (uint32_t)(intptr_t)ctx);
+}
+
+static void heap_caps_pool_slab_free(void *ctx, void *slab)
+{
+    heap_caps_free(slab);
+}
+
+/* The free list in the pool metadata is updated with compare-and-swap, which doesn't work in external RAM */
+static void *heap_caps_pool_metadata_alloc(void *ctx, size_t size)
+{
+    return heap_caps_malloc(size, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+}
+
+heap_pool_handle_t heap_caps_pool_create(size_t object_size, size_t count, uint32_t caps)
+{
+    return heap_pool_create_with_metadata(object_size, count, heap_caps_pool_metadata_alloc,
+                                          heap_caps_pool_slab_alloc, heap_caps_pool_slab_free, (void *)(intptr_t)caps);
+}
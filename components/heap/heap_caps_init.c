@@ -47,6 +47,7 @@ void heap_caps_enable_nonos_stack_heaps()
             register_heap(heap);
             if (heap->heap != NULL) {
                 multi_heap_set_lock(heap->heap, &heap->heap_mux);
+                heap_caps_init_caches(heap);
             }
         }
     }
@@ -143,6 +144,7 @@ void heap_caps_init()
     for (int i = 0; i < num_heaps; i++) {
         if (heaps_array[i].heap != NULL) {
             multi_heap_set_lock(heaps_array[i].heap, &heaps_array[i].heap_mux);
+            heap_caps_init_caches(&heaps_array[i]);
         }
         if (i == 0) {
             SLIST_INSERT_HEAD(&registered_heaps, &heaps_array[0], next);
@@ -222,6 +224,7 @@ esp_err_t heap_caps_add_region_with_caps(const uint32_t caps[], intptr_t start,
         goto done;
     }
     multi_heap_set_lock(p_new->heap, &p_new->heap_mux);
+    heap_caps_init_caches(p_new);
 
     /* (This insertion is atomic to registered_heaps, so
        we don't need to worry about thread safety for readers,
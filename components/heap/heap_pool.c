@@ -0,0 +1,251 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdatomic.h>
+#include <multi_heap.h>
+#include "esp_heap_pool.h"
+
+/* Pool allocator
+
+   Objects are carved from slabs which are allocated from the heap. Each slab
+   starts with a heap_pool_slab_t header, followed by 'slab_objects' objects.
+
+   Free objects are kept on a singly linked LIFO list (a "Treiber stack"),
+   with the link stored in the first word of the free object.
+
+   Any task may push an object onto the free list with a compare-and-swap.
+   Only the allocating task pops objects, so an object can't be popped and
+   pushed back by somebody else between reading the list head and swapping it
+   out. This is what makes the list safe against the ABA problem without
+   needing a tag counter, and why only one task may call heap_pool_alloc() at
+   a time.
+
+   Fields which are only written by the allocating task (slab list, peak
+   usage, failure count) are plain variables. The number of allocated objects
+   is atomic as it is decremented by heap_pool_free().
+*/
+
+typedef struct heap_pool_object {
+    struct heap_pool_object *next;
+} heap_pool_object_t;
+
+typedef struct heap_pool_slab {
+    struct heap_pool_slab *next;
+    /* objects follow here, aligned to the size of a pointer */
+} heap_pool_slab_t;
+
+struct heap_pool {
+    _Atomic(heap_pool_object_t *) free_list;
+    atomic_size_t allocated;
+    size_t object_size;
+    size_t slab_objects;
+    size_t slab_size;
+    size_t total_slabs;
+    size_t peak_allocated;
+    size_t failed_allocations;
+    heap_pool_slab_t *slabs;
+    heap_pool_slab_alloc_t slab_alloc;
+    heap_pool_slab_free_t slab_free;
+    void *ctx;
+};
+
+#define ALIGN_UP(X) (((X) + sizeof(void *) - 1) & ~(sizeof(void *) - 1))
+
+static inline heap_pool_object_t *get_object(heap_pool_slab_t *slab, size_t object_size, size_t index)
+{
+    return (heap_pool_object_t *)((intptr_t)&slab[1] + object_size * index);
+}
+
+/* Push the chain of objects from 'first' to 'last' onto the free list */
+static void push_objects(heap_pool_handle_t pool, heap_pool_object_t *first, heap_pool_object_t *last)
+{
+    heap_pool_object_t *head = atomic_load_explicit(&pool->free_list, memory_order_relaxed);
+    do {
+        last->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&pool->free_list, &head, first,
+                                                    memory_order_release, memory_order_relaxed));
+}
+
+/* Allocate a new slab, put all but the first of its objects on the free list
+   and return the first one.
+
+   Only called by the allocating task.
+*/
+static heap_pool_object_t *add_slab(heap_pool_handle_t pool)
+{
+    heap_pool_slab_t *slab = pool->slab_alloc(pool->ctx, pool->slab_size);
+    if (slab == NULL) {
+        return NULL;
+    }
+
+    slab->next = pool->slabs;
+    pool->slabs = slab;
+    pool->total_slabs++;
+
+    for (size_t i = 1; i < pool->slab_objects - 1; i++) {
+        get_object(slab, pool->object_size, i)->next = get_object(slab, pool->object_size, i + 1);
+    }
+    if (pool->slab_objects > 1) {
+        push_objects(pool, get_object(slab, pool->object_size, 1),
+                     get_object(slab, pool->object_size, pool->slab_objects - 1));
+    }
+    return get_object(slab, pool->object_size, 0);
+}
+
+heap_pool_handle_t heap_pool_create(size_t object_size, size_t count,
+                                    heap_pool_slab_alloc_t slab_alloc, heap_pool_slab_free_t slab_free, void *ctx)
+{
+    return heap_pool_create_with_metadata(object_size, count, slab_alloc, slab_alloc, slab_free, ctx);
+}
+
+heap_pool_handle_t heap_pool_create_with_metadata(size_t object_size, size_t count, heap_pool_slab_alloc_t metadata_alloc,
+                                                  heap_pool_slab_alloc_t slab_alloc, heap_pool_slab_free_t slab_free, void *ctx)
+{
+    if (count == 0 || metadata_alloc == NULL || slab_alloc == NULL || slab_free == NULL) {
+        return NULL;
+    }
+    if (object_size < sizeof(heap_pool_object_t)) {
+        object_size = sizeof(heap_pool_object_t);
+    }
+    if (object_size > SIZE_MAX / 2) {
+        return NULL;
+    }
+    object_size = ALIGN_UP(object_size);
+    if (count > (SIZE_MAX - sizeof(heap_pool_slab_t)) / object_size) {
+        return NULL;
+    }
+
+    heap_pool_handle_t pool = metadata_alloc(ctx, sizeof(struct heap_pool));
+    if (pool == NULL) {
+        return NULL;
+    }
+    atomic_init(&pool->free_list, NULL);
+    atomic_init(&pool->allocated, 0);
+    pool->object_size = object_size;
+    pool->slab_objects = count;
+    pool->slab_size = sizeof(heap_pool_slab_t) + object_size * count;
+    pool->total_slabs = 0;
+    pool->peak_allocated = 0;
+    pool->failed_allocations = 0;
+    pool->slabs = NULL;
+    pool->slab_alloc = slab_alloc;
+    pool->slab_free = slab_free;
+    pool->ctx = ctx;
+
+    heap_pool_object_t *first = add_slab(pool);
+    if (first == NULL) {
+        slab_free(ctx, pool);
+        return NULL;
+    }
+    push_objects(pool, first, first);
+    return pool;
+}
+
+static void *multi_heap_slab_alloc(void *ctx, size_t size)
+{
+    return multi_heap_malloc((multi_heap_handle_t)ctx, size);
+}
+
+static void multi_heap_slab_free(void *ctx, void *slab)
+{
+    multi_heap_free((multi_heap_handle_t)ctx, slab);
+}
+
+heap_pool_handle_t heap_pool_create_in_heap(multi_heap_handle_t heap, size_t object_size, size_t count)
+{
+    if (heap == NULL) {
+        return NULL;
+    }
+    return heap_pool_create(object_size, count, multi_heap_slab_alloc, multi_heap_slab_free, heap);
+}
+
+void heap_pool_delete(heap_pool_handle_t pool)
+{
+    if (pool == NULL) {
+        return;
+    }
+    heap_pool_slab_t *slab = pool->slabs;
+    while (slab != NULL) {
+        heap_pool_slab_t *next = slab->next;
+        pool->slab_free(pool->ctx, slab);
+        slab = next;
+    }
+    pool->slab_free(pool->ctx, pool);
+}
+
+void *heap_pool_alloc(heap_pool_handle_t pool)
+{
+    heap_pool_object_t *object = atomic_load_explicit(&pool->free_list, memory_order_acquire);
+
+    /* No other task pops from the list, so 'object' stays on it (and
+       object->next stays valid) until we swap it out here. */
+    while (object != NULL
+           && !atomic_compare_exchange_weak_explicit(&pool->free_list, &object, object->next,
+                                                     memory_order_acquire, memory_order_acquire)) {
+    }
+
+    if (object == NULL) {
+        object = add_slab(pool);
+        if (object == NULL) {
+            pool->failed_allocations++;
+            return NULL;
+        }
+    }
+
+    size_t allocated = atomic_fetch_add_explicit(&pool->allocated, 1, memory_order_relaxed) + 1;
+    if (allocated > pool->peak_allocated) {
+        pool->peak_allocated = allocated;
+    }
+    return object;
+}
+
+void heap_pool_free(heap_pool_handle_t pool, void *ptr)
+{
+    if (ptr == NULL) {
+        return;
+    }
+    heap_pool_object_t *object = (heap_pool_object_t *)ptr;
+    atomic_fetch_sub_explicit(&pool->allocated, 1, memory_order_relaxed);
+    push_objects(pool, object, object);
+}
+
+void heap_pool_get_info(heap_pool_handle_t pool, heap_pool_info_t *info)
+{
+    size_t total_slabs = pool->total_slabs;
+    size_t allocated = atomic_load_explicit(&pool->allocated, memory_order_relaxed);
+
+    info->object_size = pool->object_size;
+    info->total_slabs = total_slabs;
+    info->total_objects = total_slabs * pool->slab_objects;
+    info->allocated_objects = allocated;
+    info->free_objects = (allocated < info->total_objects) ? info->total_objects - allocated : 0;
+    info->peak_allocated_objects = pool->peak_allocated;
+    info->failed_allocations = pool->failed_allocations;
+    info->total_bytes = sizeof(struct heap_pool) + total_slabs * pool->slab_size;
+}
+
+void heap_pool_print_info(heap_pool_handle_t pool)
+{
+    heap_pool_info_t info;
+    heap_pool_get_info(pool, &info);
+    printf("Pool %p object size %d:\n", pool, info.object_size);
+    printf("  slabs %d objects %d allocated %d free %d peak %d\n",
+           info.total_slabs, info.total_objects, info.allocated_objects,
+           info.free_objects, info.peak_allocated_objects);
+    printf("  failed allocations %d heap bytes %d\n",
+           info.failed_allocations, info.total_bytes);
+}
@@ -19,6 +19,9 @@
 #include <soc/soc_memory_layout.h>
 #include "multi_heap.h"
 #include "rom/queue.h"
+#ifdef CONFIG_HEAP_PER_CORE_CACHE
+#include "heap_cache.h"
+#endif
 
 #ifdef __cplusplus
 extern "C" {
@@ -35,6 +38,10 @@ typedef struct heap_t_ {
     intptr_t end;
     portMUX_TYPE heap_mux;
     multi_heap_handle_t heap;
+#ifdef CONFIG_HEAP_PER_CORE_CACHE
+    heap_cache_t cache[portNUM_PROCESSORS];     ///< Small block cache for each CPU core
+    portMUX_TYPE cache_mux[portNUM_PROCESSORS]; ///< Protects each cache from other tasks & ISRs on the same core
+#endif
     SLIST_ENTRY(heap_t_) next;
 } heap_t;
 
@@ -61,6 +68,19 @@ inline static IRAM_ATTR uint32_t get_all_caps(const heap_t *heap)
     return all_caps;
 }
 
+/* Set up the per-core caches of a heap, once heap->heap is registered */
+#ifdef CONFIG_HEAP_PER_CORE_CACHE
+inline static void heap_caps_init_caches(heap_t *heap)
+{
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        vPortCPUInitializeMutex(&heap->cache_mux[i]);
+        heap_cache_init(&heap->cache[i], heap->heap);
+    }
+}
+#else
+inline static void heap_caps_init_caches(heap_t *heap) { }
+#endif
+
 /*
  Because we don't want to add _another_ known allocation method to the stack of functions to trace wrt memory tracing,
  these are declared private. The newlib malloc()/realloc() implementation also calls these, so they are declared 
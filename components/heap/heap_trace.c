@@ -26,6 +26,11 @@
 #include "soc/soc_memory_layout.h"
 
 #include "heap_private.h"
+#include "heap_trace_sampling.h"
+
+#if CONFIG_ESP32_APPTRACE_ENABLE
+#include "esp_app_trace.h"
+#endif
 
 #define STACK_DEPTH CONFIG_HEAP_TRACING_STACK_DEPTH
 
@@ -53,6 +58,12 @@ static size_t total_frees;
 /* Has the buffer overflowed and lost trace entries? */
 static bool has_overflowed = false;
 
+/* Sampled allocation profiling, see heap_trace_sampling.h */
+static portMUX_TYPE sampling_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool sampling;
+static heap_trace_sampler_t sampler;
+static heap_trace_sample_bucket_t *sample_buckets;
+
 esp_err_t heap_trace_init_standalone(heap_trace_record_t *record_buffer, size_t num_records)
 {
 #ifndef CONFIG_HEAP_TRACING
@@ -189,6 +200,83 @@ void heap_trace_dump(void)
     }
 }
 
+esp_err_t heap_trace_init_sampling(size_t num_stacks, size_t sample_period)
+{
+#ifndef CONFIG_HEAP_TRACING
+    return ESP_ERR_NOT_SUPPORTED;
+#else
+    if (sampling) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    /* An allocation on another core may have seen 'sampling' set just before it was
+       stopped, and still be recording into the buckets */
+    heap_trace_sampler_detach(&sampler);
+    heap_caps_free(sample_buckets);
+    sample_buckets = NULL;
+    if (num_stacks == 0) {
+        return ESP_OK;
+    }
+    if (sample_period == 0) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    sample_buckets = heap_caps_malloc(num_stacks * sizeof(heap_trace_sample_bucket_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if (sample_buckets == NULL) {
+        return ESP_ERR_NO_MEM;
+    }
+    heap_trace_sampler_init(&sampler, sample_buckets, num_stacks, sample_period, xthal_get_ccount(), &sampling_mux);
+    return ESP_OK;
+#endif
+}
+
+esp_err_t heap_trace_start_sampling(void)
+{
+#ifndef CONFIG_HEAP_TRACING
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+    if (sample_buckets == NULL || sampling) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sampling = true;
+    return ESP_OK;
+}
+
+esp_err_t heap_trace_stop_sampling(void)
+{
+#ifndef CONFIG_HEAP_TRACING
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+    if (!sampling) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    sampling = false;
+    return ESP_OK;
+}
+
+esp_err_t heap_trace_export_samples(heap_trace_sink_t sink, void *ctx, bool reset)
+{
+#ifndef CONFIG_HEAP_TRACING
+    return ESP_ERR_NOT_SUPPORTED;
+#else
+    if (sample_buckets == NULL) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    return heap_trace_sampler_export(&sampler, sink, ctx, reset) ? ESP_OK : ESP_FAIL;
+#endif
+}
+
+bool heap_trace_sink_file(void *ctx, const char *data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE *)ctx) == len;
+}
+
+#if CONFIG_ESP32_APPTRACE_ENABLE
+bool heap_trace_sink_apptrace(void *ctx, const char *data, size_t len)
+{
+    return esp_apptrace_fwrite(ESP_APPTRACE_DEST_TRAX, data, 1, len, ctx) == len;
+}
+#endif
+
 /* Add a new allocation to the heap trace records */
 static IRAM_ATTR void record_allocation(const heap_trace_record_t *record)
 {
@@ -335,6 +423,14 @@ static IRAM_ATTR __attribute__((noinline)) void *trace_malloc(size_t size, uint3
         get_call_stack(rec.alloced_by);
         record_allocation(&rec);
     }
+    if (sampling && p != NULL) {
+        uint32_t samples = heap_trace_sampler_sample(&sampler, size);
+        if (samples > 0) {
+            void *callers[STACK_DEPTH];
+            get_call_stack(callers);
+            heap_trace_sampler_record(&sampler, callers, samples);
+        }
+    }
     return p;
 }
 
@@ -382,6 +478,13 @@ static IRAM_ATTR __attribute__((noinline)) void *trace_realloc(void *p, size_t s
         memcpy(rec.alloced_by, callers, sizeof(void *) * STACK_DEPTH);
         record_allocation(&rec);
     }
+    if (sampling && r != NULL) {
+        uint32_t samples = heap_trace_sampler_sample(&sampler, size);
+        if (samples > 0) {
+            get_call_stack(callers);
+            heap_trace_sampler_record(&sampler, callers, samples);
+        }
+    }
     return r;
 }
 
@@ -0,0 +1,275 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdio.h>
+#include <inttypes.h>
+#include <sys/param.h>
+#include "multi_heap_platform.h"
+#include "heap_trace_sampling.h"
+
+#define STACK_DEPTH HEAP_TRACE_SAMPLING_DEPTH
+
+/* Long enough for a full stack of 0xXXXXXXXX frames, separators and a 64-bit count */
+#define FOLDED_LINE_LEN (STACK_DEPTH * (2 + 2 * sizeof(void *) + 1) + 32)
+
+static inline uint32_t next_random(uint32_t *state)
+{
+    /* xorshift32 */
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+/* Return a random number of bytes until the next sample point, exponentially
+   distributed with a mean of 'period'.
+
+   This is -ln(u) * period for u uniform in (0, 1]. It is called from inside
+   malloc(), possibly while the flash cache is disabled, so the logarithm is
+   approximated inline rather than calling logf() from libm.
+*/
+static size_t next_interval(heap_trace_sampler_t *sampler)
+{
+    /* u = x / 2^24 */
+    uint32_t x = (next_random(&sampler->random) >> 8) + 1;
+    /* x = m * 2^e, with 1 <= m < 2. m is found as a 1.23 fixed point number to avoid a float division. */
+    int e = 31 - __builtin_clz(x);
+    uint32_t m_fixed = (e <= 23) ? (x << (23 - e)) : (x >> (e - 23));
+    float m = (float)m_fixed * (1.0f / 8388608.0f);
+    /* quadratic through log2(1), log2(1.5) and log2(2), error below 0.01 */
+    float log2_m = (-0.33985f * m + 2.01955f) * m - 1.6797f;
+    float neg_ln_u = ((float)(24 - e) - log2_m) * 0.6931472f;
+    float interval = neg_ln_u * (float)sampler->period;
+    return (interval < 1.0f) ? 1 : (size_t)interval;
+}
+
+static uint32_t hash_stack(void *const *callers)
+{
+    /* FNV-1a over the return addresses */
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < STACK_DEPTH; i++) {
+        hash ^= (uint32_t)(uintptr_t)callers[i];
+        hash *= 16777619u;
+    }
+    return (hash != 0) ? hash : 1;
+}
+
+void heap_trace_sampler_init(heap_trace_sampler_t *sampler, heap_trace_sample_bucket_t *buckets, size_t num_buckets,
+                             size_t period, uint32_t seed, void *lock)
+{
+    heap_trace_sampler_t new_sampler;
+    memset(&new_sampler, 0, sizeof(heap_trace_sampler_t));
+    memset(buckets, 0, num_buckets * sizeof(heap_trace_sample_bucket_t));
+    new_sampler.lock = lock;
+    new_sampler.buckets = buckets;
+    new_sampler.num_buckets = num_buckets;
+    new_sampler.period = (period > 0) ? period : 1;
+    new_sampler.random = (seed != 0) ? seed : 1;
+    for (int i = 0; i < HEAP_TRACE_SAMPLING_CORES; i++) {
+        new_sampler.bytes_until_sample[i] = next_interval(&new_sampler);
+    }
+
+    /* A call to heap_trace_sampler_record() which started before sampling was stopped may still be running */
+    MULTI_HEAP_LOCK(lock);
+    *sampler = new_sampler;
+    MULTI_HEAP_UNLOCK(lock);
+}
+
+void heap_trace_sampler_detach(heap_trace_sampler_t *sampler)
+{
+    MULTI_HEAP_LOCK(sampler->lock);
+    sampler->buckets = NULL;
+    sampler->num_buckets = 0;
+    sampler->used_buckets = 0;
+    MULTI_HEAP_UNLOCK(sampler->lock);
+}
+
+uint32_t heap_trace_sampler_sample(heap_trace_sampler_t *sampler, size_t size)
+{
+#ifdef ESP_PLATFORM
+    /* Each core counts down to its own next sample point, so the lock is only
+       taken once one is reached. A task switch on this core between the read
+       and the write may lose an update, which only moves the sample point. */
+    size_t *countdown = &sampler->bytes_until_sample[xPortGetCoreID()];
+    if (size < *countdown) {
+        *countdown -= size;
+        return 0;
+    }
+#else
+    /* Host test threads all share one countdown */
+    size_t *countdown = &sampler->bytes_until_sample[0];
+#endif
+    uint32_t samples = 0;
+    MULTI_HEAP_LOCK(sampler->lock);
+    while (size >= *countdown) {
+        size -= *countdown;
+        *countdown = next_interval(sampler);
+        samples++;
+    }
+    *countdown -= size;
+    sampler->total_samples += samples;
+    MULTI_HEAP_UNLOCK(sampler->lock);
+    return samples;
+}
+
+void heap_trace_sampler_record(heap_trace_sampler_t *sampler, void *const *callers, uint32_t samples)
+{
+    uint32_t hash = hash_stack(callers);
+
+    MULTI_HEAP_LOCK(sampler->lock);
+    if (sampler->buckets == NULL || samples == 0) {
+        MULTI_HEAP_UNLOCK(sampler->lock);
+        return;
+    }
+    /* Buckets of exported stacks don't end a probe sequence, but are
+       reused if the stack isn't found further on */
+    heap_trace_sample_bucket_t *free_bucket = NULL;
+    size_t start = hash % sampler->num_buckets;
+    size_t i = start;
+    do {
+        heap_trace_sample_bucket_t *bucket = &sampler->buckets[i];
+        if (bucket->hash == 0) {
+            if (free_bucket == NULL) {
+                free_bucket = bucket;
+            }
+            break;
+        }
+        if (bucket->samples == 0) {
+            if (free_bucket == NULL) {
+                free_bucket = bucket;
+            }
+        } else if (bucket->hash == hash && memcmp(bucket->callers, callers, sizeof(bucket->callers)) == 0) {
+            bucket->samples += samples;
+            bucket->bytes += (uint64_t)samples * sampler->period;
+            MULTI_HEAP_UNLOCK(sampler->lock);
+            return;
+        }
+        i = (i + 1) % sampler->num_buckets;
+    } while (i != start);
+
+    if (free_bucket != NULL) {
+        free_bucket->hash = hash;
+        memcpy(free_bucket->callers, callers, sizeof(free_bucket->callers));
+        free_bucket->samples = samples;
+        free_bucket->bytes = (uint64_t)samples * sampler->period;
+        sampler->used_buckets++;
+    } else {
+        sampler->dropped_samples += samples;
+    }
+    MULTI_HEAP_UNLOCK(sampler->lock);
+}
+
+/* Write 'value' in decimal. Some newlib configurations can't printf 64-bit integers. */
+static int format_u64(uint64_t value, char *buf, size_t len)
+{
+    char digits[21];
+    int n = 0;
+    do {
+        digits[n++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    for (int i = 0; i < n && i + 1 < (int)len; i++) {
+        buf[i] = digits[n - 1 - i];
+    }
+    if (len > 0) {
+        buf[(n < (int)len) ? n : (int)len - 1] = '\0';
+    }
+    return n;
+}
+
+int heap_trace_sampler_format_folded(const heap_trace_sample_bucket_t *bucket, char *buf, size_t len)
+{
+    int depth = 0;
+    while (depth < STACK_DEPTH && bucket->callers[depth] != NULL) {
+        depth++;
+    }
+
+    int pos = 0;
+    if (depth == 0) {
+        pos += snprintf(buf, len, "[unknown]");
+    }
+    for (int i = depth - 1; i >= 0; i--) {
+        pos += snprintf(buf + MIN(pos, len), len - MIN(pos, len), "0x%08" PRIxPTR "%s",
+                        (uintptr_t)bucket->callers[i], (i > 0) ? ";" : "");
+    }
+    pos += snprintf(buf + MIN(pos, len), len - MIN(pos, len), " ");
+    pos += format_u64(bucket->bytes, buf + MIN(pos, len), len - MIN(pos, len));
+    pos += snprintf(buf + MIN(pos, len), len - MIN(pos, len), "\n");
+    return pos;
+}
+
+/* Free the buckets of exported stacks which are at the end of a probe
+   sequence, so that the sequences don't keep growing. Called with the lock held. */
+static void free_exported_buckets(heap_trace_sampler_t *sampler)
+{
+    size_t n = sampler->num_buckets;
+    heap_trace_sample_bucket_t *buckets = sampler->buckets;
+    if (buckets == NULL) {
+        return;
+    }
+    if (sampler->used_buckets == 0) {
+        memset(buckets, 0, n * sizeof(heap_trace_sample_bucket_t));
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (buckets[i].hash != 0) {
+            continue;
+        }
+        for (size_t j = (i + n - 1) % n; buckets[j].hash != 0 && buckets[j].samples == 0; j = (j + n - 1) % n) {
+            buckets[j].hash = 0;
+        }
+    }
+}
+
+bool heap_trace_sampler_export(heap_trace_sampler_t *sampler, heap_trace_sampler_write_t write, void *ctx, bool reset)
+{
+    char line[FOLDED_LINE_LEN];
+    for (size_t i = 0; ; i++) {
+        heap_trace_sample_bucket_t bucket;
+
+        /* Copy each bucket under the lock, so sampling can carry on while we write.
+           Resetting clears the counts, which makes the bucket reusable while
+           keeping probe sequences through it intact.
+        */
+        MULTI_HEAP_LOCK(sampler->lock);
+        if (i >= sampler->num_buckets) {
+            if (reset) {
+                free_exported_buckets(sampler);
+            }
+            MULTI_HEAP_UNLOCK(sampler->lock);
+            break;
+        }
+        memcpy(&bucket, &sampler->buckets[i], sizeof(bucket));
+        if (reset && bucket.samples != 0) {
+            sampler->buckets[i].samples = 0;
+            sampler->buckets[i].bytes = 0;
+            sampler->used_buckets--;
+        }
+        MULTI_HEAP_UNLOCK(sampler->lock);
+
+        if (bucket.samples == 0) {
+            continue;
+        }
+        int len = heap_trace_sampler_format_folded(&bucket, line, sizeof(line));
+        if (!write(ctx, line, MIN(len, (int)sizeof(line) - 1))) {
+            return false;
+        }
+    }
+    return true;
+}
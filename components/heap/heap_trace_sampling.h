@@ -0,0 +1,131 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#ifdef ESP_PLATFORM
+#include "sdkconfig.h"
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Sampled allocation profiler, used by heap_trace.c
+
+   Instead of recording every allocation, the sampler picks sample points
+   in the stream of allocated bytes, spaced by exponentially distributed
+   intervals with a mean of 'period' bytes (ie a Poisson process). An
+   allocation is recorded once for each sample point which falls inside it,
+   so each sample stands for 'period' bytes and the per-stack byte counts
+   are unbiased estimates of the bytes actually allocated there.
+
+   Samples are aggregated by call stack in a fixed size open addressing hash
+   table, so memory use doesn't grow with the length of the profile. The
+   table can be exported in "folded stacks" format, one line per call stack:
+
+       0x400d1234;0x400d5678;0x400d9abc 4096
+
+   with the outermost caller first. This is the input format of
+   flamegraph.pl, speedscope and similar tools (after the addresses are
+   translated to function names, eg with addr2line).
+
+   This file has no ESP-IDF dependencies other than the locking in
+   multi_heap_platform.h, so it is also built into the host tests.
+*/
+
+#if defined(CONFIG_HEAP_TRACING_STACK_DEPTH)
+#define HEAP_TRACE_SAMPLING_DEPTH CONFIG_HEAP_TRACING_STACK_DEPTH
+#elif defined(ESP_PLATFORM)
+#define HEAP_TRACE_SAMPLING_DEPTH 0 /* heap tracing is disabled, matches esp_heap_trace.h */
+#else
+#define HEAP_TRACE_SAMPLING_DEPTH 4 /* host tests */
+#endif
+
+#if defined(ESP_PLATFORM) && !defined(CONFIG_FREERTOS_UNICORE)
+#define HEAP_TRACE_SAMPLING_CORES 2
+#else
+#define HEAP_TRACE_SAMPLING_CORES 1
+#endif
+
+/* Samples aggregated for one call stack. A bucket is free if hash == 0, and
+   can be reused if samples == 0 (its stack was removed by an export with reset). */
+typedef struct {
+    uint32_t hash;
+    uint32_t samples;   ///< Number of sample points which fell into allocations from this stack
+    uint64_t bytes;     ///< Estimated bytes allocated from this stack (samples * period)
+    void *callers[HEAP_TRACE_SAMPLING_DEPTH]; ///< Innermost caller first, unused entries are NULL
+} heap_trace_sample_bucket_t;
+
+typedef struct {
+    void *lock;                 ///< Lock passed to MULTI_HEAP_LOCK/UNLOCK, may be NULL
+    heap_trace_sample_bucket_t *buckets;
+    size_t num_buckets;
+    size_t used_buckets;
+    size_t period;
+    size_t bytes_until_sample[HEAP_TRACE_SAMPLING_CORES]; ///< Countdown to the next sample point of each core
+    uint32_t random;
+    uint32_t total_samples;     ///< All sample points, including dropped ones
+    uint32_t dropped_samples;   ///< Sample points lost because the table was full
+} heap_trace_sampler_t;
+
+/* Write 'len' bytes of exported data somewhere. Returns false on failure. */
+typedef bool (*heap_trace_sampler_write_t)(void *ctx, const char *data, size_t len);
+
+/* Set up a sampler using 'buckets' (an array of 'num_buckets' entries) to aggregate stacks.
+
+   'seed' is used to randomise the sample points and must not be zero.
+*/
+void heap_trace_sampler_init(heap_trace_sampler_t *sampler, heap_trace_sample_bucket_t *buckets, size_t num_buckets,
+                             size_t period, uint32_t seed, void *lock);
+
+/* Stop using the buckets, so that they can be freed.
+
+   Later calls to heap_trace_sampler_record() and heap_trace_sampler_export()
+   don't do anything, until heap_trace_sampler_init() is called again. Calls
+   which are still running on another core are waited for.
+*/
+void heap_trace_sampler_detach(heap_trace_sampler_t *sampler);
+
+/* Account for an allocation of 'size' bytes.
+
+   Returns the number of sample points which fell inside the allocation. If
+   this is non-zero, the caller should capture its call stack and pass it to
+   heap_trace_sampler_record().
+*/
+uint32_t heap_trace_sampler_sample(heap_trace_sampler_t *sampler, size_t size);
+
+/* Add 'samples' sample points for the call stack 'callers'
+   (HEAP_TRACE_SAMPLING_DEPTH entries, innermost first) */
+void heap_trace_sampler_record(heap_trace_sampler_t *sampler, void *const *callers, uint32_t samples);
+
+/* Format one bucket as a line of folded stack output. Returns the length of
+   the line (not counting the terminating NUL), like snprintf(). */
+int heap_trace_sampler_format_folded(const heap_trace_sample_bucket_t *bucket, char *buf, size_t len);
+
+/* Write every call stack with samples to 'write' in folded format.
+
+   If 'reset' is set, each stack is removed from the table as it is exported,
+   so the next export only contains samples taken after this one, and the
+   buckets are available for other stacks. Sampling can continue while
+   exporting. Returns false if 'write' failed.
+*/
+bool heap_trace_sampler_export(heap_trace_sampler_t *sampler, heap_trace_sampler_write_t write, void *ctx, bool reset);
+
+#ifdef __cplusplus
+}
+#endif
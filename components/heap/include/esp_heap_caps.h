@@ -16,6 +16,7 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include "multi_heap.h"
+#include "esp_err.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -176,6 +177,38 @@ void heap_caps_get_info( multi_heap_info_t *info, uint32_t caps );
  */
 void heap_caps_print_heap_info( uint32_t caps );
 
+/**
+ * @brief Get incrementally maintained statistics for all regions with the given capabilities.
+ *
+ * Calls multi_heap_get_stats() on all heaps which share the given capabilities. Histograms and counters are summed
+ * across all matching heaps, ``largest_free_block`` is the largest in any matching heap and ``minimum_free_bytes``
+ * has the same caveats described in heap_caps_get_minimum_free_size().
+ *
+ * Unlike heap_caps_get_info(), this doesn't walk the heaps, so it is cheap enough to call periodically from a
+ * monitoring task. Requires CONFIG_HEAP_STATS. If CONFIG_HEAP_PER_CORE_CACHE is enabled, allocations served from
+ * the per-core caches are not counted.
+ *
+ * @param stats       Pointer to a structure which will be filled with heap statistics.
+ * @param caps        Bitwise OR of MALLOC_CAP_* flags indicating the type
+ *                    of memory
+ *
+ * @return
+ *      - ESP_OK on success
+ *      - ESP_ERR_NOT_SUPPORTED if CONFIG_HEAP_STATS is disabled (all fields are then zero)
+ */
+esp_err_t heap_caps_get_stats( multi_heap_stats_t *stats, uint32_t caps );
+
+/**
+ * @brief Reset the accumulated histograms and counters of all regions with the given capabilities.
+ *
+ * Calls multi_heap_reset_stats() on all heaps which share the given capabilities, so later calls to
+ * heap_caps_get_stats() only count allocations and frees made after this call.
+ *
+ * @param caps        Bitwise OR of MALLOC_CAP_* flags indicating the type
+ *                    of memory
+ */
+void heap_caps_reset_stats( uint32_t caps );
+
 /**
  * @brief Check integrity of all heap memory in the system.
  *
@@ -310,6 +343,17 @@ void heap_caps_dump(uint32_t caps);
  */
 void heap_caps_dump_all();
 
+/**
+ * @brief Return all blocks held in the per-core small allocation caches to their heaps.
+ *
+ * When CONFIG_HEAP_PER_CORE_CACHE is enabled, blocks held in the caches are
+ * counted as allocated by heap_caps_get_info() and related functions. Call
+ * this first to get figures which only count memory in use by the application.
+ *
+ * Does nothing if CONFIG_HEAP_PER_CORE_CACHE is disabled.
+ */
+void heap_caps_flush_caches();
+
 #ifdef __cplusplus
 }
 #endif
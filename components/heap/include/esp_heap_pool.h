@@ -0,0 +1,188 @@
+// Copyright 2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "multi_heap.h"
+
+/* Fixed-size object pools
+ *
+ * A pool hands out objects of a single size from "slabs" carved out of a heap.
+ * Allocating and freeing an object never takes the heap lock and never
+ * searches for a fitting block, which makes pools a good fit for code paths
+ * that allocate many same-sized objects at a high rate.
+ *
+ * The free list of a pool is lock free. Objects can be freed from any task,
+ * but heap_pool_alloc() must only be called from one task at a time (usually
+ * the task which owns the pool). Slabs are only returned to the heap when the
+ * pool is deleted.
+ */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** @brief Opaque handle to an object pool */
+typedef struct heap_pool *heap_pool_handle_t;
+
+/** @brief Function used by a pool to allocate a slab
+ *
+ * @param ctx Context pointer passed to heap_pool_create()
+ * @param size Size of the slab in bytes
+ *
+ * @return Pointer to the slab, or NULL if it could not be allocated
+ */
+typedef void *(*heap_pool_slab_alloc_t)(void *ctx, size_t size);
+
+/** @brief Function used by a pool to return a slab
+ *
+ * @param ctx Context pointer passed to heap_pool_create()
+ * @param slab Slab previously returned by the heap_pool_slab_alloc_t function
+ */
+typedef void (*heap_pool_slab_free_t)(void *ctx, void *slab);
+
+/** @brief Structure to access pool metadata via heap_pool_get_info */
+typedef struct {
+    size_t object_size;            ///<  Size of each object, rounded up to pointer alignment
+    size_t total_objects;          ///<  Number of objects in all slabs of the pool
+    size_t free_objects;           ///<  Number of objects which can be allocated without adding a slab
+    size_t allocated_objects;      ///<  Number of objects currently allocated
+    size_t peak_allocated_objects; ///<  Highest number of objects allocated at the same time
+    size_t failed_allocations;     ///<  Number of calls to heap_pool_alloc() which returned NULL
+    size_t total_slabs;            ///<  Number of slabs allocated by the pool
+    size_t total_bytes;            ///<  Heap memory used by the pool, including its own metadata
+} heap_pool_info_t;
+
+/**
+ * @brief Create an object pool with slabs carved from heaps with the given capabilities
+ *
+ * The first slab is allocated immediately. When all objects are in use,
+ * heap_pool_alloc() adds another slab of the same size.
+ *
+ * Only the slabs are allocated with the given capabilities. The pool metadata
+ * holds the free list, which is updated with atomic compare-and-swap, and
+ * this doesn't work in external RAM. It is always allocated from internal
+ * memory (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT).
+ *
+ * @param object_size Size in bytes of each object
+ * @param count Number of objects in each slab
+ * @param caps Bitwise OR of MALLOC_CAP_* flags indicating the type of memory
+ *             to use for the slabs
+ *
+ * @return Handle to the new pool, or NULL if the first slab could not be allocated
+ */
+heap_pool_handle_t heap_caps_pool_create(size_t object_size, size_t count, uint32_t caps);
+
+/**
+ * @brief Create an object pool with slabs carved from a single multi_heap heap
+ *
+ * @param heap Heap to allocate slabs from
+ * @param object_size Size in bytes of each object
+ * @param count Number of objects in each slab
+ *
+ * @return Handle to the new pool, or NULL if the first slab could not be allocated
+ */
+heap_pool_handle_t heap_pool_create_in_heap(multi_heap_handle_t heap, size_t object_size, size_t count);
+
+/**
+ * @brief Create an object pool with slabs from a custom allocator
+ *
+ * The pool metadata is allocated with slab_alloc as well.
+ *
+ * @param object_size Size in bytes of each object
+ * @param count Number of objects in each slab
+ * @param slab_alloc Function used to allocate slabs
+ * @param slab_free Function used to return slabs
+ * @param ctx Context pointer passed to slab_alloc and slab_free
+ *
+ * @return Handle to the new pool, or NULL if the first slab could not be allocated
+ */
+heap_pool_handle_t heap_pool_create(size_t object_size, size_t count,
+                                    heap_pool_slab_alloc_t slab_alloc, heap_pool_slab_free_t slab_free, void *ctx);
+
+/**
+ * @brief Create an object pool with slabs from a custom allocator, and metadata from another one
+ *
+ * Same as heap_pool_create(), except that the pool metadata is allocated with
+ * metadata_alloc. heap_pool_delete() returns it with slab_free.
+ *
+ * @param object_size Size in bytes of each object
+ * @param count Number of objects in each slab
+ * @param metadata_alloc Function used to allocate the pool metadata
+ * @param slab_alloc Function used to allocate slabs
+ * @param slab_free Function used to return slabs and the pool metadata
+ * @param ctx Context pointer passed to metadata_alloc, slab_alloc and slab_free
+ *
+ * @return Handle to the new pool, or NULL if the first slab could not be allocated
+ */
+heap_pool_handle_t heap_pool_create_with_metadata(size_t object_size, size_t count, heap_pool_slab_alloc_t metadata_alloc,
+                                                  heap_pool_slab_alloc_t slab_alloc, heap_pool_slab_free_t slab_free, void *ctx);
+
+/**
+ * @brief Delete an object pool and return all of its slabs to the heap
+ *
+ * All objects allocated from the pool become invalid. The pool must not be
+ * in use by any other task when it is deleted.
+ *
+ * @param pool Pool to delete. NULL is ignored.
+ */
+void heap_pool_delete(heap_pool_handle_t pool);
+
+/**
+ * @brief Allocate an object from a pool
+ *
+ * If no object is free, a new slab is allocated from the heap.
+ *
+ * @note Only one task at a time may allocate from a pool.
+ *
+ * @param pool Pool to allocate from
+ *
+ * @return Pointer to an object of the pool's object size, or NULL if
+ *         no object was free and no new slab could be allocated
+ */
+void *heap_pool_alloc(heap_pool_handle_t pool);
+
+/**
+ * @brief Return an object to its pool
+ *
+ * This function may be called from any task.
+ *
+ * @param pool Pool which the object was allocated from
+ * @param ptr Object returned by heap_pool_alloc(). NULL is ignored.
+ */
+void heap_pool_free(heap_pool_handle_t pool, void *ptr);
+
+/**
+ * @brief Get metadata about a pool
+ *
+ * When objects are allocated or freed concurrently, the returned counters
+ * may be slightly out of date.
+ *
+ * @param pool Pool to query
+ * @param info Pointer to a structure which will be filled with relevant
+ * pool metadata.
+ */
+void heap_pool_get_info(heap_pool_handle_t pool, heap_pool_info_t *info);
+
+/**
+ * @brief Print a summary of a pool's metadata to stdout
+ *
+ * @param pool Pool to print
+ */
+void heap_pool_print_info(heap_pool_handle_t pool);
+
+#ifdef __cplusplus
+}
+#endif
@@ -15,6 +15,8 @@
 
 #include "sdkconfig.h"
 #include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
 #include <esp_err.h>
 
 #ifdef __cplusplus
@@ -139,6 +141,111 @@ esp_err_t heap_trace_get(size_t index, heap_trace_record_t *record);
  */
 void heap_trace_dump(void);
 
+/**
+ * @brief Function which receives exported heap trace data, see heap_trace_export_samples()
+ *
+ * @param ctx Context pointer passed to heap_trace_export_samples()
+ * @param data Data to write. Not NUL terminated.
+ * @param len Length of data in bytes
+ * @return true if the data was written, false to abort the export
+ */
+typedef bool (*heap_trace_sink_t)(void *ctx, const char *data, size_t len);
+
+/**
+ * @brief Initialise sampled allocation profiling.
+ *
+ * Sampling records the call stack of a random subset of allocations, roughly
+ * one every sample_period bytes allocated, and aggregates them by call stack.
+ * This adds much less overhead than tracing every allocation, so it can be left
+ * running for long periods, and memory use doesn't grow while it runs.
+ *
+ * Sampling is independent of standalone heap tracing, both can be used at the same time.
+ *
+ * To free the sample table, stop sampling and then call heap_trace_init_sampling(0, 0);
+ *
+ * @param num_stacks Number of distinct call stacks which can be recorded. Samples from
+ * further call stacks are dropped. The table is allocated from internal memory.
+ * @param sample_period Mean number of bytes allocated between samples.
+ * @return
+ *  - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
+ *  - ESP_ERR_INVALID_STATE Sampling is currently in progress.
+ *  - ESP_ERR_INVALID_ARG sample_period is zero.
+ *  - ESP_ERR_NO_MEM Not enough memory for the sample table.
+ *  - ESP_OK Sampling initialised successfully.
+ */
+esp_err_t heap_trace_init_sampling(size_t num_stacks, size_t sample_period);
+
+/**
+ * @brief Start sampled allocation profiling.
+ *
+ * Samples collected previously are kept.
+ *
+ * @return
+ * - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
+ * - ESP_ERR_INVALID_STATE Sampling was not initialised, or is already started.
+ * - ESP_OK Sampling is started.
+ */
+esp_err_t heap_trace_start_sampling(void);
+
+/**
+ * @brief Stop sampled allocation profiling.
+ *
+ * @return
+ * - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
+ * - ESP_ERR_INVALID_STATE Sampling was not in progress.
+ * - ESP_OK Sampling stopped.
+ */
+esp_err_t heap_trace_stop_sampling(void);
+
+/**
+ * @brief Export the sampled allocation profile in folded stack format.
+ *
+ * One line is written for each call stack, listing return addresses from the
+ * outermost to the innermost caller separated by semicolons, followed by the
+ * estimated number of bytes allocated from that call stack. For example:
+ *
+ *     0x400d1234;0x400d5678;0x400d9abc 4096
+ *
+ * This is the input format of flamegraph.pl and similar tools, once the
+ * addresses have been translated to function names.
+ *
+ * It is safe to call this function while sampling is running. To stream
+ * the profile continuously, call it periodically with reset set, so each
+ * export covers the allocations made since the previous one.
+ *
+ * @param sink Function which writes the exported data, eg heap_trace_sink_file()
+ * @param ctx Context pointer passed to sink
+ * @param reset Clear the samples which have been exported
+ * @return
+ * - ESP_ERR_NOT_SUPPORTED Project was compiled without heap tracing enabled in menuconfig.
+ * - ESP_ERR_INVALID_STATE Sampling was not initialised.
+ * - ESP_FAIL The sink failed to write the data.
+ * - ESP_OK Profile exported.
+ */
+esp_err_t heap_trace_export_samples(heap_trace_sink_t sink, void *ctx, bool reset);
+
+/**
+ * @brief Heap trace sink which writes to a stdio stream.
+ *
+ * @param ctx FILE pointer to write to, eg stdout or a file opened with fopen()
+ * @param data Data to write
+ * @param len Length of data in bytes
+ * @return true if all data was written
+ */
+bool heap_trace_sink_file(void *ctx, const char *data, size_t len);
+
+#if CONFIG_ESP32_APPTRACE_ENABLE
+/**
+ * @brief Heap trace sink which writes to a file on the host via application tracing.
+ *
+ * @param ctx File handle returned by esp_apptrace_fopen(ESP_APPTRACE_DEST_TRAX, ...)
+ * @param data Data to write
+ * @param len Length of data in bytes
+ * @return true if all data was written
+ */
+bool heap_trace_sink_apptrace(void *ctx, const char *data, size_t len);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
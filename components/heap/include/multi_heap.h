@@ -166,6 +166,58 @@ typedef struct {
  */
 void multi_heap_get_info(multi_heap_handle_t heap, multi_heap_info_t *info);
 
+/** @brief Number of buckets in each histogram of multi_heap_stats_t */
+#define MULTI_HEAP_HISTOGRAM_BUCKETS 16
+
+/** @brief Smallest value counted in histogram bucket 'N'
+ *
+ * Bucket 0 counts values below 16, bucket N (N > 0) counts values from 2^(N+3) up to 2^(N+4) - 1, and the last bucket
+ * also counts all larger values.
+ */
+#define MULTI_HEAP_HISTOGRAM_BUCKET_MIN(N) ((N) == 0 ? 0 : (size_t)1 << ((N) + 3))
+
+/** @brief Structure to access incrementally maintained heap statistics via multi_heap_get_stats */
+typedef struct {
+    size_t total_free_bytes;      ///<  Total free bytes in the heap. Equivalent to multi_free_heap_size().
+    size_t largest_free_block;    ///<  Size of largest free block in the heap. This is the largest malloc-able size.
+    size_t minimum_free_bytes;    ///<  Lifetime minimum free heap size. Equivalent to multi_minimum_free_heap_size().
+    size_t free_blocks;           ///<  Number of free blocks in the heap.
+    uint32_t free_block_sizes[MULTI_HEAP_HISTOGRAM_BUCKETS]; ///<  Free blocks in the heap, by data size in bytes
+    uint32_t alloc_sizes[MULTI_HEAP_HISTOGRAM_BUCKETS];      ///<  Successful allocations, by requested size in bytes
+    uint32_t malloc_time[MULTI_HEAP_HISTOGRAM_BUCKETS];      ///<  Allocations (including failed ones), by duration
+    uint32_t free_time[MULTI_HEAP_HISTOGRAM_BUCKETS];        ///<  Frees, by duration
+    uint32_t mallocs;             ///<  Number of successful allocations
+    uint32_t failed_mallocs;      ///<  Number of allocations which failed as there was no free block large enough
+    uint32_t frees;               ///<  Number of frees
+} multi_heap_stats_t;
+
+/** @brief Return incrementally maintained statistics about a heap
+ *
+ * Unlike multi_heap_get_info(), this doesn't walk the heap, so takes the same (short) time regardless of the heap's
+ * size and fragmentation and is suitable for polling from a monitoring task. Statistics are only maintained if
+ * CONFIG_HEAP_STATS is enabled.
+ *
+ * The free block sizes are a snapshot of the heap's current state. The other histograms and counters accumulate from
+ * when the heap was registered or multi_heap_reset_stats() was last called. Durations are measured in CPU cycles on
+ * the target and nanoseconds on the host, and include time spent waiting for the heap lock. A realloc() which can't
+ * resize in place counts as a malloc and a free. If heap poisoning is enabled, allocation sizes include the poisoning
+ * overhead.
+ *
+ * @param heap Handle to a registered heap.
+ * @param stats Pointer to a structure to fill with heap statistics.
+ * @return true on success, false if statistics are not enabled (all fields are then zero).
+ */
+bool multi_heap_get_stats(multi_heap_handle_t heap, multi_heap_stats_t *stats);
+
+/** @brief Reset the accumulated histograms and counters returned by multi_heap_get_stats
+ *
+ * The free block sizes, free bytes and largest free block are not affected, as they describe the current state of
+ * the heap. The lifetime minimum free size is not reset either.
+ *
+ * @param heap Handle to a registered heap.
+ */
+void multi_heap_reset_stats(multi_heap_handle_t heap);
+
 #ifdef __cplusplus
 }
 #endif
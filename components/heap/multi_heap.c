@@ -54,6 +54,9 @@ size_t multi_heap_free_size(multi_heap_handle_t heap)
 size_t multi_heap_minimum_free_size(multi_heap_handle_t heap)
     __attribute__((alias("multi_heap_minimum_free_size_impl")));
 
+bool multi_heap_get_stats(multi_heap_handle_t heap, multi_heap_stats_t *stats)
+    __attribute__((alias("multi_heap_get_stats_impl")));
+
 void *multi_heap_get_block_address(multi_heap_block_handle_t block)
     __attribute__((alias("multi_heap_get_block_address_impl")));
 
@@ -71,24 +74,65 @@ struct heap_block;
 
 /* Block in the heap
 
-   Heap implementation uses two single linked lists, a block list (all blocks) and a free list (free blocks).
+   Heap implementation uses a single linked block list (all blocks) and a set of segregated free lists (free blocks
+   of similar size, see below.)
+
+   'header' holds a pointer to the next block (used or free) ORed with a free flag (the LSB of the pointer) and a flag
+   which is set if the previous block is free. is_free() and get_next_block() utility functions allow typed access to
+   these values.
 
-   'header' holds a pointer to the next block (used or free) ORed with a free flag (the LSB of the pointer.) is_free() and get_next_block() utility functions allow typed access to these values.
+   'next_free' & 'prev_free' are valid if the block is free and link the block into the free list for its size class.
 
-   'next_free' is valid if the block is free and is a pointer to the next block in the free list.
+   If MULTI_HEAP_BOUNDARY_TAGS is set, the last word of a free block's data is a "boundary tag" which points back to
+   the block itself. This lets free() find a free previous block (and merge with it) in constant time.
 */
 typedef struct heap_block {
-    intptr_t header;                  /* Encodes next block in heap (used or unused) and also free/used flag */
+    intptr_t header;                  /* Encodes next block in heap (used or unused) and also free/used flags */
     union {
         uint8_t data[1];              /* First byte of data, valid if block is used. Actual size of data is 'block_data_size(block)' */
-        struct heap_block *next_free; /* Pointer to next free block, valid if block is free */
+        struct {
+            struct heap_block *next_free; /* Pointer to next free block in the same size class, valid if block is free */
+            struct heap_block *prev_free; /* Pointer to previous free block in the same size class, valid if block is free */
+        };
     };
 } heap_block_t;
 
 /* These masks apply to the 'header' field of heap_block_t */
-#define BLOCK_FREE_FLAG 0x1  /* If set, this block is free & next_free pointer is valid */
+#define BLOCK_FREE_FLAG 0x1  /* If set, this block is free & next_free/prev_free pointers are valid */
+#define BLOCK_PREV_FREE_FLAG 0x2 /* If set, the previous block in the heap is free (never set after first_block) */
 #define NEXT_BLOCK_MASK (~3) /* AND header with this mask to get pointer to next block (free or used) */
 
+#ifdef MULTI_HEAP_BOUNDARY_TAGS
+#define BOUNDARY_TAG_SIZE sizeof(heap_block_t *)
+#else
+#define BOUNDARY_TAG_SIZE 0
+#endif
+
+/* Minimum data size of a block, so it can hold the free list pointers (and boundary tag) once it is freed */
+#define MIN_BLOCK_SIZE (sizeof(heap_block_t) - sizeof(intptr_t) + BOUNDARY_TAG_SIZE)
+
+/* Free list index
+
+   Free blocks are kept in doubly linked lists segregated by size, in the style of the TLSF allocator. Block sizes are
+   split into power of two "first level" classes, each of which is split again into SL_INDEX_COUNT linear "second
+   level" classes. Sizes smaller than SMALL_BLOCK_SIZE all share first level class 0, with one second level class per
+   aligned size.
+
+   Bitmaps record which lists are non-empty, so malloc can find a list holding blocks which are large enough without
+   walking any free list.
+*/
+#define SL_INDEX_COUNT_LOG2 2
+#define SL_INDEX_COUNT (1 << SL_INDEX_COUNT_LOG2)
+#define ALIGN_SIZE_LOG2 (sizeof(void *) == 8 ? 3 : 2)
+#define FL_INDEX_SHIFT (SL_INDEX_COUNT_LOG2 + ALIGN_SIZE_LOG2)
+#define SMALL_BLOCK_SIZE ((size_t)1 << FL_INDEX_SHIFT)
+#define FL_INDEX_COUNT_MAX 32 /* limited by the width of heap_t.fl_bitmap */
+
+typedef struct {
+    uint32_t sl_bitmap;                         /* Bit n is set if free_list[n] is not empty */
+    heap_block_t *free_list[SL_INDEX_COUNT];    /* Heads of the free lists in this first level class */
+} heap_free_class_t;
+
 /* Metadata header for the heap, stored at the beginning of heap space.
 
    'first_block' is a "fake" first block, minimum length, used to provide a pointer to the first used & free block in
@@ -96,12 +140,24 @@ typedef struct heap_block {
 
    'last_block' is a pointer to a final free block of length 0, which is added at the end of the heap when it is
    registered. This block is also never allocated or merged into an adjacent block.
+
+   Neither 'first_block' nor 'last_block' are in the free lists. The free list index (an array of 'fl_count'
+   heap_free_class_t entries, sized according to the size of the heap) is stored immediately after this structure.
+
+   If MULTI_HEAP_STATS is set, 'stats' holds the histograms and counters returned by multi_heap_get_stats(). They are
+   updated as blocks enter and leave the free lists and as malloc & free complete. The free byte and largest block
+   fields of 'stats' are unused, they are filled in when the statistics are read.
  */
 typedef struct multi_heap_info {
     void *lock;
     size_t free_bytes;
     size_t minimum_free_bytes;
     heap_block_t *last_block;
+    uint32_t fl_bitmap;       /* Bit n is set if free class n has any non-empty free list */
+    uint32_t fl_count;        /* Number of first level free classes in the index */
+#ifdef MULTI_HEAP_STATS
+    multi_heap_stats_t stats;
+#endif
     heap_block_t first_block; /* initial 'free block', never allocated */
 } heap_t;
 
@@ -131,6 +187,12 @@ static inline bool is_free(const heap_block_t *block)
     return block->header & BLOCK_FREE_FLAG;
 }
 
+/* Return true if the block before this one in the heap is free. */
+static inline bool is_prev_free(const heap_block_t *block)
+{
+    return block->header & BLOCK_PREV_FREE_FLAG;
+}
+
 /* Return true if this block is the first in the heap */
 static inline bool is_first_block(const heap_t *heap, const heap_block_t *block)
 {
@@ -155,6 +217,217 @@ static inline size_t block_data_size(const heap_block_t *block)
     return next - this - sizeof(block->header);
 }
 
+/* Return the free list index, stored after the heap_t structure */
+static inline heap_free_class_t *get_free_classes(const heap_t *heap)
+{
+    return (heap_free_class_t *)&heap[1];
+}
+
+/* Index of the most significant set bit in 'x' (x must be non-zero) */
+static inline unsigned fls_size(size_t x)
+{
+    return sizeof(unsigned long) * 8 - 1 - __builtin_clzl(x);
+}
+
+/* Find the free list (first level class 'fl', second level class 'sl') which holds free blocks of data size 'size' */
+static inline void size_to_class(size_t size, unsigned *fl, unsigned *sl)
+{
+    if (size < SMALL_BLOCK_SIZE) {
+        *fl = 0;
+        *sl = size >> ALIGN_SIZE_LOG2;
+    } else {
+        unsigned f = fls_size(size);
+        *sl = (size >> (f - SL_INDEX_COUNT_LOG2)) ^ SL_INDEX_COUNT;
+        *fl = f - FL_INDEX_SHIFT + 1;
+    }
+}
+
+/* Number of first level classes needed to index the free blocks of a heap spanning 'span' bytes */
+static inline unsigned heap_fl_count(size_t span)
+{
+    return fls_size(span) - FL_INDEX_SHIFT + 2;
+}
+
+#ifdef MULTI_HEAP_STATS
+/* Histogram bucket which counts 'value', see MULTI_HEAP_HISTOGRAM_BUCKET_MIN() */
+static inline unsigned histogram_bucket(size_t value)
+{
+    if (value < MULTI_HEAP_HISTOGRAM_BUCKET_MIN(1)) {
+        return 0;
+    }
+    unsigned bucket = fls_size(value) - 3;
+    return (bucket < MULTI_HEAP_HISTOGRAM_BUCKETS) ? bucket : MULTI_HEAP_HISTOGRAM_BUCKETS - 1;
+}
+#endif
+
+/* Statistics hooks. These are called with the heap locked, and compile to nothing unless MULTI_HEAP_STATS is set. */
+
+/* Start timing a malloc or free */
+static inline uint32_t stats_start(void)
+{
+#ifdef MULTI_HEAP_STATS
+    return MULTI_HEAP_TIMESTAMP();
+#else
+    return 0;
+#endif
+}
+
+/* Account for a free block of data size 'size' entering (delta 1) or leaving (delta -1) the free lists */
+static inline void stats_free_block(heap_t *heap, size_t size, int delta)
+{
+#ifdef MULTI_HEAP_STATS
+    heap->stats.free_block_sizes[histogram_bucket(size)] += delta;
+    heap->stats.free_blocks += delta;
+#endif
+}
+
+/* Account for a malloc of 'size' bytes, started at time 'start'. 'result' is NULL if it failed. */
+static inline void stats_malloc_done(heap_t *heap, size_t size, uint32_t start, void *result)
+{
+#ifdef MULTI_HEAP_STATS
+    heap->stats.malloc_time[histogram_bucket(MULTI_HEAP_TIMESTAMP() - start)]++;
+    if (result != NULL) {
+        heap->stats.alloc_sizes[histogram_bucket(size)]++;
+        heap->stats.mallocs++;
+    } else {
+        heap->stats.failed_mallocs++;
+    }
+#endif
+}
+
+/* Account for a free started at time 'start' */
+static inline void stats_free_done(heap_t *heap, uint32_t start)
+{
+#ifdef MULTI_HEAP_STATS
+    heap->stats.free_time[histogram_bucket(MULTI_HEAP_TIMESTAMP() - start)]++;
+    heap->stats.frees++;
+#endif
+}
+
+#ifdef MULTI_HEAP_BOUNDARY_TAGS
+/* Return the location of the boundary tag at the end of free block 'block' */
+static inline heap_block_t **get_boundary_tag(const heap_block_t *block)
+{
+    return (heap_block_t **)(block->header & NEXT_BLOCK_MASK) - 1;
+}
+#endif
+
+/* Add free block 'block' to the head of the free list for its size.
+
+   Called whenever a block becomes free or changes size while free, so also writes the block's boundary tag.
+*/
+static void insert_free_block(heap_t *heap, heap_block_t *block)
+{
+    unsigned fl, sl;
+    size_to_class(block_data_size(block), &fl, &sl);
+    stats_free_block(heap, block_data_size(block), 1);
+    assert(fl < heap->fl_count);
+    heap_free_class_t *class = &get_free_classes(heap)[fl];
+
+    block->prev_free = NULL;
+    block->next_free = class->free_list[sl];
+    if (block->next_free != NULL) {
+        block->next_free->prev_free = block;
+    }
+    class->free_list[sl] = block;
+    class->sl_bitmap |= 1U << sl;
+    heap->fl_bitmap |= 1U << fl;
+
+#ifdef MULTI_HEAP_BOUNDARY_TAGS
+    *get_boundary_tag(block) = block;
+#endif
+}
+
+/* Take free block 'block' out of the free list for its size */
+static void remove_free_block(heap_t *heap, heap_block_t *block)
+{
+    unsigned fl, sl;
+    size_to_class(block_data_size(block), &fl, &sl);
+    stats_free_block(heap, block_data_size(block), -1);
+    heap_free_class_t *class = &get_free_classes(heap)[fl];
+
+    MULTI_HEAP_ASSERT(is_free(block), block); // block should be free
+    if (block->prev_free != NULL) {
+        MULTI_HEAP_ASSERT(block->prev_free->next_free == block, &block->prev_free); // free list should be linked both ways
+        block->prev_free->next_free = block->next_free;
+    } else {
+        MULTI_HEAP_ASSERT(class->free_list[sl] == block, &block->prev_free); // block should be at the head of its list
+        class->free_list[sl] = block->next_free;
+    }
+    if (block->next_free != NULL) {
+        MULTI_HEAP_ASSERT(block->next_free->prev_free == block, &block->next_free); // free list should be linked both ways
+        block->next_free->prev_free = block->prev_free;
+    }
+
+    if (class->free_list[sl] == NULL) {
+        class->sl_bitmap &= ~(1U << sl);
+        if (class->sl_bitmap == 0) {
+            heap->fl_bitmap &= ~(1U << fl);
+        }
+    }
+
+#if defined(MULTI_HEAP_BOUNDARY_TAGS) && defined(MULTI_HEAP_POISONING_SLOW)
+    /* boundary tag is about to become allocated or inner free space, needs to be replaced with a fill pattern */
+    multi_heap_internal_poison_fill_region(get_boundary_tag(block), BOUNDARY_TAG_SIZE, true /* free */);
+#endif
+}
+
+/* Return the head of the first non-empty free list at or above class 'fl', 'sl', or NULL if there is none */
+static heap_block_t *find_class_from(const heap_t *heap, unsigned fl, unsigned sl)
+{
+    const heap_free_class_t *classes = get_free_classes(heap);
+    uint32_t sl_map = classes[fl].sl_bitmap & (~0U << sl);
+
+    if (sl_map == 0) {
+        uint32_t fl_map = (fl + 1 < FL_INDEX_COUNT_MAX) ? heap->fl_bitmap & (~0U << (fl + 1)) : 0;
+        if (fl_map == 0) {
+            return NULL;
+        }
+        fl = __builtin_ctz(fl_map);
+        sl_map = classes[fl].sl_bitmap;
+    }
+    return classes[fl].free_list[__builtin_ctz(sl_map)];
+}
+
+/* Find a free block with at least 'size' bytes of data.
+
+   If the block at the head of the free list for 'size' is large enough, it's used. Otherwise the size is rounded up
+   to the next class boundary, so any block found in the index is large enough ("good fit"). Only if no such block
+   exists is the rest of the free list for 'size' searched, as it may hold a block which is just large enough.
+*/
+static heap_block_t *find_free_block(const heap_t *heap, size_t size)
+{
+    unsigned fl, sl;
+    heap_block_t *block = NULL;
+
+    size_to_class(size, &fl, &sl);
+    if (fl >= heap->fl_count) {
+        return NULL; /* larger than any block in the heap */
+    }
+    heap_block_t *const class_head = get_free_classes(heap)[fl].free_list[sl];
+    if (class_head != NULL && block_data_size(class_head) >= size) {
+        return class_head;
+    }
+
+    if (size >= SMALL_BLOCK_SIZE) {
+        size_to_class(size + ((size_t)1 << (fls_size(size) - SL_INDEX_COUNT_LOG2)) - 1, &fl, &sl);
+        if (fl < heap->fl_count) {
+            block = find_class_from(heap, fl, sl);
+        }
+    } else {
+        block = find_class_from(heap, fl, sl);
+    }
+
+    if (block == NULL && class_head != NULL) {
+        for (block = class_head->next_free; block != NULL; block = block->next_free) {
+            if (block_data_size(block) >= size) {
+                break;
+            }
+        }
+    }
+    return block;
+}
+
 /* Check a block is valid for this heap. Used to verify parameters. */
 static void assert_valid_block(const heap_t *heap, const heap_block_t *block)
 {
@@ -163,37 +436,40 @@ static void assert_valid_block(const heap_t *heap, const heap_block_t *block)
     if (heap < (const heap_t *)heap->last_block) {
         const heap_block_t *next = get_next_block(block);
         MULTI_HEAP_ASSERT(next >= &heap->first_block && next <= heap->last_block, block); // Next block not in heap
-        if (is_free(block)) {
+        if (is_free(block) && block->next_free != NULL) {
             // Check block->next_free is valid
             MULTI_HEAP_ASSERT(block->next_free >= &heap->first_block && block->next_free <= heap->last_block, &block->next_free);
         }
     }
 }
 
-/* Get the first free block before 'block' in the heap. 'block' can be a free block or in use.
-
-   Result is always the closest free block to 'block' in the heap, that is located before 'block'. There may be multiple
-   allocated blocks between the result and 'block'.
+/* Get the free block located immediately before 'block' in the heap. 'block' can be a free block or in use.
 
-   If 'block' is free, the result's 'next_free' pointer will already point to 'block'.
-
-   Result will never be NULL, but it may be the header block heap->first_block.
+   Returns NULL if the previous block is in use, or if it is heap->first_block. The previous block is known to be
+   free from the BLOCK_PREV_FREE_FLAG in 'block'. Its address is read from its boundary tag if MULTI_HEAP_BOUNDARY_TAGS
+   is set, otherwise finding it walks the block list from the start.
 */
 static heap_block_t *get_prev_free_block(heap_t *heap, const heap_block_t *block)
 {
     assert(!is_first_block(heap, block)); /* can't look for a block before first_block */
 
-    for (heap_block_t *b = &heap->first_block; b != NULL && b < block; b = b->next_free) {
-        MULTI_HEAP_ASSERT(is_free(b), b); // Block should be free
-        if (b->next_free == NULL || b->next_free >= block) {
-            if (is_free(block)) {
-                 /* if block is on freelist, 'b' should be the item before it. */
-                MULTI_HEAP_ASSERT(b->next_free == block, &b->next_free);
-            }
-            return b; /* b is the last free block before 'block' */
+    if (!is_prev_free(block)) {
+        return NULL;
+    }
+#ifdef MULTI_HEAP_BOUNDARY_TAGS
+    heap_block_t *prev = ((heap_block_t **)block)[-1];
+    MULTI_HEAP_ASSERT(prev > &heap->first_block && prev < block, (heap_block_t **)block - 1); // Boundary tag should be in heap
+    MULTI_HEAP_ASSERT(is_free(prev) && get_next_block(prev) == block, prev); // Boundary tag should point to free previous block
+    return prev;
+#else
+    for (heap_block_t *b = &heap->first_block; b != NULL && b < block; b = get_next_block(b)) {
+        if (get_next_block(b) == block) {
+            MULTI_HEAP_ASSERT(is_free(b) && !is_first_block(heap, b), b); // Block should be free
+            return b;
         }
     }
-    abort(); /* There should always be a previous free block, even if it's heap->first_block */
+    abort(); /* 'block' should always be reachable from heap->first_block */
+#endif
 }
 
 /* Merge some block 'a' into the following block 'b'.
@@ -224,25 +500,24 @@ static heap_block_t *merge_adjacent(heap_t *heap, heap_block_t *a, heap_block_t
            means we need to take the free block out of the free list
          */
         heap_block_t *free_block = is_free(a) ? a : b;
-        heap_block_t *prev_free = get_prev_free_block(heap, free_block);
-        MULTI_HEAP_ASSERT(free_block->next_free > prev_free, &free_block->next_free); // Next free block should be after prev one
-        prev_free->next_free = free_block->next_free;
-
+        remove_free_block(heap, free_block);
         heap->free_bytes -= block_data_size(free_block);
+    } else if (free) {
+        /* both blocks change size, so move out of their free lists */
+        remove_free_block(heap, a);
+        remove_free_block(heap, b);
     }
 
-    a->header = b->header & NEXT_BLOCK_MASK;
-    MULTI_HEAP_ASSERT(a->header != 0, a);
+    a->header = (b->header & NEXT_BLOCK_MASK) | (a->header & BLOCK_PREV_FREE_FLAG);
+    MULTI_HEAP_ASSERT((a->header & NEXT_BLOCK_MASK) != 0, a);
     if (free) {
         a->header |= BLOCK_FREE_FLAG;
-        if (b->next_free != NULL) {
-            MULTI_HEAP_ASSERT(b->next_free > a, &b->next_free);
-            MULTI_HEAP_ASSERT(b->next_free > b, &b->next_free);
-        }
-        a->next_free = b->next_free;
+        insert_free_block(heap, a);
 
         /* b's header can be put into the pool of free bytes */
         heap->free_bytes += sizeof(a->header);
+    } else {
+        get_next_block(a)->header &= ~BLOCK_PREV_FREE_FLAG;
     }
 
 #ifdef MULTI_HEAP_POISONING_SLOW
@@ -257,17 +532,20 @@ static heap_block_t *merge_adjacent(heap_t *heap, heap_block_t *a, heap_block_t
    space into a new free block.
 
    'block' should be marked in-use when this function is called (implementation detail, this function
-   doesn't set the next_free pointer).
-
-   'prev_free_block' is the free block before 'block', if already known. Can be NULL if not yet known.
-   (This is a performance optimisation to avoid walking the freelist twice when possible.)
+   doesn't set the free list pointers).
 */
-static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size, heap_block_t *prev_free_block)
+static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size)
 {
     const size_t block_size = block_data_size(block);
     MULTI_HEAP_ASSERT(!is_free(block), block); // split block shouldn't be free
     MULTI_HEAP_ASSERT(size <= block_size, block); // size should be valid
     size = ALIGN_UP(size);
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
+    if (size >= block_size) {
+        return; /* nothing to split off */
+    }
 
     /* can't split the head or tail block */
     assert(!is_first_block(heap, block));
@@ -278,14 +556,8 @@ static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size, h
 
     if (is_free(next_block) && !is_last_block(next_block)) {
         /* The next block is free, just extend it upwards. */
+        remove_free_block(heap, next_block);
         new_block->header = next_block->header;
-        new_block->next_free = next_block->next_free;
-        if (prev_free_block == NULL) {
-            prev_free_block = get_prev_free_block(heap, block);
-        }
-        /* prev_free_block should point to the next block (which we found to be free). */
-        MULTI_HEAP_ASSERT(prev_free_block->next_free == next_block,
-                          &prev_free_block->next_free); // free blocks should be in order
         /* Note: We have not introduced a new block header, hence the simple math. */
         heap->free_bytes += block_size - size;
 #ifdef MULTI_HEAP_POISONING_SLOW
@@ -294,22 +566,16 @@ static void split_if_necessary(heap_t *heap, heap_block_t *block, size_t size, h
 #endif
     } else {
         /* Insert a free block between the current and the next one. */
-        if (block_data_size(block) < size + sizeof(heap_block_t)) {
+        if (block_data_size(block) < size + sizeof(new_block->header) + MIN_BLOCK_SIZE) {
             /* Can't split 'block' if we're not going to get a usable free block afterwards */
             return;
         }
-        if (prev_free_block == NULL) {
-            prev_free_block = get_prev_free_block(heap, block);
-        }
-        new_block->header = block->header | BLOCK_FREE_FLAG;
-        new_block->next_free = prev_free_block->next_free;
-        /* prev_free_block should point to a free block after new_block */
-        MULTI_HEAP_ASSERT(prev_free_block->next_free > new_block,
-                          &prev_free_block->next_free); // free blocks should be in order
+        new_block->header = (block->header & NEXT_BLOCK_MASK) | BLOCK_FREE_FLAG;
+        next_block->header |= BLOCK_PREV_FREE_FLAG;
         heap->free_bytes += block_data_size(new_block);
     }
-    block->header = (intptr_t)new_block;
-    prev_free_block->next_free = new_block;
+    block->header = (intptr_t)new_block | (block->header & BLOCK_PREV_FREE_FLAG);
+    insert_free_block(heap, new_block);
 }
 
 void *multi_heap_get_block_address_impl(multi_heap_block_handle_t block)
@@ -330,33 +596,43 @@ multi_heap_handle_t multi_heap_register_impl(void *start, size_t size)
 {
     heap_t *heap = (heap_t *)ALIGN_UP((intptr_t)start);
     uintptr_t end = ALIGN((uintptr_t)start + size);
-    if (end - (uintptr_t)start < sizeof(heap_t) + 2*sizeof(heap_block_t)) {
+    if (end <= (uintptr_t)heap || end - (uintptr_t)heap < sizeof(heap_t) + 2*sizeof(heap_block_t)) {
         return NULL; /* 'size' is too small to fit a heap here */
     }
+    const unsigned fl_count = heap_fl_count(end - (uintptr_t)heap);
+    const size_t index_size = fl_count * sizeof(heap_free_class_t);
+    if (fl_count > FL_INDEX_COUNT_MAX
+        || end - (uintptr_t)heap < sizeof(heap_t) + index_size + 2*sizeof(heap_block_t)) {
+        return NULL; /* 'size' is too small (or too large) to fit a heap here */
+    }
     heap->lock = NULL;
     heap->last_block = (heap_block_t *)(end - sizeof(heap_block_t));
+    heap->fl_bitmap = 0;
+    heap->fl_count = fl_count;
+#ifdef MULTI_HEAP_STATS
+    memset(&heap->stats, 0, sizeof(heap->stats));
+#endif
+    memset(get_free_classes(heap), 0, index_size);
 
-    /* first 'real' (allocatable) free block goes after the heap structure */
-    heap_block_t *first_free_block = (heap_block_t *)((intptr_t)start + sizeof(heap_t));
+    /* first 'real' (allocatable) free block goes after the heap structure and free list index */
+    heap_block_t *first_free_block = (heap_block_t *)((intptr_t)get_free_classes(heap) + index_size);
     first_free_block->header = (intptr_t)heap->last_block | BLOCK_FREE_FLAG;
-    first_free_block->next_free = heap->last_block;
 
     /* last block is 'free' but has a NULL next pointer */
-    heap->last_block->header = BLOCK_FREE_FLAG;
+    heap->last_block->header = BLOCK_FREE_FLAG | BLOCK_PREV_FREE_FLAG;
     heap->last_block->next_free = NULL;
+    heap->last_block->prev_free = NULL;
 
     /* first block also 'free' but has legitimate length,
        malloc will never allocate into this block. */
     heap->first_block.header = (intptr_t)first_free_block | BLOCK_FREE_FLAG;
-    heap->first_block.next_free = first_free_block;
+    heap->first_block.next_free = NULL;
+    heap->first_block.prev_free = NULL;
 
-    /* free bytes is:
-       - total bytes in heap
-       - minus heap_t header at top (includes heap->first_block)
-       - minus header of first_free_block
-       - minus whole block at heap->last_block
-    */
-    heap->free_bytes = ALIGN(size) - sizeof(heap_t) - sizeof(first_free_block->header) - sizeof(heap_block_t);
+    insert_free_block(heap, first_free_block);
+
+    /* free bytes is everything between the header of first_free_block and last_block */
+    heap->free_bytes = block_data_size(first_free_block);
     heap->minimum_free_bytes = heap->free_bytes;
 
     return heap;
@@ -401,14 +677,16 @@ bool multi_heap_is_free(multi_heap_block_handle_t block)
 void *multi_heap_malloc_impl(multi_heap_handle_t heap, size_t size)
 {
     heap_block_t *best_block = NULL;
-    heap_block_t *prev_free = NULL;
-    heap_block_t *prev = NULL;
-    size_t best_size = SIZE_MAX;
+    const uint32_t start = stats_start();
+    const size_t requested_size = size;
     size = ALIGN_UP(size);
 
     if (size == 0 || heap == NULL) {
         return NULL;
     }
+    if (size < MIN_BLOCK_SIZE) {
+        size = MIN_BLOCK_SIZE;
+    }
 
     multi_heap_internal_lock(heap);
 
@@ -418,43 +696,33 @@ void *multi_heap_malloc_impl(multi_heap_handle_t heap, size_t size)
        especially if the heap is unfragmented.
     */
     if (heap->free_bytes < size) {
+        stats_malloc_done(heap, requested_size, start, NULL);
         MULTI_HEAP_UNLOCK(heap->lock);
         return NULL;
     }
 
-    /* Find best free block to perform the allocation in */
-    prev = &heap->first_block;
-    for (heap_block_t *b = heap->first_block.next_free; b != NULL; b = b->next_free) {
-        MULTI_HEAP_ASSERT(b > prev, &prev->next_free); // free blocks should be ascending in address
-        MULTI_HEAP_ASSERT(is_free(b), b); // block should be free
-        size_t bs = block_data_size(b);
-        if (bs >= size && bs < best_size) {
-            best_block = b;
-            best_size = bs;
-            prev_free = prev;
-            if (bs == size) {
-                break; /* we've found a perfect sized block */
-            }
-        }
-        prev = b;
-    }
+    /* Find a free block to perform the allocation in */
+    best_block = find_free_block(heap, size);
 
     if (best_block == NULL) {
+        stats_malloc_done(heap, requested_size, start, NULL);
         multi_heap_internal_unlock(heap);
         return NULL; /* No room in heap */
     }
 
-    prev_free->next_free = best_block->next_free;
+    remove_free_block(heap, best_block);
     best_block->header &= ~BLOCK_FREE_FLAG;
+    get_next_block(best_block)->header &= ~BLOCK_PREV_FREE_FLAG;
 
     heap->free_bytes -= block_data_size(best_block);
 
-    split_if_necessary(heap, best_block, size, prev_free);
+    split_if_necessary(heap, best_block, size);
 
     if (heap->free_bytes < heap->minimum_free_bytes) {
         heap->minimum_free_bytes = heap->free_bytes;
     }
 
+    stats_malloc_done(heap, requested_size, start, best_block->data);
     multi_heap_internal_unlock(heap);
 
     return best_block->data;
@@ -463,6 +731,7 @@ void *multi_heap_malloc_impl(multi_heap_handle_t heap, size_t size)
 void multi_heap_free_impl(multi_heap_handle_t heap, void *p)
 {
     heap_block_t *pb = get_block(p);
+    const uint32_t start = stats_start();
 
     if (heap == NULL || p == NULL) {
         return;
@@ -476,21 +745,17 @@ void multi_heap_free_impl(multi_heap_handle_t heap, void *p)
     MULTI_HEAP_ASSERT(!is_first_block(heap, pb), pb); // block should not be first block
 
     heap_block_t *next = get_next_block(pb);
-
-    /* Update freelist pointers */
     heap_block_t *prev_free = get_prev_free_block(heap, pb);
-    // freelist validity check
-    MULTI_HEAP_ASSERT(prev_free->next_free == NULL || prev_free->next_free > pb, &prev_free->next_free);
-    pb->next_free = prev_free->next_free;
-    prev_free->next_free = pb;
 
     /* Mark this block as free */
     pb->header |= BLOCK_FREE_FLAG;
+    next->header |= BLOCK_PREV_FREE_FLAG;
+    insert_free_block(heap, pb);
 
     heap->free_bytes += block_data_size(pb);
 
     /* Try and merge previous free block into this one */
-    if (get_next_block(prev_free) == pb) {
+    if (prev_free != NULL) {
         pb = merge_adjacent(heap, prev_free, pb);
     }
 
@@ -499,6 +764,7 @@ void multi_heap_free_impl(multi_heap_handle_t heap, void *p)
         pb = merge_adjacent(heap, pb, next);
     }
 
+    stats_free_done(heap, start);
     multi_heap_internal_unlock(heap);
 }
 
@@ -535,7 +801,7 @@ void *multi_heap_realloc_impl(multi_heap_handle_t heap, void *p, size_t size)
 
     if (size <= block_data_size(pb)) {
         // Shrinking....
-        split_if_necessary(heap, pb, size, NULL);
+        split_if_necessary(heap, pb, size);
         result = pb->data;
     }
     else if (heap->free_bytes < size - block_data_size(pb)) {
@@ -552,8 +818,8 @@ void *multi_heap_realloc_impl(multi_heap_handle_t heap, void *p, size_t size)
         heap_block_t *next = get_next_block(pb);
         heap_block_t *prev = get_prev_free_block(heap, pb);
 
-        // Can only grow into the previous free block if it's adjacent
-        size_t prev_grow_size = (get_next_block(prev) == pb) ? block_data_size(prev) : 0;
+        // Can only grow into the previous block if it's free
+        size_t prev_grow_size = (prev != NULL) ? block_data_size(prev) : 0;
 
         // Can grow into next block? (we may also need to grow into 'prev' to get to our desired size)
         if (is_free(next) && (block_data_size(pb) + block_data_size(next) + prev_grow_size >= size)) {
@@ -570,7 +836,7 @@ void *multi_heap_realloc_impl(multi_heap_handle_t heap, void *p, size_t size)
 
         if (block_data_size(pb) >= size) {
             memmove(pb->data, orig_pb->data, orig_size);
-            split_if_necessary(heap, pb, size, NULL);
+            split_if_necessary(heap, pb, size);
             result = pb->data;
         }
     }
@@ -612,8 +878,10 @@ bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
     multi_heap_internal_lock(heap);
 
     heap_block_t *prev = NULL;
-    heap_block_t *prev_free = NULL;
-    heap_block_t *expected_free = NULL;
+    size_t free_blocks = 0;
+#ifdef MULTI_HEAP_STATS
+    uint32_t free_block_sizes[MULTI_HEAP_HISTOGRAM_BUCKETS] = { 0 };
+#endif
 
     /* note: not using get_next_block() in loop, so that assertions aren't checked here */
     for(heap_block_t *b = &heap->first_block; b != NULL; b = (heap_block_t *)(b->header & NEXT_BLOCK_MASK)) {
@@ -629,28 +897,37 @@ bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
             FAIL_PRINT("CORRUPT HEAP: Block %p is outside heap (last valid block %p)\n", b, prev);
             goto done;
         }
+        if (prev != NULL) {
+            bool prev_free = is_free(prev) && !is_first_block(heap, prev);
+            if (prev_free != is_prev_free(b)) {
+                FAIL_PRINT("CORRUPT HEAP: Block %p previous free flag doesn't match block %p\n", b, prev);
+            }
+        }
         if (is_free(b)) {
             if (prev != NULL && is_free(prev) && !is_first_block(heap, prev) && !is_last_block(b)) {
                 FAIL_PRINT("CORRUPT HEAP: Two adjacent free blocks found, %p and %p\n", prev, b);
             }
-            if (expected_free != NULL && expected_free != b) {
-                FAIL_PRINT("CORRUPT HEAP: Prev free block %p pointed to next free %p but this free block is %p\n",
-                       prev_free, expected_free, b);
-            }
-            prev_free = b;
-            expected_free = b->next_free;
-            if (!is_first_block(heap, b)) {
+            if (!is_first_block(heap, b) && !is_last_block(b)) {
                 total_free_bytes += block_data_size(b);
+                free_blocks++;
+#ifdef MULTI_HEAP_STATS
+                free_block_sizes[histogram_bucket(block_data_size(b))]++;
+#endif
+#ifdef MULTI_HEAP_BOUNDARY_TAGS
+                if (*get_boundary_tag(b) != b) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p boundary tag points to %p\n", b, *get_boundary_tag(b));
+                }
+#endif
             }
         }
         prev = b;
 
 #ifdef MULTI_HEAP_POISONING
-        if (!is_last_block(b)) {
+        if (!is_last_block(b) && !is_first_block(heap, b)) {
             /* For slow heap poisoning, any block should contain correct poisoning patterns and/or fills */
             bool poison_ok;
             if (is_free(b) && b != heap->last_block) {
-                uint32_t block_len = (intptr_t)get_next_block(b) - (intptr_t)b - sizeof(heap_block_t);
+                uint32_t block_len = (intptr_t)get_next_block(b) - (intptr_t)b - sizeof(heap_block_t) - BOUNDARY_TAG_SIZE;
                 poison_ok = multi_heap_internal_check_block_poisoning(&b[1], block_len, true, print_errors);
             }
             else {
@@ -673,6 +950,55 @@ bool multi_heap_check(multi_heap_handle_t heap, bool print_errors)
         FAIL_PRINT("CORRUPT HEAP: Expected %u free bytes counted %u\n", (unsigned)heap->free_bytes, (unsigned)total_free_bytes);
     }
 
+#ifdef MULTI_HEAP_STATS
+    if (heap->stats.free_blocks != free_blocks) {
+        FAIL_PRINT("CORRUPT HEAP: Statistics count %u free blocks, found %u\n", (unsigned)heap->stats.free_blocks, (unsigned)free_blocks);
+    }
+    for (int i = 0; i < MULTI_HEAP_HISTOGRAM_BUCKETS; i++) {
+        if (heap->stats.free_block_sizes[i] != free_block_sizes[i]) {
+            FAIL_PRINT("CORRUPT HEAP: Statistics count %u free blocks in size bucket %d, found %u\n",
+                       (unsigned)heap->stats.free_block_sizes[i], i, (unsigned)free_block_sizes[i]);
+        }
+    }
+#endif
+
+    /* Every free block should be in the free list for its size class, and nothing else */
+    size_t listed_blocks = 0;
+    const heap_free_class_t *classes = get_free_classes(heap);
+    for (unsigned fl = 0; fl < heap->fl_count; fl++) {
+        for (unsigned sl = 0; sl < SL_INDEX_COUNT; sl++) {
+            heap_block_t *prev_free = NULL;
+            for (heap_block_t *b = classes[fl].free_list[sl]; b != NULL; b = b->next_free) {
+                if (b <= &heap->first_block || b >= heap->last_block || !is_free(b)) {
+                    FAIL_PRINT("CORRUPT HEAP: Free list entry %p is not a free block\n", b);
+                    goto done;
+                }
+                if (++listed_blocks > free_blocks) {
+                    FAIL_PRINT("CORRUPT HEAP: Free lists hold more than the %u free blocks\n", (unsigned)free_blocks);
+                    goto done;
+                }
+                if (b->prev_free != prev_free) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p prev free %p expected %p\n", b, b->prev_free, prev_free);
+                }
+                unsigned b_fl, b_sl;
+                size_to_class(block_data_size(b), &b_fl, &b_sl);
+                if (b_fl != fl || b_sl != sl) {
+                    FAIL_PRINT("CORRUPT HEAP: Free block %p size 0x%08x is in the wrong free list\n", b, (unsigned)block_data_size(b));
+                }
+                prev_free = b;
+            }
+            if ((classes[fl].free_list[sl] != NULL) != ((classes[fl].sl_bitmap & (1U << sl)) != 0)) {
+                FAIL_PRINT("CORRUPT HEAP: Free class %u/%u bitmap doesn't match its free list\n", fl, sl);
+            }
+        }
+        if ((classes[fl].sl_bitmap != 0) != ((heap->fl_bitmap & (1U << fl)) != 0)) {
+            FAIL_PRINT("CORRUPT HEAP: Free class %u bitmap doesn't match its free lists\n", fl);
+        }
+    }
+    if (listed_blocks != free_blocks) {
+        FAIL_PRINT("CORRUPT HEAP: Found %u free blocks but %u in free lists\n", (unsigned)free_blocks, (unsigned)listed_blocks);
+    }
+
  done:
     multi_heap_internal_unlock(heap);
 
@@ -684,11 +1010,11 @@ void multi_heap_dump(multi_heap_handle_t heap)
     assert(heap != NULL);
 
     multi_heap_internal_lock(heap);
-    MULTI_HEAP_STDERR_PRINTF("Heap start %p end %p\nFirst free block %p\n", &heap->first_block, heap->last_block, heap->first_block.next_free);
+    MULTI_HEAP_STDERR_PRINTF("Heap start %p end %p\nFree class bitmap 0x%08x\n", &heap->first_block, heap->last_block, heap->fl_bitmap);
     for(heap_block_t *b = &heap->first_block; b != NULL; b = get_next_block(b)) {
         MULTI_HEAP_STDERR_PRINTF("Block %p data size 0x%08x bytes next block %p", b, block_data_size(b), get_next_block(b));
         if (is_free(b)) {
-            MULTI_HEAP_STDERR_PRINTF(" FREE. Next free %p\n", b->next_free);
+            MULTI_HEAP_STDERR_PRINTF(" FREE. Next free %p prev free %p\n", b->next_free, b->prev_free);
         } else {
             MULTI_HEAP_STDERR_PRINTF("%s", "\n"); /* C macros & optional __VA_ARGS__ */
         }
@@ -743,3 +1069,63 @@ void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info)
     multi_heap_internal_unlock(heap);
 
 }
+
+#ifdef MULTI_HEAP_STATS
+/* Size of the largest free block, found from the free list index without walking the heap.
+
+   The largest block is in the highest non-empty free list, so only that list needs to be searched.
+*/
+static size_t largest_free_block(const heap_t *heap)
+{
+    if (heap->fl_bitmap == 0) {
+        return 0;
+    }
+    const heap_free_class_t *class = &get_free_classes(heap)[31 - __builtin_clz(heap->fl_bitmap)];
+    size_t largest = 0;
+    for (heap_block_t *b = class->free_list[31 - __builtin_clz(class->sl_bitmap)]; b != NULL; b = b->next_free) {
+        if (block_data_size(b) > largest) {
+            largest = block_data_size(b);
+        }
+    }
+    return largest;
+}
+#endif
+
+bool multi_heap_get_stats_impl(multi_heap_handle_t heap, multi_heap_stats_t *stats)
+{
+    memset(stats, 0, sizeof(multi_heap_stats_t));
+
+#ifdef MULTI_HEAP_STATS
+    if (heap == NULL) {
+        return true;
+    }
+
+    multi_heap_internal_lock(heap);
+    memcpy(stats, &heap->stats, sizeof(multi_heap_stats_t));
+    stats->total_free_bytes = heap->free_bytes;
+    stats->minimum_free_bytes = heap->minimum_free_bytes;
+    stats->largest_free_block = largest_free_block(heap);
+    multi_heap_internal_unlock(heap);
+    return true;
+#else
+    return false;
+#endif
+}
+
+void multi_heap_reset_stats(multi_heap_handle_t heap)
+{
+#ifdef MULTI_HEAP_STATS
+    if (heap == NULL) {
+        return;
+    }
+
+    multi_heap_internal_lock(heap);
+    memset(heap->stats.alloc_sizes, 0, sizeof(heap->stats.alloc_sizes));
+    memset(heap->stats.malloc_time, 0, sizeof(heap->stats.malloc_time));
+    memset(heap->stats.free_time, 0, sizeof(heap->stats.free_time));
+    heap->stats.mallocs = 0;
+    heap->stats.failed_mallocs = 0;
+    heap->stats.frees = 0;
+    multi_heap_internal_unlock(heap);
+#endif
+}
@@ -27,3 +27,11 @@
 #define MULTI_HEAP_POISONING
 #define MULTI_HEAP_POISONING_SLOW
 #endif
+
+#ifdef CONFIG_HEAP_BOUNDARY_TAGS
+#define MULTI_HEAP_BOUNDARY_TAGS
+#endif
+
+#ifdef CONFIG_HEAP_STATS
+#define MULTI_HEAP_STATS
+#endif
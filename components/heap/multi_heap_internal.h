@@ -28,6 +28,7 @@ void multi_heap_free_impl(multi_heap_handle_t heap, void *p);
 void *multi_heap_realloc_impl(multi_heap_handle_t heap, void *p, size_t size);
 multi_heap_handle_t multi_heap_register_impl(void *start, size_t size);
 void multi_heap_get_info_impl(multi_heap_handle_t heap, multi_heap_info_t *info);
+bool multi_heap_get_stats_impl(multi_heap_handle_t heap, multi_heap_stats_t *stats);
 size_t multi_heap_free_size_impl(multi_heap_handle_t heap);
 size_t multi_heap_minimum_free_size_impl(multi_heap_handle_t heap);
 size_t multi_heap_get_allocated_size_impl(multi_heap_handle_t heap, void *p);
@@ -43,6 +44,11 @@ bool multi_heap_internal_check_block_poisoning(void *start, size_t size, bool is
 */
 void multi_heap_internal_poison_fill_region(void *start, size_t size, bool is_free);
 
+/* Get the size a poisoned block was allocated with, ie the number of bytes which can be used
+   without overwriting its tail canary. Called by the small block caches in heap_cache.c.
+*/
+size_t multi_heap_internal_get_poisoned_size(void *p);
+
 /* Allow heap poisoning to lock/unlock the heap to avoid race conditions
    if multi_heap_check() is running concurrently.
 */
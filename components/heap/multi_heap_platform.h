@@ -17,6 +17,7 @@
 
 #include <freertos/FreeRTOS.h>
 #include <rom/ets_sys.h>
+#include <xtensa/hal.h>
 #include <assert.h>
 
 /* Because malloc/free can happen inside an ISR context,
@@ -40,6 +41,9 @@
 #define MULTI_HEAP_PRINTF ets_printf
 #define MULTI_HEAP_STDERR_PRINTF(MSG, ...) ets_printf(MSG, __VA_ARGS__)
 
+/* Timestamp for the malloc/free duration statistics, in CPU cycles */
+#define MULTI_HEAP_TIMESTAMP() xthal_get_ccount()
+
 inline static void multi_heap_assert(bool condition, const char *format, int line, intptr_t address)
 {
     /* Can't use libc assert() here as it calls printf() which can cause another malloc() for a newlib lock.
@@ -79,11 +83,33 @@ inline static void multi_heap_assert(bool condition, const char *format, int lin
 
 #define MULTI_HEAP_PRINTF printf
 #define MULTI_HEAP_STDERR_PRINTF(MSG, ...) fprintf(stderr, MSG, __VA_ARGS__)
-#define MULTI_HEAP_LOCK(PLOCK)
-#define MULTI_HEAP_UNLOCK(PLOCK)
+/* On the host, a heap is only locked if multi_heap_set_lock() was given a
+   recursive pthread mutex (used by the multithreaded host tests). */
+#include <pthread.h>
+#define MULTI_HEAP_LOCK(PLOCK) do {                         \
+        if((PLOCK) != NULL) {                               \
+            pthread_mutex_lock((pthread_mutex_t *)(PLOCK)); \
+        }                                                   \
+    } while(0)
+
+#define MULTI_HEAP_UNLOCK(PLOCK) do {                         \
+        if ((PLOCK) != NULL) {                                \
+            pthread_mutex_unlock((pthread_mutex_t *)(PLOCK)); \
+        }                                                     \
+    } while(0)
 
 #define MULTI_HEAP_ASSERT(CONDITION, ADDRESS) assert((CONDITION) && "Heap corrupt")
 
+/* Timestamp for the malloc/free duration statistics, in nanoseconds */
+#include <time.h>
+static inline uint32_t multi_heap_timestamp(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000000000ULL + ts.tv_nsec);
+}
+#define MULTI_HEAP_TIMESTAMP() multi_heap_timestamp()
+
 #define MULTI_HEAP_BLOCK_OWNER
 #define MULTI_HEAP_SET_BLOCK_OWNER(HEAD)
 #define MULTI_HEAP_GET_BLOCK_OWNER(HEAD) (NULL)
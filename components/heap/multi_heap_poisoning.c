@@ -295,6 +295,13 @@ size_t multi_heap_get_allocated_size(multi_heap_handle_t heap, void *p)
     return 0;
 }
 
+size_t multi_heap_internal_get_poisoned_size(void *p)
+{
+    poison_head_t *head = verify_allocated_region(p, true);
+    assert(head != NULL);
+    return head->alloc_size;
+}
+
 void *multi_heap_get_block_owner(multi_heap_block_handle_t block)
 {
     return MULTI_HEAP_GET_BLOCK_OWNER((poison_head_t*)multi_heap_get_block_address_impl(block));
@@ -329,6 +336,16 @@ void multi_heap_get_info(multi_heap_handle_t heap, multi_heap_info_t *info)
     subtract_poison_overhead(&info->minimum_free_bytes);
 }
 
+bool multi_heap_get_stats(multi_heap_handle_t heap, multi_heap_stats_t *stats)
+{
+    bool result = multi_heap_get_stats_impl(heap, stats);
+    /* as for multi_heap_get_info(), don't suggest blocks this big may be allocated */
+    subtract_poison_overhead(&stats->largest_free_block);
+    subtract_poison_overhead(&stats->total_free_bytes);
+    subtract_poison_overhead(&stats->minimum_free_bytes);
+    return result;
+}
+
 size_t multi_heap_free_size(multi_heap_handle_t heap)
 {
     size_t r = multi_heap_free_size_impl(heap);
@@ -5,9 +5,13 @@
 
 FAIL=0
 
-for FLAGS in "CONFIG_HEAP_POISONING_NONE" "CONFIG_HEAP_POISONING_LIGHT" "CONFIG_HEAP_POISONING_COMPREHENSIVE"; do
+for FLAGS in "CONFIG_HEAP_POISONING_NONE" "CONFIG_HEAP_POISONING_LIGHT" "CONFIG_HEAP_POISONING_COMPREHENSIVE" \
+             "CONFIG_HEAP_POISONING_NONE CONFIG_HEAP_BOUNDARY_TAGS" "CONFIG_HEAP_POISONING_LIGHT CONFIG_HEAP_BOUNDARY_TAGS" \
+             "CONFIG_HEAP_POISONING_COMPREHENSIVE CONFIG_HEAP_BOUNDARY_TAGS" \
+             "CONFIG_HEAP_POISONING_NONE CONFIG_HEAP_BOUNDARY_TAGS CONFIG_HEAP_STATS" \
+             "CONFIG_HEAP_POISONING_COMPREHENSIVE CONFIG_HEAP_BOUNDARY_TAGS CONFIG_HEAP_STATS"; do
     echo "==== Testing with config: ${FLAGS} ===="
-    CPPFLAGS="-D${FLAGS}" make clean test || FAIL=1
+    CPPFLAGS="$(for F in ${FLAGS}; do echo -n "-D${F} "; done)" make clean test || FAIL=1
 done
 
 make clean
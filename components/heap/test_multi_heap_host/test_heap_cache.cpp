@@ -0,0 +1,244 @@
+#include "catch.hpp"
+#include "multi_heap.h"
+
+#include "../heap_cache.h"
+
+#include <string.h>
+#include <pthread.h>
+#include <chrono>
+#include <random>
+#include <thread>
+#include <vector>
+
+TEST_CASE("heap cache serves small allocations and returns them on flush", "[cache]")
+{
+    uint8_t buf[16384];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+    heap_cache_t cache;
+    heap_cache_init(&cache, heap);
+
+    std::vector<std::pair<uint8_t *, size_t> > blocks;
+    for (size_t size = 1; size <= 200; size += 3) {
+        uint8_t *p = (uint8_t *)heap_cache_malloc(&cache, size);
+        REQUIRE( p != NULL );
+        REQUIRE( multi_heap_get_allocated_size(heap, p) >= size );
+        memset(p, size & 0xFF, size);
+        blocks.push_back(std::make_pair(p, size));
+    }
+    REQUIRE( multi_heap_check(heap, true) );
+    for (auto &b : blocks) {
+        for (size_t i = 0; i < b.second; i++) {
+            REQUIRE( b.first[i] == (b.second & 0xFF) );
+        }
+        heap_cache_free(&cache, b.first);
+    }
+    heap_cache_free(&cache, NULL);
+
+    REQUIRE( heap_cache_cached_size(&cache) > 0 );
+    REQUIRE( multi_heap_free_size(heap) < heap_free );
+
+    heap_cache_flush(&cache);
+    REQUIRE( heap_cache_cached_size(&cache) == 0 );
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+    REQUIRE( multi_heap_check(heap, true) );
+}
+
+TEST_CASE("heap cache moves blocks to and from the heap in batches", "[cache]")
+{
+    uint8_t buf[16384];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+    heap_cache_t cache;
+    heap_cache_init(&cache, heap);
+
+    /* alloc/free pairs of the same size only touch the heap once */
+    for (int i = 0; i < 1000; i++) {
+        void *p = heap_cache_malloc(&cache, 30);
+        REQUIRE( p != NULL );
+        heap_cache_free(&cache, p);
+    }
+    REQUIRE( cache.refills == 1 );
+    REQUIRE( cache.flushes == 0 );
+
+    /* large allocations bypass the cache */
+    void *big = heap_cache_malloc(&cache, HEAP_CACHE_MAX_SIZE * 2);
+    REQUIRE( big != NULL );
+    heap_cache_free(&cache, big);
+    REQUIRE( cache.refills == 1 );
+    REQUIRE( cache.flushes == 0 );
+
+    const int N = 100;
+    void *p[N];
+    for (int i = 0; i < N; i++) {
+        p[i] = heap_cache_malloc(&cache, 64);
+        REQUIRE( p[i] != NULL );
+    }
+    REQUIRE( cache.refills == 1 + (N + HEAP_CACHE_BATCH - 1) / HEAP_CACHE_BATCH );
+    for (int i = 0; i < N; i++) {
+        heap_cache_free(&cache, p[i]);
+    }
+    REQUIRE( cache.flushes > 0 );
+    REQUIRE( cache.flushes <= N / HEAP_CACHE_BATCH );
+    REQUIRE( heap_cache_cached_size(&cache) <= HEAP_CACHE_BIN_DEPTH * (32 + 64) );
+
+    heap_cache_flush(&cache);
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+}
+
+TEST_CASE("heap cache when the heap runs out", "[cache]")
+{
+    uint8_t buf[2048];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+    heap_cache_t cache;
+    heap_cache_init(&cache, heap);
+
+    std::vector<void *> blocks;
+    void *p;
+    while ((p = heap_cache_malloc(&cache, 48)) != NULL) {
+        blocks.push_back(p);
+    }
+    REQUIRE( blocks.size() > 10 );
+    /* partial batches are used before failing */
+    REQUIRE( heap_cache_cached_size(&cache) == 0 );
+
+    for (auto b : blocks) {
+        heap_cache_free(&cache, b);
+    }
+    heap_cache_flush(&cache);
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+    REQUIRE( multi_heap_check(heap, true) );
+}
+
+namespace {
+
+/* Heap shared between threads, locked with a recursive mutex
+   (the heap lock is recursive on the target as well) */
+struct shared_heap {
+    pthread_mutex_t lock;
+    multi_heap_handle_t heap;
+
+    shared_heap(void *buf, size_t size)
+    {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+        pthread_mutex_init(&lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+        heap = multi_heap_register(buf, size);
+        multi_heap_set_lock(heap, &lock);
+    }
+
+    ~shared_heap()
+    {
+        pthread_mutex_destroy(&lock);
+    }
+};
+
+/* Each thread keeps a random working set of small blocks, replacing one at
+   a time. Blocks are written on allocation and checked before being freed. */
+struct workload_result {
+    size_t failures;
+    size_t corrupt;
+    uint32_t batches;
+};
+
+static void small_object_workload(multi_heap_handle_t heap, bool use_cache, unsigned seed,
+                                  size_t ops, workload_result *result)
+{
+    const size_t SLOTS = 64;
+    uint8_t *slots[SLOTS] = { 0 };
+    size_t sizes[SLOTS] = { 0 };
+    std::mt19937 rng(seed);
+    heap_cache_t cache;
+    heap_cache_init(&cache, heap);
+    result->failures = 0;
+    result->corrupt = 0;
+
+    for (size_t i = 0; i < ops; i++) {
+        size_t slot = rng() % SLOTS;
+        if (slots[slot] != NULL) {
+            for (size_t j = 0; j < sizes[slot]; j++) {
+                if (slots[slot][j] != (uint8_t)(slot ^ sizes[slot])) {
+                    result->corrupt++;
+                    break;
+                }
+            }
+            if (use_cache) {
+                heap_cache_free(&cache, slots[slot]);
+            } else {
+                multi_heap_free(heap, slots[slot]);
+            }
+        }
+        sizes[slot] = 8 + rng() % (HEAP_CACHE_MAX_SIZE - 8);
+        slots[slot] = (uint8_t *)(use_cache ? heap_cache_malloc(&cache, sizes[slot])
+                                  : multi_heap_malloc(heap, sizes[slot]));
+        if (slots[slot] == NULL) {
+            result->failures++;
+            continue;
+        }
+        memset(slots[slot], (uint8_t)(slot ^ sizes[slot]), sizes[slot]);
+    }
+
+    for (size_t slot = 0; slot < SLOTS; slot++) {
+        if (use_cache) {
+            heap_cache_free(&cache, slots[slot]);
+        } else {
+            multi_heap_free(heap, slots[slot]);
+        }
+    }
+    heap_cache_flush(&cache);
+    result->batches = cache.refills + cache.flushes;
+}
+
+/* Run the workload on 'threads' threads sharing one heap, return the elapsed time in ns */
+static double run_threads(bool use_cache, size_t threads, size_t ops_per_thread)
+{
+    static uint8_t buf[1024 * 1024];
+    shared_heap shared(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(shared.heap);
+    std::vector<workload_result> results(threads);
+    std::vector<std::thread> workers;
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < threads; i++) {
+        workers.push_back(std::thread(small_object_workload, shared.heap, use_cache,
+                                      (unsigned)i + 1, ops_per_thread, &results[i]));
+    }
+    for (auto &t : workers) {
+        t.join();
+    }
+    auto end = std::chrono::steady_clock::now();
+
+    for (auto &r : results) {
+        REQUIRE( r.failures == 0 );
+        REQUIRE( r.corrupt == 0 );
+        if (use_cache) {
+            /* the heap lock is taken once per batch rather than once per malloc/free */
+            REQUIRE( r.batches < ops_per_thread / 4 );
+        }
+    }
+    REQUIRE( multi_heap_free_size(shared.heap) == heap_free );
+    REQUIRE( multi_heap_check(shared.heap, true) );
+    return std::chrono::duration<double, std::nano>(end - start).count();
+}
+
+} // namespace
+
+TEST_CASE("heap cache with threads sharing a heap", "[cache]")
+{
+    run_threads(true, 4, 20000);
+    run_threads(false, 4, 20000);
+}
+
+TEST_CASE("heap cache throughput with contending threads", "[cache][bench]")
+{
+    const size_t OPS = 500000;
+    for (size_t threads = 1; threads <= 4; threads *= 2) {
+        double uncached = run_threads(false, threads, OPS);
+        double cached = run_threads(true, threads, OPS);
+        printf("%zu threads: %.1f Mops/s uncached, %.1f Mops/s cached\n", threads,
+               threads * OPS * 1e3 / uncached, threads * OPS * 1e3 / cached);
+    }
+}
@@ -0,0 +1,288 @@
+#include "catch.hpp"
+#include "multi_heap.h"
+#include "esp_heap_pool.h"
+
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+TEST_CASE("pool allocates distinct aligned objects from a heap", "[pool]")
+{
+    const size_t OBJECTS = 16;
+    uint8_t buf[4096];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+
+    heap_pool_handle_t pool = heap_pool_create_in_heap(heap, 13, OBJECTS);
+    REQUIRE( pool != NULL );
+    REQUIRE( multi_heap_free_size(heap) < heap_free );
+
+    heap_pool_info_t info;
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.object_size >= 13 );
+    REQUIRE( info.object_size % sizeof(void *) == 0 );
+    REQUIRE( info.total_slabs == 1 );
+    REQUIRE( info.total_objects == OBJECTS );
+    REQUIRE( info.free_objects == OBJECTS );
+    REQUIRE( info.allocated_objects == 0 );
+    REQUIRE( info.total_bytes <= heap_free - multi_heap_free_size(heap) );
+
+    void *p[OBJECTS];
+    for (size_t i = 0; i < OBJECTS; i++) {
+        p[i] = heap_pool_alloc(pool);
+        REQUIRE( p[i] != NULL );
+        REQUIRE( (intptr_t)p[i] % sizeof(void *) == 0 );
+        REQUIRE( (uint8_t *)p[i] >= buf );
+        REQUIRE( (uint8_t *)p[i] + info.object_size <= buf + sizeof(buf) );
+        memset(p[i], i, info.object_size);
+    }
+    for (size_t i = 0; i < OBJECTS; i++) {
+        for (size_t j = 0; j < info.object_size; j++) {
+            REQUIRE( ((uint8_t *)p[i])[j] == i );
+        }
+    }
+
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.total_slabs == 1 );
+    REQUIRE( info.allocated_objects == OBJECTS );
+    REQUIRE( info.free_objects == 0 );
+    REQUIRE( info.peak_allocated_objects == OBJECTS );
+
+    for (size_t i = 0; i < OBJECTS; i += 2) {
+        heap_pool_free(pool, p[i]);
+    }
+    heap_pool_free(pool, NULL);
+
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.allocated_objects == OBJECTS / 2 );
+    REQUIRE( info.free_objects == OBJECTS / 2 );
+    REQUIRE( info.peak_allocated_objects == OBJECTS );
+
+    /* freed objects are reused before a new slab is added */
+    for (size_t i = 0; i < OBJECTS; i += 2) {
+        p[i] = heap_pool_alloc(pool);
+        REQUIRE( p[i] != NULL );
+    }
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.total_slabs == 1 );
+
+    REQUIRE( multi_heap_check(heap, true) );
+    heap_pool_delete(pool);
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+    REQUIRE( multi_heap_check(heap, true) );
+}
+
+TEST_CASE("pool adds slabs when exhausted and fails when the heap is full", "[pool]")
+{
+    uint8_t buf[4096];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+
+    heap_pool_handle_t pool = heap_pool_create_in_heap(heap, 32, 4);
+    REQUIRE( pool != NULL );
+
+    std::vector<void *> objects;
+    void *p;
+    while ((p = heap_pool_alloc(pool)) != NULL) {
+        objects.push_back(p);
+    }
+    REQUIRE( objects.size() > 4 );
+
+    heap_pool_info_t info;
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.total_slabs == (objects.size() + 3) / 4 );
+    REQUIRE( info.total_objects == info.total_slabs * 4 );
+    REQUIRE( info.allocated_objects == objects.size() );
+    REQUIRE( info.failed_allocations == 1 );
+    REQUIRE( info.total_bytes <= heap_free - multi_heap_free_size(heap) );
+
+    REQUIRE( heap_pool_alloc(pool) == NULL );
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.failed_allocations == 2 );
+
+    heap_pool_free(pool, objects.back());
+    objects.pop_back();
+    REQUIRE( heap_pool_alloc(pool) != NULL );
+
+    heap_pool_delete(pool);
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+    REQUIRE( multi_heap_check(heap, true) );
+}
+
+TEST_CASE("pool creation with bad arguments", "[pool]")
+{
+    uint8_t buf[1024];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+
+    REQUIRE( heap_pool_create_in_heap(NULL, 16, 4) == NULL );
+    REQUIRE( heap_pool_create_in_heap(heap, 16, 0) == NULL );
+    REQUIRE( heap_pool_create_in_heap(heap, SIZE_MAX, 4) == NULL );
+    REQUIRE( heap_pool_create_in_heap(heap, 16, SIZE_MAX / 8) == NULL );
+    /* first slab doesn't fit, pool metadata must not leak */
+    REQUIRE( heap_pool_create_in_heap(heap, 64, 1024) == NULL );
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+
+    /* objects smaller than a pointer are rounded up */
+    heap_pool_handle_t pool = heap_pool_create_in_heap(heap, 1, 1);
+    REQUIRE( pool != NULL );
+    heap_pool_info_t info;
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.object_size == sizeof(void *) );
+    heap_pool_delete(pool);
+    heap_pool_delete(NULL);
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+}
+
+/* Two heaps standing in for internal and external RAM, blocks are freed to the heap they came from */
+static uint8_t internal_buf[1024];
+static uint8_t external_buf[4096];
+static multi_heap_handle_t internal_heap;
+static multi_heap_handle_t external_heap;
+
+static void *internal_alloc(void *ctx, size_t size)
+{
+    return multi_heap_malloc(internal_heap, size);
+}
+
+static void *external_alloc(void *ctx, size_t size)
+{
+    return multi_heap_malloc(external_heap, size);
+}
+
+static void free_to_owner(void *ctx, void *p)
+{
+    bool internal = (uint8_t *)p >= internal_buf && (uint8_t *)p < internal_buf + sizeof(internal_buf);
+    multi_heap_free(internal ? internal_heap : external_heap, p);
+}
+
+TEST_CASE("pool metadata allocated separately from slabs", "[pool]")
+{
+    internal_heap = multi_heap_register(internal_buf, sizeof(internal_buf));
+    external_heap = multi_heap_register(external_buf, sizeof(external_buf));
+    size_t internal_free = multi_heap_free_size(internal_heap);
+    size_t external_free = multi_heap_free_size(external_heap);
+
+    heap_pool_handle_t pool = heap_pool_create_with_metadata(32, 8, internal_alloc, external_alloc, free_to_owner, NULL);
+    REQUIRE( pool != NULL );
+    REQUIRE( (uint8_t *)pool >= internal_buf );
+    REQUIRE( (uint8_t *)pool < internal_buf + sizeof(internal_buf) );
+    for (int i = 0; i < 20; i++) {
+        void *p = heap_pool_alloc(pool);
+        REQUIRE( (uint8_t *)p >= external_buf );
+        REQUIRE( (uint8_t *)p < external_buf + sizeof(external_buf) );
+    }
+
+    heap_pool_delete(pool);
+    REQUIRE( multi_heap_free_size(internal_heap) == internal_free );
+    REQUIRE( multi_heap_free_size(external_heap) == external_free );
+}
+
+/* One task allocates objects and hands them to several tasks which free them */
+TEST_CASE("pool single producer with concurrent frees", "[pool]")
+{
+    const size_t ITERATIONS = 200000;
+    const size_t CONSUMERS = 3;
+    const size_t MAX_QUEUED = 256;
+    static uint8_t buf[128 * 1024];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    size_t heap_free = multi_heap_free_size(heap);
+
+    heap_pool_handle_t pool = heap_pool_create_in_heap(heap, 24, 64);
+    REQUIRE( pool != NULL );
+
+    std::mutex queue_lock;
+    std::vector<uint32_t *> queue;
+    std::atomic<bool> done(false);
+    std::atomic<size_t> freed(0);
+    std::atomic<size_t> corrupt(0);
+    size_t alloc_failures = 0;
+
+    auto consumer = [&]() {
+        while (true) {
+            uint32_t *p = NULL;
+            {
+                std::lock_guard<std::mutex> guard(queue_lock);
+                if (!queue.empty()) {
+                    p = queue.back();
+                    queue.pop_back();
+                }
+            }
+            if (p == NULL) {
+                if (done) {
+                    std::lock_guard<std::mutex> guard(queue_lock);
+                    if (queue.empty()) {
+                        return;
+                    }
+                }
+                std::this_thread::yield();
+                continue;
+            }
+            /* the object must not have been handed out again while we held it */
+            if (p[1] != ~p[0] || p[2] != p[0]) {
+                corrupt++;
+            }
+            p[1] = 0;
+            heap_pool_free(pool, p);
+            freed++;
+        }
+    };
+
+    std::vector<std::thread> consumers;
+    for (size_t i = 0; i < CONSUMERS; i++) {
+        consumers.push_back(std::thread(consumer));
+    }
+
+    for (uint32_t i = 0; i < ITERATIONS; i++) {
+        uint32_t *p = (uint32_t *)heap_pool_alloc(pool);
+        if (p == NULL) {
+            alloc_failures++;
+            continue;
+        }
+        p[0] = i;
+        p[1] = ~i;
+        p[2] = i;
+        while (true) {
+            std::lock_guard<std::mutex> guard(queue_lock);
+            if (queue.size() < MAX_QUEUED) {
+                queue.push_back(p);
+                break;
+            }
+        }
+    }
+    done = true;
+    for (auto &t : consumers) {
+        t.join();
+    }
+
+    REQUIRE( alloc_failures == 0 );
+    REQUIRE( corrupt == 0 );
+    REQUIRE( freed == ITERATIONS );
+
+    heap_pool_info_t info;
+    heap_pool_get_info(pool, &info);
+    printf("pool after %zu concurrent frees: %zu slabs, peak %zu objects\n",
+           ITERATIONS, info.total_slabs, info.peak_allocated_objects);
+    REQUIRE( info.allocated_objects == 0 );
+    REQUIRE( info.free_objects == info.total_objects );
+    REQUIRE( info.peak_allocated_objects <= info.total_objects );
+
+    /* every object is back on the free list exactly once */
+    std::vector<void *> all;
+    for (size_t i = 0; i < info.total_objects; i++) {
+        void *p = heap_pool_alloc(pool);
+        REQUIRE( p != NULL );
+        all.push_back(p);
+    }
+    std::sort(all.begin(), all.end());
+    REQUIRE( std::adjacent_find(all.begin(), all.end()) == all.end() );
+    heap_pool_get_info(pool, &info);
+    REQUIRE( info.total_slabs * 64 == all.size() );
+
+    heap_pool_delete(pool);
+    REQUIRE( multi_heap_free_size(heap) == heap_free );
+    REQUIRE( multi_heap_check(heap, true) );
+}
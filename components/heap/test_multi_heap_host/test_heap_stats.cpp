@@ -0,0 +1,197 @@
+#include "catch.hpp"
+#include "multi_heap.h"
+
+#include "../multi_heap_config.h"
+
+#include <string.h>
+#include <random>
+
+#ifdef MULTI_HEAP_STATS
+
+static uint32_t histogram_total(const uint32_t *histogram)
+{
+    uint32_t total = 0;
+    for (int i = 0; i < MULTI_HEAP_HISTOGRAM_BUCKETS; i++) {
+        total += histogram[i];
+    }
+    return total;
+}
+
+/* Compare the incrementally maintained statistics with a full walk of the heap */
+static void check_stats_match_walk(multi_heap_handle_t heap)
+{
+    multi_heap_stats_t stats;
+    multi_heap_info_t info;
+
+    /* with stats enabled, multi_heap_check() also compares the free block histogram against the heap */
+    REQUIRE( multi_heap_check(heap, true) );
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    multi_heap_get_info(heap, &info);
+
+    REQUIRE( stats.total_free_bytes == info.total_free_bytes );
+    REQUIRE( stats.largest_free_block == info.largest_free_block );
+    REQUIRE( stats.minimum_free_bytes == info.minimum_free_bytes );
+    REQUIRE( stats.free_blocks == info.free_blocks );
+    REQUIRE( histogram_total(stats.free_block_sizes) == info.free_blocks );
+}
+
+TEST_CASE("heap stats histogram of free block sizes", "[multi_heap][stats]")
+{
+    uint8_t buf[8192];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    multi_heap_stats_t stats;
+    void *p[20];
+
+    check_stats_match_walk(heap);
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.free_blocks == 1 );
+
+    for (int i = 0; i < 20; i++) {
+        p[i] = multi_heap_malloc(heap, 100);
+        REQUIRE( p[i] != NULL );
+    }
+    for (int i = 0; i < 20; i += 2) {
+        multi_heap_free(heap, p[i]);
+    }
+    check_stats_match_walk(heap);
+
+    /* ten free blocks of ~100 bytes (plus any poisoning overhead) between the allocated ones,
+       and the rest of the heap */
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.free_blocks == 11 );
+    REQUIRE( MULTI_HEAP_HISTOGRAM_BUCKET_MIN(3) == 64 );
+    REQUIRE( stats.free_block_sizes[3] == 10 );
+    REQUIRE( stats.largest_free_block > 4096 );
+
+    for (int i = 1; i < 20; i += 2) {
+        multi_heap_free(heap, p[i]);
+    }
+    check_stats_match_walk(heap);
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.free_blocks == 1 );
+    REQUIRE( stats.free_block_sizes[3] == 0 );
+}
+
+TEST_CASE("heap stats count allocations, failures and frees", "[multi_heap][stats]")
+{
+    uint8_t buf[4096];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    multi_heap_stats_t stats;
+
+    void *a = multi_heap_malloc(heap, 10);   /* bucket 0 */
+    void *b = multi_heap_malloc(heap, 16);   /* bucket 1 */
+    void *c = multi_heap_malloc(heap, 1000); /* bucket 6 */
+    void *d = multi_heap_malloc(heap, 8192); /* fails */
+    REQUIRE( a != NULL );
+    REQUIRE( b != NULL );
+    REQUIRE( c != NULL );
+    REQUIRE( d == NULL );
+    multi_heap_free(heap, b);
+
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.mallocs == 3 );
+    REQUIRE( stats.failed_mallocs == 1 );
+    REQUIRE( stats.frees == 1 );
+#ifndef MULTI_HEAP_POISONING
+    /* with poisoning, the poisoning overhead is included in the size */
+    REQUIRE( stats.alloc_sizes[0] == 1 );
+    REQUIRE( stats.alloc_sizes[1] == 1 );
+    REQUIRE( stats.alloc_sizes[6] == 1 );
+#endif
+    REQUIRE( histogram_total(stats.alloc_sizes) == 3 );
+    REQUIRE( histogram_total(stats.malloc_time) == 4 );
+    REQUIRE( histogram_total(stats.free_time) == 1 );
+
+    /* resetting clears the accumulated counts but not the state of the heap */
+    multi_heap_stats_t before = stats;
+    multi_heap_reset_stats(heap);
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.mallocs == 0 );
+    REQUIRE( stats.failed_mallocs == 0 );
+    REQUIRE( stats.frees == 0 );
+    REQUIRE( histogram_total(stats.alloc_sizes) == 0 );
+    REQUIRE( histogram_total(stats.malloc_time) == 0 );
+    REQUIRE( histogram_total(stats.free_time) == 0 );
+    REQUIRE( stats.free_blocks == before.free_blocks );
+    REQUIRE( memcmp(stats.free_block_sizes, before.free_block_sizes, sizeof(stats.free_block_sizes)) == 0 );
+    REQUIRE( stats.total_free_bytes == before.total_free_bytes );
+    REQUIRE( stats.minimum_free_bytes == before.minimum_free_bytes );
+
+    multi_heap_free(heap, a);
+    multi_heap_free(heap, c);
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.frees == 2 );
+    check_stats_match_walk(heap);
+}
+
+TEST_CASE("heap stats match a full walk during random allocations", "[multi_heap][stats]")
+{
+    const size_t NUM_POINTERS = 64;
+    uint8_t buf[32768];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    void *p[NUM_POINTERS] = { 0 };
+    std::mt19937 rng(42);
+    uint32_t frees = 0;
+
+    for (int i = 0; i < 20000; i++) {
+        size_t n = rng() % NUM_POINTERS;
+        size_t size = (rng() % 4 == 0) ? rng() % 4096 : rng() % 256;
+
+        switch (rng() % 3) {
+        case 0:
+            if (p[n] != NULL) {
+                multi_heap_free(heap, p[n]);
+                frees++;
+            }
+            p[n] = multi_heap_malloc(heap, size);
+            break;
+        case 1:
+            if (p[n] != NULL) {
+                multi_heap_free(heap, p[n]);
+                frees++;
+                p[n] = NULL;
+            }
+            break;
+        default:
+            if (size > 0) {
+                void *r = multi_heap_realloc(heap, p[n], size);
+                if (r != NULL) {
+                    p[n] = r;
+                }
+            }
+            break;
+        }
+
+        if (i % 200 == 0) {
+            check_stats_match_walk(heap);
+        }
+    }
+    check_stats_match_walk(heap);
+
+    multi_heap_stats_t stats;
+    REQUIRE( multi_heap_get_stats(heap, &stats) );
+    /* realloc can also malloc & free internally, so these are lower bounds */
+    REQUIRE( stats.frees >= frees );
+    REQUIRE( stats.mallocs > 0 );
+    REQUIRE( stats.failed_mallocs > 0 );
+    REQUIRE( histogram_total(stats.alloc_sizes) == stats.mallocs );
+    REQUIRE( histogram_total(stats.malloc_time) == stats.mallocs + stats.failed_mallocs );
+    REQUIRE( histogram_total(stats.free_time) == stats.frees );
+}
+
+#else
+
+TEST_CASE("heap stats are not available", "[multi_heap][stats]")
+{
+    uint8_t buf[4096];
+    multi_heap_handle_t heap = multi_heap_register(buf, sizeof(buf));
+    multi_heap_stats_t stats;
+    memset(&stats, 0xAA, sizeof(stats));
+
+    REQUIRE( !multi_heap_get_stats(heap, &stats) );
+    REQUIRE( stats.total_free_bytes == 0 );
+    REQUIRE( stats.free_blocks == 0 );
+    multi_heap_reset_stats(heap);
+}
+
+#endif
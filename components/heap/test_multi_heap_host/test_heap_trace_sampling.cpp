@@ -0,0 +1,277 @@
+#include "catch.hpp"
+
+#include "../heap_trace_sampling.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/* Call stacks are just made up return addresses here */
+static void make_stack(void **callers, uintptr_t id)
+{
+    for (int i = 0; i < HEAP_TRACE_SAMPLING_DEPTH; i++) {
+        callers[i] = (void *)(0x400d0000 + id * 0x100 + i * 4);
+    }
+}
+
+/* Allocate 'total' bytes in allocations of 'size' bytes from stack 'id' */
+static void allocate_from(heap_trace_sampler_t *sampler, uintptr_t id, size_t size, size_t total)
+{
+    void *callers[HEAP_TRACE_SAMPLING_DEPTH];
+    make_stack(callers, id);
+    for (size_t done = 0; done < total; done += size) {
+        uint32_t samples = heap_trace_sampler_sample(sampler, size);
+        if (samples > 0) {
+            heap_trace_sampler_record(sampler, callers, samples);
+        }
+    }
+}
+
+static const heap_trace_sample_bucket_t *find_stack(const heap_trace_sampler_t *sampler, uintptr_t id)
+{
+    void *callers[HEAP_TRACE_SAMPLING_DEPTH];
+    make_stack(callers, id);
+    for (size_t i = 0; i < sampler->num_buckets; i++) {
+        if (sampler->buckets[i].hash != 0
+            && memcmp(sampler->buckets[i].callers, callers, sizeof(callers)) == 0) {
+            return &sampler->buckets[i];
+        }
+    }
+    return NULL;
+}
+
+/* "File sink on the host": write the export to a stdio stream */
+static bool write_file(void *ctx, const char *data, size_t len)
+{
+    return fwrite(data, 1, len, (FILE *)ctx) == len;
+}
+
+/* Export to a temporary file and parse it back as folded stack -> bytes */
+static std::map<std::string, uint64_t> export_folded(heap_trace_sampler_t *sampler, bool reset)
+{
+    FILE *f = tmpfile();
+    REQUIRE( f != NULL );
+    REQUIRE( heap_trace_sampler_export(sampler, write_file, f, reset) );
+    rewind(f);
+
+    std::map<std::string, uint64_t> result;
+    char line[256];
+    while (fgets(line, sizeof(line), f) != NULL) {
+        REQUIRE( line[strlen(line) - 1] == '\n' );
+        char *space = strrchr(line, ' ');
+        REQUIRE( space != NULL );
+        *space = '\0';
+        REQUIRE( result.count(line) == 0 );
+        result[line] = strtoull(space + 1, NULL, 10);
+    }
+    fclose(f);
+    return result;
+}
+
+TEST_CASE("sampled byte counts are close to the bytes allocated", "[heap_trace]")
+{
+    const size_t PERIOD = 512;
+    heap_trace_sample_bucket_t buckets[16];
+    heap_trace_sampler_t sampler;
+    heap_trace_sampler_init(&sampler, buckets, 16, PERIOD, 12345, NULL);
+
+    allocate_from(&sampler, 1, 64, 2000000);    /* many small allocations */
+    allocate_from(&sampler, 2, 4000, 600000);   /* fewer large ones */
+    allocate_from(&sampler, 3, 1, 20000);       /* tiny allocations, rarely sampled */
+    allocate_from(&sampler, 4, 51200, 512000);  /* allocations spanning many sample points */
+
+    const struct {
+        uintptr_t id;
+        double bytes;
+        double tolerance;
+    } expected[] = {
+        { 1, 2000000, 0.05 },
+        { 2, 600000, 0.10 },
+        { 3, 20000, 0.50 },
+        { 4, 512000, 0.10 },
+    };
+    for (auto &e : expected) {
+        const heap_trace_sample_bucket_t *bucket = find_stack(&sampler, e.id);
+        REQUIRE( bucket != NULL );
+        REQUIRE( bucket->bytes == (uint64_t)bucket->samples * PERIOD );
+        REQUIRE( bucket->bytes > e.bytes * (1 - e.tolerance) );
+        REQUIRE( bucket->bytes < e.bytes * (1 + e.tolerance) );
+    }
+
+    REQUIRE( sampler.used_buckets == 4 );
+    REQUIRE( sampler.dropped_samples == 0 );
+    double total = 2000000 + 600000 + 20000 + 512000;
+    REQUIRE( sampler.total_samples * PERIOD > total * 0.97 );
+    REQUIRE( sampler.total_samples * PERIOD < total * 1.03 );
+}
+
+TEST_CASE("sampler drops samples when the stack table is full", "[heap_trace]")
+{
+    heap_trace_sample_bucket_t buckets[8];
+    heap_trace_sampler_t sampler;
+    heap_trace_sampler_init(&sampler, buckets, 8, 1, 1, NULL);
+
+    /* with a period of 1 byte every allocation is sampled */
+    for (uintptr_t id = 0; id < 20; id++) {
+        allocate_from(&sampler, id, 10, 10);
+    }
+    REQUIRE( sampler.used_buckets == 8 );
+    REQUIRE( sampler.total_samples >= 20 * 5 );
+    REQUIRE( sampler.dropped_samples > 0 );
+
+    uint32_t recorded = 0;
+    for (auto &b : buckets) {
+        recorded += b.samples;
+    }
+    REQUIRE( recorded + sampler.dropped_samples == sampler.total_samples );
+}
+
+TEST_CASE("sampler doesn't use the stack table once detached", "[heap_trace]")
+{
+    heap_trace_sample_bucket_t buckets[8];
+    heap_trace_sampler_t sampler;
+    heap_trace_sampler_init(&sampler, buckets, 8, 1, 1, NULL);
+    allocate_from(&sampler, 1, 10, 10);
+    REQUIRE( sampler.used_buckets == 1 );
+
+    heap_trace_sampler_detach(&sampler);
+    memset(buckets, 0xee, sizeof(buckets));
+    allocate_from(&sampler, 2, 10, 10);
+    REQUIRE( export_folded(&sampler, false).empty() );
+    for (auto &b : buckets) {
+        REQUIRE( b.hash == 0xeeeeeeee );
+    }
+
+    /* initializing it again starts with an empty table */
+    heap_trace_sampler_init(&sampler, buckets, 8, 1, 1, NULL);
+    allocate_from(&sampler, 3, 10, 10);
+    REQUIRE( sampler.used_buckets == 1 );
+    REQUIRE( export_folded(&sampler, false).size() == 1 );
+}
+
+TEST_CASE("sampler exports folded stacks", "[heap_trace]")
+{
+    heap_trace_sample_bucket_t buckets[16];
+    heap_trace_sampler_t sampler;
+    heap_trace_sampler_init(&sampler, buckets, 16, 256, 99, NULL);
+
+    allocate_from(&sampler, 1, 100, 100000);
+    allocate_from(&sampler, 2, 300, 50000);
+
+    auto folded = export_folded(&sampler, false);
+    REQUIRE( folded.size() == 2 );
+
+    char expected_stack[128];
+    heap_trace_sample_bucket_t bucket = *find_stack(&sampler, 1);
+    /* outermost caller (last in the array) comes first */
+    snprintf(expected_stack, sizeof(expected_stack), "0x%08lx;0x%08lx;0x%08lx;0x%08lx",
+             (unsigned long)bucket.callers[3], (unsigned long)bucket.callers[2],
+             (unsigned long)bucket.callers[1], (unsigned long)bucket.callers[0]);
+    REQUIRE( folded.count(expected_stack) == 1 );
+    REQUIRE( folded[expected_stack] == bucket.bytes );
+
+    char line[256];
+    int len = heap_trace_sampler_format_folded(&bucket, line, sizeof(line));
+    REQUIRE( len == (int)strlen(line) );
+    /* truncated output is still terminated */
+    char short_line[8];
+    REQUIRE( heap_trace_sampler_format_folded(&bucket, short_line, sizeof(short_line)) == len );
+    REQUIRE( strlen(short_line) == sizeof(short_line) - 1 );
+
+    /* exporting without reset gives the same result again */
+    REQUIRE( export_folded(&sampler, false) == folded );
+
+    /* with reset, each export only covers new allocations */
+    REQUIRE( export_folded(&sampler, true) == folded );
+    REQUIRE( export_folded(&sampler, true).empty() );
+    allocate_from(&sampler, 2, 300, 50000);
+    auto after = export_folded(&sampler, true);
+    REQUIRE( after.size() == 1 );
+    REQUIRE( sampler.used_buckets == 0 );
+
+    /* stacks shorter than the maximum depth, and unknown stacks */
+    heap_trace_sample_bucket_t partial = bucket;
+    partial.callers[2] = NULL;
+    partial.callers[3] = NULL;
+    heap_trace_sampler_format_folded(&partial, line, sizeof(line));
+    REQUIRE( strchr(line, ';') == strrchr(line, ';') );
+    partial.callers[0] = NULL;
+    heap_trace_sampler_format_folded(&partial, line, sizeof(line));
+    REQUIRE( strncmp(line, "[unknown] ", 10) == 0 );
+}
+
+TEST_CASE("sampler reuses buckets of stacks removed by export", "[heap_trace]")
+{
+    heap_trace_sample_bucket_t buckets[8];
+    heap_trace_sampler_t sampler;
+    heap_trace_sampler_init(&sampler, buckets, 8, 1, 1, NULL);
+
+    /* each round fills the table with new stacks, which only fit if the previous ones were removed */
+    for (uintptr_t round = 0; round < 10; round++) {
+        for (uintptr_t id = round * 8; id < round * 8 + 8; id++) {
+            allocate_from(&sampler, id, 10, 10);
+        }
+        REQUIRE( sampler.used_buckets == 8 );
+        REQUIRE( export_folded(&sampler, true).size() == 8 );
+        REQUIRE( sampler.used_buckets == 0 );
+    }
+    REQUIRE( sampler.dropped_samples == 0 );
+    for (auto &b : buckets) {
+        REQUIRE( b.hash == 0 );
+    }
+
+    /* stacks which aren't sampled again after an export with reset aren't exported again */
+    allocate_from(&sampler, 1, 10, 10);
+    allocate_from(&sampler, 2, 10, 10);
+    export_folded(&sampler, true);
+    allocate_from(&sampler, 2, 10, 10);
+    allocate_from(&sampler, 3, 10, 10);
+    REQUIRE( sampler.used_buckets == 2 );
+    REQUIRE( export_folded(&sampler, false).size() == 2 );
+    REQUIRE( find_stack(&sampler, 1) == NULL );
+}
+
+TEST_CASE("sampler shared between threads", "[heap_trace]")
+{
+    const size_t THREADS = 4;
+    pthread_mutex_t lock;
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&lock, &attr);
+
+    heap_trace_sample_bucket_t buckets[16];
+    heap_trace_sampler_t sampler;
+    heap_trace_sampler_init(&sampler, buckets, 16, 128, 7, &lock);
+
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < THREADS; i++) {
+        threads.push_back(std::thread(allocate_from, &sampler, (uintptr_t)i, 48, 1000000));
+    }
+    /* exporting while sampling runs */
+    FILE *f = fopen("/dev/null", "w");
+    REQUIRE( f != NULL );
+    for (int i = 0; i < 10; i++) {
+        REQUIRE( heap_trace_sampler_export(&sampler, write_file, f, false) );
+    }
+    fclose(f);
+    for (auto &t : threads) {
+        t.join();
+    }
+
+    uint32_t recorded = 0;
+    for (size_t i = 0; i < THREADS; i++) {
+        const heap_trace_sample_bucket_t *bucket = find_stack(&sampler, i);
+        REQUIRE( bucket != NULL );
+        REQUIRE( bucket->bytes > 1000000 * 0.9 );
+        REQUIRE( bucket->bytes < 1000000 * 1.1 );
+        recorded += bucket->samples;
+    }
+    REQUIRE( recorded == sampler.total_samples );
+    pthread_mutex_destroy(&lock);
+    pthread_mutexattr_destroy(&attr);
+}
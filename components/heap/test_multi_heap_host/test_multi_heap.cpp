@@ -5,6 +5,8 @@
 
 #include <string.h>
 #include <assert.h>
+#include <chrono>
+#include <algorithm>
 
 /* Insurance against accidentally using libc heap functions in tests */
 #undef free
@@ -16,11 +18,34 @@
 #undef realloc
 #define realloc #error
 
+/* Register a heap in 'buf' which has 'free_size' bytes free to begin with (rounded up to the heap's alignment).
+
+   The heap metadata (including the free list index) varies in size with the size of the heap and the target, so tests
+   which depend on how much space is free use this instead of registering the whole buffer.
+*/
+static multi_heap_handle_t register_heap_with_free_size(uint8_t *buf, size_t buf_size, size_t free_size)
+{
+    size_t heap_size = free_size;
+    multi_heap_handle_t heap = NULL;
+    while (heap_size <= buf_size) {
+        heap = multi_heap_register(buf, heap_size);
+        size_t heap_free = (heap != NULL) ? multi_heap_free_size(heap) : 0;
+        if (heap_free >= free_size) {
+            break;
+        }
+        heap_size += free_size - heap_free;
+    }
+    REQUIRE( heap != NULL );
+    REQUIRE( multi_heap_free_size(heap) >= free_size );
+    REQUIRE( multi_heap_free_size(heap) < free_size + sizeof(void *) );
+    return heap;
+}
+
 TEST_CASE("multi_heap simple allocations", "[multi_heap]")
 {
-    uint8_t small_heap[128];
+    uint8_t small_heap[1024];
 
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    multi_heap_handle_t heap = register_heap_with_free_size(small_heap, sizeof(small_heap), 92);
 
     size_t test_alloc_size = (multi_heap_free_size(heap) + 4) / 2;
 
@@ -59,8 +84,8 @@ TEST_CASE("multi_heap simple allocations", "[multi_heap]")
 
 TEST_CASE("multi_heap fragmentation", "[multi_heap]")
 {
-    uint8_t small_heap[256];
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    uint8_t small_heap[1024];
+    multi_heap_handle_t heap = register_heap_with_free_size(small_heap, sizeof(small_heap), 220);
 
     const size_t alloc_size = 24;
 
@@ -109,9 +134,9 @@ TEST_CASE("multi_heap fragmentation", "[multi_heap]")
 TEST_CASE("multi_heap defrag", "[multi_heap]")
 {
     void *p[4];
-    uint8_t small_heap[512];
+    uint8_t small_heap[2048];
     multi_heap_info_t info, info2;
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    multi_heap_handle_t heap = register_heap_with_free_size(small_heap, sizeof(small_heap), 476);
 
     printf("0 ---\n");
     multi_heap_dump(heap);
@@ -159,9 +184,9 @@ TEST_CASE("multi_heap defrag", "[multi_heap]")
 TEST_CASE("multi_heap defrag realloc", "[multi_heap]")
 {
     void *p[4];
-    uint8_t small_heap[512];
+    uint8_t small_heap[2048];
     multi_heap_info_t info, info2;
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    multi_heap_handle_t heap = register_heap_with_free_size(small_heap, sizeof(small_heap), 476);
 
     printf("0 ---\n");
     multi_heap_dump(heap);
@@ -204,14 +229,14 @@ TEST_CASE("multi_heap defrag realloc", "[multi_heap]")
 
 TEST_CASE("multi_heap many random allocations", "[multi_heap]")
 {
-    uint8_t big_heap[1024];
+    uint8_t big_heap[2048];
     const int NUM_POINTERS = 64;
 
     printf("Running multi-allocation test...\n");
 
     void *p[NUM_POINTERS] = { 0 };
     size_t s[NUM_POINTERS] = { 0 };
-    multi_heap_handle_t heap = multi_heap_register(big_heap, sizeof(big_heap));
+    multi_heap_handle_t heap = register_heap_with_free_size(big_heap, sizeof(big_heap), 988);
 
     const size_t initial_free = multi_heap_free_size(heap);
 
@@ -296,8 +321,8 @@ TEST_CASE("multi_heap many random allocations", "[multi_heap]")
 
 TEST_CASE("multi_heap_get_info() function", "[multi_heap]")
 {
-    uint8_t heapdata[256];
-    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+    uint8_t heapdata[1024];
+    multi_heap_handle_t heap = register_heap_with_free_size(heapdata, sizeof(heapdata), 220);
     multi_heap_info_t before, after, freed;
 
     multi_heap_get_info(heap, &before);
@@ -350,7 +375,7 @@ TEST_CASE("multi_heap_get_info() function", "[multi_heap]")
 TEST_CASE("multi_heap minimum-size allocations", "[multi_heap]")
 {
     uint8_t heapdata[16384];
-    void *p[sizeof(heapdata) / sizeof(void *)];
+    void *p[sizeof(heapdata) / sizeof(void *)] = { 0 };
     const size_t NUM_P = sizeof(p) / sizeof(void *);
     multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
 
@@ -391,8 +416,8 @@ TEST_CASE("multi_heap minimum-size allocations", "[multi_heap]")
 TEST_CASE("multi_heap_realloc()", "[multi_heap]")
 {
     const uint32_t PATTERN = 0xABABDADA;
-    uint8_t small_heap[300];
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    uint8_t small_heap[1024];
+    multi_heap_handle_t heap = register_heap_with_free_size(small_heap, sizeof(small_heap), 264);
 
     uint32_t *a = (uint32_t *)multi_heap_malloc(heap, 64);
     uint32_t *b = (uint32_t *)multi_heap_malloc(heap, 32);
@@ -445,11 +470,192 @@ TEST_CASE("multi_heap_realloc()", "[multi_heap]")
 
 TEST_CASE("corrupt heap block", "[multi_heap]")
 {
-    uint8_t small_heap[256];
-    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+    uint8_t small_heap[1024];
+    multi_heap_handle_t heap = register_heap_with_free_size(small_heap, sizeof(small_heap), 220);
 
     void *a = multi_heap_malloc(heap, 32);
     REQUIRE( multi_heap_check(heap, true) );
     memset(a, 0xEE, 64);
     REQUIRE( !multi_heap_check(heap, true) );
 }
+
+/* Time 'iterations' pairs of malloc & free of 'size' bytes, returns nanoseconds per pair */
+static double time_malloc_free(multi_heap_handle_t heap, size_t size, int iterations)
+{
+    int failures = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++) {
+        void *p = multi_heap_malloc(heap, size);
+        failures += (p == NULL);
+        multi_heap_free(heap, p);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    REQUIRE( failures == 0 );
+    return elapsed.count() / iterations;
+}
+
+TEST_CASE("multi_heap malloc time doesn't grow with fragmentation", "[multi_heap][bench]")
+{
+    static uint8_t heapdata[1024 * 1024];
+    const int ITERATIONS = 20000;
+    const size_t FRAGMENT_SIZE = 32;
+    const size_t ALLOC_SIZE = 64;
+    const int NUM_FRAGMENTS = 4096;
+    static void *p[NUM_FRAGMENTS * 2];
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+
+    double unfragmented = time_malloc_free(heap, ALLOC_SIZE, ITERATIONS);
+
+    /* Leave thousands of free blocks in the heap, none of them large enough for ALLOC_SIZE */
+    for (int i = 0; i < NUM_FRAGMENTS * 2; i++) {
+        p[i] = multi_heap_malloc(heap, FRAGMENT_SIZE);
+        REQUIRE( p[i] != NULL );
+    }
+    for (int i = 0; i < NUM_FRAGMENTS * 2; i += 2) {
+        multi_heap_free(heap, p[i]);
+    }
+    multi_heap_info_t info;
+    multi_heap_get_info(heap, &info);
+    REQUIRE( info.free_blocks > NUM_FRAGMENTS );
+
+    double fragmented = time_malloc_free(heap, ALLOC_SIZE, ITERATIONS);
+    printf("malloc+free of %zu bytes: %.0f ns unfragmented, %.0f ns with %zu free blocks\n",
+           ALLOC_SIZE, unfragmented, fragmented, info.free_blocks);
+    REQUIRE( multi_heap_check(heap, true) );
+
+    /* Allow plenty of margin for timing noise, walking the free list would be orders of magnitude slower */
+    REQUIRE( fragmented < unfragmented * 5 );
+
+    for (int i = 1; i < NUM_FRAGMENTS * 2; i += 2) {
+        multi_heap_free(heap, p[i]);
+    }
+    multi_heap_get_info(heap, &info);
+    REQUIRE( 1 == info.free_blocks );
+}
+
+/* Free every other pointer in 'p' (those with the same parity as 'first'), starting from the end of the array.
+   Returns nanoseconds per free */
+static double time_free_alternate(multi_heap_handle_t heap, void **p, int count, int first)
+{
+    int freed = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (int i = (count - 1) - ((count - 1 - first) % 2); i >= first; i -= 2) {
+        multi_heap_free(heap, p[i]);
+        p[i] = NULL;
+        freed++;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / freed;
+}
+
+TEST_CASE("multi_heap free time with a fragmented heap", "[multi_heap][bench]")
+{
+    static uint8_t heapdata[1024 * 1024];
+    const int NUM_BLOCKS = 8192;
+    const size_t BLOCK_SIZE = 32;
+    static void *p[NUM_BLOCKS];
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+
+    for (int i = 0; i < NUM_BLOCKS; i++) {
+        p[i] = multi_heap_malloc(heap, BLOCK_SIZE);
+        REQUIRE( p[i] != NULL );
+    }
+    /* Block before each freed block is still in use */
+    double prev_used = time_free_alternate(heap, p, NUM_BLOCKS, 0);
+
+    for (int i = 0; i < NUM_BLOCKS; i += 2) {
+        p[i] = multi_heap_malloc(heap, BLOCK_SIZE);
+        REQUIRE( p[i] != NULL );
+    }
+    for (int i = 0; i < NUM_BLOCKS; i += 2) {
+        multi_heap_free(heap, p[i]);
+        p[i] = NULL;
+    }
+    REQUIRE( multi_heap_check(heap, true) );
+
+    /* Block before each freed block is free, so they are merged */
+    double prev_free = time_free_alternate(heap, p, NUM_BLOCKS, 1);
+    printf("free of %zu bytes: %.0f ns when previous block is used, %.0f ns when it is free\n",
+           BLOCK_SIZE, prev_used, prev_free);
+
+    multi_heap_info_t info;
+    multi_heap_get_info(heap, &info);
+    REQUIRE( 1 == info.free_blocks );
+    REQUIRE( multi_heap_check(heap, true) );
+
+#ifdef MULTI_HEAP_BOUNDARY_TAGS
+    /* Without boundary tags, finding the previous block walks the heap and is orders of magnitude slower */
+    REQUIRE( prev_free < prev_used * 20 );
+#endif
+}
+
+TEST_CASE("multi_heap fragmentation-heavy workload", "[multi_heap]")
+{
+    static uint8_t heapdata[128 * 1024];
+    const int NUM_POINTERS = 1024;
+    const int ITERATIONS = 50000;
+    void *p[NUM_POINTERS] = { 0 };
+    size_t s[NUM_POINTERS] = { 0 };
+    multi_heap_info_t before, after;
+    multi_heap_handle_t heap = multi_heap_register(heapdata, sizeof(heapdata));
+
+    multi_heap_get_info(heap, &before);
+    size_t max_free_blocks = 0;
+    int failed_allocs = 0;
+
+    for (int i = 0; i < ITERATIONS; i++) {
+        int n = rand() % NUM_POINTERS;
+        if (p[n] != NULL) {
+            for (size_t j = 0; j < s[n]; j++) {
+                REQUIRE( ((uint8_t *)p[n])[j] == (uint8_t)n );
+            }
+            multi_heap_free(heap, p[n]);
+            p[n] = NULL;
+        } else {
+            /* Mostly small allocations, and occasional large ones which only fit once free space is merged */
+            s[n] = (rand() % 16 == 0) ? 512 + rand() % 2048 : 1 + rand() % 64;
+            p[n] = multi_heap_malloc(heap, s[n]);
+            if (p[n] != NULL) {
+                memset(p[n], n, s[n]);
+            } else {
+                failed_allocs++;
+            }
+        }
+
+        if (i % 1000 == 0) {
+            REQUIRE( multi_heap_check(heap, true) );
+            multi_heap_get_info(heap, &after);
+            max_free_blocks = std::max(max_free_blocks, after.free_blocks);
+        }
+    }
+    printf("up to %zu free blocks, %d failed allocations\n", max_free_blocks, failed_allocs);
+    REQUIRE( max_free_blocks > 20 ); // workload should fragment the heap
+
+    for (int i = 0; i < NUM_POINTERS; i++) {
+        multi_heap_free(heap, p[i]);
+    }
+    REQUIRE( multi_heap_check(heap, true) );
+    multi_heap_get_info(heap, &after);
+    REQUIRE( 1 == after.free_blocks );
+    REQUIRE( before.total_free_bytes == after.total_free_bytes );
+    REQUIRE( before.largest_free_block == after.largest_free_block );
+}
+
+#if defined(MULTI_HEAP_BOUNDARY_TAGS) && !defined(MULTI_HEAP_POISONING)
+TEST_CASE("corrupt boundary tag", "[multi_heap]")
+{
+    uint8_t small_heap[1024];
+    multi_heap_handle_t heap = multi_heap_register(small_heap, sizeof(small_heap));
+
+    void *a = multi_heap_malloc(heap, 32);
+    void *b = multi_heap_malloc(heap, 32);
+    REQUIRE( a != NULL );
+    REQUIRE( b != NULL );
+    multi_heap_free(heap, a);
+    REQUIRE( multi_heap_check(heap, true) );
+
+    /* The boundary tag is the last word of free block 'a', before the header of the block holding 'b' */
+    memset((uint8_t *)b - 2 * sizeof(void *), 0xEE, sizeof(void *));
+    REQUIRE( !multi_heap_check(heap, true) );
+}
+#endif
@@ -65,6 +65,38 @@ typedef enum {
 	NVS_READWRITE  /*!< Read and write */
 } nvs_open_mode;
 
+/**
+ * @brief Types of variables
+ *
+ */
+typedef enum {
+    NVS_TYPE_U8    = 0x01,  /*!< Type uint8_t */
+    NVS_TYPE_I8    = 0x11,  /*!< Type int8_t */
+    NVS_TYPE_U16   = 0x02,  /*!< Type uint16_t */
+    NVS_TYPE_I16   = 0x12,  /*!< Type int16_t */
+    NVS_TYPE_U32   = 0x04,  /*!< Type uint32_t */
+    NVS_TYPE_I32   = 0x14,  /*!< Type int32_t */
+    NVS_TYPE_U64   = 0x08,  /*!< Type uint64_t */
+    NVS_TYPE_I64   = 0x18,  /*!< Type int64_t */
+    NVS_TYPE_STR   = 0x21,  /*!< Type string */
+    NVS_TYPE_BLOB  = 0x41,  /*!< Type blob */
+    NVS_TYPE_ANY   = 0xff   /*!< Must be last */
+} nvs_type_t;
+
+/**
+ * @brief Information about entry obtained from nvs_entry_info function
+ */
+typedef struct {
+    char namespace_name[16];    /*!< Namespace to which key-value belong */
+    char key[16];               /*!< Key of stored key-value pair */
+    nvs_type_t type;            /*!< Type of stored key-value pair */
+} nvs_entry_info_t;
+
+/**
+ * Opaque pointer type representing iterator to nvs entries
+ */
+typedef struct nvs_opaque_iterator_t *nvs_iterator_t;
+
 /**
  * @brief      Open non-volatile storage with a given namespace from the default NVS partition
  *
@@ -300,6 +332,142 @@ esp_err_t nvs_get_str (nvs_handle handle, const char* key, char* out_value, size
 esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_value, size_t* length);
 /**@}*/
 
+/**
+ * Opaque pointer type representing a blob which is being written in pieces
+ */
+typedef struct nvs_opaque_blob_writer_t *nvs_blob_writer_t;
+
+/**
+ * Opaque pointer type representing a blob which is being read in pieces
+ */
+typedef struct nvs_opaque_blob_reader_t *nvs_blob_reader_t;
+
+/**
+ * @brief      Start writing a blob in pieces
+ *
+ * Data passed to nvs_blob_write is stored in the same format as data written
+ * by nvs_set_blob, so the blob can later be read using either nvs_get_blob or
+ * nvs_blob_read. Data is collected in a buffer of about 4 kB and written to
+ * flash whenever the buffer is full, so the complete blob doesn't have to be
+ * kept in RAM. The previous value of the blob stays valid until
+ * nvs_blob_write_close returns successfully.
+ *
+ * While the writer is open, the same key must not be written or erased by other
+ * means, and the writer has to be closed or aborted before the partition is
+ * deinitialized.
+ *
+ * @param[in]  handle      Handle obtained from nvs_open function.
+ *                         Handles that were opened read only cannot be used.
+ * @param[in]  key         Key name. Maximal length is 15 characters. Shouldn't be empty.
+ * @param[out] out_writer  Writer to be passed to nvs_blob_write. Only set if
+ *                         this function succeeds; the writer must then be
+ *                         released with nvs_blob_write_close or nvs_blob_write_abort.
+ *
+ * @return
+ *             - ESP_OK if the writer was created
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if storage handle was opened as read only
+ *             - ESP_ERR_NVS_KEY_TOO_LONG if key name is too long
+ *             - ESP_ERR_NVS_INVALID_STATE if a transaction is open on the handle
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_write_open(nvs_handle handle, const char* key, nvs_blob_writer_t* out_writer);
+
+/**
+ * @brief      Append data to a blob
+ *
+ * If this function fails, the data written so far is discarded and further
+ * calls return the same error. The writer still has to be released, using
+ * either nvs_blob_write_close, which returns that error, or nvs_blob_write_abort.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_write_open.
+ * @param[in]  data    Data to append.
+ * @param[in]  length  Length of data, in bytes.
+ *
+ * @return
+ *             - ESP_OK if data was appended
+ *             - ESP_ERR_NVS_VALUE_TOO_LONG if the blob doesn't fit into the partition
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space in the
+ *               underlying storage to save the value
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_write(nvs_blob_writer_t writer, const void* data, size_t length);
+
+/**
+ * @brief      Finish writing a blob and release the writer
+ *
+ * Remaining data and the blob index are written, which makes the new value
+ * visible, then the previous value is erased. If this function fails before
+ * the new value was made visible, the previous value is kept.
+ *
+ * The writer is released whether this function succeeds or fails, and must
+ * not be used afterwards.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_write_open.
+ *
+ * @return
+ *             - ESP_OK if the blob was written
+ *             - ESP_ERR_NVS_REMOVE_FAILED if the previous value wasn't erased because
+ *               flash write operation has failed. The new value was written however,
+ *               and the update will be finished after re-initialization of nvs.
+ *             - other error codes from nvs_blob_write
+ */
+esp_err_t nvs_blob_write_close(nvs_blob_writer_t writer);
+
+/**
+ * @brief      Discard data written so far and release the writer
+ *
+ * Use this instead of nvs_blob_write_close to keep the previous value. The
+ * writer must not be used afterwards.
+ *
+ * @param[in]  writer  Writer obtained from nvs_blob_write_open. NULL argument is allowed.
+ */
+void nvs_blob_write_abort(nvs_blob_writer_t writer);
+
+/**
+ * @brief      Start reading a blob in pieces
+ *
+ * Only the chunks of the blob which hold the requested range are read from flash.
+ * The blob must not be written or erased while the reader is open, and the reader
+ * has to be closed before the partition is deinitialized.
+ *
+ * @param[in]  handle      Handle obtained from nvs_open function.
+ * @param[in]  key         Key name. Maximal length is 15 characters. Shouldn't be empty.
+ * @param[out] out_reader  Reader to be passed to nvs_blob_read.
+ * @param[out] out_length  Length of the blob, in bytes. May be NULL.
+ *
+ * @return
+ *             - ESP_OK if the reader was created
+ *             - ESP_ERR_NVS_NOT_FOUND if the requested key doesn't exist
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_KEY_TOO_LONG if key name is too long
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_read_open(nvs_handle handle, const char* key, nvs_blob_reader_t* out_reader, size_t* out_length);
+
+/**
+ * @brief      Read a range of a blob
+ *
+ * @param[in]  reader     Reader obtained from nvs_blob_read_open.
+ * @param[in]  offset     Offset of the first byte to read.
+ * @param[out] out_value  Buffer for the data.
+ * @param[in]  length     Number of bytes to read.
+ *
+ * @return
+ *             - ESP_OK if data was read
+ *             - ESP_ERR_NVS_INVALID_LENGTH if the range exceeds the length of the blob
+ *             - ESP_ERR_NVS_NOT_FOUND if the blob was modified or a chunk of it is corrupted
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_blob_read(nvs_blob_reader_t reader, size_t offset, void* out_value, size_t length);
+
+/**
+ * @brief      Release a reader
+ *
+ * @param[in]  reader  Reader obtained from nvs_blob_read_open. NULL argument is allowed.
+ */
+void nvs_blob_read_close(nvs_blob_reader_t reader);
+
 /**
  * @brief      Erase key-value pair with given key name.
  *
@@ -333,6 +501,7 @@ esp_err_t nvs_erase_key(nvs_handle handle, const char* key);
  *              - ESP_OK if erase operation was successful
  *              - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
  *              - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *              - ESP_ERR_NOT_SUPPORTED if a transaction is open on this handle
  *              - other error codes from the underlying storage driver
  */
 esp_err_t nvs_erase_all(nvs_handle handle);
@@ -354,6 +523,69 @@ esp_err_t nvs_erase_all(nvs_handle handle);
  */
 esp_err_t nvs_commit(nvs_handle handle);
 
+/**
+ * @brief      Start a transaction on the storage handle
+ *
+ * While a transaction is open, nvs_set_* and nvs_erase_key calls made with this
+ * handle are not written to flash immediately, but are staged in RAM. They
+ * are applied together by nvs_tx_commit: after a power loss, either all of
+ * them or none of them are visible. Reads through any handle return values
+ * which have been committed to flash, not the staged ones.
+ *
+ * All staged items are written into a single NVS page, so a transaction can
+ * hold at most 125 entries (each primitive value or erase takes one entry,
+ * strings take one entry plus one per 32 bytes of data, blobs take one
+ * more entry than a string of the same length). The last entry of the page
+ * is kept for a mark written by nvs_tx_commit.
+ *
+ * Transactions are only available with CONFIG_NVS_TRANSACTIONS, see its help
+ * text about compatibility with older firmware.
+ *
+ * @param[in]  handle  Storage handle obtained with nvs_open.
+ *                     Handles that were opened read only cannot be used.
+ *
+ * @return
+ *             - ESP_OK if the transaction was started
+ *             - ESP_ERR_NOT_SUPPORTED if CONFIG_NVS_TRANSACTIONS is disabled
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_READ_ONLY if handle was opened as read only
+ *             - ESP_ERR_NVS_INVALID_STATE if a transaction is already open on this handle
+ */
+esp_err_t nvs_tx_begin(nvs_handle handle);
+
+/**
+ * @brief      Apply all changes staged since nvs_tx_begin
+ *
+ * The transaction is closed whether or not the commit succeeds.
+ *
+ * @param[in]  handle  Storage handle with an open transaction.
+ *
+ * @return
+ *             - ESP_OK if the changes have been written successfully
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_STATE if no transaction is open on this handle
+ *             - ESP_ERR_NVS_NOT_ENOUGH_SPACE if there is not enough space in the
+ *               underlying storage to save the changes
+ *             - ESP_ERR_NVS_REMOVE_FAILED if the changes were committed, but the values
+ *               they replace weren't removed because flash write operation has failed.
+ *               Removal will be finished after re-initialization of nvs, provided that
+ *               flash operation doesn't fail again.
+ *             - other error codes from the underlying storage driver
+ */
+esp_err_t nvs_tx_commit(nvs_handle handle);
+
+/**
+ * @brief      Discard all changes staged since nvs_tx_begin and close the transaction
+ *
+ * @param[in]  handle  Storage handle with an open transaction.
+ *
+ * @return
+ *             - ESP_OK if the transaction was discarded
+ *             - ESP_ERR_NVS_INVALID_HANDLE if handle has been closed or is NULL
+ *             - ESP_ERR_NVS_INVALID_STATE if no transaction is open on this handle
+ */
+esp_err_t nvs_tx_abort(nvs_handle handle);
+
 /**
  * @brief      Close the storage handle and free any allocated resources
  *
@@ -375,13 +607,16 @@ typedef struct {
     size_t free_entries;      /**< Amount of free entries. */
     size_t total_entries;     /**< Amount all available entries. */
     size_t namespace_count;   /**< Amount name space. */
+    uint32_t cache_hits;      /**< Number of reads served from the value cache. */
+    uint32_t cache_misses;    /**< Number of cacheable reads which had to access flash. */
 } nvs_stats_t;
 
 /**
  * @brief      Fill structure nvs_stats_t. It provides info about used memory the partition.
  *
  * This function calculates to runtime the number of used entries, free entries, total entries,
- * and amount namespace in partition.
+ * and amount namespace in partition. If the value cache is enabled (CONFIG_NVS_VALUE_CACHE),
+ * the number of cache hits and misses since the partition was initialized is also returned.
  *
  * \code{c}
  * // Example of nvs_get_stats() to get the number of used entries and free entries:
@@ -450,6 +685,73 @@ esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats);
  */
 esp_err_t nvs_get_used_entry_count(nvs_handle handle, size_t* used_entries);
 
+/**
+ * @brief       Create an iterator to enumerate NVS entries based on one or more parameters
+ *
+ * \code{c}
+ * // Example of listing all the key-value pairs of any type under specified partition and namespace
+ * nvs_iterator_t it = nvs_entry_find(partition, namespace, NVS_TYPE_ANY);
+ * while (it != NULL) {
+ *         nvs_entry_info_t info;
+ *         nvs_entry_info(it, &info);
+ *         it = nvs_entry_next(it);
+ *         printf("key '%s', type '%d' \n", info.key, info.type);
+ * };
+ * // Note: no need to release iterator obtained from nvs_entry_find function when
+ * //       nvs_entry_find or nvs_entry_next function return NULL, indicating no other
+ * //       element for specified criteria was found.
+ * \endcode
+ *
+ * Entries are enumerated in a single pass over the pages of the partition, in the order
+ * in which they are stored. Writing or erasing entries of the same partition while the
+ * iterator is in use may cause entries to be skipped or returned more than once.
+ * The iterator has to be released before the partition is deinitialized.
+ *
+ * @param[in]   part_name       Partition name
+ *
+ * @param[in]   namespace_name  Set this value if looking for entries with
+ *                              a specific namespace. Pass NULL otherwise.
+ *
+ * @param[in]   type            One of nvs_type_t values.
+ *
+ * @return
+ *          Iterator used to enumerate all the entries found,
+ *          or NULL if no entry satisfying criteria was found.
+ *          Iterator obtained through this function has to be released
+ *          using nvs_release_iterator when not used any more.
+ */
+nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type);
+
+/**
+ * @brief       Returns next item matching the iterator criteria, NULL if no such item exists.
+ *
+ * Note that any copies of the iterator will be invalid after this call.
+ *
+ * @param[in]   iterator     Iterator obtained from nvs_entry_find function. Must be non-NULL.
+ *
+ * @return
+ *          NULL if no entry was found, valid nvs_iterator_t otherwise.
+ *          The iterator is released in the former case.
+ */
+nvs_iterator_t nvs_entry_next(nvs_iterator_t iterator);
+
+/**
+ * @brief       Fills nvs_entry_info_t structure with information about entry pointed to by the iterator.
+ *
+ * @param[in]   iterator     Iterator obtained from nvs_entry_find or nvs_entry_next function. Must be non-NULL.
+ *
+ * @param[out]  out_info     Structure to which entry information is copied.
+ */
+void nvs_entry_info(nvs_iterator_t iterator, nvs_entry_info_t *out_info);
+
+/**
+ * @brief       Release iterator
+ *
+ * @param[in]   iterator    Release iterator obtained from nvs_entry_find function. NULL argument is allowed.
+ *
+ */
+void nvs_release_iterator(nvs_iterator_t iterator);
+
 #ifdef __cplusplus
 } // extern "C"
 #endif
@@ -85,6 +85,31 @@ esp_err_t nvs_flash_deinit(void);
  */
 esp_err_t nvs_flash_deinit_partition(const char* partition_label);
 
+/**
+ * @brief Reclaim space taken by erased entries of the given NVS partition
+ *
+ * When a write needs a new page and only one free page is left, the remaining
+ * items of another page have to be moved before that page can be erased and
+ * reused, which makes this write much slower than others. This function does
+ * the same work in advance, moving at most max_items items per call, so that
+ * it can be called repeatedly while the application is idle.
+ *
+ * The page with the most unused entries is reclaimed first. Nothing is done
+ * once the number of free pages set in menuconfig is reached.
+ *
+ * @param[in]  part_name   Name (label) of the partition, NULL for the default
+ *                         NVS partition
+ * @param[in]  max_items   Maximum number of items moved by this call
+ *
+ * @return
+ *      - ESP_OK if some of the work was done, call again to continue
+ *      - ESP_ERR_NVS_NOT_FOUND if there is nothing to reclaim at the moment
+ *      - ESP_ERR_NVS_NOT_INITIALIZED if the storage for given partition was not
+ *        initialized prior to this call
+ *      - one of the error codes from the underlying flash storage driver
+ */
+esp_err_t nvs_flash_compact_partition(const char* part_name, size_t max_items);
+
 /**
  * @brief Erase the default NVS partition
  *
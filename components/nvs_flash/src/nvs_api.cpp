@@ -14,6 +14,7 @@
 #include "nvs.hpp"
 #include "nvs_flash.h"
 #include "nvs_storage.hpp"
+#include "nvs_blob_stream.hpp"
 #include "intrusive_list.h"
 #include "nvs_platform.hpp"
 #include "esp_partition.h"
@@ -59,6 +60,7 @@ public:
     uint8_t mReadOnly;
     uint8_t mNsIndex;
     nvs::Storage* mStoragePtr;
+    nvs::Transaction* mTransaction = nullptr;
 };
 
 #ifdef ESP_PLATFORM
@@ -236,6 +238,7 @@ extern "C" esp_err_t nvs_flash_deinit_partition(const char* partition_name)
             ESP_LOGD(TAG, "Deleting handle %d (ns=%d) related to partition \"%s\" (missing call to nvs_close?)",
                      it->mHandle, it->mNsIndex, partition_name);
             s_nvs_handles.erase(it);
+            delete it->mTransaction;
             delete static_cast<HandleEntry*>(it);
         }
         it = next;
@@ -253,6 +256,18 @@ extern "C" esp_err_t nvs_flash_deinit(void)
     return nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME);
 }
 
+extern "C" esp_err_t nvs_flash_compact_partition(const char* part_name, size_t max_items)
+{
+    Lock lock;
+
+    nvs::Storage* storage = lookup_storage_from_name((part_name == NULL) ? NVS_DEFAULT_PART_NAME : part_name);
+    if (!storage) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    return storage->compact(max_items);
+}
+
 static esp_err_t nvs_find_ns_handle(nvs_handle handle, HandleEntry& entry)
 {
     auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
@@ -310,6 +325,7 @@ extern "C" void nvs_close(nvs_handle handle)
         return;
     }
     s_nvs_handles.erase(it);
+    delete it->mTransaction;
     delete static_cast<HandleEntry*>(it);
 }
 
@@ -325,6 +341,9 @@ extern "C" esp_err_t nvs_erase_key(nvs_handle handle, const char* key)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return entry.mStoragePtr->eraseItem(*entry.mTransaction, entry.mNsIndex, key);
+    }
     return entry.mStoragePtr->eraseItem(entry.mNsIndex, key);
 }
 
@@ -340,6 +359,9 @@ extern "C" esp_err_t nvs_erase_all(nvs_handle handle)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return ESP_ERR_NOT_SUPPORTED;
+    }
     return entry.mStoragePtr->eraseNamespace(entry.mNsIndex);
 }
 
@@ -356,6 +378,9 @@ static esp_err_t nvs_set(nvs_handle handle, const char* key, T value)
     if (entry.mReadOnly) {
         return ESP_ERR_NVS_READ_ONLY;
     }
+    if (entry.mTransaction) {
+        return entry.mStoragePtr->writeItem(*entry.mTransaction, entry.mNsIndex, key, value);
+    }
     return entry.mStoragePtr->writeItem(entry.mNsIndex, key, value);
 }
 
@@ -407,6 +432,67 @@ extern "C" esp_err_t nvs_commit(nvs_handle handle)
     return nvs_find_ns_handle(handle, entry);
 }
 
+extern "C" esp_err_t nvs_tx_begin(nvs_handle handle)
+{
+#ifndef CONFIG_NVS_TRANSACTIONS
+    return ESP_ERR_NOT_SUPPORTED;
+#else
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
+        return e.mHandle == handle;
+    });
+    if (it == end(s_nvs_handles)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (it->mReadOnly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (it->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    it->mTransaction = new Transaction;
+    return ESP_OK;
+#endif // CONFIG_NVS_TRANSACTIONS
+}
+
+extern "C" esp_err_t nvs_tx_commit(nvs_handle handle)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
+        return e.mHandle == handle;
+    });
+    if (it == end(s_nvs_handles)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!it->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    auto err = it->mStoragePtr->commitTransaction(*it->mTransaction);
+    delete it->mTransaction;
+    it->mTransaction = nullptr;
+    return err;
+}
+
+extern "C" esp_err_t nvs_tx_abort(nvs_handle handle)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %d", __func__, handle);
+    auto it = find_if(begin(s_nvs_handles), end(s_nvs_handles), [=](HandleEntry& e) -> bool {
+        return e.mHandle == handle;
+    });
+    if (it == end(s_nvs_handles)) {
+        return ESP_ERR_NVS_INVALID_HANDLE;
+    }
+    if (!it->mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    delete it->mTransaction;
+    it->mTransaction = nullptr;
+    return ESP_OK;
+}
+
 extern "C" esp_err_t nvs_set_str(nvs_handle handle, const char* key, const char* value)
 {
     Lock lock;
@@ -416,6 +502,9 @@ extern "C" esp_err_t nvs_set_str(nvs_handle handle, const char* key, const char*
     if (err != ESP_OK) {
         return err;
     }
+    if (entry.mTransaction) {
+        return entry.mStoragePtr->writeItem(*entry.mTransaction, entry.mNsIndex, nvs::ItemType::SZ, key, value, strlen(value) + 1);
+    }
     return entry.mStoragePtr->writeItem(entry.mNsIndex, nvs::ItemType::SZ, key, value, strlen(value) + 1);
 }
 
@@ -428,6 +517,9 @@ extern "C" esp_err_t nvs_set_blob(nvs_handle handle, const char* key, const void
     if (err != ESP_OK) {
         return err;
     }
+    if (entry.mTransaction) {
+        return entry.mStoragePtr->writeItem(*entry.mTransaction, entry.mNsIndex, nvs::ItemType::BLOB, key, value, length);
+    }
     return entry.mStoragePtr->writeItem(entry.mNsIndex, nvs::ItemType::BLOB, key, value, length);
 }
 
@@ -525,6 +617,96 @@ extern "C" esp_err_t nvs_get_blob(nvs_handle handle, const char* key, void* out_
     return nvs_get_str_or_blob(handle, nvs::ItemType::BLOB, key, out_value, length);
 }
 
+extern "C" esp_err_t nvs_blob_write_open(nvs_handle handle, const char* key, nvs_blob_writer_t* out_writer)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(handle, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (entry.mReadOnly) {
+        return ESP_ERR_NVS_READ_ONLY;
+    }
+    if (entry.mTransaction) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    if (strlen(key) > nvs::Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    nvs_blob_writer_t writer = new nvs_opaque_blob_writer_t{nvs::BlobWriter(*entry.mStoragePtr, entry.mNsIndex, key)};
+    err = writer->writer.open();
+    if (err != ESP_OK) {
+        delete writer;
+        return err;
+    }
+    *out_writer = writer;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_blob_write(nvs_blob_writer_t writer, const void* data, size_t length)
+{
+    Lock lock;
+    return writer->writer.write(data, length);
+}
+
+extern "C" esp_err_t nvs_blob_write_close(nvs_blob_writer_t writer)
+{
+    Lock lock;
+    auto err = writer->writer.close();
+    delete writer;
+    return err;
+}
+
+extern "C" void nvs_blob_write_abort(nvs_blob_writer_t writer)
+{
+    Lock lock;
+    if (writer) {
+        writer->writer.abort();
+        delete writer;
+    }
+}
+
+extern "C" esp_err_t nvs_blob_read_open(nvs_handle handle, const char* key, nvs_blob_reader_t* out_reader, size_t* out_length)
+{
+    Lock lock;
+    ESP_LOGD(TAG, "%s %s", __func__, key);
+    HandleEntry entry;
+    auto err = nvs_find_ns_handle(handle, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (strlen(key) > nvs::Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    nvs_blob_reader_t reader = new nvs_opaque_blob_reader_t{nvs::BlobReader(*entry.mStoragePtr, entry.mNsIndex, key)};
+    size_t length;
+    err = reader->reader.open(length);
+    if (err != ESP_OK) {
+        delete reader;
+        return err;
+    }
+    if (out_length) {
+        *out_length = length;
+    }
+    *out_reader = reader;
+    return ESP_OK;
+}
+
+extern "C" esp_err_t nvs_blob_read(nvs_blob_reader_t reader, size_t offset, void* out_value, size_t length)
+{
+    Lock lock;
+    return reader->reader.read(offset, out_value, length);
+}
+
+extern "C" void nvs_blob_read_close(nvs_blob_reader_t reader)
+{
+    delete reader;
+}
+
 extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats)
 {
     Lock lock;
@@ -537,6 +719,8 @@ extern "C" esp_err_t nvs_get_stats(const char* part_name, nvs_stats_t* nvs_stats
     nvs_stats->free_entries     = 0;
     nvs_stats->total_entries    = 0;
     nvs_stats->namespace_count  = 0;
+    nvs_stats->cache_hits       = 0;
+    nvs_stats->cache_misses     = 0;
 
     pStorage = lookup_storage_from_name((part_name == NULL) ? NVS_DEFAULT_PART_NAME : part_name);
     if (pStorage == NULL) {
@@ -572,6 +756,52 @@ extern "C" esp_err_t nvs_get_used_entry_count(nvs_handle handle, size_t* used_en
     return err;
 }
 
+extern "C" nvs_iterator_t nvs_entry_find(const char *part_name, const char *namespace_name, nvs_type_t type)
+{
+    Lock lock;
+    nvs::Storage *pStorage;
+
+    pStorage = lookup_storage_from_name((part_name == NULL) ? NVS_DEFAULT_PART_NAME : part_name);
+    if (pStorage == NULL || !pStorage->isValid()) {
+        return NULL;
+    }
+
+    nvs_iterator_t it = new nvs_opaque_iterator_t;
+    it->type = type;
+    it->storage = pStorage;
+
+    if (!pStorage->findEntry(it, namespace_name)) {
+        delete it;
+        return NULL;
+    }
+    return it;
+}
+
+extern "C" nvs_iterator_t nvs_entry_next(nvs_iterator_t it)
+{
+    Lock lock;
+    assert(it);
+
+    if (!it->storage->nextEntry(it)) {
+        delete it;
+        return NULL;
+    }
+    return it;
+}
+
+extern "C" void nvs_entry_info(nvs_iterator_t it, nvs_entry_info_t *out_info)
+{
+    Lock lock;
+    assert(it && out_info);
+
+    it->storage->fillEntryInfo(it->entry, *out_info);
+}
+
+extern "C" void nvs_release_iterator(nvs_iterator_t it)
+{
+    delete it;
+}
+
 #if (defined CONFIG_NVS_ENCRYPTION) && (defined ESP_PLATFORM)
 
 extern "C" esp_err_t nvs_flash_generate_keys(const esp_partition_t* partition, nvs_sec_cfg_t* cfg)
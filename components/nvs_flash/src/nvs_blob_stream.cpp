@@ -0,0 +1,353 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_blob_stream.hpp"
+#include "nvs_storage.hpp"
+
+namespace nvs
+{
+
+static const uint8_t MAX_CHUNK_COUNT = (Page::CHUNK_ANY - 1) / 2;
+
+BlobWriter::BlobWriter(Storage& storage, uint8_t nsIndex, const char* key) :
+    mStorage(storage), mNsIndex(nsIndex)
+{
+    strncpy(mKey, key, sizeof(mKey) - 1);
+    mKey[sizeof(mKey) - 1] = 0;
+}
+
+esp_err_t BlobWriter::open()
+{
+    if (!mStorage.isValid()) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    auto err = mStorage.loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = mStorage.eraseMarkedItems();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* Write the new version next to the current one, same as Storage::writeItem */
+    Item item;
+    Page* findPage = nullptr;
+    err = mStorage.findItem(mNsIndex, ItemType::BLOB_IDX, mKey, findPage, item);
+    if (err == ESP_OK) {
+        mChunkStart = (item.blobIndex.chunkStart == VerOffset::VER_1_OFFSET) ? VerOffset::VER_0_OFFSET : VerOffset::VER_1_OFFSET;
+    } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+
+    mBuffer.reset(new uint8_t[Page::CHUNK_MAX_SIZE]);
+    return ESP_OK;
+}
+
+esp_err_t BlobWriter::write(const void* data, size_t dataSize)
+{
+    if (mError != ESP_OK) {
+        return mError;
+    }
+    if (dataSize > mStorage.getMaxBlobSize() - mDataSize) {
+        abort();
+        mError = ESP_ERR_NVS_VALUE_TOO_LONG;
+        return mError;
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    while (dataSize > 0) {
+        if (mBufferedSize == Page::CHUNK_MAX_SIZE) {
+            auto err = writeChunk();
+            if (err != ESP_OK) {
+                abort();
+                mError = err;
+                return err;
+            }
+        }
+        size_t willCopy = Page::CHUNK_MAX_SIZE - mBufferedSize;
+        willCopy = (dataSize < willCopy) ? dataSize : willCopy;
+        memcpy(mBuffer.get() + mBufferedSize, src, willCopy);
+        mBufferedSize += willCopy;
+        mDataSize += willCopy;
+        src += willCopy;
+        dataSize -= willCopy;
+    }
+    return ESP_OK;
+}
+
+esp_err_t BlobWriter::close()
+{
+    if (mError != ESP_OK) {
+        return mError;
+    }
+
+    esp_err_t err = ESP_OK;
+    while (err == ESP_OK && (mBufferedSize > 0 || mChunkCount == 0)) {
+        err = writeChunk();
+    }
+    if (err == ESP_OK) {
+        err = writeIndex();
+    }
+    if (err != ESP_OK) {
+        abort();
+        mError = err;
+        return err;
+    }
+    mBuffer.reset();
+
+    /* The new version is valid now, erase the previous one */
+    VerOffset prevStart = (mChunkStart == VerOffset::VER_1_OFFSET) ? VerOffset::VER_0_OFFSET : VerOffset::VER_1_OFFSET;
+    err = mStorage.eraseMultiPageBlob(mNsIndex, mKey, prevStart);
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        /* Support for earlier versions where BLOBS were stored without index */
+        Item item;
+        Page* findPage = nullptr;
+        err = mStorage.findItem(mNsIndex, ItemType::BLOB, mKey, findPage, item);
+        if (err == ESP_OK) {
+            err = mStorage.eraseItemFromPage(*findPage, mNsIndex, ItemType::BLOB, mKey);
+        }
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND) {
+        err = ESP_OK;
+    }
+    if (err == ESP_ERR_FLASH_OP_FAIL) {
+        return ESP_ERR_NVS_REMOVE_FAILED;
+    }
+#ifndef ESP_PLATFORM
+    if (err == ESP_OK) {
+        mStorage.debugCheck();
+    }
+#endif
+    return err;
+}
+
+void BlobWriter::abort()
+{
+    for (uint8_t chunkNum = 0; chunkNum < mChunkCount; ++chunkNum) {
+        Item item;
+        Page* findPage = nullptr;
+        uint8_t chunkIdx = static_cast<uint8_t>(mChunkStart) + chunkNum;
+        if (mStorage.findItem(mNsIndex, ItemType::BLOB_DATA, mKey, findPage, item, chunkIdx) == ESP_OK) {
+            mStorage.eraseItemFromPage(*findPage, mNsIndex, ItemType::BLOB_DATA, mKey, chunkIdx);
+        }
+    }
+    mChunkCount = 0;
+    mBufferedSize = 0;
+    mBuffer.reset();
+}
+
+esp_err_t BlobWriter::writeChunk()
+{
+    if (mChunkCount >= MAX_CHUNK_COUNT) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    while (true) {
+        Page& page = mStorage.getCurrentPage();
+        size_t tailroom = page.getVarDataTailroom();
+        /* Don't start the blob with a tiny chunk, same as Storage::writeMultiPageBlob */
+        if (tailroom == 0 || (mChunkCount == 0 && tailroom < mBufferedSize && tailroom < Page::CHUNK_MAX_SIZE / 10)) {
+            if (page.state() != Page::PageState::FULL) {
+                auto err = page.markFull();
+                if (err != ESP_OK) {
+                    return err;
+                }
+            }
+            auto err = mStorage.requestNewPage();
+            if (err != ESP_OK) {
+                return err;
+            }
+            if (mStorage.getCurrentPage().getVarDataTailroom() == tailroom) {
+                return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+            }
+            continue;
+        }
+
+        size_t chunkSize = (mBufferedSize < tailroom) ? mBufferedSize : tailroom;
+        auto err = mStorage.writeItemToPage(page, mNsIndex, ItemType::BLOB_DATA, mKey, mBuffer.get(), chunkSize,
+                static_cast<uint8_t>(mChunkStart) + mChunkCount);
+        assert(err != ESP_ERR_NVS_PAGE_FULL);
+        if (err != ESP_OK) {
+            return err;
+        }
+        ++mChunkCount;
+        mBufferedSize -= chunkSize;
+        memmove(mBuffer.get(), mBuffer.get() + chunkSize, mBufferedSize);
+        return ESP_OK;
+    }
+}
+
+esp_err_t BlobWriter::writeIndex()
+{
+    Item item;
+    std::fill_n(item.data, sizeof(item.data), 0xff);
+    item.blobIndex.dataSize = mDataSize;
+    item.blobIndex.chunkCount = mChunkCount;
+    item.blobIndex.chunkStart = mChunkStart;
+
+    Page* page = &mStorage.getCurrentPage();
+    auto err = mStorage.writeItemToPage(*page, mNsIndex, ItemType::BLOB_IDX, mKey, item.data, sizeof(item.data));
+    if (err == ESP_ERR_NVS_PAGE_FULL) {
+        if (page->state() != Page::PageState::FULL) {
+            err = page->markFull();
+            if (err != ESP_OK) {
+                return err;
+            }
+        }
+        err = mStorage.requestNewPage();
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = mStorage.writeItemToPage(mStorage.getCurrentPage(), mNsIndex, ItemType::BLOB_IDX, mKey, item.data, sizeof(item.data));
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+    }
+    return err;
+}
+
+BlobReader::BlobReader(Storage& storage, uint8_t nsIndex, const char* key) :
+    mStorage(storage), mNsIndex(nsIndex)
+{
+    strncpy(mKey, key, sizeof(mKey) - 1);
+    mKey[sizeof(mKey) - 1] = 0;
+}
+
+esp_err_t BlobReader::open(size_t& dataSize)
+{
+    if (!mStorage.isValid()) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    auto err = mStorage.findItem(mNsIndex, ItemType::BLOB_IDX, mKey, findPage, item);
+    if (err == ESP_OK) {
+        mChunkType = ItemType::BLOB_DATA;
+        mChunkStart = item.blobIndex.chunkStart;
+        mChunkCount = item.blobIndex.chunkCount;
+        mDataSize = item.blobIndex.dataSize;
+    } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+        /* Blob stored in the old format, as a single item */
+        err = mStorage.findItem(mNsIndex, ItemType::BLOB, mKey, findPage, item);
+        if (err != ESP_OK) {
+            return err;
+        }
+        mChunkType = ItemType::BLOB;
+        mChunkCount = 1;
+        mDataSize = item.varLength.dataSize;
+    } else {
+        return err;
+    }
+
+    mChunkLoaded = false;
+    dataSize = mDataSize;
+    return ESP_OK;
+}
+
+esp_err_t BlobReader::read(size_t offset, void* data, size_t dataSize)
+{
+    if (offset > mDataSize || dataSize > mDataSize - offset) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    while (dataSize > 0) {
+        auto err = selectChunk(offset);
+        if (err != ESP_OK) {
+            return err;
+        }
+
+        size_t chunkOffset = offset - mChunkOffset;
+        size_t willRead = mChunkSize - chunkOffset;
+        willRead = (dataSize < willRead) ? dataSize : willRead;
+
+        err = mChunkPage->readItemData(mChunkItemIndex, mChunkItem, chunkOffset, dst, willRead, !mChunkVerified);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            // items are moved to another page when their page is freed
+            err = findChunk();
+            if (err == ESP_OK && mChunkItem.varLength.dataSize != mChunkSize) {
+                err = ESP_ERR_NVS_NOT_FOUND;
+            }
+            if (err == ESP_OK) {
+                err = mChunkPage->readItemData(mChunkItemIndex, mChunkItem, chunkOffset, dst, willRead, true);
+            }
+        }
+        if (err != ESP_OK) {
+            mChunkLoaded = false;
+            return err;
+        }
+        mChunkVerified = true;
+
+        offset += willRead;
+        dst += willRead;
+        dataSize -= willRead;
+    }
+    return ESP_OK;
+}
+
+esp_err_t BlobReader::selectChunk(size_t offset)
+{
+    if (!mChunkLoaded || offset < mChunkOffset) {
+        mChunkNum = 0;
+        mChunkOffset = 0;
+        mChunkSize = 0;
+    } else if (offset < mChunkOffset + mChunkSize) {
+        return ESP_OK;
+    } else {
+        mChunkOffset += mChunkSize;
+        ++mChunkNum;
+    }
+
+    /* Only chunk headers are read while skipping to the chunk which holds the offset */
+    while (true) {
+        if (mChunkNum >= mChunkCount) {
+            mChunkLoaded = false;
+            return ESP_ERR_NVS_NOT_FOUND;
+        }
+        auto err = findChunk();
+        if (err != ESP_OK) {
+            mChunkLoaded = false;
+            return err;
+        }
+        mChunkSize = mChunkItem.varLength.dataSize;
+        if (offset < mChunkOffset + mChunkSize) {
+            break;
+        }
+        mChunkOffset += mChunkSize;
+        ++mChunkNum;
+    }
+    mChunkLoaded = true;
+    mChunkVerified = false;
+    return ESP_OK;
+}
+
+esp_err_t BlobReader::findChunk()
+{
+    mChunkItemIndex = 0;
+    return mStorage.findItem(mNsIndex, mChunkType, mKey, mChunkPage, mChunkItemIndex, mChunkItem, getChunkIndex(mChunkNum));
+}
+
+uint8_t BlobReader::getChunkIndex(uint8_t chunkNum) const
+{
+    if (mChunkType == ItemType::BLOB) {
+        return Page::CHUNK_ANY;
+    }
+    return static_cast<uint8_t>(mChunkStart) + chunkNum;
+}
+
+} // namespace nvs
@@ -0,0 +1,132 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_blob_stream_hpp
+#define nvs_blob_stream_hpp
+
+#include <memory>
+#include "nvs.h"
+#include "nvs_types.hpp"
+
+namespace nvs
+{
+
+class Storage;
+class Page;
+
+/**
+ * Writes a blob in pieces, using the same chunk layout as
+ * Storage::writeMultiPageBlob.
+ *
+ * Data is collected in a buffer of Page::CHUNK_MAX_SIZE bytes. Whenever the
+ * buffer is full, as much of it as fits into the current page is written as
+ * a data chunk of the new blob version. The blob index is only written by
+ * close(), so until then the previous version of the blob stays valid.
+ * Chunks left behind by a writer which was never closed are removed as
+ * orphans by Storage::init.
+ */
+class BlobWriter
+{
+public:
+    BlobWriter(Storage& storage, uint8_t nsIndex, const char* key);
+
+    esp_err_t open();
+
+    esp_err_t write(const void* data, size_t dataSize);
+
+    /**
+     * Write the remaining data and the blob index, then erase the previous
+     * version of the blob. Written chunks are erased if this fails.
+     */
+    esp_err_t close();
+
+    /**
+     * Erase all chunks written so far.
+     */
+    void abort();
+
+protected:
+    esp_err_t writeChunk();
+
+    esp_err_t writeIndex();
+
+    Storage& mStorage;
+    uint8_t mNsIndex;
+    char mKey[Item::MAX_KEY_LENGTH + 1];
+    VerOffset mChunkStart = VerOffset::VER_0_OFFSET;
+    uint8_t mChunkCount = 0;
+    size_t mDataSize = 0;
+    std::unique_ptr<uint8_t[]> mBuffer;
+    size_t mBufferedSize = 0;
+    esp_err_t mError = ESP_OK;
+}; // class BlobWriter
+
+/**
+ * Reads arbitrary ranges of a blob, only accessing the chunks which hold
+ * the requested range.
+ *
+ * The data checksum of a chunk is verified when the chunk is read for the
+ * first time. The page and entry index of the chunk are kept, so consecutive
+ * reads from the same chunk don't search for it again, and only read its
+ * header and the entries which hold the requested data.
+ */
+class BlobReader
+{
+public:
+    BlobReader(Storage& storage, uint8_t nsIndex, const char* key);
+
+    esp_err_t open(size_t& dataSize);
+
+    esp_err_t read(size_t offset, void* data, size_t dataSize);
+
+protected:
+    esp_err_t selectChunk(size_t offset);
+
+    esp_err_t findChunk();
+
+    uint8_t getChunkIndex(uint8_t chunkNum) const;
+
+    Storage& mStorage;
+    uint8_t mNsIndex;
+    char mKey[Item::MAX_KEY_LENGTH + 1];
+    ItemType mChunkType = ItemType::BLOB_DATA;  // ItemType::BLOB for blobs stored in the old format
+    VerOffset mChunkStart = VerOffset::VER_0_OFFSET;
+    uint8_t mChunkCount = 0;
+    size_t mDataSize = 0;
+
+    // chunk which holds the most recently read data
+    bool mChunkLoaded = false;
+    uint8_t mChunkNum = 0;
+    size_t mChunkOffset = 0;
+    size_t mChunkSize = 0;
+    bool mChunkVerified = false;
+    Page* mChunkPage = nullptr;
+    size_t mChunkItemIndex = 0;
+    Item mChunkItem;
+}; // class BlobReader
+
+} // namespace nvs
+
+struct nvs_opaque_blob_writer_t
+{
+    nvs::BlobWriter writer;
+};
+
+struct nvs_opaque_blob_reader_t
+{
+    nvs::BlobReader reader;
+};
+
+
+#endif /* nvs_blob_stream_hpp */
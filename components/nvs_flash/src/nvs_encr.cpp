@@ -46,8 +46,19 @@ namespace nvs
         return isActive;
     }
 
+    static bool isAddrInCtxt(const XtsCtxt* ctx, uint32_t addr)
+    {
+        return (ctx->baseSector * SPI_FLASH_SEC_SIZE <= addr)
+            && (addr < (ctx->baseSector + ctx->sectorCount) * SPI_FLASH_SEC_SIZE);
+    }
+
     XtsCtxt* EncrMgr::findXtsCtxtFromAddr(uint32_t addr) {
 
+        /* Consecutive accesses almost always go to the same partition, check the last match first */
+        if (lastCtxt && isAddrInCtxt(lastCtxt, addr)) {
+            return lastCtxt;
+        }
+
         auto it = find_if(std::begin(xtsCtxtList), std::end(xtsCtxtList), [=](XtsCtxt& ctx) -> bool
                 { return (ctx.baseSector * SPI_FLASH_SEC_SIZE  <= addr)
                 && (addr < (ctx.baseSector + ctx.sectorCount) * SPI_FLASH_SEC_SIZE); });
@@ -55,6 +66,7 @@ namespace nvs
         if (it == std::end(xtsCtxtList)) {
             return nullptr;
         }
+        lastCtxt = it;
         return it;
     }
 
@@ -88,6 +100,9 @@ namespace nvs
         if(!xtsCtxt) {
             return ESP_ERR_NVS_XTS_CFG_NOT_FOUND;
         }
+        if (lastCtxt == xtsCtxt) {
+            lastCtxt = nullptr;
+        }
         xtsCtxtList.erase(xtsCtxt);
         delete xtsCtxt;
 
@@ -128,22 +143,27 @@ namespace nvs
 
     esp_err_t EncrMgr::decryptNvsData(uint8_t* ctxt, uint32_t addr, uint32_t ctxtLen, XtsCtxt* xtsCtxt) {
 
+        uint8_t entrySize = sizeof(Item);
+
         //sector num required as an arr by mbedtls. Should have been just uint64/32.
         uint8_t data_unit[16];
 
-
-        /** Currently upper layer of NVS reads entries one by one even for variable size
-        * multi-entry data types. So length should always be equal to size of an entry.*/
-        assert(ctxtLen == sizeof(Item));
+        /* Spans of consecutive entries are decrypted in one call, each entry is still
+         * a separate data unit with its own address as the tweak, same as in encryptNvsData */
+        assert(ctxtLen % entrySize == 0);
 
         uint32_t relAddr = addr - (xtsCtxt->baseSector * SPI_FLASH_SEC_SIZE);
 
         memset(data_unit, 0, sizeof(data_unit));
 
-        memcpy(data_unit, &relAddr, sizeof(relAddr));
+        for(uint32_t offset = 0; offset < ctxtLen; offset += entrySize)
+        {
+            uint32_t entryAddr = relAddr + offset;
+            memcpy(data_unit, &entryAddr, sizeof(entryAddr));
 
-        if(mbedtls_aes_crypt_xts(xtsCtxt->dctxt, MBEDTLS_AES_DECRYPT, ctxtLen, data_unit, ctxt, ctxt))  {
-            return ESP_ERR_NVS_XTS_DECR_FAILED;
+            if(mbedtls_aes_crypt_xts(xtsCtxt->dctxt, MBEDTLS_AES_DECRYPT, entrySize, data_unit, ctxt + offset, ctxt + offset))  {
+                return ESP_ERR_NVS_XTS_DECR_FAILED;
+            }
         }
         return ESP_OK;
     }
@@ -49,6 +49,7 @@ class EncrMgr
         static bool isActive;
         static EncrMgr* instance;
         intrusive_list<XtsCtxt> xtsCtxtList;
+        XtsCtxt* lastCtxt = nullptr;   // context found by the most recent lookup
         EncrMgr() {}
 
 }; // class EncrMgr
@@ -13,22 +13,26 @@
 // limitations under the License.
 
 #include "nvs_item_hash_list.hpp"
+#include "nvs_page.hpp"
 
 namespace nvs
 {
 
+static_assert(Page::ENTRY_COUNT <= HashList::ITEM_COUNT, "hash list should fit all entries of a page");
+
+const size_t HashList::ITEM_COUNT;
+const size_t HashList::MIN_CAPACITY;
+
 HashList::HashList()
 {
 }
     
 void HashList::clear()
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        auto tmp = it;
-        ++it;
-        mBlockList.erase(tmp);
-        delete static_cast<HashListBlock*>(tmp);
-    }
+    delete[] mNodes;
+    mNodes = nullptr;
+    mCount = 0;
+    mCapacity = 0;
 }
     
 HashList::~HashList()
@@ -36,50 +40,57 @@ HashList::~HashList()
     clear();
 }
 
-HashList::HashListBlock::HashListBlock()
+void HashList::resize(size_t capacity)
+{
+    HashListNode* nodes = new HashListNode[capacity];
+    std::copy(mNodes, mNodes + mCount, nodes);
+    delete[] mNodes;
+    mNodes = nodes;
+    mCapacity = static_cast<uint8_t>(capacity);
+}
+
+size_t HashList::lowerBound(uint32_t hash) const
 {
-    static_assert(sizeof(HashListBlock) == HashListBlock::BYTE_SIZE,
-                  "cache block size calculation incorrect");
+    size_t lo = 0;
+    size_t hi = mCount;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (mNodes[mid].mHash < hash) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
 
 void HashList::insert(const Item& item, size_t index)
 {
+    assert(index < ITEM_COUNT);
     const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    // add entry to the end of last block if possible
-    if (mBlockList.size()) {
-        auto& block = mBlockList.back();
-        if (block.mCount < HashListBlock::ENTRY_COUNT) {
-            block.mNodes[block.mCount++] = HashListNode(hash_24, index);
-            return;
-        }
+    // drop the previous item with the same index, if there is one
+    erase(index, false);
+    if (mCount == mCapacity) {
+        resize((mCapacity == 0) ? MIN_CAPACITY : std::min<size_t>(mCapacity * 2, ITEM_COUNT));
     }
-    // if the above failed, create a new block and add entry to it
-    HashListBlock* newBlock = new HashListBlock;
-    mBlockList.push_back(newBlock);
-    newBlock->mNodes[0] = HashListNode(hash_24, index);
-    newBlock->mCount++;
+    size_t pos = lowerBound(hash_24);
+    std::copy_backward(mNodes + pos, mNodes + mCount, mNodes + mCount + 1);
+    mNodes[pos] = HashListNode(hash_24, index);
+    ++mCount;
 }
 
 void HashList::erase(size_t index, bool itemShouldExist)
 {
-    for (auto it = mBlockList.begin(); it != mBlockList.end();) {
-        bool haveEntries = false;
-        for (size_t i = 0; i < it->mCount; ++i) {
-            if (it->mNodes[i].mIndex == index) {
-                it->mNodes[i].mIndex = 0xff;
-                return;
-            }
-            if (it->mNodes[i].mIndex != 0xff) {
-                haveEntries = true;
+    for (size_t i = 0; i < mCount; ++i) {
+        if (mNodes[i].mIndex == index) {
+            std::copy(mNodes + i + 1, mNodes + mCount, mNodes + i);
+            --mCount;
+            if (mCount == 0) {
+                clear();
+            } else if (mCapacity > MIN_CAPACITY && mCount <= mCapacity / 4) {
+                resize(mCapacity / 2);
             }
-        }
-        if (!haveEntries) {
-            auto tmp = it;
-            ++it;
-            mBlockList.erase(tmp);
-            delete static_cast<HashListBlock*>(tmp);
-        } else {
-            ++it;
+            return;
         }
     }
     if (itemShouldExist) {
@@ -90,17 +101,14 @@ void HashList::erase(size_t index, bool itemShouldExist)
 size_t HashList::find(size_t start, const Item& item)
 {
     const uint32_t hash_24 = item.calculateCrc32WithoutValue() & 0xffffff;
-    for (auto it = mBlockList.begin(); it != mBlockList.end(); ++it) {
-        for (size_t index = 0; index < it->mCount; ++index) {
-            HashListNode& e = it->mNodes[index];
-            if (e.mIndex >= start &&
-                    e.mHash == hash_24 &&
-                    e.mIndex != 0xff) {
-                return e.mIndex;
-            }
+    size_t result = SIZE_MAX;
+    for (size_t i = lowerBound(hash_24); i < mCount && mNodes[i].mHash == hash_24; ++i) {
+        const size_t index = mNodes[i].mIndex;
+        if (index >= start && index < result) {
+            result = index;
         }
     }
-    return SIZE_MAX;
+    return result;
 }
 
 
@@ -17,14 +17,24 @@
 
 #include "nvs.h"
 #include "nvs_types.hpp"
-#include "intrusive_list.h"
 
 namespace nvs
 {
 
+/**
+ * Maps item hashes to item indices within one page.
+ *
+ * Entries hold the 24-bit hash and the index of an item (4 bytes each), and are
+ * kept in a single array sorted by hash, so that find is a binary search. The
+ * array is allocated on first insert, grows by doubling as items are inserted,
+ * shrinks when most of them are erased, and is freed by clear(). A page with
+ * few items only costs a few dozen bytes of RAM.
+ */
 class HashList
 {
 public:
+    static const size_t ITEM_COUNT = 126;
+
     HashList();
     ~HashList();
     
@@ -32,6 +42,14 @@ public:
     void erase(const size_t index, bool itemShouldExist=true);
     size_t find(size_t start, const Item& item);
     void clear();
+
+    template<typename TFunc>
+    void forEach(TFunc func)
+    {
+        for (size_t i = 0; i < mCount; ++i) {
+            func(mNodes[i].mHash, mNodes[i].mIndex);
+        }
+    }
     
 private:
     HashList(const HashList& other);
@@ -39,6 +57,8 @@ private:
     
 protected:
 
+    static const size_t MIN_CAPACITY = 8;
+
     struct HashListNode {
         HashListNode() :
             mIndex(0xff), mHash(0)
@@ -54,18 +74,13 @@ protected:
         uint32_t mHash  : 24;
     };
 
-    struct HashListBlock : public intrusive_list_node<HashList::HashListBlock> {
-        HashListBlock();
-
-        static const size_t BYTE_SIZE = 128;
-        static const size_t ENTRY_COUNT = (BYTE_SIZE - sizeof(intrusive_list_node<HashListBlock>) - sizeof(size_t)) / 4;
+    size_t lowerBound(uint32_t hash) const;
 
-        size_t mCount = 0;
-        HashListNode mNodes[ENTRY_COUNT];
-    };
+    void resize(size_t capacity);
 
-    typedef intrusive_list<HashListBlock> TBlockList;
-    TBlockList mBlockList;
+    HashListNode* mNodes = nullptr;
+    uint8_t mCount = 0;
+    uint8_t mCapacity = 0;
 }; // class HashList
 
 } // namespace nvs
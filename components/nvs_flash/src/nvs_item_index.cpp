@@ -0,0 +1,154 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_item_index.hpp"
+#include "nvs_page.hpp"
+
+namespace nvs
+{
+
+static const uint32_t COUNT_STICKY = 0xff;
+
+void ItemIndex::init(size_t maxEntries, size_t pageCount)
+{
+    size_t entries = pageCount * Page::ENTRY_COUNT;
+    if (maxEntries < entries) {
+        entries = maxEntries;
+    }
+
+    mEntries.reset();
+    mCapacity = 0;
+    mUsedCount = 0;
+    mComplete = false;
+    if (entries == 0) {
+        return;
+    }
+
+    // keep load factor below 3/4 so that probe sequences stay short
+    size_t capacity = 1;
+    while (capacity * 3 < entries * 4) {
+        capacity <<= 1;
+    }
+    mEntries.reset(new IndexEntry[capacity]);
+    mCapacity = capacity;
+    clear();
+}
+
+void ItemIndex::clear()
+{
+    for (size_t i = 0; i < mCapacity; ++i) {
+        mEntries[i].mPage = nullptr;
+        mEntries[i].mHash = 0;
+        mEntries[i].mCount = 0;
+    }
+    mUsedCount = 0;
+    mComplete = isEnabled();
+}
+
+void ItemIndex::insert(uint32_t hash, Page* page)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    const size_t mask = mCapacity - 1;
+    IndexEntry* freeEntry = nullptr;
+    for (size_t i = hash & mask, n = 0; n < mCapacity; i = (i + 1) & mask, ++n) {
+        IndexEntry& e = mEntries[i];
+        if (e.mPage == nullptr) {
+            if (freeEntry == nullptr) {
+                freeEntry = &e;
+            }
+            break;
+        }
+        if (e.mCount == 0) {
+            if (freeEntry == nullptr) {
+                freeEntry = &e;
+            }
+            continue;
+        }
+        if (e.mHash == hash && e.mPage == page) {
+            // once the counter saturates, the entry stays until the index is cleared
+            if (e.mCount != COUNT_STICKY) {
+                ++e.mCount;
+            }
+            return;
+        }
+    }
+
+    if (freeEntry == nullptr) {
+        mComplete = false;
+        return;
+    }
+
+    if (freeEntry->mPage == nullptr) {
+        if ((mUsedCount + 1) * 4 > mCapacity * 3) {
+            mComplete = false;
+            return;
+        }
+        ++mUsedCount;
+    }
+
+    freeEntry->mPage = page;
+    freeEntry->mHash = hash;
+    freeEntry->mCount = 1;
+}
+
+void ItemIndex::erase(const Item& item, Page* page)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    const uint32_t hash = hashOf(item);
+    const size_t mask = mCapacity - 1;
+    for (size_t i = hash & mask, n = 0; n < mCapacity; i = (i + 1) & mask, ++n) {
+        IndexEntry& e = mEntries[i];
+        if (e.mPage == nullptr) {
+            return;
+        }
+        if (e.mCount != 0 && e.mHash == hash && e.mPage == page) {
+            if (e.mCount != COUNT_STICKY) {
+                --e.mCount;
+            }
+            return;
+        }
+    }
+}
+
+size_t ItemIndex::find(const Item& item, Page** pages, size_t maxCount) const
+{
+    if (!isEnabled()) {
+        return 0;
+    }
+
+    const uint32_t hash = hashOf(item);
+    const size_t mask = mCapacity - 1;
+    size_t count = 0;
+    for (size_t i = hash & mask, n = 0; n < mCapacity; i = (i + 1) & mask, ++n) {
+        const IndexEntry& e = mEntries[i];
+        if (e.mPage == nullptr) {
+            break;
+        }
+        if (e.mCount != 0 && e.mHash == hash) {
+            if (count < maxCount) {
+                pages[count] = e.mPage;
+            }
+            ++count;
+        }
+    }
+    return count;
+}
+
+} // namespace nvs
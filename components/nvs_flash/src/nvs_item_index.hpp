@@ -0,0 +1,111 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_item_index_hpp
+#define nvs_item_index_hpp
+
+#include <memory>
+#include "nvs.h"
+#include "nvs_types.hpp"
+
+namespace nvs
+{
+
+class Page;
+
+/**
+ * Storage-wide index which maps item hash (namespace, key, chunk index) to the
+ * pages which may contain an item with this hash.
+ *
+ * The index is allowed to contain stale entries, but it must never miss a page
+ * which holds an item with a given hash, unless it is marked as incomplete.
+ * The hash is the same 24-bit value used by HashList, so a page which is not in
+ * the index would not have found the item in its own hash list anyway.
+ *
+ * Entries live in a fixed-size open-addressed table allocated by init(). When the
+ * table can't accept more entries, the index is marked incomplete and callers
+ * have to fall back to searching all pages until the index is rebuilt.
+ */
+class ItemIndex
+{
+public:
+    static const size_t UNBOUNDED = SIZE_MAX;
+
+    // Maximum number of candidate pages returned by a single lookup
+    static const size_t MAX_CANDIDATES = 4;
+
+    ItemIndex() {}
+
+    void init(size_t maxEntries, size_t pageCount);
+
+    bool isEnabled() const
+    {
+        return mCapacity != 0;
+    }
+
+    bool isComplete() const
+    {
+        return mComplete;
+    }
+
+    void insert(const Item& item, Page* page)
+    {
+        insert(hashOf(item), page);
+    }
+
+    void insert(uint32_t hash, Page* page);
+
+    void erase(const Item& item, Page* page);
+
+    /**
+     * Fill pages with up to maxCount candidate pages for the item.
+     * Returns the number of candidates, which may exceed maxCount.
+     */
+    size_t find(const Item& item, Page** pages, size_t maxCount) const;
+
+    void clear();
+
+    size_t getCapacity() const
+    {
+        return mCapacity;
+    }
+
+    size_t getUsedCount() const
+    {
+        return mUsedCount;
+    }
+
+    static uint32_t hashOf(const Item& item)
+    {
+        return item.calculateCrc32WithoutValue() & 0xffffff;
+    }
+
+protected:
+    struct IndexEntry {
+        // nullptr for slots which were never used, mCount is 0 for removed entries
+        Page* mPage;
+        uint32_t mHash  : 24;
+        uint32_t mCount : 8;
+    };
+
+    size_t mCapacity = 0;
+    size_t mUsedCount = 0;
+    bool mComplete = false;
+    std::unique_ptr<IndexEntry[]> mEntries;
+}; // class ItemIndex
+
+} // namespace nvs
+
+
+#endif /* nvs_item_index_hpp */
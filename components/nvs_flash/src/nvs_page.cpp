@@ -32,7 +32,7 @@ uint32_t Page::Header::calculateCrc32()
                     offsetof(Header, mCrc32) - offsetof(Header, mSeqNumber));
 }
 
-esp_err_t Page::load(uint32_t sectorNumber)
+esp_err_t Page::load(uint32_t sectorNumber, bool deferItems)
 {
     mBaseAddress = sectorNumber * SEC_SIZE;
     mUsedEntryCount = 0;
@@ -80,6 +80,8 @@ esp_err_t Page::load(uint32_t sectorNumber)
     case PageState::FULL:
     case PageState::ACTIVE:
     case PageState::FREEING:
+        // only full pages can be used without recovery, so only these may be loaded lazily
+        mItemsLoaded = !(deferItems && mState == PageState::FULL);
         mLoadEntryTable();
         break;
 
@@ -254,6 +256,59 @@ esp_err_t Page::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, c
     return ESP_OK;
 }
 
+esp_err_t Page::writeItems(const Item* entries, size_t count, size_t& itemIndex)
+{
+    esp_err_t err;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    if (mState == PageState::UNINITIALIZED) {
+        err = initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    if (mState == PageState::FULL) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    assert(count > 0);
+    if (mNextFreeEntry == INVALID_ENTRY || mNextFreeEntry + count > ENTRY_COUNT) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    for (size_t i = 0; i < count; i += entries[i].span) {
+        assert(entries[i].span > 0 && i + entries[i].span <= count);
+        mHashList.insert(entries[i], mNextFreeEntry + i);
+    }
+
+    err = nvs_flash_write(getEntryAddress(mNextFreeEntry), entries, count * ENTRY_SIZE);
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    // alterEntryRangeState goes from the last entry to the first one, so the
+    // word which holds the first entry of the run is written last
+    err = alterEntryRangeState(mNextFreeEntry, mNextFreeEntry + count, EntryState::WRITTEN);
+    if (err != ESP_OK) {
+        mState = PageState::INVALID;
+        return err;
+    }
+
+    if (mFirstUsedEntry == INVALID_ENTRY) {
+        mFirstUsedEntry = mNextFreeEntry;
+    }
+
+    itemIndex = mNextFreeEntry;
+    mUsedEntryCount += count;
+    mNextFreeEntry += count;
+    return ESP_OK;
+}
+
 esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -281,19 +336,24 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
         return ESP_ERR_NVS_INVALID_LENGTH;
     }
 
+    // whole data entries are read straight into the output buffer with a single flash read,
+    // only the partially used last entry goes through a temporary item
     uint8_t* dst = reinterpret_cast<uint8_t*>(data);
-    size_t left = item.varLength.dataSize;
-    for (size_t i = index + 1; i < index + item.span; ++i) {
+    size_t fullEntries = item.varLength.dataSize / ENTRY_SIZE;
+    size_t tail = item.varLength.dataSize % ENTRY_SIZE;
+    if (fullEntries > 0) {
+        rc = readEntries(index + 1, dst, fullEntries);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+    }
+    if (tail > 0) {
         Item ditem;
-        rc = readEntry(i, ditem);
+        rc = readEntry(index + 1 + fullEntries, ditem);
         if (rc != ESP_OK) {
             return rc;
         }
-        size_t willCopy = ENTRY_SIZE;
-        willCopy = (left < willCopy)?left:willCopy;
-        memcpy(dst, ditem.rawData, willCopy);
-        left -= willCopy;
-        dst += willCopy;
+        memcpy(dst + fullEntries * ENTRY_SIZE, ditem.rawData, tail);
     }
     if (Item::calculateCrc32(reinterpret_cast<uint8_t*>(data), item.varLength.dataSize) != item.varLength.dataCrc32) {
         rc = eraseEntryAndSpan(index);
@@ -305,6 +365,92 @@ esp_err_t Page::readItem(uint8_t nsIndex, ItemType datatype, const char* key, vo
     return ESP_OK;
 }
 
+esp_err_t Page::readItemData(uint8_t nsIndex, ItemType datatype, const char* key, size_t offset, void* data, size_t dataSize, uint8_t chunkIdx, bool checkCrc)
+{
+    size_t index = 0;
+    Item item;
+
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+
+    assert(isVariableLengthType(datatype));
+    esp_err_t rc = findItem(nsIndex, datatype, key, index, item, chunkIdx);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    return readItemEntries(index, item, offset, data, dataSize, checkCrc);
+}
+
+esp_err_t Page::readItemData(size_t index, const Item& item, size_t offset, void* data, size_t dataSize, bool checkCrc)
+{
+    if (mState == PageState::INVALID) {
+        return ESP_ERR_NVS_INVALID_STATE;
+    }
+    if (mState == PageState::CORRUPT || mState == PageState::UNINITIALIZED ||
+            index >= ENTRY_COUNT || mEntryTable.get(index) != EntryState::WRITTEN) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    // the page may have been erased and written again since the item was found
+    Item header;
+    esp_err_t rc = readEntry(index, header);
+    if (rc != ESP_OK) {
+        return rc;
+    }
+    if (memcmp(&header, &item, sizeof(item)) != 0) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return readItemEntries(index, item, offset, data, dataSize, checkCrc);
+}
+
+esp_err_t Page::readItemEntries(size_t index, const Item& item, size_t offset, void* data, size_t dataSize, bool checkCrc)
+{
+    esp_err_t rc;
+    size_t itemSize = item.varLength.dataSize;
+    if (offset > itemSize || dataSize > itemSize - offset) {
+        return ESP_ERR_NVS_INVALID_LENGTH;
+    }
+
+    size_t first = checkCrc ? 0 : offset / ENTRY_SIZE;
+    size_t last = checkCrc ? (itemSize + ENTRY_SIZE - 1) / ENTRY_SIZE : (offset + dataSize + ENTRY_SIZE - 1) / ENTRY_SIZE;
+    uint8_t* dst = static_cast<uint8_t*>(data);
+    uint32_t crc = 0xffffffff;
+    // entries are read in batches to keep the number of flash reads (and decryption calls) low
+    const size_t batchSize = 8;
+    Item batch[batchSize];
+    for (size_t i = first; i < last; ++i) {
+        size_t batchIndex = (i - first) % batchSize;
+        if (batchIndex == 0) {
+            size_t count = (last - i < batchSize) ? last - i : batchSize;
+            rc = readEntries(index + 1 + i, batch, count);
+            if (rc != ESP_OK) {
+                return rc;
+            }
+        }
+        const Item& ditem = batch[batchIndex];
+        size_t entryStart = i * ENTRY_SIZE;
+        size_t entrySize = (itemSize - entryStart < ENTRY_SIZE) ? itemSize - entryStart : ENTRY_SIZE;
+        if (checkCrc) {
+            crc = Item::calculateCrc32(ditem.rawData, entrySize, crc);
+        }
+        // copy the part of this entry which overlaps the requested range
+        size_t from = std::max(entryStart, offset);
+        size_t to = std::min(entryStart + entrySize, offset + dataSize);
+        if (from < to) {
+            memcpy(dst + (from - offset), ditem.rawData + (from - entryStart), to - from);
+        }
+    }
+    if (checkCrc && crc != item.varLength.dataCrc32) {
+        rc = eraseEntryAndSpan(index);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    return ESP_OK;
+}
+
 esp_err_t Page::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx, VerOffset chunkStart)
 {
     size_t index = 0;
@@ -379,6 +525,64 @@ esp_err_t Page::eraseEntryAndSpan(size_t index)
     return ESP_OK;
 }
 
+esp_err_t Page::eraseItems(const size_t* indices, size_t count)
+{
+    static_assert(TEntryTable::byteSize() / 4 <= 32, "dirty word mask is too small");
+    uint32_t dirtyWords = 0;
+    size_t end = 0;
+
+    for (size_t n = 0; n < count; ++n) {
+        size_t index = indices[n];
+        assert(mEntryTable.get(index) == EntryState::WRITTEN);
+
+        Item item;
+        auto rc = readEntry(index, item);
+        if (rc != ESP_OK) {
+            return rc;
+        }
+        size_t span = 1;
+        if (item.calculateCrc32() == item.crc32) {
+            mHashList.erase(index);
+            span = item.span;
+        } else {
+            mHashList.erase(index, false);
+        }
+        for (size_t i = index; i < index + span; ++i) {
+            if (mEntryTable.get(i) == EntryState::WRITTEN) {
+                --mUsedEntryCount;
+            }
+            ++mErasedEntryCount;
+            mEntryTable.set(i, EntryState::ERASED);
+            dirtyWords |= 1 << mEntryTable.getWordIndex(i);
+        }
+        if (index + span > end) {
+            end = index + span;
+        }
+    }
+
+    for (size_t word = 0; dirtyWords != 0; ++word, dirtyWords >>= 1) {
+        if ((dirtyWords & 1) == 0) {
+            continue;
+        }
+        auto rc = spi_flash_write(mBaseAddress + ENTRY_TABLE_OFFSET + static_cast<uint32_t>(word) * 4,
+                mEntryTable.data() + word, 4);
+        if (rc != ESP_OK) {
+            mState = PageState::INVALID;
+            return rc;
+        }
+    }
+
+    if (mFirstUsedEntry != INVALID_ENTRY && mEntryTable.get(mFirstUsedEntry) != EntryState::WRITTEN) {
+        updateFirstUsedEntry(mFirstUsedEntry, 1);
+    }
+
+    if (end > mNextFreeEntry) {
+        mNextFreeEntry = end;
+    }
+
+    return ESP_OK;
+}
+
 void Page::updateFirstUsedEntry(size_t index, size_t span)
 {
     assert(index == mFirstUsedEntry);
@@ -397,6 +601,8 @@ void Page::updateFirstUsedEntry(size_t index, size_t span)
 
 esp_err_t Page::copyItems(Page& other)
 {
+    assert(mItemsLoaded);
+
     if (mFirstUsedEntry == INVALID_ENTRY) {
         return ESP_ERR_NVS_NOT_FOUND;
     }
@@ -446,6 +652,50 @@ esp_err_t Page::copyItems(Page& other)
     return ESP_OK;
 }
 
+esp_err_t Page::moveItem(size_t index, Page& other)
+{
+    assert(mItemsLoaded);
+    assert(mEntryTable.get(index) == EntryState::WRITTEN);
+
+    if (other.mState == PageState::UNINITIALIZED) {
+        auto err = other.initialize();
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+
+    Item entry;
+    auto err = readEntry(index, entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    if (entry.calculateCrc32() != entry.crc32) {
+        return eraseEntryAndSpan(index);
+    }
+
+    size_t span = entry.span;
+    if (span > other.getFreeEntryCount()) {
+        return ESP_ERR_NVS_PAGE_FULL;
+    }
+
+    other.mHashList.insert(entry, other.mNextFreeEntry);
+    err = other.writeEntry(entry);
+    if (err != ESP_OK) {
+        return err;
+    }
+    for (size_t i = index + 1; i < index + span; ++i) {
+        err = readEntry(i, entry);
+        if (err != ESP_OK) {
+            return err;
+        }
+        err = other.writeEntry(entry);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return eraseEntryAndSpan(index);
+}
+
 esp_err_t Page::mLoadEntryTable()
 {
     // for states where we actually care about data in the page, read entry state table
@@ -488,6 +738,10 @@ esp_err_t Page::mLoadEntryTable()
         // but before the entry state table was altered, the entry locacted via
         // entry state table may actually be half-written.
         // this is easy to check by reading EntryHeader (i.e. first word)
+        // the same applies to items written by writeItems, which may additionally
+        // have entries past the first empty one marked as written. Data entries
+        // of such items may start with 0xffffffff, so whenever an entry
+        // holds a valid item header, skip over the whole item.
         while (mNextFreeEntry < ENTRY_COUNT) {
             uint32_t entryAddress = getEntryAddress(mNextFreeEntry);
             uint32_t header;
@@ -496,22 +750,40 @@ esp_err_t Page::mLoadEntryTable()
                 mState = PageState::INVALID;
                 return rc;
             }
+            if (header == 0xffffffff && mEntryTable.get(mNextFreeEntry) == EntryState::EMPTY) {
+                break;
+            }
+
+            size_t span = 1;
             if (header != 0xffffffff) {
-                auto oldState = mEntryTable.get(mNextFreeEntry);
-                auto err = alterEntryState(mNextFreeEntry, EntryState::ERASED);
-                if (err != ESP_OK) {
+                Item item;
+                rc = readEntry(mNextFreeEntry, item);
+                if (rc != ESP_OK) {
                     mState = PageState::INVALID;
-                    return err;
+                    return rc;
+                }
+                if (item.crc32 == item.calculateCrc32() && item.span > 0) {
+                    span = std::min(static_cast<size_t>(item.span), ENTRY_COUNT - mNextFreeEntry);
                 }
-                ++mNextFreeEntry;
-                if (oldState == EntryState::WRITTEN) {
+            }
+
+            for (size_t i = mNextFreeEntry; i < mNextFreeEntry + span; ++i) {
+                if (mEntryTable.get(i) == EntryState::WRITTEN) {
                     --mUsedEntryCount;
                 }
                 ++mErasedEntryCount;
             }
-            else {
-                break;
+            esp_err_t err;
+            if (span == 1) {
+                err = alterEntryState(mNextFreeEntry, EntryState::ERASED);
+            } else {
+                err = alterEntryRangeState(mNextFreeEntry, mNextFreeEntry + span, EntryState::ERASED);
             }
+            if (err != ESP_OK) {
+                mState = PageState::INVALID;
+                return err;
+            }
+            mNextFreeEntry += span;
         }
 
         // check that all variable-length items are written or erased fully
@@ -590,53 +862,89 @@ esp_err_t Page::mLoadEntryTable()
                 }
             }
         }
-    } else if (mState == PageState::FULL || mState == PageState::FREEING) {
+    } else if ((mState == PageState::FULL || mState == PageState::FREEING) && mItemsLoaded) {
         // We have already filled mHashList for page in active state.
         // Do the same for the case when page is in full or freeing state.
-        Item item;
-        for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
-            if (mEntryTable.get(i) != EntryState::WRITTEN) {
-                continue;
-            }
+        return mLoadHashList(nullptr);
+    }
 
-            auto err = readEntry(i, item);
+    return ESP_OK;
+}
+
+esp_err_t Page::loadItems(Page* newerPage)
+{
+    if (mItemsLoaded) {
+        return ESP_OK;
+    }
+    mItemsLoaded = true;
+    return mLoadHashList(newerPage);
+}
+
+esp_err_t Page::mLoadHashList(Page* newerPage)
+{
+    Item item;
+    for (size_t i = mFirstUsedEntry; i < ENTRY_COUNT; ++i) {
+        if (mEntryTable.get(i) != EntryState::WRITTEN) {
+            continue;
+        }
+
+        auto err = readEntry(i, item);
+        if (err != ESP_OK) {
+            mState = PageState::INVALID;
+            return err;
+        }
+
+        if (item.crc32 != item.calculateCrc32()) {
+            err = eraseEntryAndSpan(i);
             if (err != ESP_OK) {
                 mState = PageState::INVALID;
                 return err;
             }
+            continue;
+        }
 
-            if (item.crc32 != item.calculateCrc32()) {
-                err = eraseEntryAndSpan(i);
-                if (err != ESP_OK) {
-                    mState = PageState::INVALID;
-                    return err;
-                }
-                continue;
-            }
-
-            assert(item.span > 0);
+        assert(item.span > 0);
 
-            mHashList.insert(item, i);
+        mHashList.insert(item, i);
 
-            size_t span = item.span;
+        size_t span = item.span;
 
-            if (isVariableLengthType(item.datatype)) {
-                for (size_t j = i + 1; j < i + span; ++j) {
-                    if (mEntryTable.get(j) != EntryState::WRITTEN) {
-                        eraseEntryAndSpan(i);
-                        break;
-                    }
+        if (newerPage && newerPage->containsItem(item)) {
+            // same check as PageManager::load does for pages which are loaded at once
+            err = eraseEntryAndSpan(i);
+            if (err != ESP_OK) {
+                mState = PageState::INVALID;
+                return err;
+            }
+        } else if (isVariableLengthType(item.datatype)) {
+            for (size_t j = i + 1; j < i + span; ++j) {
+                if (mEntryTable.get(j) != EntryState::WRITTEN) {
+                    eraseEntryAndSpan(i);
+                    break;
                 }
             }
-
-            i += span - 1;
         }
 
+        i += span - 1;
     }
-
     return ESP_OK;
 }
 
+bool Page::containsItem(const Item& item)
+{
+    if (item.datatype == ItemType::ERASE_MARK) {
+        return false;
+    }
+    size_t itemIndex = 0;
+    Item found;
+    if (findItem(item.nsIndex, item.datatype, item.key, itemIndex, found, item.chunkIndex) == ESP_OK) {
+        return true;
+    }
+    // blob stored in the old format is replaced by a blob index
+    itemIndex = 0;
+    return item.datatype == ItemType::BLOB &&
+           findItem(item.nsIndex, ItemType::BLOB_IDX, item.key, itemIndex, found) == ESP_OK;
+}
 
 esp_err_t Page::initialize()
 {
@@ -714,7 +1022,13 @@ esp_err_t Page::alterPageState(PageState state)
 
 esp_err_t Page::readEntry(size_t index, Item& dst) const
 {
-    auto rc = nvs_flash_read(getEntryAddress(index), &dst, sizeof(dst));
+    return readEntries(index, &dst, 1);
+}
+
+esp_err_t Page::readEntries(size_t index, void* dst, size_t count) const
+{
+    assert(index + count <= ENTRY_COUNT);
+    auto rc = nvs_flash_read(getEntryAddress(index), dst, count * ENTRY_SIZE);
     if (rc != ESP_OK) {
         return rc;
     }
@@ -723,6 +1037,8 @@ esp_err_t Page::readEntry(size_t index, Item& dst) const
 
 esp_err_t Page::findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
 {
+    assert(mItemsLoaded);
+
     if (mState == PageState::CORRUPT || mState == PageState::INVALID || mState == PageState::UNINITIALIZED) {
         return ESP_ERR_NVS_NOT_FOUND;
     }
@@ -861,6 +1177,7 @@ esp_err_t Page::erase()
     mFirstUsedEntry = INVALID_ENTRY;
     mNextFreeEntry = INVALID_ENTRY;
     mState = PageState::UNINITIALIZED;
+    mItemsLoaded = true;
     mHashList.clear();
     return ESP_OK;
 }
@@ -892,6 +1209,16 @@ size_t Page::getVarDataTailroom() const
     return ((mNextFreeEntry < (ENTRY_COUNT-1)) ? ((ENTRY_COUNT - mNextFreeEntry - 1) * ENTRY_SIZE): 0);
 }
 
+size_t Page::getFreeEntryCount() const
+{
+    if (mState == PageState::UNINITIALIZED) {
+        return ENTRY_COUNT;
+    } else if (mState != PageState::ACTIVE || mNextFreeEntry == INVALID_ENTRY) {
+        return 0;
+    }
+    return ENTRY_COUNT - mNextFreeEntry;
+}
+
 const char* Page::pageStateToName(PageState ps)
 {
     switch (ps) {
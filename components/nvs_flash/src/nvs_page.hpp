@@ -82,7 +82,24 @@ public:
         return mState;
     }
 
-    esp_err_t load(uint32_t sectorNumber);
+    /**
+     * Load page header and entry state table. If deferItems is set, a full
+     * page doesn't read its items until loadItems is called, other pages are
+     * always loaded completely.
+     */
+    esp_err_t load(uint32_t sectorNumber, bool deferItems = false);
+
+    /**
+     * Read items of a page whose loading was deferred and fill its hash list.
+     * Items which also exist on newerPage are stale copies left behind by a
+     * write which was interrupted by power loss, and are erased.
+     */
+    esp_err_t loadItems(Page* newerPage);
+
+    bool itemsLoaded() const
+    {
+        return mItemsLoaded;
+    }
 
     esp_err_t getSeqNumber(uint32_t& seqNumber) const;
 
@@ -92,12 +109,40 @@ public:
 
     esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY);
 
+    /**
+     * Write a run of serialized items with a single flash write, then mark all
+     * of their entries as written in one pass over the entry state table.
+     * Until the state table word holding the first entry is written, none of
+     * the items is visible after a reload. Index of the first entry is
+     * returned in itemIndex.
+     */
+    esp_err_t writeItems(const Item* entries, size_t count, size_t& itemIndex);
+
     esp_err_t readItem(uint8_t nsIndex, ItemType datatype, const char* key, void* data, size_t dataSize, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /**
+     * Read dataSize bytes of a variable length item, starting at offset.
+     * If checkCrc is set, all data entries of the item are read to verify
+     * the data checksum, otherwise only the entries which hold the range.
+     */
+    esp_err_t readItemData(uint8_t nsIndex, ItemType datatype, const char* key, size_t offset, void* data, size_t dataSize, uint8_t chunkIdx, bool checkCrc);
+
+    /**
+     * Same as above, for the item found at entry index with the given header.
+     * Returns ESP_ERR_NVS_NOT_FOUND if the entry doesn't hold this item anymore.
+     */
+    esp_err_t readItemData(size_t index, const Item& item, size_t offset, void* data, size_t dataSize, bool checkCrc);
+
     esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    /**
+     * Erase items which start at the given entry indices. Each word of the
+     * entry state table which covers any of them is written only once.
+     */
+    esp_err_t eraseItems(const size_t* indices, size_t count);
+
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, size_t &itemIndex, Item& item, uint8_t chunkIdx = CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
     template<typename T>
@@ -129,16 +174,32 @@ public:
     }
     size_t getVarDataTailroom() const ;
 
+    size_t getFreeEntryCount() const;
+
     esp_err_t markFull();
 
     esp_err_t markFreeing();
 
     esp_err_t copyItems(Page& other);
 
+    /**
+     * Copy the item which starts at the given entry to the other page, then
+     * erase it from this page. If power is lost in between, the copy on the
+     * newer page is kept when the partition is loaded. Returns
+     * ESP_ERR_NVS_PAGE_FULL if the item doesn't fit into the other page.
+     */
+    esp_err_t moveItem(size_t index, Page& other);
+
     esp_err_t erase();
 
     void debugDump() const;
 
+    template<typename TFunc>
+    void forEachItemHash(TFunc func)
+    {
+        mHashList.forEach(func);
+    }
+
     esp_err_t calcEntries(nvs_stats_t &nvsStats);
 
 protected:
@@ -169,6 +230,10 @@ protected:
 
     esp_err_t mLoadEntryTable();
 
+    esp_err_t mLoadHashList(Page* newerPage);
+
+    bool containsItem(const Item& item);
+
     esp_err_t initialize();
 
     esp_err_t alterEntryState(size_t index, EntryState state);
@@ -179,6 +244,10 @@ protected:
 
     esp_err_t readEntry(size_t index, Item& dst) const;
 
+    esp_err_t readEntries(size_t index, void* dst, size_t count) const;
+
+    esp_err_t readItemEntries(size_t index, const Item& item, size_t offset, void* data, size_t dataSize, bool checkCrc);
+
     esp_err_t writeEntry(const Item& item);
     
     esp_err_t writeEntryData(const uint8_t* data, size_t size);
@@ -212,6 +281,7 @@ protected:
     size_t mFirstUsedEntry = INVALID_ENTRY;
     uint16_t mUsedEntryCount = 0;
     uint16_t mErasedEntryCount = 0;
+    bool mItemsLoaded = true;
 
     HashList mHashList;
 
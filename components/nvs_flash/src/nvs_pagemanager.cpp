@@ -15,19 +15,24 @@
 
 namespace nvs
 {
-esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
+esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount, bool deferItems)
 {
     mBaseSector = baseSector;
     mPageCount = sectorCount;
     mPageList.clear();
     mFreePageList.clear();
     mPages.reset(new Page[sectorCount]);
+    mDeferredPageCount = 0;
+    mRecoveryPage = nullptr;
 
     for (uint32_t i = 0; i < sectorCount; ++i) {
-        auto err = mPages[i].load(baseSector + i);
+        auto err = mPages[i].load(baseSector + i, deferItems);
         if (err != ESP_OK) {
             return err;
         }
+        if (!mPages[i].itemsLoaded()) {
+            ++mDeferredPageCount;
+        }
         uint32_t seqNumber;
         if (mPages[i].getSeqNumber(seqNumber) != ESP_OK) {
             mFreePageList.push_back(&mPages[i]);
@@ -54,38 +59,57 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
     }
 
     // if power went out after a new item for the given key was written,
-    // but before the old one was erased, we end up with a duplicate item
+    // but before the old one was erased, we end up with a duplicate item.
+    // A single write may only leave the last item on the last page duplicated.
+    // A committed transaction may do so for every item it has written, but its
+    // erase marks stay on the last page until the cleanup is finished, so all
+    // items on the last page are only checked if there are marks.
+    // Pages whose loading was deferred check their items against the last page
+    // when they are loaded, see loadItems.
     Page& lastPage = back();
-    size_t lastItemIndex = SIZE_MAX;
+    auto err = loadItems(lastPage);
+    if (err != ESP_OK) {
+        return err;
+    }
+    mRecoveryPage = &lastPage;
     Item item;
     size_t itemIndex = 0;
+    bool needAllItems = false;
+    bool hasLastItem = false;
     while (lastPage.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
         itemIndex += item.span;
-        lastItemIndex = itemIndex;
+        hasLastItem = true;
+        if (item.datatype == ItemType::ERASE_MARK) {
+            // items erased by a transaction may be on any page, see Storage::eraseMarkedItems
+            needAllItems = true;
+        }
     }
 
-    if (lastItemIndex != SIZE_MAX) {
-        auto last = PageManager::TPageListIterator(&lastPage);
-        TPageListIterator it;
-
-        for (it = begin(); it != last; ++it) {
-
-            if ((it->state() != Page::PageState::FREEING) &&
-                    (it->eraseItem(item.nsIndex, item.datatype, item.key, item.chunkIndex) == ESP_OK)) {
-                break;
+    if (needAllItems) {
+        itemIndex = 0;
+        while (lastPage.findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item) == ESP_OK) {
+            itemIndex += item.span;
+            if (item.datatype != ItemType::ERASE_MARK) {
+                eraseOlderItem(lastPage, item);
             }
         }
-        if ((it == last) && (item.datatype == ItemType::BLOB_IDX)) {
-            /* Rare case in which the blob was stored using old format, but power went just after writing
-             * blob index during modification. Loop again and delete the old version blob*/
-            for (it = begin(); it != last; ++it) {
-
-                if ((it->state() != Page::PageState::FREEING) &&
-                        (it->eraseItem(item.nsIndex, ItemType::BLOB, item.key, item.chunkIndex) == ESP_OK)) {
-                    break;
-                }
+    } else if (hasLastItem) {
+        eraseOlderItem(lastPage, item);
+    }
+
+    // freeing page is recovered below, which may move the items to a new page
+    for (auto it = begin(); it != end(); ++it) {
+        if (it->state() == Page::PageState::FREEING) {
+            needAllItems = true;
+        }
+    }
+    if (needAllItems) {
+        for (auto it = begin(); it != end() && mDeferredPageCount > 0; ++it) {
+            err = loadItems(*it);
+            if (err != ESP_OK) {
+                return err;
             }
-        } 
+        }
     }
 
     // check if power went out while page was being freed
@@ -100,7 +124,7 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
                 mPageList.erase(newPage);
                 mFreePageList.push_back(newPage);
             }
-            auto err = activatePage();
+            err = activatePage();
             if (err != ESP_OK) {
                 return err;
             }
@@ -131,8 +155,44 @@ esp_err_t PageManager::load(uint32_t baseSector, uint32_t sectorCount)
     return ESP_OK;
 }
 
+void PageManager::eraseOlderItem(Page& lastPage, const Item& item)
+{
+    auto last = PageManager::TPageListIterator(&lastPage);
+    TPageListIterator it;
+
+    for (it = begin(); it != last; ++it) {
+
+        if (it->itemsLoaded() && (it->state() != Page::PageState::FREEING) &&
+                (it->eraseItem(item.nsIndex, item.datatype, item.key, item.chunkIndex) == ESP_OK)) {
+            break;
+        }
+    }
+    if ((it == last) && (item.datatype == ItemType::BLOB_IDX)) {
+        /* Rare case in which the blob was stored using old format, but power went just after writing
+         * blob index during modification. Loop again and delete the old version blob*/
+        for (it = begin(); it != last; ++it) {
+
+            if (it->itemsLoaded() && (it->state() != Page::PageState::FREEING) &&
+                    (it->eraseItem(item.nsIndex, ItemType::BLOB, item.key, item.chunkIndex) == ESP_OK)) {
+                break;
+            }
+        }
+    }
+}
+
+esp_err_t PageManager::loadItems(Page& page)
+{
+    if (page.itemsLoaded()) {
+        return ESP_OK;
+    }
+    --mDeferredPageCount;
+    return page.loadItems((&page != mRecoveryPage) ? mRecoveryPage : nullptr);
+}
+
 esp_err_t PageManager::requestNewPage()
 {
+    assert(mDeferredPageCount == 0);
+
     if (mFreePageList.empty()) {
         return ESP_ERR_NVS_INVALID_STATE;
     }
@@ -142,19 +202,8 @@ esp_err_t PageManager::requestNewPage()
         return activatePage();
     }
 
-    // find the page with the higest number of erased items
-    TPageListIterator maxUnusedItemsPageIt;
-    size_t maxUnusedItems = 0;
-    for (auto it = begin(); it != end(); ++it) {
-
-        auto unused =  Page::ENTRY_COUNT - it->getUsedEntryCount();
-        if (unused > maxUnusedItems) {
-            maxUnusedItemsPageIt = it;
-            maxUnusedItems = unused;
-        }
-    }
-
-    if (maxUnusedItems == 0) {
+    Page* erasedPage = selectReclaimPage();
+    if (erasedPage == nullptr) {
         return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
     }
 
@@ -165,8 +214,6 @@ esp_err_t PageManager::requestNewPage()
 
     Page* newPage = &mPageList.back();
 
-    Page* erasedPage = maxUnusedItemsPageIt;
-
 #ifndef NDEBUG
     size_t usedEntries = erasedPage->getUsedEntryCount();
 #endif
@@ -188,12 +235,45 @@ esp_err_t PageManager::requestNewPage()
     assert(usedEntries == newPage->getUsedEntryCount());
 #endif
 
-    mPageList.erase(maxUnusedItemsPageIt);
+    mPageList.erase(erasedPage);
     mFreePageList.push_back(erasedPage);
 
     return ESP_OK;
 }
 
+Page* PageManager::selectReclaimPage(size_t maxUsedEntries, bool includeCurrent)
+{
+    Page* selected = nullptr;
+    size_t maxUnused = 0;
+    auto last = includeCurrent ? end() : TPageListIterator(&back());
+    for (auto it = begin(); it != last; ++it) {
+        size_t used = it->getUsedEntryCount();
+        size_t unused = Page::ENTRY_COUNT - used;
+        if (unused == 0 || used > maxUsedEntries) {
+            continue;
+        }
+        if (unused > maxUnused) {
+            selected = it;
+            maxUnused = unused;
+        }
+    }
+    return selected;
+}
+
+esp_err_t PageManager::releasePage(Page& page)
+{
+    assert(page.getUsedEntryCount() == 0);
+    assert(&page != &back());
+
+    auto err = page.erase();
+    if (err != ESP_OK) {
+        return err;
+    }
+    mPageList.erase(&page);
+    mFreePageList.push_back(&page);
+    return ESP_OK;
+}
+
 esp_err_t PageManager::activatePage()
 {
     if (mFreePageList.empty()) {
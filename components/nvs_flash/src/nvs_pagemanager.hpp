@@ -20,6 +20,7 @@
 #include "nvs_page.hpp"
 #include "nvs_pagemanager.hpp"
 #include "intrusive_list.h"
+#include "sdkconfig.h"
 
 namespace nvs
 {
@@ -31,7 +32,23 @@ public:
 
     PageManager() {}
 
-    esp_err_t load(uint32_t baseSector, uint32_t sectorCount);
+    /**
+     * Load all pages of the partition. If deferItems is set, items of full
+     * pages other than the last one are only read by loadItems, unless
+     * recovery after power loss needs them.
+     */
+    esp_err_t load(uint32_t baseSector, uint32_t sectorCount, bool deferItems = false);
+
+    /**
+     * Read items of a page whose loading was deferred. Has to be done before
+     * anything is written to the partition.
+     */
+    esp_err_t loadItems(Page& page);
+
+    bool hasDeferredPages() const
+    {
+        return mDeferredPageCount != 0;
+    }
 
     TPageListIterator begin()
     {
@@ -54,6 +71,26 @@ public:
 
     esp_err_t requestNewPage();
 
+    /**
+     * Choose the page which requestNewPage or compaction should free next: the
+     * one with the most unused entries, among pages with at most maxUsedEntries
+     * used entries, so that the fewest items have to be moved. The current page
+     * is only considered if includeCurrent is set. Returns nullptr if no page
+     * has any unused entries.
+     */
+    Page* selectReclaimPage(size_t maxUsedEntries = Page::ENTRY_COUNT, bool includeCurrent = true);
+
+    /**
+     * Erase a page which no longer holds any items and return it to the
+     * list of free pages.
+     */
+    esp_err_t releasePage(Page& page);
+
+    size_t getFreePageCount() const
+    {
+        return mFreePageList.size();
+    }
+
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
     uint32_t getBaseSector()
@@ -66,12 +103,16 @@ protected:
 
     esp_err_t activatePage();
 
+    void eraseOlderItem(Page& lastPage, const Item& item);
+
     TPageList mPageList;
     TPageList mFreePageList;
     std::unique_ptr<Page[]> mPages;
     uint32_t mBaseSector;
     uint32_t mPageCount;
     uint32_t mSeqNumber;
+    size_t mDeferredPageCount = 0;
+    Page* mRecoveryPage = nullptr; // last page at load time, duplicates are checked against it
 }; // class PageManager
 
 
@@ -84,43 +84,101 @@ void Storage::eraseOrphanDataBlobs(TBlobIndexList& blobIdxList)
     }
 }
 
+void Storage::eraseOrphanDataBlobs()
+{
+    // Populate list of multi-page index entries.
+    TBlobIndexList blobIdxList;
+    populateBlobIndices(blobIdxList);
+
+    // Remove the entries for which there is no parent multi-page index.
+    eraseOrphanDataBlobs(blobIdxList);
+
+    // Purge the blob index list
+    blobIdxList.clearAndFreeNodes();
+}
+
+void Storage::loadNamespaces(Page& page)
+{
+    size_t itemIndex = 0;
+    Item item;
+    while (page.findItem(Page::NS_INDEX, ItemType::U8, nullptr, itemIndex, item) == ESP_OK) {
+        NamespaceEntry* entry = new NamespaceEntry;
+        item.getKey(entry->mName, sizeof(entry->mName) - 1);
+        item.getValue(entry->mIndex);
+        mNamespaces.push_back(entry);
+        mNamespaceUsage.set(entry->mIndex, true);
+        itemIndex += item.span;
+    }
+}
+
+esp_err_t Storage::loadDeferredPage(Page& page)
+{
+    if (page.itemsLoaded()) {
+        return ESP_OK;
+    }
+    auto err = mPageManager.loadItems(page);
+    if (err != ESP_OK) {
+        return err;
+    }
+    loadNamespaces(page);
+    page.forEachItemHash([&](uint32_t hash, size_t) {
+        mItemIndex.insert(hash, &page);
+    });
+    if (!mPageManager.hasDeferredPages()) {
+        // orphans can only be told apart once all blob indices are known
+        eraseOrphanDataBlobs();
+    }
+    return ESP_OK;
+}
+
+esp_err_t Storage::loadDeferredPages()
+{
+    for (auto it = mPageManager.begin(); it != mPageManager.end() && mPageManager.hasDeferredPages(); ++it) {
+        auto err = loadDeferredPage(*it);
+        if (err != ESP_OK) {
+            return err;
+        }
+    }
+    return ESP_OK;
+}
+
 esp_err_t Storage::init(uint32_t baseSector, uint32_t sectorCount)
 {
-    auto err = mPageManager.load(baseSector, sectorCount);
+    auto err = mPageManager.load(baseSector, sectorCount, mLazyPageLoad);
     if (err != ESP_OK) {
         mState = StorageState::INVALID;
         return err;
     }
 
-    // load namespaces list
+    // load namespaces list, namespaces on deferred pages are added when these are loaded
     clearNamespaces();
     std::fill_n(mNamespaceUsage.data(), mNamespaceUsage.byteSize() / 4, 0);
     for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
-        Page& p = *it;
-        size_t itemIndex = 0;
-        Item item;
-        while (p.findItem(Page::NS_INDEX, ItemType::U8, nullptr, itemIndex, item) == ESP_OK) {
-            NamespaceEntry* entry = new NamespaceEntry;
-            item.getKey(entry->mName, sizeof(entry->mName) - 1);
-            item.getValue(entry->mIndex);
-            mNamespaces.push_back(entry);
-            mNamespaceUsage.set(entry->mIndex, true);
-            itemIndex += item.span;
+        if (it->itemsLoaded()) {
+            loadNamespaces(*it);
         }
     }
     mNamespaceUsage.set(0, true);
     mNamespaceUsage.set(255, true);
     mState = StorageState::ACTIVE;
 
-    // Populate list of multi-page index entries.
-    TBlobIndexList blobIdxList;
-    populateBlobIndices(blobIdxList);
+    if (!mPageManager.hasDeferredPages()) {
+        eraseOrphanDataBlobs();
+    }
 
-    // Remove the entries for which there is no parent multi-page index.
-    eraseOrphanDataBlobs(blobIdxList);
+    mItemIndex.init(mItemIndexLimit, mPageManager.getPageCount());
+    rebuildItemIndex();
 
-    // Purge the blob index list
-    blobIdxList.clearAndFreeNodes();
+    mValueCache.init(mValueCacheSize);
+
+    // If power went out after a transaction was committed, but before the items
+    // it erases were removed, finish this now.
+    mEraseMarksLeft = true;
+    err = eraseMarkedItems();
+    if (err != ESP_OK) {
+        mState = StorageState::INVALID;
+        return err;
+    }
 
 #ifndef ESP_PLATFORM
     debugCheck();
@@ -133,11 +191,159 @@ bool Storage::isValid() const
     return mState == StorageState::ACTIVE;
 }
 
+void Storage::rebuildItemIndex()
+{
+    if (!mItemIndex.isEnabled()) {
+        return;
+    }
+    mItemIndex.clear();
+    for (auto it = mPageManager.begin(); it != mPageManager.end(); ++it) {
+        Page* page = it;
+        page->forEachItemHash([=](uint32_t hash, size_t) {
+            mItemIndex.insert(hash, page);
+        });
+    }
+}
+
+esp_err_t Storage::requestNewPage()
+{
+    auto err = mPageManager.requestNewPage();
+    // items may have been moved from the page which was freed
+    rebuildItemIndex();
+    return err;
+}
+
+esp_err_t Storage::compact(size_t maxItems)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = eraseMarkedItems();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (mPageManager.getFreePageCount() >= mCompactFreePages) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    // only pages whose remaining items all fit into the current page are
+    // considered, so the chosen page is picked again by the next call
+    Page& page = getCurrentPage();
+    Page* reclaimPage = mPageManager.selectReclaimPage(page.getFreeEntryCount(), false);
+    if (reclaimPage == nullptr) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+
+    size_t itemIndex = 0;
+    Item item;
+    for (size_t moved = 0; moved < maxItems && reclaimPage->getUsedEntryCount() > 0; ++moved) {
+        err = reclaimPage->findItem(Page::NS_ANY, ItemType::ANY, nullptr, itemIndex, item);
+        if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+            break;
+        } else if (err != ESP_OK) {
+            return err;
+        }
+        mItemIndex.insert(item, &page);
+        err = reclaimPage->moveItem(itemIndex, page);
+        if (err != ESP_OK) {
+            return err;
+        }
+        mItemIndex.erase(item, reclaimPage);
+        itemIndex += item.span;
+    }
+
+    if (reclaimPage->getUsedEntryCount() == 0) {
+        err = mPageManager.releasePage(*reclaimPage);
+    }
+#ifndef ESP_PLATFORM
+    if (err == ESP_OK) {
+        debugCheck();
+    }
+#endif
+    return err;
+}
+
+esp_err_t Storage::writeItemToPage(Page& page, uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx)
+{
+    // page adds the item to its hash list before writing it, do the same here
+    mItemIndex.insert(Item(nsIndex, datatype, 0, key, chunkIdx), &page);
+    return page.writeItem(nsIndex, datatype, key, data, dataSize, chunkIdx);
+}
+
+esp_err_t Storage::eraseItemFromPage(Page& page, uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx, VerOffset chunkStart)
+{
+    auto err = page.eraseItem(nsIndex, datatype, key, chunkIdx, chunkStart);
+    if (err == ESP_OK) {
+        mItemIndex.erase(Item(nsIndex, datatype, 0, key, chunkIdx), &page);
+    }
+    return err;
+}
+
+esp_err_t Storage::writeItemsToPage(Page& page, Transaction& tx, size_t& itemIndex)
+{
+    tx.forEachItem([&](const Item& item) {
+        mItemIndex.insert(item, &page);
+    });
+    return page.writeItems(tx.getEntries(), tx.getEntryCount(), itemIndex);
+}
+
 esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
 {
+    size_t itemIndex;
+    return findItem(nsIndex, datatype, key, page, itemIndex, item, chunkIdx, chunkStart);
+}
+
+esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, size_t& itemIndex, Item& item, uint8_t chunkIdx, VerOffset chunkStart)
+{
+    // the index doesn't know about items on pages which haven't been loaded yet
+    if (mItemIndex.isEnabled() && !mPageManager.hasDeferredPages() &&
+            nsIndex != Page::NS_ANY && datatype != ItemType::ANY && key != nullptr) {
+        Page* candidates[ItemIndex::MAX_CANDIDATES];
+        size_t count = mItemIndex.find(Item(nsIndex, datatype, 0, key, chunkIdx), candidates, ItemIndex::MAX_CANDIDATES);
+        if (count <= ItemIndex::MAX_CANDIDATES) {
+            // same result as the linear search below: prefer the oldest page
+            Page* found = nullptr;
+            uint32_t foundSeqNumber = 0;
+            for (size_t i = 0; i < count; ++i) {
+                size_t candidateIndex = 0;
+                uint32_t seqNumber;
+                Item candidateItem;
+                if (candidates[i]->getSeqNumber(seqNumber) != ESP_OK || (found && seqNumber >= foundSeqNumber)) {
+                    continue;
+                }
+                auto err = candidates[i]->findItem(nsIndex, datatype, key, candidateIndex, candidateItem, chunkIdx, chunkStart);
+                if (err == ESP_OK) {
+                    found = candidates[i];
+                    foundSeqNumber = seqNumber;
+                    itemIndex = candidateIndex;
+                    item = candidateItem;
+                }
+            }
+            if (found) {
+                page = found;
+                return ESP_OK;
+            }
+            if (mItemIndex.isComplete()) {
+                return ESP_ERR_NVS_NOT_FOUND;
+            }
+        }
+    }
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
-        size_t itemIndex = 0;
-        auto err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
+        auto err = loadDeferredPage(*it);
+        if (err != ESP_OK) {
+            return err;
+        }
+        itemIndex = 0;
+        err = it->findItem(nsIndex, datatype, key, itemIndex, item, chunkIdx, chunkStart);
         if (err == ESP_OK) {
             page = it;
             return ESP_OK;
@@ -146,22 +352,26 @@ esp_err_t Storage::findItem(uint8_t nsIndex, ItemType datatype, const char* key,
     return ESP_ERR_NVS_NOT_FOUND;
 }
 
-esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize, VerOffset chunkStart)
+size_t Storage::getMaxBlobSize()
 {
-    uint8_t chunkCount = 0;
-    TUsedPageList usedPages;
-    size_t remainingSize = dataSize;
-    size_t offset=0;
-    esp_err_t err = ESP_OK;
-
     /* Check how much maximum data can be accommodated**/
     uint32_t max_pages = mPageManager.getPageCount() - 1;
 
     if(max_pages > (Page::CHUNK_ANY-1)/2) {
        max_pages = (Page::CHUNK_ANY-1)/2;
     }
+    return max_pages * Page::CHUNK_MAX_SIZE;
+}
+
+esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const void* data, size_t dataSize, VerOffset chunkStart)
+{
+    uint8_t chunkCount = 0;
+    TUsedPageList usedPages;
+    size_t remainingSize = dataSize;
+    size_t offset=0;
+    esp_err_t err = ESP_OK;
 
-    if (dataSize > max_pages * Page::CHUNK_MAX_SIZE) {
+    if (dataSize > getMaxBlobSize()) {
         return ESP_ERR_NVS_VALUE_TOO_LONG;
     }
 
@@ -177,7 +387,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
                     return err;
                 }
             }
-            err = mPageManager.requestNewPage();
+            err = requestNewPage();
             if (err != ESP_OK) {
                 return err;
             } else if(getCurrentPage().getVarDataTailroom() == tailroom) {
@@ -196,7 +406,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         chunkSize = (remainingSize > tailroom)? tailroom : remainingSize;
         remainingSize -= chunkSize;
 
-        err = page.writeItem(nsIndex, ItemType::BLOB_DATA, key,
+        err = writeItemToPage(page, nsIndex, ItemType::BLOB_DATA, key,
                 static_cast<const uint8_t*> (data) + offset, chunkSize, static_cast<uint8_t> (chunkStart) + chunkCount);
         chunkCount++;
         assert(err != ESP_ERR_NVS_PAGE_FULL);
@@ -213,7 +423,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
                         break;
                     }
                 }
-                err = mPageManager.requestNewPage();
+                err = requestNewPage();
                 if (err != ESP_OK) {
                     break;
                 }
@@ -228,7 +438,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
             item.blobIndex.chunkCount = chunkCount;
             item.blobIndex.chunkStart = chunkStart;
 
-            err = getCurrentPage().writeItem(nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
+            err = writeItemToPage(getCurrentPage(), nsIndex, ItemType::BLOB_IDX, key, item.data, sizeof(item.data));
             assert(err != ESP_ERR_NVS_PAGE_FULL);
             break;
         }
@@ -238,7 +448,7 @@ esp_err_t Storage::writeMultiPageBlob(uint8_t nsIndex, const char* key, const vo
         /* Anything failed, then we should erase all the written chunks*/
         int ii=0;
         for (auto it = std::begin(usedPages); it != std::end(usedPages); it++) {
-            it->mPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, ii++);
+            eraseItemFromPage(*it->mPage, nsIndex, ItemType::BLOB_DATA, key, ii++);
         }
     }
     usedPages.clearAndFreeNodes();
@@ -251,10 +461,21 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = eraseMarkedItems();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    mValueCache.erase(nsIndex, key);
+
     Page* findPage = nullptr;
     Item item;
 
-    esp_err_t err;
     if (datatype == ItemType::BLOB) {
         err = findItem(nsIndex, ItemType::BLOB_IDX, key, findPage, item);
     } else {
@@ -313,7 +534,7 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
     } else {
 
         Page& page = getCurrentPage();
-        err = page.writeItem(nsIndex, datatype, key, data, dataSize);
+        err = writeItemToPage(page, nsIndex, datatype, key, data, dataSize);
         if (err == ESP_ERR_NVS_PAGE_FULL) {
             if (page.state() != Page::PageState::FULL) {
                 err = page.markFull();
@@ -321,12 +542,12 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
                     return err;
                 }
             }
-            err = mPageManager.requestNewPage();
+            err = requestNewPage();
             if (err != ESP_OK) {
                 return err;
             }
 
-            err = getCurrentPage().writeItem(nsIndex, datatype, key, data, dataSize);
+            err = writeItemToPage(getCurrentPage(), nsIndex, datatype, key, data, dataSize);
             if (err == ESP_ERR_NVS_PAGE_FULL) {
                 return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
             }
@@ -343,7 +564,7 @@ esp_err_t Storage::writeItem(uint8_t nsIndex, ItemType datatype, const char* key
                 findPage->state() == Page::PageState::INVALID) {
             ESP_ERROR_CHECK(findItem(nsIndex, datatype, key, findPage, item));
         }
-        err = findPage->eraseItem(nsIndex, datatype, key);
+        err = eraseItemFromPage(*findPage, nsIndex, datatype, key);
         if (err == ESP_ERR_FLASH_OP_FAIL) {
             return ESP_ERR_NVS_REMOVE_FAILED;
         }
@@ -362,9 +583,22 @@ esp_err_t Storage::createOrOpenNamespace(const char* nsName, bool canCreate, uin
     if (mState != StorageState::ACTIVE) {
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
-    auto it = std::find_if(mNamespaces.begin(), mNamespaces.end(), [=] (const NamespaceEntry& e) -> bool {
-        return strncmp(nsName, e.mName, sizeof(e.mName) - 1) == 0;
-    });
+    auto findNamespace = [&]() {
+        return std::find_if(mNamespaces.begin(), mNamespaces.end(), [=] (const NamespaceEntry& e) -> bool {
+            return strncmp(nsName, e.mName, sizeof(e.mName) - 1) == 0;
+        });
+    };
+    auto it = findNamespace();
+    // namespace entry may be on a page which hasn't been loaded yet
+    for (auto p = mPageManager.begin(); it == std::end(mNamespaces) && p != mPageManager.end(); ++p) {
+        if (!p->itemsLoaded()) {
+            auto err = loadDeferredPage(*p);
+            if (err != ESP_OK) {
+                return err;
+            }
+            it = findNamespace();
+        }
+    }
     if (it == std::end(mNamespaces)) {
         if (!canCreate) {
             return ESP_ERR_NVS_NOT_FOUND;
@@ -449,6 +683,23 @@ esp_err_t Storage::readItem(uint8_t nsIndex, ItemType datatype, const char* key,
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    bool cacheable = mValueCache.isEnabled() && ValueCache::isCacheableType(datatype);
+    if (cacheable) {
+        size_t cachedSize;
+        const uint8_t* cached = mValueCache.find(nsIndex, datatype, key, cachedSize);
+        if (cached) {
+            // same checks as Page::readItem
+            if (!isVariableLengthType(datatype) && dataSize != cachedSize) {
+                return ESP_ERR_NVS_TYPE_MISMATCH;
+            }
+            if (dataSize < cachedSize) {
+                return ESP_ERR_NVS_INVALID_LENGTH;
+            }
+            memcpy(data, cached, cachedSize);
+            return ESP_OK;
+        }
+    }
+
     Item item;
     Page* findPage = nullptr;
     if (datatype == ItemType::BLOB) {
@@ -462,7 +713,11 @@ esp_err_t Storage::readItem(uint8_t nsIndex, ItemType datatype, const char* key,
     if (err != ESP_OK) {
         return err;
     }
-    return findPage->readItem(nsIndex, datatype, key, data, dataSize);
+    err = findPage->readItem(nsIndex, datatype, key, data, dataSize);
+    if (err == ESP_OK && cacheable) {
+        mValueCache.insert(nsIndex, datatype, key, data, isVariableLengthType(datatype) ? item.varLength.dataSize : dataSize);
+    }
+    return err;
     
 }
 
@@ -479,7 +734,7 @@ esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffse
         return err;
     }
     /* Erase the index first and make children blobs orphan*/
-    err = findPage->eraseItem(nsIndex, ItemType::BLOB_IDX, key, Page::CHUNK_ANY, chunkStart);
+    err = eraseItemFromPage(*findPage, nsIndex, ItemType::BLOB_IDX, key, Page::CHUNK_ANY, chunkStart);
     if (err != ESP_OK) {
         return err;
     }
@@ -501,7 +756,7 @@ esp_err_t Storage::eraseMultiPageBlob(uint8_t nsIndex, const char* key, VerOffse
         } else if (err == ESP_ERR_NVS_NOT_FOUND) {
             continue; // Keep erasing other chunks
         }
-        err = findPage->eraseItem(nsIndex, ItemType::BLOB_DATA, key, static_cast<uint8_t> (chunkStart) + chunkNum);
+        err = eraseItemFromPage(*findPage, nsIndex, ItemType::BLOB_DATA, key, static_cast<uint8_t> (chunkStart) + chunkNum);
         if (err != ESP_OK) {
             return err;
         }
@@ -517,18 +772,30 @@ esp_err_t Storage::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = eraseMarkedItems();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    mValueCache.erase(nsIndex, key);
+
     if (datatype == ItemType::BLOB) {
         return eraseMultiPageBlob(nsIndex, key);
     }
 
     Item item;
     Page* findPage = nullptr;
-    auto err = findItem(nsIndex, datatype, key, findPage, item);
+    err = findItem(nsIndex, datatype, key, findPage, item);
     if (err != ESP_OK) {
         return err;
     }
 
-    return findPage->eraseItem(nsIndex, datatype, key);
+    return eraseItemFromPage(*findPage, nsIndex, datatype, key);
 }
 
 esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
@@ -537,19 +804,319 @@ esp_err_t Storage::eraseNamespace(uint8_t nsIndex)
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = eraseMarkedItems();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    mValueCache.eraseNamespace(nsIndex);
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         while (true) {
-            auto err = it->eraseItem(nsIndex, ItemType::ANY, nullptr);
+            err = it->eraseItem(nsIndex, ItemType::ANY, nullptr);
             if (err == ESP_ERR_NVS_NOT_FOUND) {
                 break;
             }
             else if (err != ESP_OK) {
+                rebuildItemIndex();
+                return err;
+            }
+        }
+    }
+    rebuildItemIndex();
+    return ESP_OK;
+
+}
+
+esp_err_t Storage::writeItem(Transaction& tx, uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    return tx.writeItem(nsIndex, datatype, key, data, dataSize);
+}
+
+esp_err_t Storage::eraseItem(Transaction& tx, uint8_t nsIndex, ItemType datatype, const char* key)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    bool staged = tx.removeItem(nsIndex, key);
+
+    Item item;
+    Page* findPage = nullptr;
+    auto err = findItem(nsIndex, (datatype == ItemType::BLOB) ? ItemType::BLOB_IDX : datatype, key, findPage, item);
+    if (err == ESP_ERR_NVS_NOT_FOUND && datatype == ItemType::BLOB) {
+        err = findItem(nsIndex, ItemType::BLOB, key, findPage, item);
+    }
+    if (err == ESP_ERR_NVS_NOT_FOUND && staged) {
+        return ESP_OK;
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    // record the actual type, so that the erase doesn't depend on lookup order at commit time
+    datatype = item.datatype;
+    if (datatype == ItemType::BLOB_IDX || datatype == ItemType::BLOB_DATA) {
+        datatype = ItemType::BLOB;
+    }
+    return tx.eraseItem(nsIndex, datatype, key);
+}
+
+esp_err_t Storage::commitTransaction(Transaction& tx)
+{
+    if (mState != StorageState::ACTIVE) {
+        return ESP_ERR_NVS_NOT_INITIALIZED;
+    }
+
+    if (tx.empty()) {
+        return ESP_OK;
+    }
+
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    err = eraseMarkedItems();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    tx.forEachItem([&](const Item& item) {
+        mValueCache.erase(Transaction::getNsIndex(item), item.key);
+    });
+    tx.addCommitMark();
+
+    /* Toggle the version of staged blobs, same as writeItem does */
+    Item* entries = tx.getEntries();
+    for (size_t i = 0; i < tx.getEntryCount(); i += entries[i].span) {
+        if (entries[i].datatype != ItemType::BLOB_DATA) {
+            continue;
+        }
+        Item& dataItem = entries[i];
+        Item& indexItem = entries[i + dataItem.span];
+        assert(indexItem.datatype == ItemType::BLOB_IDX);
+
+        Item item;
+        Page* findPage = nullptr;
+        VerOffset nextStart = VerOffset::VER_0_OFFSET;
+        auto err = findItem(dataItem.nsIndex, ItemType::BLOB_IDX, dataItem.key, findPage, item);
+        if (err == ESP_OK) {
+            nextStart = (item.blobIndex.chunkStart == VerOffset::VER_1_OFFSET) ? VerOffset::VER_0_OFFSET : VerOffset::VER_1_OFFSET;
+        } else if (err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        }
+        dataItem.chunkIndex = static_cast<uint8_t>(nextStart);
+        dataItem.crc32 = dataItem.calculateCrc32();
+        indexItem.blobIndex.chunkStart = nextStart;
+        indexItem.crc32 = indexItem.calculateCrc32();
+    }
+
+    Page* page = &getCurrentPage();
+    size_t itemIndex;
+    err = writeItemsToPage(*page, tx, itemIndex);
+    if (err == ESP_ERR_NVS_PAGE_FULL) {
+        if (page->state() != Page::PageState::FULL) {
+            err = page->markFull();
+            if (err != ESP_OK) {
                 return err;
             }
         }
+        err = requestNewPage();
+        if (err != ESP_OK) {
+            return err;
+        }
+        page = &getCurrentPage();
+        err = writeItemsToPage(*page, tx, itemIndex);
+        if (err == ESP_ERR_NVS_PAGE_FULL) {
+            return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+        }
+    }
+    if (err != ESP_OK) {
+        tx.clear();
+        return err;
+    }
+
+    /* All items are committed at this point, remove the ones they replace */
+    err = eraseReplacedItems(*page, itemIndex, tx);
+    tx.clear();
+    if (err != ESP_OK) {
+        /* Marks left on flash are removed before anything else is written */
+        mEraseMarksLeft = true;
+    }
+
+    if (err == ESP_ERR_FLASH_OP_FAIL) {
+        return ESP_ERR_NVS_REMOVE_FAILED;
+    }
+    if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+        return err;
+    }
+#ifndef ESP_PLATFORM
+    debugCheck();
+#endif
+    return ESP_OK;
+}
+
+esp_err_t Storage::findReplacedItem(Page& page, size_t itemIndex, uint8_t nsIndex, ItemType datatype, const char* key, ItemLocation& location)
+{
+    Item item;
+    Page* findPage = nullptr;
+    auto err = findItem(nsIndex, datatype, key, findPage, item);
+    if (err != ESP_OK) {
+        return err;
+    }
+    size_t index = 0;
+    err = findPage->findItem(nsIndex, datatype, key, index, item);
+    if (err != ESP_OK) {
+        return err;
+    }
+    // old item on the same page comes before the ones written by the transaction
+    if (findPage == &page && index >= itemIndex) {
+        return ESP_ERR_NVS_NOT_FOUND;
+    }
+    location.mPage = findPage;
+    location.mIndex = index;
+    return ESP_OK;
+}
+
+esp_err_t Storage::eraseReplacedItems(Page& page, size_t itemIndex, Transaction& tx)
+{
+    std::unique_ptr<ItemLocation[]> locations(new ItemLocation[tx.getEntryCount()]);
+    size_t count = 0;
+    esp_err_t err = ESP_OK;
+
+    tx.forEachItem([&](const Item& item) {
+        if (err != ESP_OK || item.datatype == ItemType::BLOB_DATA || Transaction::isCommitMark(item)) {
+            return;
+        }
+        ItemType datatype = item.datatype;
+        uint8_t nsIndex = Transaction::getNsIndex(item);
+        if (datatype == ItemType::BLOB_IDX || datatype == ItemType::ERASE_MARK) {
+            VerOffset chunkStart = VerOffset::VER_ANY;
+            if (datatype == ItemType::BLOB_IDX) {
+                chunkStart = (item.blobIndex.chunkStart == VerOffset::VER_1_OFFSET) ? VerOffset::VER_0_OFFSET : VerOffset::VER_1_OFFSET;
+                datatype = ItemType::BLOB;
+            } else {
+                datatype = static_cast<ItemType>(item.data[0]);
+            }
+            if (datatype == ItemType::BLOB) {
+                err = eraseMultiPageBlob(nsIndex, item.key, chunkStart);
+                if (err != ESP_ERR_NVS_NOT_FOUND) {
+                    return;
+                }
+                /* Support for earlier versions where BLOBS were stored without index */
+            }
+        }
+        ItemLocation& location = locations[count];
+        err = findReplacedItem(page, itemIndex, nsIndex, datatype, item.key, location);
+        if (err == ESP_OK) {
+            location.mItem = &item;
+            ++count;
+        } else if (err == ESP_ERR_NVS_NOT_FOUND) {
+            err = ESP_OK;
+        }
+    });
+    if (err == ESP_OK) {
+        err = eraseItemsFromPages(locations.get(), count);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    /* Erase marks go last, so that if power goes out before the items they refer
+     * to are erased, init can finish the job. */
+    count = 0;
+    tx.forEachItem([&](const Item& item) {
+        if (item.datatype == ItemType::ERASE_MARK) {
+            locations[count].mPage = &page;
+            locations[count].mIndex = itemIndex + (&item - tx.getEntries());
+            locations[count].mItem = &item;
+            ++count;
+        }
+    });
+    return eraseItemsFromPages(locations.get(), count);
+}
+
+esp_err_t Storage::eraseItemsFromPages(ItemLocation* locations, size_t count)
+{
+    std::unique_ptr<size_t[]> indices(new size_t[count]);
+    for (size_t i = 0; i < count; ++i) {
+        Page* page = locations[i].mPage;
+        if (page == nullptr) {
+            continue;
+        }
+        // erase all items on this page with a single pass over its entry state table
+        size_t pageCount = 0;
+        for (size_t j = i; j < count; ++j) {
+            if (locations[j].mPage == page) {
+                indices[pageCount++] = locations[j].mIndex;
+                mItemIndex.erase(*locations[j].mItem, page);
+                locations[j].mPage = nullptr;
+            }
+        }
+        auto err = page->eraseItems(indices.get(), pageCount);
+        if (err != ESP_OK) {
+            return err;
+        }
     }
     return ESP_OK;
+}
+
+esp_err_t Storage::eraseMarkedItem(uint8_t nsIndex, ItemType datatype, const char* key)
+{
+    if (datatype == ItemType::BLOB) {
+        auto err = eraseMultiPageBlob(nsIndex, key);
+        if (err != ESP_ERR_NVS_NOT_FOUND) {
+            return err;
+        }
+    }
+
+    Item item;
+    Page* findPage = nullptr;
+    auto err = findItem(nsIndex, datatype, key, findPage, item);
+    if (err != ESP_OK) {
+        return err;
+    }
+    return eraseItemFromPage(*findPage, nsIndex, datatype, key);
+}
 
+esp_err_t Storage::eraseMarkedItems()
+{
+    if (!mEraseMarksLeft) {
+        return ESP_OK;
+    }
+    // marks are written to the current page and removed before anything else is written
+    Page& page = getCurrentPage();
+    size_t itemIndex = 0;
+    Item item;
+    while (page.findItem(Page::NS_ANY, ItemType::ERASE_MARK, nullptr, itemIndex, item) == ESP_OK) {
+        if (!Transaction::isCommitMark(item)) {
+            auto err = eraseMarkedItem(Transaction::getNsIndex(item), static_cast<ItemType>(item.data[0]), item.key);
+            if (err != ESP_OK && err != ESP_ERR_NVS_NOT_FOUND) {
+                return err;
+            }
+        }
+        ItemLocation location;
+        location.mPage = &page;
+        location.mIndex = itemIndex;
+        location.mItem = &item;
+        auto err = eraseItemsFromPages(&location, 1);
+        if (err != ESP_OK) {
+            return err;
+        }
+        itemIndex += item.span;
+    }
+    mEraseMarksLeft = false;
+    return ESP_OK;
 }
 
 esp_err_t Storage::getItemDataSize(uint8_t nsIndex, ItemType datatype, const char* key, size_t& dataSize)
@@ -558,6 +1125,12 @@ esp_err_t Storage::getItemDataSize(uint8_t nsIndex, ItemType datatype, const cha
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    if (datatype == ItemType::SZ) {
+        if (mValueCache.find(nsIndex, datatype, key, dataSize, false)) {
+            return ESP_OK;
+        }
+    }
+
     Item item;
     Page* findPage = nullptr;
     auto err = findItem(nsIndex, datatype, key, findPage, item);
@@ -587,9 +1160,17 @@ void Storage::debugDump()
 #ifndef ESP_PLATFORM
 void Storage::debugCheck()
 {
+    if (!mDebugCheck) {
+        return;
+    }
+
     std::map<std::string, Page*> keys;
 
     for (auto p = mPageManager.begin(); p != mPageManager.end(); ++p) {
+        // a page is invalid after a write to it failed, until nvs is initialized again
+        if (!p->itemsLoaded() || p->state() == Page::PageState::INVALID) {
+            continue;
+        }
         size_t itemIndex = 0;
         size_t usedCount = 0;
         Item item;
@@ -613,10 +1194,86 @@ void Storage::debugCheck()
 
 esp_err_t Storage::fillStats(nvs_stats_t& nvsStats)
 {
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
     nvsStats.namespace_count = mNamespaces.size();
+    nvsStats.cache_hits = mValueCache.getHitCount();
+    nvsStats.cache_misses = mValueCache.getMissCount();
     return mPageManager.fillStats(nvsStats);
 }
 
+static bool isIterableItem(const Item& item, nvs_type_t type)
+{
+    // namespace entries, blob data chunks and erase marks are not visible to the user
+    if (item.nsIndex == Page::NS_INDEX ||
+            item.datatype == ItemType::BLOB_DATA ||
+            item.datatype == ItemType::ERASE_MARK) {
+        return false;
+    }
+    if (type == NVS_TYPE_ANY) {
+        return true;
+    }
+    if (type == NVS_TYPE_BLOB) {
+        return item.datatype == ItemType::BLOB_IDX || item.datatype == ItemType::BLOB;
+    }
+    return item.datatype == static_cast<ItemType>(type);
+}
+
+bool Storage::findEntry(nvs_opaque_iterator_t* it, const char* nsName)
+{
+    if (loadDeferredPages() != ESP_OK) {
+        return false;
+    }
+
+    it->entryIndex = 0;
+    it->nsIndex = Page::NS_ANY;
+    it->page = mPageManager.begin();
+
+    if (nsName != nullptr) {
+        auto nsEntry = std::find_if(mNamespaces.begin(), mNamespaces.end(), [=](const NamespaceEntry& e) -> bool {
+            return strncmp(nsName, e.mName, sizeof(e.mName) - 1) == 0;
+        });
+        if (nsEntry == mNamespaces.end()) {
+            return false;
+        }
+        it->nsIndex = nsEntry->mIndex;
+    }
+
+    return nextEntry(it);
+}
+
+bool Storage::nextEntry(nvs_opaque_iterator_t* it)
+{
+    while (it->page != mPageManager.end()) {
+        while (it->page->findItem(it->nsIndex, ItemType::ANY, nullptr, it->entryIndex, it->entry) == ESP_OK) {
+            it->entryIndex += it->entry.span;
+            if (isIterableItem(it->entry, it->type)) {
+                return true;
+            }
+        }
+        it->entryIndex = 0;
+        ++it->page;
+    }
+    return false;
+}
+
+void Storage::fillEntryInfo(const Item& item, nvs_entry_info_t& info)
+{
+    info.namespace_name[0] = 0;
+    for (auto it = mNamespaces.begin(); it != mNamespaces.end(); ++it) {
+        if (it->mIndex == item.nsIndex) {
+            strncpy(info.namespace_name, it->mName, sizeof(info.namespace_name) - 1);
+            info.namespace_name[sizeof(info.namespace_name) - 1] = 0;
+            break;
+        }
+    }
+    strncpy(info.key, item.key, sizeof(info.key) - 1);
+    info.key[sizeof(info.key) - 1] = 0;
+    info.type = (item.datatype == ItemType::BLOB_IDX) ? NVS_TYPE_BLOB : static_cast<nvs_type_t>(item.datatype);
+}
+
 esp_err_t Storage::calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries)
 {
     usedEntries = 0;
@@ -625,11 +1282,16 @@ esp_err_t Storage::calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries)
         return ESP_ERR_NVS_NOT_INITIALIZED;
     }
 
+    auto err = loadDeferredPages();
+    if (err != ESP_OK) {
+        return err;
+    }
+
     for (auto it = std::begin(mPageManager); it != std::end(mPageManager); ++it) {
         size_t itemIndex = 0;
         Item item;
         while (true) {
-            auto err = it->findItem(nsIndex, ItemType::ANY, nullptr, itemIndex, item);
+            err = it->findItem(nsIndex, ItemType::ANY, nullptr, itemIndex, item);
             if (err == ESP_ERR_NVS_NOT_FOUND) {
                 break;
             }
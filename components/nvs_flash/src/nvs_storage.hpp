@@ -21,6 +21,10 @@
 #include "nvs_types.hpp"
 #include "nvs_page.hpp"
 #include "nvs_pagemanager.hpp"
+#include "nvs_item_index.hpp"
+#include "nvs_value_cache.hpp"
+#include "nvs_transaction.hpp"
+#include "sdkconfig.h"
 
 //extern void dumpBytes(const uint8_t* data, size_t count);
 
@@ -29,6 +33,9 @@ namespace nvs
 
 class Storage : public intrusive_list_node<Storage>
 {
+    friend class BlobWriter;
+    friend class BlobReader;
+
     enum class StorageState : uint32_t {
         INVALID,
         ACTIVE,
@@ -58,6 +65,12 @@ class Storage : public intrusive_list_node<Storage>
 
     typedef intrusive_list<BlobIndexNode> TBlobIndexList;
 
+    struct ItemLocation {
+        Page* mPage;
+        size_t mIndex;
+        const Item* mItem; // staged item with the same hash, used to update the item index
+    };
+
 public:
     ~Storage();
 
@@ -96,6 +109,29 @@ public:
     
     esp_err_t eraseNamespace(uint8_t nsIndex);
 
+    esp_err_t writeItem(Transaction& tx, uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    esp_err_t eraseItem(Transaction& tx, uint8_t nsIndex, ItemType datatype, const char* key);
+
+    template<typename T>
+    esp_err_t writeItem(Transaction& tx, uint8_t nsIndex, const char* key, const T& value)
+    {
+        return writeItem(tx, nsIndex, itemTypeOf(value), key, &value, sizeof(value));
+    }
+
+    esp_err_t eraseItem(Transaction& tx, uint8_t nsIndex, const char* key)
+    {
+        return eraseItem(tx, nsIndex, ItemType::ANY, key);
+    }
+
+    /**
+     * Write all items staged in the transaction to the current page and make
+     * them visible at once, then erase the items they replace. The transaction
+     * is cleared as soon as its items have been passed to the page, so it is
+     * only left intact if an error is returned before that.
+     */
+    esp_err_t commitTransaction(Transaction& tx);
+
     const char *getPartName() const
     {
         return mPartitionName;
@@ -115,10 +151,82 @@ public:
     
     void debugCheck();
 
+    /**
+     * Host builds check the whole storage for consistency after each write.
+     * Benchmarks turn this off, as the check reads every page.
+     */
+    void setDebugCheck(bool enable)
+    {
+        mDebugCheck = enable;
+    }
+
     esp_err_t fillStats(nvs_stats_t& nvsStats);
 
     esp_err_t calcEntriesInNamespace(uint8_t nsIndex, size_t& usedEntries);
 
+    /**
+     * Position the iterator at the first entry which matches its type, in the
+     * given namespace or in any namespace if nsName is nullptr.
+     * Returns false if there is no such entry.
+     */
+    bool findEntry(nvs_opaque_iterator_t* it, const char* nsName);
+
+    bool nextEntry(nvs_opaque_iterator_t* it);
+
+    void fillEntryInfo(const Item& item, nvs_entry_info_t& info);
+
+    /**
+     * Set maximum number of entries in the storage-wide item index.
+     * 0 disables the index, ItemIndex::UNBOUNDED sizes it for the whole partition.
+     * Takes effect on the next call to init.
+     */
+    void setItemIndexLimit(size_t maxEntries)
+    {
+        mItemIndexLimit = maxEntries;
+    }
+
+    /**
+     * Set number of values kept in the value cache, 0 disables the cache.
+     * Takes effect on the next call to init.
+     */
+    void setValueCacheSize(size_t entries)
+    {
+        mValueCacheSize = entries;
+    }
+
+    /**
+     * Defer reading items of full pages until they are needed.
+     * Takes effect on the next call to init.
+     */
+    void setLazyPageLoad(bool enable)
+    {
+        mLazyPageLoad = enable;
+    }
+
+    /**
+     * Read items of all pages whose loading was deferred by init.
+     */
+    esp_err_t loadDeferredPages();
+
+    /**
+     * Set number of free pages compact tries to keep. While at least two pages
+     * are free, moving to a new page doesn't need to reclaim another one.
+     */
+    void setCompactFreePages(size_t pages)
+    {
+        mCompactFreePages = pages;
+    }
+
+    /**
+     * Move up to maxItems items from the page with the most unused entries to
+     * the current page, and erase that page once it is empty. This is the work
+     * requestNewPage does when only one free page is left, split into steps
+     * which can be done while the storage is idle.
+     * Returns ESP_ERR_NVS_NOT_FOUND if there are enough free pages, or if no
+     * page can be reclaimed without requesting a new page.
+     */
+    esp_err_t compact(size_t maxItems);
+
 protected:
 
     Page& getCurrentPage()
@@ -132,9 +240,38 @@ protected:
 
     void eraseOrphanDataBlobs(TBlobIndexList&);
 
+    void eraseOrphanDataBlobs();
+
+    void loadNamespaces(Page& page);
+
+    esp_err_t loadDeferredPage(Page& page);
+
+    void rebuildItemIndex();
+
+    size_t getMaxBlobSize();
+
+    esp_err_t requestNewPage();
+
+    esp_err_t writeItemToPage(Page& page, uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize, uint8_t chunkIdx = Page::CHUNK_ANY);
+
+    esp_err_t eraseItemFromPage(Page& page, uint8_t nsIndex, ItemType datatype, const char* key, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+
+    esp_err_t writeItemsToPage(Page& page, Transaction& tx, size_t& itemIndex);
+
+    esp_err_t findReplacedItem(Page& page, size_t itemIndex, uint8_t nsIndex, ItemType datatype, const char* key, ItemLocation& location);
+
+    esp_err_t eraseReplacedItems(Page& page, size_t itemIndex, Transaction& tx);
+
+    esp_err_t eraseItemsFromPages(ItemLocation* locations, size_t count);
+
+    esp_err_t eraseMarkedItem(uint8_t nsIndex, ItemType datatype, const char* key);
+
+    esp_err_t eraseMarkedItems();
 
     esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
 
+    esp_err_t findItem(uint8_t nsIndex, ItemType datatype, const char* key, Page* &page, size_t& itemIndex, Item& item, uint8_t chunkIdx = Page::CHUNK_ANY, VerOffset chunkStart = VerOffset::VER_ANY);
+
 protected:
     const char *mPartitionName;
     size_t mPageCount;
@@ -142,10 +279,45 @@ protected:
     TNamespaces mNamespaces;
     CompressedEnumTable<bool, 1, 256> mNamespaceUsage;
     StorageState mState = StorageState::INVALID;
+    bool mEraseMarksLeft = false; // erase marks of a transaction may be on flash, see eraseMarkedItems
+    ItemIndex mItemIndex;
+#if defined(CONFIG_NVS_ITEM_INDEX) && CONFIG_NVS_ITEM_INDEX_MAX_ENTRIES > 0
+    size_t mItemIndexLimit = CONFIG_NVS_ITEM_INDEX_MAX_ENTRIES;
+#elif defined(CONFIG_NVS_ITEM_INDEX)
+    size_t mItemIndexLimit = ItemIndex::UNBOUNDED;
+#else
+    size_t mItemIndexLimit = 0;
+#endif
+    ValueCache mValueCache;
+#ifdef CONFIG_NVS_VALUE_CACHE
+    size_t mValueCacheSize = CONFIG_NVS_VALUE_CACHE_ENTRIES;
+#else
+    size_t mValueCacheSize = 0;
+#endif
+#ifdef CONFIG_NVS_LAZY_PAGE_LOAD
+    bool mLazyPageLoad = true;
+#else
+    bool mLazyPageLoad = false;
+#endif
+    bool mDebugCheck = true;
+#ifdef CONFIG_NVS_COMPACT_FREE_PAGES
+    size_t mCompactFreePages = CONFIG_NVS_COMPACT_FREE_PAGES;
+#else
+    size_t mCompactFreePages = 2;
+#endif
 };
 
 } // namespace nvs
 
+struct nvs_opaque_iterator_t
+{
+    nvs_type_t type;
+    uint8_t nsIndex;
+    size_t entryIndex;
+    nvs::Storage *storage;
+    intrusive_list<nvs::Page>::iterator page;
+    nvs::Item entry;
+};
 
 
 #endif /* nvs_storage_hpp */
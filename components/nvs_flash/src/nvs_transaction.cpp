@@ -0,0 +1,200 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_transaction.hpp"
+#include "nvs_page.hpp"
+
+namespace nvs
+{
+
+// one entry of the page is left for the commit mark
+static const size_t MAX_ENTRY_COUNT = Page::ENTRY_COUNT - 1;
+
+static bool itemHasKey(const Item& item, uint8_t nsIndex, const char* key)
+{
+    return Transaction::getNsIndex(item) == nsIndex && strncmp(item.key, key, Item::MAX_KEY_LENGTH) == 0;
+}
+
+esp_err_t Transaction::writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    // blobs are staged as a single data chunk followed by the blob index
+    size_t dataEntries = 0;
+    if (isVariableLengthType(datatype)) {
+        dataEntries = (dataSize + Page::ENTRY_SIZE - 1) / Page::ENTRY_SIZE;
+    }
+    size_t entries = 1 + dataEntries + ((datatype == ItemType::BLOB) ? 1 : 0);
+    if (entries > MAX_ENTRY_COUNT || dataSize > Page::CHUNK_MAX_SIZE) {
+        return ESP_ERR_NVS_VALUE_TOO_LONG;
+    }
+
+    size_t replacedEntries = 0;
+    forEachItem([&](const Item& item) {
+        if (itemHasKey(item, nsIndex, key)) {
+            replacedEntries += item.span;
+        }
+    });
+    if (mEntryCount - replacedEntries + entries > MAX_ENTRY_COUNT) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    removeItem(nsIndex, key);
+
+    auto err = reserve(mEntryCount + entries);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    if (!isVariableLengthType(datatype)) {
+        Item* item = appendItem(nsIndex, datatype, 1, key, Item::CHUNK_ANY);
+        memcpy(item->data, data, dataSize);
+        item->crc32 = item->calculateCrc32();
+        return ESP_OK;
+    }
+
+    const uint8_t* src = static_cast<const uint8_t*>(data);
+    ItemType chunkType = (datatype == ItemType::BLOB) ? ItemType::BLOB_DATA : datatype;
+    uint8_t chunkIdx = (datatype == ItemType::BLOB) ? static_cast<uint8_t>(VerOffset::VER_0_OFFSET) : Item::CHUNK_ANY;
+    Item* item = appendItem(nsIndex, chunkType, 1 + dataEntries, key, chunkIdx);
+    item->varLength.dataCrc32 = Item::calculateCrc32(src, dataSize);
+    item->varLength.dataSize = dataSize;
+    item->varLength.reserved = 0xffff;
+    item->crc32 = item->calculateCrc32();
+    appendData(src, dataSize);
+
+    if (datatype == ItemType::BLOB) {
+        // chunk version is chosen by Storage::commitTransaction, which also updates the CRCs
+        item = appendItem(nsIndex, ItemType::BLOB_IDX, 1, key, Item::CHUNK_ANY);
+        item->blobIndex.dataSize = dataSize;
+        item->blobIndex.chunkCount = 1;
+        item->blobIndex.chunkStart = VerOffset::VER_0_OFFSET;
+        item->crc32 = item->calculateCrc32();
+    }
+    return ESP_OK;
+}
+
+esp_err_t Transaction::eraseItem(uint8_t nsIndex, ItemType datatype, const char* key)
+{
+    if (strlen(key) > Item::MAX_KEY_LENGTH) {
+        return ESP_ERR_NVS_KEY_TOO_LONG;
+    }
+
+    removeItem(nsIndex, key);
+    if (mEntryCount + 1 > MAX_ENTRY_COUNT) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+
+    auto err = reserve(mEntryCount + 1);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    Item* item = appendItem(Page::NS_ANY, ItemType::ERASE_MARK, 1, key, nsIndex);
+    item->data[0] = static_cast<uint8_t>(datatype);
+    item->crc32 = item->calculateCrc32();
+    return ESP_OK;
+}
+
+bool Transaction::removeItem(uint8_t nsIndex, const char* key)
+{
+    size_t dst = 0;
+    size_t span;
+    for (size_t i = 0; i < mEntryCount; i += span) {
+        span = mEntries[i].span;
+        if (itemHasKey(mEntries[i], nsIndex, key)) {
+            continue;
+        }
+        if (dst != i) {
+            std::copy(&mEntries[i], &mEntries[i] + span, &mEntries[dst]);
+        }
+        dst += span;
+    }
+    bool removed = (dst != mEntryCount);
+    mEntryCount = dst;
+    return removed;
+}
+
+void Transaction::addCommitMark()
+{
+    for (size_t i = 0; i < mEntryCount; i += mEntries[i].span) {
+        if (mEntries[i].datatype == ItemType::ERASE_MARK) {
+            return;
+        }
+    }
+
+    // the entry was kept free by writeItem and eraseItem
+    auto err = reserve(mEntryCount + 1);
+    assert(err == ESP_OK);
+    (void) err;
+
+    Item* item = appendItem(Page::NS_ANY, ItemType::ERASE_MARK, 1, "", Page::NS_ANY);
+    item->data[0] = static_cast<uint8_t>(ItemType::ANY);
+    item->crc32 = item->calculateCrc32();
+}
+
+void Transaction::clear()
+{
+    mEntries.reset();
+    mEntryCount = 0;
+    mCapacity = 0;
+}
+
+esp_err_t Transaction::reserve(size_t count)
+{
+    if (count > Page::ENTRY_COUNT) {
+        return ESP_ERR_NVS_NOT_ENOUGH_SPACE;
+    }
+    if (count <= mCapacity) {
+        return ESP_OK;
+    }
+
+    size_t capacity = (mCapacity == 0) ? 8 : mCapacity * 2;
+    while (capacity < count) {
+        capacity *= 2;
+    }
+    if (capacity > Page::ENTRY_COUNT) {
+        capacity = Page::ENTRY_COUNT;
+    }
+
+    Item* entries = new Item[capacity];
+    std::copy(mEntries.get(), mEntries.get() + mEntryCount, entries);
+    mEntries.reset(entries);
+    mCapacity = capacity;
+    return ESP_OK;
+}
+
+Item* Transaction::appendItem(uint8_t nsIndex, ItemType datatype, uint8_t span, const char* key, uint8_t chunkIdx)
+{
+    assert(mEntryCount < mCapacity);
+    Item* item = &mEntries[mEntryCount++];
+    *item = Item(nsIndex, datatype, span, key, chunkIdx);
+    return item;
+}
+
+void Transaction::appendData(const uint8_t* data, size_t dataSize)
+{
+    while (dataSize > 0) {
+        assert(mEntryCount < mCapacity);
+        Item& entry = mEntries[mEntryCount++];
+        size_t willCopy = (dataSize < Page::ENTRY_SIZE) ? dataSize : Page::ENTRY_SIZE;
+        std::fill_n(entry.rawData, Page::ENTRY_SIZE, 0xff);
+        memcpy(entry.rawData, data, willCopy);
+        data += willCopy;
+        dataSize -= willCopy;
+    }
+}
+
+} // namespace nvs
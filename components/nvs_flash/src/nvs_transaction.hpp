@@ -0,0 +1,126 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_transaction_hpp
+#define nvs_transaction_hpp
+
+#include <memory>
+#include "nvs.h"
+#include "nvs_types.hpp"
+
+namespace nvs
+{
+
+/**
+ * Set of item writes and erases which are applied to the storage at once.
+ *
+ * Staged items are serialized into page entries as soon as they are added,
+ * so that Storage::commitTransaction can write all of them to flash with
+ * a single write operation and make them valid with a single pass over the
+ * entry state table. For this reason all staged entries have to fit into
+ * one page.
+ *
+ * An erase is staged as an ItemType::ERASE_MARK item with the same key, and
+ * the type of the erased item stored in the first data byte. Marks are kept in
+ * the reserved Page::NS_ANY namespace, so that lookups of the key never find
+ * them, and the namespace of the erased item is stored as the chunk index.
+ * Marks only live on flash until the transaction has been cleaned up.
+ *
+ * A transaction without erases is committed with a mark of type ItemType::ANY
+ * which doesn't erase anything, so that a mark on the last page at init time
+ * tells that the cleanup of a transaction wasn't finished. One entry of the
+ * page is kept for it.
+ */
+class Transaction
+{
+public:
+    Transaction() {}
+
+    esp_err_t writeItem(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    esp_err_t eraseItem(uint8_t nsIndex, ItemType datatype, const char* key);
+
+    /**
+     * Drop the staged write or erase for the given key.
+     * Returns true if there was anything to drop.
+     */
+    bool removeItem(uint8_t nsIndex, const char* key);
+
+    /**
+     * Append the commit mark if there are no erase marks.
+     */
+    void addCommitMark();
+
+    void clear();
+
+    /**
+     * Namespace of the item, or of the item erased by an erase mark.
+     */
+    static uint8_t getNsIndex(const Item& item)
+    {
+        return (item.datatype == ItemType::ERASE_MARK) ? item.chunkIndex : item.nsIndex;
+    }
+
+    static bool isCommitMark(const Item& item)
+    {
+        return item.datatype == ItemType::ERASE_MARK && item.data[0] == static_cast<uint8_t>(ItemType::ANY);
+    }
+
+    bool empty() const
+    {
+        return mEntryCount == 0;
+    }
+
+    size_t getEntryCount() const
+    {
+        return mEntryCount;
+    }
+
+    const Item* getEntries() const
+    {
+        return mEntries.get();
+    }
+
+    Item* getEntries()
+    {
+        return mEntries.get();
+    }
+
+    /**
+     * Call func(Item& item) for the first entry of every staged item.
+     */
+    template<typename TFunc>
+    void forEachItem(TFunc func)
+    {
+        for (size_t i = 0; i < mEntryCount; i += mEntries[i].span) {
+            func(mEntries[i]);
+        }
+    }
+
+protected:
+    esp_err_t reserve(size_t count);
+
+    Item* appendItem(uint8_t nsIndex, ItemType datatype, uint8_t span, const char* key, uint8_t chunkIdx);
+
+    void appendData(const uint8_t* data, size_t dataSize);
+
+    std::unique_ptr<Item[]> mEntries;
+    size_t mEntryCount = 0;
+    size_t mCapacity = 0;
+}; // class Transaction
+
+} // namespace nvs
+
+
+#endif /* nvs_transaction_hpp */
@@ -39,6 +39,7 @@ enum class ItemType : uint8_t {
     BLOB = 0x41,
     BLOB_DATA = 0x42,
     BLOB_IDX  = 0x48,
+    ERASE_MARK = 0x80,
     ANY  = 0xff
 };
 
@@ -121,7 +122,7 @@ public:
 
     uint32_t calculateCrc32() const;
     uint32_t calculateCrc32WithoutValue() const;
-    static uint32_t calculateCrc32(const uint8_t* data, size_t size);
+    static uint32_t calculateCrc32(const uint8_t* data, size_t size, uint32_t crc = 0xffffffff);
 
     void getKey(char* dst, size_t dstSize)
     {
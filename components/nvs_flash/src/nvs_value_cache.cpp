@@ -0,0 +1,196 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "nvs_value_cache.hpp"
+
+namespace nvs
+{
+
+void ValueCache::init(size_t capacity)
+{
+    if (capacity > MAX_CAPACITY) {
+        capacity = MAX_CAPACITY;
+    }
+
+    mEntries.reset();
+    mCapacity = 0;
+    mHead = NONE;
+    mTail = NONE;
+    mHitCount = 0;
+    mMissCount = 0;
+    if (capacity == 0) {
+        return;
+    }
+
+    mEntries.reset(new CacheEntry[capacity]);
+    mCapacity = capacity;
+    clear();
+}
+
+void ValueCache::clear()
+{
+    // entries form a single list ordered from most to least recently used,
+    // unused entries are kept at the tail
+    for (size_t i = 0; i < mCapacity; ++i) {
+        CacheEntry& e = mEntries[i];
+        e.datatype = ItemType::ANY;
+        e.prev = (i == 0) ? NONE : static_cast<uint8_t>(i - 1);
+        e.next = (i + 1 == mCapacity) ? NONE : static_cast<uint8_t>(i + 1);
+    }
+    mHead = (mCapacity == 0) ? NONE : 0;
+    mTail = (mCapacity == 0) ? NONE : static_cast<uint8_t>(mCapacity - 1);
+}
+
+const uint8_t* ValueCache::find(uint8_t nsIndex, ItemType datatype, const char* key, size_t& dataSize, bool countStats)
+{
+    if (!isEnabled()) {
+        return nullptr;
+    }
+
+    for (uint8_t i = mHead; i != NONE; i = mEntries[i].next) {
+        CacheEntry& e = mEntries[i];
+        if (e.datatype == ItemType::ANY) {
+            break;
+        }
+        if (e.nsIndex == nsIndex && e.datatype == datatype && strncmp(e.key, key, Item::MAX_KEY_LENGTH) == 0) {
+            if (i != mHead) {
+                unlink(i);
+                pushFront(i);
+            }
+            if (countStats) {
+                ++mHitCount;
+            }
+            dataSize = e.dataSize;
+            return e.data;
+        }
+    }
+    if (countStats) {
+        ++mMissCount;
+    }
+    return nullptr;
+}
+
+void ValueCache::insert(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize)
+{
+    if (!isEnabled() || !isCacheableType(datatype) || dataSize > MAX_VALUE_SIZE) {
+        return;
+    }
+
+    uint8_t index = mTail;
+    for (uint8_t i = mHead; i != NONE; i = mEntries[i].next) {
+        CacheEntry& e = mEntries[i];
+        if (e.datatype == ItemType::ANY) {
+            break;
+        }
+        if (e.nsIndex == nsIndex && e.datatype == datatype && strncmp(e.key, key, Item::MAX_KEY_LENGTH) == 0) {
+            index = i;
+            break;
+        }
+    }
+
+    CacheEntry& e = mEntries[index];
+    e.nsIndex = nsIndex;
+    e.datatype = datatype;
+    e.dataSize = static_cast<uint8_t>(dataSize);
+    strncpy(e.key, key, Item::MAX_KEY_LENGTH);
+    e.key[Item::MAX_KEY_LENGTH] = 0;
+    memcpy(e.data, data, dataSize);
+    if (index != mHead) {
+        unlink(index);
+        pushFront(index);
+    }
+}
+
+void ValueCache::erase(uint8_t nsIndex, const char* key)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    for (uint8_t i = mHead; i != NONE;) {
+        CacheEntry& e = mEntries[i];
+        uint8_t next = e.next;
+        if (e.datatype == ItemType::ANY) {
+            break;
+        }
+        if (e.nsIndex == nsIndex && strncmp(e.key, key, Item::MAX_KEY_LENGTH) == 0) {
+            release(i);
+        }
+        i = next;
+    }
+}
+
+void ValueCache::eraseNamespace(uint8_t nsIndex)
+{
+    if (!isEnabled()) {
+        return;
+    }
+
+    for (uint8_t i = mHead; i != NONE;) {
+        CacheEntry& e = mEntries[i];
+        uint8_t next = e.next;
+        if (e.datatype == ItemType::ANY) {
+            break;
+        }
+        if (e.nsIndex == nsIndex) {
+            release(i);
+        }
+        i = next;
+    }
+}
+
+void ValueCache::unlink(uint8_t index)
+{
+    CacheEntry& e = mEntries[index];
+    if (e.prev != NONE) {
+        mEntries[e.prev].next = e.next;
+    } else {
+        mHead = e.next;
+    }
+    if (e.next != NONE) {
+        mEntries[e.next].prev = e.prev;
+    } else {
+        mTail = e.prev;
+    }
+}
+
+void ValueCache::pushFront(uint8_t index)
+{
+    CacheEntry& e = mEntries[index];
+    e.prev = NONE;
+    e.next = mHead;
+    if (mHead != NONE) {
+        mEntries[mHead].prev = index;
+    }
+    mHead = index;
+    if (mTail == NONE) {
+        mTail = index;
+    }
+}
+
+void ValueCache::release(uint8_t index)
+{
+    CacheEntry& e = mEntries[index];
+    e.datatype = ItemType::ANY;
+    if (index == mTail) {
+        return;
+    }
+    unlink(index);
+    e.next = NONE;
+    e.prev = mTail;
+    mEntries[mTail].next = index;
+    mTail = index;
+}
+
+} // namespace nvs
@@ -0,0 +1,119 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef nvs_value_cache_hpp
+#define nvs_value_cache_hpp
+
+#include <memory>
+#include "nvs.h"
+#include "nvs_types.hpp"
+
+namespace nvs
+{
+
+/**
+ * Bounded cache of values which were recently read from the storage.
+ *
+ * Only integer values and strings which fit into MAX_VALUE_SIZE bytes
+ * (including zero terminator) are cached. When the cache is full, the least
+ * recently used value is replaced.
+ *
+ * The cache doesn't track item locations, so Storage has to drop the cached
+ * value whenever an item with the same namespace and key is written or erased.
+ */
+class ValueCache
+{
+public:
+    static const size_t MAX_VALUE_SIZE = 32;
+
+    static const size_t MAX_CAPACITY = 255;
+
+    ValueCache() {}
+
+    void init(size_t capacity);
+
+    bool isEnabled() const
+    {
+        return mCapacity != 0;
+    }
+
+    static bool isCacheableType(ItemType datatype)
+    {
+        return datatype == ItemType::SZ || !isVariableLengthType(datatype);
+    }
+
+    /**
+     * Look up a cached value and mark it as most recently used.
+     * Returns nullptr if the value is not in the cache.
+     * If countStats is set, the lookup is counted as a cache hit or a miss.
+     */
+    const uint8_t* find(uint8_t nsIndex, ItemType datatype, const char* key, size_t& dataSize, bool countStats = true);
+
+    void insert(uint8_t nsIndex, ItemType datatype, const char* key, const void* data, size_t dataSize);
+
+    /**
+     * Drop cached values of any type for the given key.
+     */
+    void erase(uint8_t nsIndex, const char* key);
+
+    void eraseNamespace(uint8_t nsIndex);
+
+    void clear();
+
+    size_t getCapacity() const
+    {
+        return mCapacity;
+    }
+
+    uint32_t getHitCount() const
+    {
+        return mHitCount;
+    }
+
+    uint32_t getMissCount() const
+    {
+        return mMissCount;
+    }
+
+protected:
+    static const uint8_t NONE = 0xff;
+
+    struct CacheEntry {
+        uint8_t  nsIndex;
+        ItemType datatype;      // ItemType::ANY for unused entries
+        uint8_t  dataSize;
+        uint8_t  prev;          // towards most recently used
+        uint8_t  next;          // towards least recently used
+        char     key[Item::MAX_KEY_LENGTH + 1];
+        uint8_t  data[MAX_VALUE_SIZE];
+    };
+
+    void unlink(uint8_t index);
+
+    void pushFront(uint8_t index);
+
+    void release(uint8_t index);
+
+    std::unique_ptr<CacheEntry[]> mEntries;
+    size_t mCapacity = 0;
+    uint8_t mHead = NONE;
+    uint8_t mTail = NONE;
+    uint32_t mHitCount = 0;
+    uint32_t mMissCount = 0;
+}; // class ValueCache
+
+} // namespace nvs
+
+
+#endif /* nvs_value_cache_hpp */
@@ -0,0 +1,282 @@
+// Copyright 2015-2018 Espressif Systems (Shanghai) PTE LTD
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+
+//     http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+/*
+ * Throughput and wear benchmark for NVS storage on the host.
+ *
+ * Each workload fills a partition emulated by SpiFlashEmulator with a set of
+ * keys, then runs a fixed number of random reads and writes on them. Results
+ * are printed to stdout as one JSON object per workload and line, so they can
+ * be collected and compared across releases:
+ *
+ *     ./bench_nvs [workload name filter] > bench_nvs.json
+ *
+ * Flash time is the time estimated by the emulator for the operations it saw,
+ * which is independent of the host. Heap usage only counts memory allocated
+ * with operator new, which is what Storage and its pages use.
+ */
+
+// SpiFlashEmulator reports invalid accesses with Catch, which needs its implementation but not its main
+#define CATCH_CONFIG_RUNNER
+#include "catch.hpp"
+#include "nvs.hpp"
+#include "nvs_storage.hpp"
+#ifdef CONFIG_NVS_ENCRYPTION
+#include "nvs_encr.hpp"
+#endif
+#include "spi_flash_emulation.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <vector>
+
+using namespace nvs;
+
+static size_t s_heap_bytes;
+static size_t s_heap_peak_bytes;
+
+void* operator new(size_t size)
+{
+    // keep the size in front of the block, so that delete can account for it
+    size_t* p = static_cast<size_t*>(malloc(size + sizeof(max_align_t)));
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    *p = size;
+    s_heap_bytes += size;
+    if (s_heap_bytes > s_heap_peak_bytes) {
+        s_heap_peak_bytes = s_heap_bytes;
+    }
+    return reinterpret_cast<uint8_t*>(p) + sizeof(max_align_t);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    if (ptr == nullptr) {
+        return;
+    }
+    size_t* p = reinterpret_cast<size_t*>(static_cast<uint8_t*>(ptr) - sizeof(max_align_t));
+    s_heap_bytes -= *p;
+    free(p);
+}
+
+struct Workload {
+    const char* name;
+    size_t sectors;
+    size_t keyCount;
+    ItemType type;          // U32, SZ or BLOB
+    size_t minValueSize;    // value sizes are uniformly distributed, ignored for U32
+    size_t maxValueSize;
+    unsigned readPercent;
+    size_t ops;
+};
+
+static const Workload s_workloads[] = {
+    { "int-read-mostly",      6,    50, ItemType::U32,    0,    0, 90, 20000 },
+    { "int-write-mostly",     6,    50, ItemType::U32,    0,    0, 10,  5000 },
+    { "str-mixed",           16,   200, ItemType::SZ,     8,   64, 50,  5000 },
+    { "blob-mixed",          32,    16, ItemType::BLOB, 256, 4000, 50,   500 },
+    { "int-large-partition", 256, 2000, ItemType::U32,    0,    0, 80, 10000 },
+};
+
+// xorshift32, so that workloads are the same with any standard library
+class Random
+{
+public:
+    explicit Random(uint32_t seed) : mState(seed) {}
+
+    uint32_t next()
+    {
+        mState ^= mState << 13;
+        mState ^= mState >> 17;
+        mState ^= mState << 5;
+        return mState;
+    }
+
+    size_t range(size_t min, size_t max)
+    {
+        return min + next() % (max - min + 1);
+    }
+
+protected:
+    uint32_t mState;
+};
+
+struct KeyState {
+    uint32_t version;
+    size_t size;
+};
+
+// Value contents depend on the key and the number of times it was written, so reads can be verified
+static void fill_value(uint8_t* data, size_t size, size_t keyIndex, uint32_t version)
+{
+    uint32_t x = static_cast<uint32_t>(keyIndex) * 2654435761u + version + 1;
+    for (size_t i = 0; i < size; ++i) {
+        x = x * 1103515245 + 12345;
+        data[i] = static_cast<uint8_t>('a' + (x >> 16) % 26);
+    }
+    if (size > 0) {
+        data[size - 1] = 0;
+    }
+}
+
+static const char* type_name(ItemType type)
+{
+    switch (type) {
+    case ItemType::U32:
+        return "u32";
+    case ItemType::SZ:
+        return "str";
+    case ItemType::BLOB:
+        return "blob";
+    default:
+        return "other";
+    }
+}
+
+static esp_err_t write_key(Storage& storage, const Workload& w, size_t keyIndex, KeyState& state, uint8_t* buf)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "k%d", static_cast<int>(keyIndex));
+    if (w.type == ItemType::U32) {
+        return storage.writeItem(1, key, static_cast<uint32_t>(keyIndex * 100000 + state.version));
+    }
+    fill_value(buf, state.size, keyIndex, state.version);
+    return storage.writeItem(1, w.type, key, buf, state.size);
+}
+
+static bool read_key(Storage& storage, const Workload& w, size_t keyIndex, const KeyState& state, uint8_t* buf, uint8_t* expected)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "k%d", static_cast<int>(keyIndex));
+    if (w.type == ItemType::U32) {
+        uint32_t value;
+        return storage.readItem(1, key, value) == ESP_OK && value == keyIndex * 100000 + state.version;
+    }
+    if (storage.readItem(1, w.type, key, buf, state.size) != ESP_OK) {
+        return false;
+    }
+    fill_value(expected, state.size, keyIndex, state.version);
+    return memcmp(buf, expected, state.size) == 0;
+}
+
+static bool run_workload(const Workload& w, bool encrypted)
+{
+    SpiFlashEmulator emu(w.sectors);
+#ifdef CONFIG_NVS_ENCRYPTION
+    if (encrypted) {
+        nvs_sec_cfg_t cfg;
+        for (size_t i = 0; i < NVS_KEY_SIZE; ++i) {
+            cfg.eky[i] = static_cast<uint8_t>(0x11 * i);
+            cfg.tky[i] = static_cast<uint8_t>(0x22 * i + 1);
+        }
+        if (EncrMgr::getInstance()->setSecurityContext(0, w.sectors, &cfg) != ESP_OK) {
+            return false;
+        }
+    }
+#endif
+
+    Random rnd(static_cast<uint32_t>(w.keyCount * 31 + w.sectors + 1));
+    std::vector<KeyState> keys(w.keyCount);
+    size_t maxSize = (w.type == ItemType::U32) ? sizeof(uint32_t) : w.maxValueSize;
+    std::vector<uint8_t> buf(maxSize);
+    std::vector<uint8_t> expected(maxSize);
+
+    size_t heapBefore = s_heap_bytes;
+    s_heap_peak_bytes = s_heap_bytes;
+    size_t errors = 0;
+    size_t heapBytes;
+    std::chrono::microseconds::rep hostTime;
+    // returns false if the keys couldn't be set up, the security context is removed after it either way
+    auto measure = [&]() -> bool {
+        Storage storage;
+        storage.setDebugCheck(false);
+        if (storage.init(0, w.sectors) != ESP_OK) {
+            return false;
+        }
+
+        for (size_t i = 0; i < w.keyCount; ++i) {
+            keys[i].version = 0;
+            keys[i].size = (w.type == ItemType::U32) ? sizeof(uint32_t) : rnd.range(w.minValueSize, w.maxValueSize);
+            if (write_key(storage, w, i, keys[i], buf.data()) != ESP_OK) {
+                return false;
+            }
+        }
+
+        emu.clearStats();
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < w.ops; ++n) {
+            size_t keyIndex = rnd.range(0, w.keyCount - 1);
+            KeyState& state = keys[keyIndex];
+            if (rnd.range(0, 99) < w.readPercent) {
+                errors += !read_key(storage, w, keyIndex, state, buf.data(), expected.data());
+            } else {
+                ++state.version;
+                if (w.type != ItemType::U32) {
+                    state.size = rnd.range(w.minValueSize, w.maxValueSize);
+                }
+                errors += (write_key(storage, w, keyIndex, state, buf.data()) != ESP_OK);
+            }
+        }
+        hostTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        heapBytes = s_heap_bytes - heapBefore;
+        return true;
+    };
+    bool measured = measure();
+
+#ifdef CONFIG_NVS_ENCRYPTION
+    if (encrypted) {
+        EncrMgr::getInstance()->removeSecurityContext(0);
+    }
+#endif
+    if (!measured) {
+        return false;
+    }
+
+    size_t flashTime = emu.getTotalTime();
+    size_t minSize = (w.type == ItemType::U32) ? sizeof(uint32_t) : w.minValueSize;
+    printf("{\"workload\": \"%s\", \"sectors\": %zu, \"keys\": %zu, \"value_type\": \"%s\", "
+           "\"value_size_min\": %zu, \"value_size_max\": %zu, \"read_percent\": %u, \"encrypted\": %s, "
+           "\"ops\": %zu, \"errors\": %zu, \"host_us\": %lld, \"host_ops_per_sec\": %.0f, "
+           "\"flash_us\": %zu, \"flash_ops_per_sec\": %.0f, "
+           "\"flash_read_ops\": %zu, \"flash_write_ops\": %zu, \"flash_erase_ops\": %zu, "
+           "\"flash_read_bytes\": %zu, \"flash_write_bytes\": %zu, "
+           "\"heap_bytes\": %zu, \"heap_peak_bytes\": %zu}\n",
+           w.name, w.sectors, w.keyCount, type_name(w.type),
+           minSize, maxSize, w.readPercent, encrypted ? "true" : "false",
+           w.ops, errors, static_cast<long long>(hostTime), w.ops * 1e6 / (hostTime + 1),
+           flashTime, w.ops * 1e6 / (flashTime + 1),
+           emu.getReadOps(), emu.getWriteOps(), emu.getEraseOps(),
+           emu.getReadBytes(), emu.getWriteBytes(),
+           heapBytes, s_heap_peak_bytes - heapBefore);
+    return errors == 0;
+}
+
+int main(int argc, char** argv)
+{
+    const char* filter = (argc > 1) ? argv[1] : nullptr;
+    bool ok = true;
+    for (const Workload& w : s_workloads) {
+        if (filter != nullptr && strstr(w.name, filter) == nullptr) {
+            continue;
+        }
+        ok = run_workload(w, false) && ok;
+#ifdef CONFIG_NVS_ENCRYPTION
+        ok = run_workload(w, true) && ok;
+#endif
+    }
+    return ok ? 0 : 1;
+}
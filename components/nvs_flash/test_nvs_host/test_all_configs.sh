@@ -0,0 +1,23 @@
+#!/bin/bash
+#
+# Run the test suite with all configurations enabled
+#
+
+FAIL=0
+
+for FLAGS in "" "CONFIG_NVS_ITEM_INDEX" "CONFIG_NVS_ITEM_INDEX CONFIG_NVS_ITEM_INDEX_MAX_ENTRIES=64" \
+             "CONFIG_NVS_VALUE_CACHE CONFIG_NVS_VALUE_CACHE_ENTRIES=16" "CONFIG_NVS_LAZY_PAGE_LOAD" \
+             "CONFIG_NVS_TRANSACTIONS" \
+             "CONFIG_NVS_ITEM_INDEX CONFIG_NVS_VALUE_CACHE CONFIG_NVS_VALUE_CACHE_ENTRIES=16 CONFIG_NVS_LAZY_PAGE_LOAD CONFIG_NVS_TRANSACTIONS"; do
+    echo "==== Testing with config: ${FLAGS} ===="
+    CPPFLAGS="$(for F in ${FLAGS}; do echo -n "-D${F} "; done)" make clean test || FAIL=1
+done
+
+make clean
+
+if [ $FAIL == 0 ]; then
+    echo "All configurations passed"
+else
+    echo "Some configurations failed, see log."
+    exit 1
+fi
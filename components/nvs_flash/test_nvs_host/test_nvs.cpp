@@ -23,6 +23,9 @@
 #include <fstream>
 #include <unistd.h>
 #include <sys/wait.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
 
 #define TEST_ESP_ERR(rc, res) CHECK((rc) == (res))
 #define TEST_ESP_OK(rc) CHECK((rc) == ESP_OK)
@@ -2155,6 +2158,1140 @@ TEST_CASE("read data from partition generated via partition generation utility w
 
 }
 
+TEST_CASE("HashList finds, erases and reinserts items", "[nvs]")
+{
+    HashList hashList;
+    char key[16];
+    for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        hashList.insert(Item(1, ItemType::U32, 1, key), i);
+    }
+    for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        CHECK(hashList.find(0, Item(1, ItemType::U32, 1, key)) == i);
+        CHECK(hashList.find(i + 1, Item(1, ItemType::U32, 1, key)) == SIZE_MAX);
+    }
+    for (size_t i = 0; i < Page::ENTRY_COUNT; i += 2) {
+        hashList.erase(i);
+    }
+    for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        CHECK(hashList.find(0, Item(1, ItemType::U32, 1, key)) == ((i % 2) ? i : SIZE_MAX));
+    }
+    // same key at several indices: lowest index at or after start is returned
+    hashList.insert(Item(1, ItemType::U32, 1, "key1"), 4);
+    hashList.insert(Item(1, ItemType::U32, 1, "key1"), 10);
+    CHECK(hashList.find(0, Item(1, ItemType::U32, 1, "key1")) == 1);
+    CHECK(hashList.find(2, Item(1, ItemType::U32, 1, "key1")) == 4);
+    CHECK(hashList.find(5, Item(1, ItemType::U32, 1, "key1")) == 10);
+    hashList.erase(7, false);
+    // the list shrinks as most items are erased, remaining ones are still found
+    for (size_t i = 3; i < Page::ENTRY_COUNT; i += 2) {
+        hashList.erase(i, i != 7);
+    }
+    CHECK(hashList.find(0, Item(1, ItemType::U32, 1, "key1")) == 1);
+    CHECK(hashList.find(2, Item(1, ItemType::U32, 1, "key1")) == 4);
+    CHECK(hashList.find(0, Item(1, ItemType::U32, 1, "key3")) == SIZE_MAX);
+    size_t count = 0;
+    hashList.forEach([&](uint32_t, size_t) { ++count; });
+    CHECK(count == 3);
+    hashList.clear();
+    CHECK(hashList.find(0, Item(1, ItemType::U32, 1, "key1")) == SIZE_MAX);
+}
+
+TEST_CASE("storage finds all items when item index is full", "[nvs]")
+{
+    const size_t sectors = 16;
+    SpiFlashEmulator emu(sectors);
+    Storage storage;
+    storage.setItemIndexLimit(32);
+    CHECK(storage.init(0, sectors) == ESP_OK);
+
+    char key[16];
+    const size_t keyCount = Page::ENTRY_COUNT * 4;
+    for (size_t i = 0; i < keyCount; ++i) {
+        snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+        REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(i)) == ESP_OK);
+    }
+    for (size_t i = 0; i < keyCount; i += 3) {
+        snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+        REQUIRE(storage.eraseItem(1, key) == ESP_OK);
+    }
+    for (size_t i = 0; i < keyCount; ++i) {
+        snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+        uint32_t value;
+        if (i % 3 == 0) {
+            CHECK(storage.readItem(1, key, value) == ESP_ERR_NVS_NOT_FOUND);
+        } else {
+            CHECK(storage.readItem(1, key, value) == ESP_OK);
+            CHECK(value == i);
+        }
+    }
+    int8_t wrongType;
+    CHECK(storage.readItem(1, "key00001", wrongType) == ESP_ERR_NVS_NOT_FOUND);
+}
+
+TEST_CASE("item index is updated when pages are freed", "[nvs]")
+{
+    SpiFlashEmulator emu(4);
+    Storage storage;
+    CHECK(storage.init(0, 4) == ESP_OK);
+    uint32_t value;
+    CHECK(storage.writeItem(1, "const", static_cast<uint32_t>(42)) == ESP_OK);
+    // keep rewriting one key, so that the page holding "const" gets freed several times
+    for (size_t i = 0; i < Page::ENTRY_COUNT * 4 * 4; ++i) {
+        REQUIRE(storage.writeItem(1, "var", static_cast<uint32_t>(i)) == ESP_OK);
+        REQUIRE(storage.readItem(1, "const", value) == ESP_OK);
+        REQUIRE(value == 42);
+    }
+    CHECK(storage.eraseNamespace(1) == ESP_OK);
+    CHECK(storage.readItem(1, "const", value) == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(storage.readItem(1, "var", value) == ESP_ERR_NVS_NOT_FOUND);
+}
+
+static void benchmark_item_lookup(size_t sectors, size_t indexLimit, const char* name)
+{
+    SpiFlashEmulator emu(sectors);
+    // one integer and a few large strings per page, so that lookups have to deal with many pages
+    const size_t keyCount = sectors - 1;
+    const size_t rounds = 16;
+    char key[16];
+    char str[1200];
+    std::fill_n(str, sizeof(str) - 1, 'x');
+    str[sizeof(str) - 1] = 0;
+    {
+        Storage storage;
+        REQUIRE(storage.init(0, sectors) == ESP_OK);
+        for (size_t i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+            REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(i)) == ESP_OK);
+            for (size_t j = 0; j < 3; ++j) {
+                snprintf(key, sizeof(key), "str%05d_%d", static_cast<int>(i), static_cast<int>(j));
+                REQUIRE(storage.writeItem(1, ItemType::SZ, key, str, sizeof(str)) == ESP_OK);
+            }
+        }
+    }
+
+    Storage storage;
+    storage.setItemIndexLimit(indexLimit);
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    REQUIRE(storage.loadDeferredPages() == ESP_OK);
+    size_t errors = 0;
+    emu.clearStats();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t round = 0; round < rounds; ++round) {
+        for (size_t i = 0; i < keyCount; ++i) {
+            uint32_t value = 0;
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+            errors += (storage.readItem(1, key, value) != ESP_OK || value != i);
+            snprintf(key, sizeof(key), "missing%05d", static_cast<int>(i));
+            errors += (storage.readItem(1, key, value) != ESP_ERR_NVS_NOT_FOUND);
+        }
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(errors == 0);
+    s_perf << "Time to look up " << keyCount * rounds * 2 << " keys in " << sectors << " sectors " << name << ": "
+           << elapsed << " us (host), " << emu.getTotalTime() << " us (flash, " << emu.getReadOps() << " reads)" << std::endl;
+}
+
+TEST_CASE("benchmark item lookup on large partitions", "[nvs][bench]")
+{
+    for (size_t sectors : {16, 64, 128}) {
+        benchmark_item_lookup(sectors, 0, "without index");
+        benchmark_item_lookup(sectors, ItemIndex::UNBOUNDED, "with index");
+        benchmark_item_lookup(sectors, 256, "with index limited to 256 entries");
+    }
+}
+
+#ifndef CONFIG_NVS_TRANSACTIONS
+TEST_CASE("nvs transactions are rejected unless enabled in config", "[nvs][tx]")
+{
+    SpiFlashEmulator emu(4);
+    TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 4) );
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+    TEST_ESP_ERR( nvs_tx_begin(handle), ESP_ERR_NOT_SUPPORTED );
+    TEST_ESP_ERR( nvs_tx_commit(handle), ESP_ERR_NVS_INVALID_STATE );
+    TEST_ESP_OK( nvs_set_u32(handle, "counter", 1) );
+    uint32_t counter;
+    TEST_ESP_OK( nvs_get_u32(handle, "counter", &counter) );
+    CHECK(counter == 1);
+    nvs_close(handle);
+}
+
+#else
+TEST_CASE("nvs transactions stage changes until commit", "[nvs][tx]")
+{
+    SpiFlashEmulator emu(4);
+    TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 4) );
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+
+    uint8_t blob[64];
+    std::fill_n(blob, sizeof(blob), 0x5a);
+    TEST_ESP_OK( nvs_set_u32(handle, "counter", 1) );
+    TEST_ESP_OK( nvs_set_str(handle, "name", "old") );
+    TEST_ESP_OK( nvs_set_blob(handle, "blob", blob, sizeof(blob)) );
+
+    TEST_ESP_ERR( nvs_tx_commit(handle), ESP_ERR_NVS_INVALID_STATE );
+    TEST_ESP_ERR( nvs_tx_abort(handle), ESP_ERR_NVS_INVALID_STATE );
+    TEST_ESP_OK( nvs_tx_begin(handle) );
+    TEST_ESP_ERR( nvs_tx_begin(handle), ESP_ERR_NVS_INVALID_STATE );
+
+    TEST_ESP_OK( nvs_set_u32(handle, "counter", 2) );
+    TEST_ESP_OK( nvs_set_str(handle, "name", "new") );
+    TEST_ESP_OK( nvs_erase_key(handle, "blob") );
+    TEST_ESP_OK( nvs_set_u8(handle, "tmp", 1) );
+    TEST_ESP_OK( nvs_erase_key(handle, "tmp") );
+    TEST_ESP_ERR( nvs_erase_key(handle, "missing"), ESP_ERR_NVS_NOT_FOUND );
+    TEST_ESP_ERR( nvs_erase_all(handle), ESP_ERR_NOT_SUPPORTED );
+
+    // reads return committed values while the transaction is open
+    uint32_t counter;
+    TEST_ESP_OK( nvs_get_u32(handle, "counter", &counter) );
+    CHECK(counter == 1);
+
+    TEST_ESP_OK( nvs_tx_commit(handle) );
+    TEST_ESP_ERR( nvs_tx_commit(handle), ESP_ERR_NVS_INVALID_STATE );
+
+    char name[8];
+    size_t length = sizeof(name);
+    TEST_ESP_OK( nvs_get_u32(handle, "counter", &counter) );
+    CHECK(counter == 2);
+    TEST_ESP_OK( nvs_get_str(handle, "name", name, &length) );
+    CHECK(strcmp(name, "new") == 0);
+    length = sizeof(blob);
+    TEST_ESP_ERR( nvs_get_blob(handle, "blob", blob, &length), ESP_ERR_NVS_NOT_FOUND );
+    uint8_t tmp;
+    TEST_ESP_ERR( nvs_get_u8(handle, "tmp", &tmp), ESP_ERR_NVS_NOT_FOUND );
+
+    TEST_ESP_OK( nvs_tx_begin(handle) );
+    TEST_ESP_OK( nvs_set_u32(handle, "counter", 3) );
+    TEST_ESP_OK( nvs_tx_abort(handle) );
+    TEST_ESP_OK( nvs_get_u32(handle, "counter", &counter) );
+    CHECK(counter == 2);
+
+    // items are written with one flash write, and entry state table words
+    // are written once per commit, not once per item
+    char key[16];
+    for (int round = 0; round < 2; ++round) {
+        TEST_ESP_OK( nvs_tx_begin(handle) );
+        for (int i = 0; i < 16; ++i) {
+            snprintf(key, sizeof(key), "key%d", i);
+            TEST_ESP_OK( nvs_set_u32(handle, key, round) );
+        }
+        emu.clearStats();
+        TEST_ESP_OK( nvs_tx_commit(handle) );
+        // one write for the items, up to two for their entry states,
+        // up to two to erase the items written in the previous round,
+        // and one to erase the commit mark
+        CHECK(emu.getWriteOps() <= 6);
+    }
+
+    // all staged entries have to fit into one page
+    TEST_ESP_OK( nvs_tx_begin(handle) );
+    uint8_t bigBlob[Page::CHUNK_MAX_SIZE / 2];
+    std::fill_n(bigBlob, sizeof(bigBlob), 0x33);
+    TEST_ESP_OK( nvs_set_blob(handle, "big1", bigBlob, sizeof(bigBlob)) );
+    TEST_ESP_ERR( nvs_set_blob(handle, "big2", bigBlob, sizeof(bigBlob)), ESP_ERR_NVS_NOT_ENOUGH_SPACE );
+    TEST_ESP_OK( nvs_tx_commit(handle) );
+    length = sizeof(bigBlob);
+    TEST_ESP_OK( nvs_get_blob(handle, "big1", bigBlob, &length) );
+    CHECK(length == sizeof(bigBlob));
+
+    nvs_close(handle);
+
+    nvs_handle handle_ro;
+    TEST_ESP_OK( nvs_open("test", NVS_READONLY, &handle_ro) );
+    TEST_ESP_ERR( nvs_tx_begin(handle_ro), ESP_ERR_NVS_READ_ONLY );
+    nvs_close(handle_ro);
+}
+#endif // CONFIG_NVS_TRANSACTIONS
+
+static void check_transaction_recovery(size_t fillerSize, bool eraseKey = true)
+{
+    const uint8_t nsIndex = 1;
+    const size_t keyCount = 8;
+    const char* oldStr = "string value which takes a few entries, before the transaction";
+    const char* newStr = "string value which takes a few entries, after the transaction";
+    uint8_t oldBlob[100];
+    uint8_t newBlob[100];
+    std::fill_n(oldBlob, sizeof(oldBlob), 0x11);
+    // data entries which look like free space have to be handled during recovery
+    std::fill_n(newBlob, sizeof(newBlob), 0xff);
+    newBlob[sizeof(newBlob) - 1] = 0x22;
+    std::unique_ptr<uint8_t[]> filler(new uint8_t[fillerSize + 1]);
+    std::fill_n(filler.get(), fillerSize + 1, 0xee);
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(4);
+        bool committed;
+        {
+            Storage storage;
+            TEST_ESP_OK(storage.init(0, 4));
+            char key[16];
+            for (size_t i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+                TEST_ESP_OK(storage.writeItem(nsIndex, key, static_cast<uint32_t>(0)));
+            }
+            TEST_ESP_OK(storage.writeItem(nsIndex, ItemType::SZ, "str", oldStr, strlen(oldStr) + 1));
+            TEST_ESP_OK(storage.writeItem(nsIndex, ItemType::BLOB, "blob", oldBlob, sizeof(oldBlob)));
+            TEST_ESP_OK(storage.writeItem(nsIndex, "gone", static_cast<uint8_t>(1)));
+            if (fillerSize > 0) {
+                TEST_ESP_OK(storage.writeItem(nsIndex, ItemType::SZ, "filler", filler.get(), fillerSize));
+            }
+
+            Transaction tx;
+            for (size_t i = 0; i < keyCount; ++i) {
+                snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+                TEST_ESP_OK(storage.writeItem(tx, nsIndex, key, static_cast<uint32_t>(1)));
+            }
+            TEST_ESP_OK(storage.writeItem(tx, nsIndex, ItemType::SZ, "str", newStr, strlen(newStr) + 1));
+            TEST_ESP_OK(storage.writeItem(tx, nsIndex, ItemType::BLOB, "blob", newBlob, sizeof(newBlob)));
+            if (eraseKey) {
+                TEST_ESP_OK(storage.eraseItem(tx, nsIndex, "gone"));
+            }
+            TEST_ESP_OK(storage.writeItem(tx, nsIndex, "added", static_cast<uint8_t>(1)));
+
+            emu.failAfter(errDelay);
+            committed = storage.commitTransaction(tx) == ESP_OK;
+            if (committed) {
+                // the commit went through without hitting the injected failure
+                emu.failAfter(UINT32_MAX);
+            }
+        }
+
+        Storage storage;
+        TEST_ESP_OK(storage.init(0, 4));
+
+        uint8_t added;
+        auto err = storage.readItem(nsIndex, "added", added);
+        REQUIRE((err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND));
+        bool applied = (err == ESP_OK);
+        if (committed) {
+            REQUIRE(applied);
+        }
+
+        char key[16];
+        for (size_t i = 0; i < keyCount; ++i) {
+            snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+            uint32_t value;
+            TEST_ESP_OK(storage.readItem(nsIndex, key, value));
+            CHECK(value == (applied ? 1 : 0));
+        }
+        char str[80];
+        TEST_ESP_OK(storage.readItem(nsIndex, ItemType::SZ, "str", str, sizeof(str)));
+        CHECK(strcmp(str, applied ? newStr : oldStr) == 0);
+        uint8_t blob[sizeof(newBlob)];
+        TEST_ESP_OK(storage.readItem(nsIndex, ItemType::BLOB, "blob", blob, sizeof(blob)));
+        CHECK(memcmp(blob, applied ? newBlob : oldBlob, sizeof(blob)) == 0);
+        uint8_t gone;
+        TEST_ESP_ERR(storage.readItem(nsIndex, "gone", gone), (applied && eraseKey) ? ESP_ERR_NVS_NOT_FOUND : ESP_OK);
+
+        // storage stays writable after recovery
+        TEST_ESP_OK(storage.writeItem(nsIndex, "after", static_cast<uint32_t>(errDelay)));
+        uint32_t after;
+        TEST_ESP_OK(storage.readItem(nsIndex, "after", after));
+        CHECK(after == errDelay);
+
+        if (committed) {
+            break;
+        }
+    }
+}
+
+TEST_CASE("nvs transaction is applied atomically if power goes off during commit", "[nvs][tx]")
+{
+    SECTION("transaction fits into the current page") {
+        check_transaction_recovery(0);
+    }
+    SECTION("transaction is written to a new page") {
+        check_transaction_recovery((Page::ENTRY_COUNT - 30) * Page::ENTRY_SIZE);
+    }
+    SECTION("transaction without erases") {
+        check_transaction_recovery(0, false);
+    }
+}
+
+TEST_CASE("key erased by a transaction can be written again after the erase failed", "[nvs][tx]")
+{
+    size_t removeFailures = 0;
+    for (uint32_t errDelay = 0; errDelay < 40; ++errDelay) {
+        SpiFlashEmulator emu(4);
+        Storage storage;
+        CHECK(storage.init(0, 4) == ESP_OK);
+        // the erased key is on the first page, the transaction is written to the second one
+        CHECK(storage.writeItem(1, "key", static_cast<uint32_t>(1)) == ESP_OK);
+        for (size_t i = 1; i < Page::ENTRY_COUNT; ++i) {
+            char name[16];
+            snprintf(name, sizeof(name), "filler%d", static_cast<int>(i));
+            CHECK(storage.writeItem(1, name, static_cast<uint8_t>(i)) == ESP_OK);
+        }
+
+        Transaction tx;
+        CHECK(storage.eraseItem(tx, 1, ItemType::U32, "key") == ESP_OK);
+        CHECK(storage.writeItem(tx, 1, "other", static_cast<uint32_t>(3)) == ESP_OK);
+        emu.failAfter(errDelay);
+        auto err = storage.commitTransaction(tx);
+        emu.failAfter(UINT32_MAX);
+        if (err != ESP_ERR_NVS_REMOVE_FAILED) {
+            continue;
+        }
+
+        // the erase mark may be left on flash, writing the key again must not be undone by it
+        uint32_t value;
+        if (storage.writeItem(1, "key", static_cast<uint32_t>(4)) != ESP_OK) {
+            // the page with the marks can't be written until nvs is initialized again
+            continue;
+        }
+        ++removeFailures;
+        CHECK(storage.readItem(1, "key", value) == ESP_OK);
+        CHECK(value == 4);
+
+        Storage storage2;
+        CHECK(storage2.init(0, 4) == ESP_OK);
+        CHECK(storage2.readItem(1, "key", value) == ESP_OK);
+        CHECK(value == 4);
+        CHECK(storage2.readItem(1, "other", value) == ESP_OK);
+        CHECK(value == 3);
+    }
+    CHECK(removeFailures > 0);
+}
+
+TEST_CASE("value cache is invalidated when items change", "[nvs][cache]")
+{
+    SpiFlashEmulator emu(4);
+    Storage storage;
+    storage.setValueCacheSize(2);
+    CHECK(storage.init(0, 4) == ESP_OK);
+
+    uint32_t value;
+    char str[16];
+    CHECK(storage.writeItem(1, "int", static_cast<uint32_t>(1)) == ESP_OK);
+    CHECK(storage.writeItem(1, ItemType::SZ, "str", "one", 4) == ESP_OK);
+    CHECK(storage.readItem(1, "int", value) == ESP_OK);
+    CHECK(storage.readItem(1, ItemType::SZ, "str", str, sizeof(str)) == ESP_OK);
+
+    // both values are cached now, reading them again must not touch flash
+    emu.clearStats();
+    CHECK(storage.readItem(1, "int", value) == ESP_OK);
+    CHECK(value == 1);
+    size_t size;
+    CHECK(storage.getItemDataSize(1, ItemType::SZ, "str", size) == ESP_OK);
+    CHECK(size == 4);
+    CHECK(storage.readItem(1, ItemType::SZ, "str", str, size) == ESP_OK);
+    CHECK(strcmp(str, "one") == 0);
+    CHECK(emu.getReadOps() == 0);
+
+    // cached values are checked the same way as values read from flash
+    uint16_t wrongSize;
+    CHECK(storage.readItem(1, ItemType::U32, "int", &wrongSize, sizeof(wrongSize)) == ESP_ERR_NVS_TYPE_MISMATCH);
+    CHECK(storage.readItem(1, ItemType::SZ, "str", str, 2) == ESP_ERR_NVS_INVALID_LENGTH);
+
+    CHECK(storage.writeItem(1, "int", static_cast<uint32_t>(2)) == ESP_OK);
+    CHECK(storage.readItem(1, "int", value) == ESP_OK);
+    CHECK(value == 2);
+
+    CHECK(storage.eraseItem(1, "str") == ESP_OK);
+    CHECK(storage.getItemDataSize(1, ItemType::SZ, "str", size) == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(storage.readItem(1, ItemType::SZ, "str", str, sizeof(str)) == ESP_ERR_NVS_NOT_FOUND);
+
+    // least recently used value is replaced
+    CHECK(storage.writeItem(1, "a", static_cast<uint8_t>(10)) == ESP_OK);
+    CHECK(storage.writeItem(1, "b", static_cast<uint8_t>(11)) == ESP_OK);
+    uint8_t small;
+    CHECK(storage.readItem(1, "a", small) == ESP_OK);
+    CHECK(storage.readItem(1, "b", small) == ESP_OK);
+    emu.clearStats();
+    CHECK(storage.readItem(1, "int", value) == ESP_OK);
+    CHECK(emu.getReadOps() != 0);
+    emu.clearStats();
+    CHECK(storage.readItem(1, "b", small) == ESP_OK);
+    CHECK(small == 11);
+    CHECK(emu.getReadOps() == 0);
+
+    CHECK(storage.eraseNamespace(1) == ESP_OK);
+    CHECK(storage.readItem(1, "int", value) == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(storage.readItem(1, "b", small) == ESP_ERR_NVS_NOT_FOUND);
+
+    Transaction tx;
+    CHECK(storage.writeItem(1, "int", static_cast<uint32_t>(3)) == ESP_OK);
+    CHECK(storage.readItem(1, "int", value) == ESP_OK);
+    CHECK(storage.writeItem(tx, 1, "int", static_cast<uint32_t>(4)) == ESP_OK);
+    CHECK(storage.commitTransaction(tx) == ESP_OK);
+    CHECK(storage.readItem(1, "int", value) == ESP_OK);
+    CHECK(value == 4);
+}
+
+TEST_CASE("value cache hits and misses are reported by nvs_get_stats", "[nvs][cache]")
+{
+    SpiFlashEmulator emu(4);
+    TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, 4) );
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+    TEST_ESP_OK( nvs_set_i32(handle, "level", -5) );
+
+    int32_t level;
+    for (int i = 0; i < 10; ++i) {
+        TEST_ESP_OK( nvs_get_i32(handle, "level", &level) );
+        CHECK(level == -5);
+    }
+    CHECK(nvs_get_i32(handle, "missing", &level) == ESP_ERR_NVS_NOT_FOUND);
+
+    nvs_stats_t stats;
+    TEST_ESP_OK( nvs_get_stats(NULL, &stats) );
+#ifdef CONFIG_NVS_VALUE_CACHE
+    CHECK(stats.cache_hits == 9);
+    CHECK(stats.cache_misses == 2);
+#else
+    // without the cache, reads are not counted
+    CHECK(stats.cache_hits == 0);
+    CHECK(stats.cache_misses == 0);
+#endif
+
+    nvs_close(handle);
+    TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+}
+
+static void benchmark_value_cache(size_t cacheSize, const char* name)
+{
+    const size_t sectors = 8;
+    const size_t rounds = 1000;
+    SpiFlashEmulator emu(sectors);
+    Storage storage;
+    storage.setValueCacheSize(cacheSize);
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    REQUIRE(storage.writeItem(1, "channel", static_cast<int32_t>(6)) == ESP_OK);
+    REQUIRE(storage.writeItem(1, "timeout", static_cast<uint32_t>(3000)) == ESP_OK);
+    REQUIRE(storage.writeItem(1, ItemType::SZ, "hostname", "esp32-device", 13) == ESP_OK);
+
+    size_t errors = 0;
+    emu.clearStats();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        int32_t channel;
+        uint32_t timeout;
+        char hostname[32];
+        size_t size;
+        errors += (storage.readItem(1, "channel", channel) != ESP_OK || channel != 6);
+        errors += (storage.readItem(1, "timeout", timeout) != ESP_OK || timeout != 3000);
+        errors += (storage.getItemDataSize(1, ItemType::SZ, "hostname", size) != ESP_OK || size != 13);
+        errors += (storage.readItem(1, ItemType::SZ, "hostname", hostname, size) != ESP_OK);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(errors == 0);
+    s_perf << "Time to poll 3 settings " << rounds << " times " << name << ": "
+           << elapsed << " us (host), " << emu.getTotalTime() << " us (flash, " << emu.getReadOps() << " reads)" << std::endl;
+}
+
+TEST_CASE("benchmark value cache", "[nvs][bench]")
+{
+    benchmark_value_cache(0, "without value cache");
+    benchmark_value_cache(16, "with value cache");
+}
+
+TEST_CASE("nvs iterators enumerate entries", "[nvs][iterator]")
+{
+    const size_t sectors = 6;
+    SpiFlashEmulator emu(sectors);
+    TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors) );
+
+    nvs_handle handle_1;
+    nvs_handle handle_2;
+    TEST_ESP_OK( nvs_open("test_1", NVS_READWRITE, &handle_1) );
+    TEST_ESP_OK( nvs_open("test_2", NVS_READWRITE, &handle_2) );
+
+    const size_t intCount = 150;
+    char key[16];
+    for (size_t i = 0; i < intCount; ++i) {
+        snprintf(key, sizeof(key), "int%d", static_cast<int>(i));
+        TEST_ESP_OK( nvs_set_u32(handle_1, key, i) );
+    }
+    TEST_ESP_OK( nvs_set_i8(handle_2, "i8", -1) );
+    TEST_ESP_OK( nvs_set_u16(handle_2, "u16", 2) );
+    TEST_ESP_OK( nvs_set_i64(handle_2, "i64", -3) );
+    TEST_ESP_OK( nvs_set_str(handle_2, "str", "text") );
+    // blob which spans several pages is still reported once
+    static uint8_t blob[Page::CHUNK_MAX_SIZE * 2];
+    TEST_ESP_OK( nvs_set_blob(handle_2, "large_blob", blob, sizeof(blob)) );
+    TEST_ESP_OK( nvs_set_blob(handle_2, "small_blob", blob, 8) );
+    TEST_ESP_OK( nvs_set_blob(handle_2, "small_blob", blob, 16) );
+    TEST_ESP_OK( nvs_set_u8(handle_2, "erased", 1) );
+    TEST_ESP_OK( nvs_erase_key(handle_2, "erased") );
+#ifdef CONFIG_NVS_TRANSACTIONS
+    TEST_ESP_OK( nvs_tx_begin(handle_2) );
+#endif
+    TEST_ESP_OK( nvs_set_blob(handle_2, "tx_blob", blob, 4) );
+    TEST_ESP_OK( nvs_set_u8(handle_2, "tx_u8", 5) );
+    TEST_ESP_OK( nvs_erase_key(handle_2, "i8") );
+#ifdef CONFIG_NVS_TRANSACTIONS
+    TEST_ESP_OK( nvs_tx_commit(handle_2) );
+#endif
+
+    auto entry_count = [](const char* nsName, nvs_type_t type) -> size_t {
+        size_t count = 0;
+        nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, nsName, type);
+        while (it != NULL) {
+            nvs_entry_info_t info;
+            nvs_entry_info(it, &info);
+            if (nsName) {
+                CHECK(strcmp(info.namespace_name, nsName) == 0);
+            }
+            if (type != NVS_TYPE_ANY) {
+                CHECK(info.type == type);
+            }
+            ++count;
+            it = nvs_entry_next(it);
+        }
+        return count;
+    };
+
+    CHECK(entry_count(NULL, NVS_TYPE_ANY) == intCount + 7);
+    CHECK(entry_count("test_1", NVS_TYPE_ANY) == intCount);
+    CHECK(entry_count("test_2", NVS_TYPE_ANY) == 7);
+    CHECK(entry_count(NULL, NVS_TYPE_U32) == intCount);
+    CHECK(entry_count("test_2", NVS_TYPE_U32) == 0);
+    CHECK(entry_count("test_2", NVS_TYPE_BLOB) == 3);
+    CHECK(entry_count("test_2", NVS_TYPE_STR) == 1);
+    CHECK(entry_count("test_2", NVS_TYPE_I8) == 0);
+    CHECK(entry_count("missing", NVS_TYPE_ANY) == 0);
+    CHECK(nvs_entry_find("missing_part", NULL, NVS_TYPE_ANY) == NULL);
+
+    nvs_iterator_t it = nvs_entry_find(NVS_DEFAULT_PART_NAME, "test_2", NVS_TYPE_STR);
+    REQUIRE(it != NULL);
+    nvs_entry_info_t info;
+    nvs_entry_info(it, &info);
+    CHECK(strcmp(info.key, "str") == 0);
+    CHECK(info.type == NVS_TYPE_STR);
+    nvs_release_iterator(it);
+
+    // enumeration reads each item header once, without looking up keys
+    nvs_stats_t stats;
+    TEST_ESP_OK( nvs_get_stats(NULL, &stats) );
+    emu.clearStats();
+    CHECK(entry_count(NULL, NVS_TYPE_ANY) == intCount + 7);
+    CHECK(emu.getReadOps() <= stats.used_entries);
+
+    nvs_close(handle_1);
+    nvs_close(handle_2);
+    TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+}
+
+TEST_CASE("nvs blobs can be written and read in pieces", "[nvs][blob_stream]")
+{
+    const size_t sectors = 8;
+    SpiFlashEmulator emu(sectors);
+    TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors) );
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+
+    const size_t blobSize = Page::CHUNK_MAX_SIZE * 3 + 123;
+    std::unique_ptr<uint8_t[]> blob(new uint8_t[blobSize]);
+    std::unique_ptr<uint8_t[]> readBlob(new uint8_t[blobSize]);
+    for (size_t i = 0; i < blobSize; ++i) {
+        blob[i] = static_cast<uint8_t>(i * 7 + i / 251);
+    }
+    TEST_ESP_OK( nvs_set_u32(handle, "before", 1) );
+    TEST_ESP_OK( nvs_set_blob(handle, "blob", blob.get(), 100) );
+
+    // write in pieces which don't line up with chunks or entries
+    nvs_blob_writer_t writer;
+    TEST_ESP_OK( nvs_blob_write_open(handle, "blob", &writer) );
+    for (size_t offset = 0; offset < blobSize; offset += 333) {
+        TEST_ESP_OK( nvs_blob_write(writer, blob.get() + offset, std::min<size_t>(333, blobSize - offset)) );
+    }
+    // previous value is still visible until the writer is closed
+    size_t size = blobSize;
+    TEST_ESP_OK( nvs_get_blob(handle, "blob", readBlob.get(), &size) );
+    CHECK(size == 100);
+    TEST_ESP_OK( nvs_blob_write_close(writer) );
+
+    size = blobSize;
+    TEST_ESP_OK( nvs_get_blob(handle, "blob", readBlob.get(), &size) );
+    CHECK(size == blobSize);
+    CHECK(memcmp(blob.get(), readBlob.get(), blobSize) == 0);
+
+    nvs_blob_reader_t reader;
+    TEST_ESP_OK( nvs_blob_read_open(handle, "blob", &reader, &size) );
+    CHECK(size == blobSize);
+    std::fill_n(readBlob.get(), blobSize, 0);
+    for (size_t offset = 0; offset < blobSize; offset += 1000) {
+        TEST_ESP_OK( nvs_blob_read(reader, offset, readBlob.get() + offset, std::min<size_t>(1000, blobSize - offset)) );
+    }
+    CHECK(memcmp(blob.get(), readBlob.get(), blobSize) == 0);
+    uint8_t piece[40];
+    for (size_t offset : {blobSize - 40, size_t(5), Page::CHUNK_MAX_SIZE - 20, size_t(0)}) {
+        TEST_ESP_OK( nvs_blob_read(reader, offset, piece, sizeof(piece)) );
+        CHECK(memcmp(blob.get() + offset, piece, sizeof(piece)) == 0);
+    }
+    CHECK(nvs_blob_read(reader, blobSize - 10, piece, 11) == ESP_ERR_NVS_INVALID_LENGTH);
+
+    // reading a small range only touches the chunk which holds it,
+    // and the checksum of a chunk is only verified the first time it is read
+    nvs_blob_read_close(reader);
+    TEST_ESP_OK( nvs_blob_read_open(handle, "blob", &reader, &size) );
+    emu.clearStats();
+    TEST_ESP_OK( nvs_blob_read(reader, blobSize - 40, piece, sizeof(piece)) );
+    CHECK(emu.getReadBytes() < 2 * Page::CHUNK_MAX_SIZE);
+    emu.clearStats();
+    TEST_ESP_OK( nvs_blob_read(reader, blobSize - 80, piece, sizeof(piece)) );
+    // chunk header and the three entries holding the range
+    CHECK(emu.getReadBytes() <= 4 * Page::ENTRY_SIZE);
+    CHECK(memcmp(blob.get() + blobSize - 80, piece, sizeof(piece)) == 0);
+    nvs_blob_read_close(reader);
+
+    // aborted writer leaves the previous value
+    TEST_ESP_OK( nvs_blob_write_open(handle, "blob", &writer) );
+    TEST_ESP_OK( nvs_blob_write(writer, blob.get(), Page::CHUNK_MAX_SIZE * 2) );
+    nvs_blob_write_abort(writer);
+    size = blobSize;
+    TEST_ESP_OK( nvs_get_blob(handle, "blob", readBlob.get(), &size) );
+    CHECK(size == blobSize);
+
+    // empty blob
+    TEST_ESP_OK( nvs_blob_write_open(handle, "blob", &writer) );
+    TEST_ESP_OK( nvs_blob_write_close(writer) );
+    TEST_ESP_OK( nvs_get_blob(handle, "blob", NULL, &size) );
+    CHECK(size == 0);
+
+    // previous versions were erased, only the "before" value, the empty chunk and the index are left
+    uint32_t before;
+    TEST_ESP_OK( nvs_get_u32(handle, "before", &before) );
+    size_t usedEntries;
+    TEST_ESP_OK( nvs_get_used_entry_count(handle, &usedEntries) );
+    CHECK(usedEntries == 3);
+
+    CHECK(nvs_blob_read_open(handle, "missing", &reader, &size) == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(nvs_blob_write_open(handle, "key_is_too_long_", &writer) == ESP_ERR_NVS_KEY_TOO_LONG);
+#ifdef CONFIG_NVS_TRANSACTIONS
+    TEST_ESP_OK( nvs_tx_begin(handle) );
+    CHECK(nvs_blob_write_open(handle, "blob", &writer) == ESP_ERR_NVS_INVALID_STATE);
+    TEST_ESP_OK( nvs_tx_abort(handle) );
+#endif
+
+    // blobs which don't fit into the partition are rejected without using any space
+    TEST_ESP_OK( nvs_blob_write_open(handle, "blob", &writer) );
+    esp_err_t err = ESP_OK;
+    for (size_t i = 0; i < sectors && err == ESP_OK; ++i) {
+        err = nvs_blob_write(writer, blob.get(), Page::CHUNK_MAX_SIZE);
+    }
+    CHECK((err == ESP_ERR_NVS_VALUE_TOO_LONG || err == ESP_ERR_NVS_NOT_ENOUGH_SPACE));
+    CHECK(nvs_blob_write_close(writer) == err);
+    TEST_ESP_OK( nvs_get_used_entry_count(handle, &usedEntries) );
+    CHECK(usedEntries == 3);
+
+    nvs_close(handle);
+    TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+}
+
+TEST_CASE("nvs blob reader finds chunks moved to another page", "[nvs][blob_stream]")
+{
+    const size_t sectors = 4;
+    SpiFlashEmulator emu(sectors);
+    TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors) );
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+
+    uint8_t blob[200];
+    for (size_t i = 0; i < sizeof(blob); ++i) {
+        blob[i] = static_cast<uint8_t>(i * 3);
+    }
+    TEST_ESP_OK( nvs_set_blob(handle, "blob", blob, sizeof(blob)) );
+    nvs_blob_reader_t reader;
+    size_t size;
+    TEST_ESP_OK( nvs_blob_read_open(handle, "blob", &reader, &size) );
+    uint8_t piece[20];
+    TEST_ESP_OK( nvs_blob_read(reader, 0, piece, sizeof(piece)) );
+    CHECK(memcmp(blob, piece, sizeof(piece)) == 0);
+
+    // fill the first page with erased values, and the next ones with live values,
+    // so that the first page is the one freed when a new page is needed
+    for (uint32_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        TEST_ESP_OK( nvs_set_u32(handle, "counter", i) );
+    }
+    emu.clearStats();
+    char key[16];
+    for (size_t i = 0; emu.getEraseOps() == 0; ++i) {
+        REQUIRE(i < (sectors - 1) * Page::ENTRY_COUNT);
+        snprintf(key, sizeof(key), "key%d", static_cast<int>(i));
+        TEST_ESP_OK( nvs_set_u8(handle, key, 1) );
+    }
+
+    TEST_ESP_OK( nvs_blob_read(reader, 100, piece, sizeof(piece)) );
+    CHECK(memcmp(blob + 100, piece, sizeof(piece)) == 0);
+    nvs_blob_read_close(reader);
+
+    nvs_close(handle);
+    TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+}
+
+TEST_CASE("nvs blob writer keeps previous value if power goes off", "[nvs][blob_stream]")
+{
+    const size_t sectors = 5;
+    const size_t blobSize = Page::CHUNK_MAX_SIZE + 500;
+    std::unique_ptr<uint8_t[]> oldBlob(new uint8_t[blobSize]);
+    std::unique_ptr<uint8_t[]> newBlob(new uint8_t[blobSize]);
+    std::unique_ptr<uint8_t[]> readBlob(new uint8_t[blobSize]);
+    std::fill_n(oldBlob.get(), blobSize, 0x11);
+    std::fill_n(newBlob.get(), blobSize, 0x22);
+
+    for (uint32_t errDelay = 0; ; ++errDelay) {
+        INFO(errDelay);
+        SpiFlashEmulator emu(sectors);
+        bool closed = false;
+        {
+            TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors) );
+            nvs_handle handle;
+            TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+            TEST_ESP_OK( nvs_set_blob(handle, "blob", oldBlob.get(), blobSize) );
+
+            emu.failAfter(errDelay);
+            nvs_blob_writer_t writer;
+            if (nvs_blob_write_open(handle, "blob", &writer) == ESP_OK) {
+                if (nvs_blob_write(writer, newBlob.get(), blobSize) == ESP_OK) {
+                    closed = (nvs_blob_write_close(writer) == ESP_OK);
+                } else {
+                    nvs_blob_write_abort(writer);
+                }
+            }
+            if (closed) {
+                emu.failAfter(UINT32_MAX);
+            }
+            nvs_close(handle);
+            TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+        }
+
+        TEST_ESP_OK( nvs_flash_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors) );
+        nvs_handle handle;
+        TEST_ESP_OK( nvs_open("test", NVS_READWRITE, &handle) );
+        size_t size = blobSize;
+        TEST_ESP_OK( nvs_get_blob(handle, "blob", readBlob.get(), &size) );
+        REQUIRE(size == blobSize);
+        bool isOld = memcmp(readBlob.get(), oldBlob.get(), blobSize) == 0;
+        bool isNew = memcmp(readBlob.get(), newBlob.get(), blobSize) == 0;
+        REQUIRE((isOld || isNew));
+        if (closed) {
+            REQUIRE(isNew);
+        }
+        nvs_close(handle);
+        TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+        if (closed) {
+            break;
+        }
+    }
+}
+
+/* Fill all but the last two sectors with integers in namespace "first", one item per entry.
+ * Pages are written directly, since going through Storage is slow on the host. */
+static size_t fill_storage_for_lazy_load(size_t sectors)
+{
+    size_t keyCount = 0;
+    char key[16];
+    for (uint32_t sector = 0; sector < sectors - 2; ++sector) {
+        Page page;
+        REQUIRE(page.load(sector) == ESP_OK);
+        REQUIRE(page.setSeqNumber(sector) == ESP_OK);
+        if (sector == 0) {
+            REQUIRE(page.writeItem<uint8_t>(Page::NS_INDEX, "first", 1) == ESP_OK);
+        }
+        if (sector == sectors - 3) {
+            REQUIRE(page.writeItem<uint8_t>(Page::NS_INDEX, "last", 2) == ESP_OK);
+        }
+        while (page.getUsedEntryCount() < Page::ENTRY_COUNT) {
+            snprintf(key, sizeof(key), "key%05d", static_cast<int>(keyCount));
+            REQUIRE(page.writeItem(1, key, static_cast<uint32_t>(keyCount)) == ESP_OK);
+            ++keyCount;
+        }
+        REQUIRE(page.markFull() == ESP_OK);
+    }
+    return keyCount;
+}
+
+TEST_CASE("lazy page loading defers reading items of full pages", "[nvs][lazy]")
+{
+    const size_t sectors = 8;
+    SpiFlashEmulator emu(sectors);
+    const size_t keyCount = fill_storage_for_lazy_load(sectors);
+
+    emu.clearStats();
+    Storage eager;
+    eager.setLazyPageLoad(false);
+    REQUIRE(eager.init(0, sectors) == ESP_OK);
+    const size_t eagerReads = emu.getReadOps();
+
+    emu.clearStats();
+    Storage storage;
+    storage.setLazyPageLoad(true);
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    CHECK(emu.getReadOps() < eagerReads / 3);
+
+    // namespace and item on the oldest page are found without loading the other pages
+    uint8_t nsIndex;
+    TEST_ESP_OK(storage.createOrOpenNamespace("first", false, nsIndex));
+    uint32_t value;
+    TEST_ESP_OK(storage.readItem(nsIndex, "key00000", value));
+    CHECK(value == 0);
+    CHECK(emu.getReadOps() < eagerReads / 2);
+
+    // missing items and namespaces are only reported once all pages are loaded
+    uint8_t missingIndex;
+    TEST_ESP_ERR(storage.createOrOpenNamespace("missing", false, missingIndex), ESP_ERR_NVS_NOT_FOUND);
+    TEST_ESP_ERR(storage.readItem(nsIndex, "missing", value), ESP_ERR_NVS_NOT_FOUND);
+    uint8_t lastIndex;
+    TEST_ESP_OK(storage.createOrOpenNamespace("last", false, lastIndex));
+
+    char key[16];
+    for (size_t i = 0; i < keyCount; ++i) {
+        snprintf(key, sizeof(key), "key%05d", static_cast<int>(i));
+        TEST_ESP_OK(storage.readItem(nsIndex, key, value));
+        CHECK(value == i);
+    }
+
+    // writes load all pages first
+    Storage writer;
+    writer.setLazyPageLoad(true);
+    REQUIRE(writer.init(0, sectors) == ESP_OK);
+    TEST_ESP_OK(writer.writeItem(lastIndex, "new", static_cast<uint32_t>(1)));
+    TEST_ESP_OK(writer.writeItem(nsIndex, "key00001", static_cast<uint32_t>(100)));
+    TEST_ESP_OK(writer.readItem(nsIndex, "key00001", value));
+    CHECK(value == 100);
+    size_t usedEntries;
+    TEST_ESP_OK(writer.calcEntriesInNamespace(nsIndex, usedEntries));
+    CHECK(usedEntries == keyCount);
+}
+
+TEST_CASE("lazy page loading removes duplicates left by power loss", "[nvs][lazy]")
+{
+    const size_t sectors = 8;
+    SpiFlashEmulator emu(sectors);
+    const size_t keyCount = fill_storage_for_lazy_load(sectors);
+
+    // write a newer version of an item on the first page to the active page,
+    // as if power went out before the old version was erased
+    {
+        Page page;
+        TEST_ESP_OK(page.load(sectors - 2));
+        TEST_ESP_OK(page.setSeqNumber(sectors - 2));
+        TEST_ESP_OK(page.writeItem(1, "key00000", static_cast<uint32_t>(42)));
+    }
+
+    Storage storage;
+    storage.setLazyPageLoad(true);
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    uint32_t value;
+    TEST_ESP_OK(storage.readItem(1, "key00000", value));
+    CHECK(value == 42);
+    TEST_ESP_OK(storage.loadDeferredPages());
+    storage.debugCheck();
+    size_t usedEntries;
+    TEST_ESP_OK(storage.calcEntriesInNamespace(1, usedEntries));
+    CHECK(usedEntries == keyCount);
+}
+
+static void benchmark_init(size_t sectors, bool lazy)
+{
+    SpiFlashEmulator emu(sectors);
+    fill_storage_for_lazy_load(sectors);
+
+    emu.clearStats();
+    auto start = std::chrono::steady_clock::now();
+    Storage storage;
+    storage.setLazyPageLoad(lazy);
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    auto initTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    auto initFlashTime = emu.getTotalTime();
+    auto initReads = emu.getReadOps();
+
+    uint8_t nsIndex;
+    uint32_t value;
+    REQUIRE(storage.createOrOpenNamespace("first", false, nsIndex) == ESP_OK);
+    REQUIRE(storage.readItem(nsIndex, "key00000", value) == ESP_OK);
+    auto firstReadTime = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+    s_perf << "Time to init storage with " << sectors << " sectors " << (lazy ? "with" : "without") << " lazy page loading: "
+           << initTime << " us (host), " << initFlashTime << " us (flash, " << initReads << " reads), "
+           << firstReadTime << " us until first read (host)" << std::endl;
+}
+
+TEST_CASE("benchmark storage init with lazy page loading", "[nvs][bench]")
+{
+    for (size_t sectors : {16, 64, 256}) {
+        benchmark_init(sectors, false);
+        benchmark_init(sectors, true);
+    }
+}
+
+static const size_t COMPACT_TEST_COLD_KEYS = 30;
+static const size_t COMPACT_TEST_HOT_KEYS = 20;
+
+// Write settings which don't change, then update a few keys until the storage
+// had to reclaim a page, so only one page is free
+static void fill_storage_for_compaction(Storage& storage, SpiFlashEmulator& emu)
+{
+    char key[16];
+    for (size_t i = 0; i < COMPACT_TEST_COLD_KEYS; ++i) {
+        snprintf(key, sizeof(key), "cold%d", static_cast<int>(i));
+        REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(i)) == ESP_OK);
+    }
+    for (uint32_t round = 0; emu.getEraseOps() == 0; ++round) {
+        for (size_t i = 0; i < COMPACT_TEST_HOT_KEYS; ++i) {
+            snprintf(key, sizeof(key), "hot%d", static_cast<int>(i));
+            REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(round * COMPACT_TEST_HOT_KEYS + i)) == ESP_OK);
+        }
+    }
+}
+
+static void check_storage_after_compaction(Storage& storage)
+{
+    char key[16];
+    uint32_t value;
+    for (size_t i = 0; i < COMPACT_TEST_COLD_KEYS; ++i) {
+        snprintf(key, sizeof(key), "cold%d", static_cast<int>(i));
+        TEST_ESP_OK(storage.readItem(1, key, value));
+        CHECK(value == i);
+    }
+    // the last round of updates may have been interrupted
+    uint32_t first = 0;
+    for (size_t i = 0; i < COMPACT_TEST_HOT_KEYS; ++i) {
+        snprintf(key, sizeof(key), "hot%d", static_cast<int>(i));
+        TEST_ESP_OK(storage.readItem(1, key, value));
+        if (i == 0) {
+            first = value;
+        }
+        CHECK(value % COMPACT_TEST_HOT_KEYS == i);
+        CHECK(value / COMPACT_TEST_HOT_KEYS <= first / COMPACT_TEST_HOT_KEYS);
+    }
+    size_t usedEntries;
+    TEST_ESP_OK(storage.calcEntriesInNamespace(1, usedEntries));
+    CHECK(usedEntries == COMPACT_TEST_COLD_KEYS + COMPACT_TEST_HOT_KEYS);
+}
+
+TEST_CASE("compact reclaims pages ahead of time", "[nvs][gc]")
+{
+    const size_t sectors = 6;
+    SpiFlashEmulator emu(sectors);
+    Storage storage;
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+    TEST_ESP_ERR(storage.compact(8), ESP_ERR_NVS_NOT_FOUND);
+    fill_storage_for_compaction(storage, emu);
+
+    // reclaim as many pages as possible, including the one with the settings
+    storage.setCompactFreePages(sectors);
+    emu.clearStats();
+    size_t steps = 0;
+    esp_err_t err;
+    while ((err = storage.compact(8)) == ESP_OK) {
+        ++steps;
+        REQUIRE(steps < 100);
+    }
+    CHECK(err == ESP_ERR_NVS_NOT_FOUND);
+    CHECK(steps >= COMPACT_TEST_COLD_KEYS / 8);
+    CHECK(emu.getEraseOps() == sectors - 2);
+    check_storage_after_compaction(storage);
+
+    // with more than one free page, moving to the next page doesn't reclaim another one
+    emu.clearStats();
+    char key[16];
+    for (size_t i = 0; i < Page::ENTRY_COUNT; ++i) {
+        snprintf(key, sizeof(key), "hot%d", static_cast<int>(i % COMPACT_TEST_HOT_KEYS));
+        TEST_ESP_OK(storage.writeItem(1, key, static_cast<uint32_t>(i)));
+    }
+    CHECK(emu.getEraseOps() == 0);
+
+    Storage reloaded;
+    REQUIRE(reloaded.init(0, sectors) == ESP_OK);
+    check_storage_after_compaction(reloaded);
+}
+
+TEST_CASE("compact can be interrupted by power loss", "[nvs][gc][long]")
+{
+    const size_t sectors = 6;
+    size_t compactWrites;
+    {
+        SpiFlashEmulator emu(sectors);
+        Storage storage;
+        REQUIRE(storage.init(0, sectors) == ESP_OK);
+        fill_storage_for_compaction(storage, emu);
+        storage.setCompactFreePages(sectors);
+        emu.clearStats();
+        while (storage.compact(8) == ESP_OK);
+        // the emulator counts down once per word written
+        compactWrites = emu.getWriteBytes() / 4 + emu.getEraseOps();
+    }
+
+    for (size_t failAfter = 0; failAfter < compactWrites; ++failAfter) {
+        SpiFlashEmulator emu(sectors);
+        {
+            Storage storage;
+            REQUIRE(storage.init(0, sectors) == ESP_OK);
+            fill_storage_for_compaction(storage, emu);
+            storage.setCompactFreePages(sectors);
+            emu.failAfter(failAfter);
+            while (storage.compact(8) == ESP_OK);
+            emu.failAfter(UINT32_MAX);
+        }
+        Storage storage;
+        REQUIRE(storage.init(0, sectors) == ESP_OK);
+        check_storage_after_compaction(storage);
+    }
+}
+
+static void benchmark_reclaim(bool compact, const char* name)
+{
+    const size_t sectors = 8;
+    const size_t hotKeys = 8;
+    const size_t coldKeys = 200;
+    const size_t writes = 4000;
+    SpiFlashEmulator emu(sectors);
+    Storage storage;
+    REQUIRE(storage.init(0, sectors) == ESP_OK);
+
+    char key[16];
+    char hotValue[48];
+    for (size_t i = 0; i < coldKeys; ++i) {
+        snprintf(key, sizeof(key), "cold%d", static_cast<int>(i));
+        REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(i)) == ESP_OK);
+    }
+
+    // most writes update a few strings, every 16th write updates a setting which rarely changes
+    std::vector<size_t> latencies;
+    uint32_t lcg = 1;
+    emu.clearStats();
+    size_t idleTime = 0;
+    for (size_t n = 0; n < writes; ++n) {
+        lcg = lcg * 1103515245 + 12345;
+        size_t start = emu.getTotalTime();
+        if (n % 16 == 0) {
+            snprintf(key, sizeof(key), "cold%d", static_cast<int>((lcg >> 16) % coldKeys));
+            REQUIRE(storage.writeItem(1, key, static_cast<uint32_t>(n)) == ESP_OK);
+        } else {
+            snprintf(key, sizeof(key), "hot%d", static_cast<int>((lcg >> 16) % hotKeys));
+            snprintf(hotValue, sizeof(hotValue), "value of %s after write %d", key, static_cast<int>(n));
+            REQUIRE(storage.writeItem(1, ItemType::SZ, key, hotValue, strlen(hotValue) + 1) == ESP_OK);
+        }
+        latencies.push_back(emu.getTotalTime() - start);
+
+        if (compact) {
+            start = emu.getTotalTime();
+            auto err = storage.compact(4);
+            REQUIRE((err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND));
+            idleTime += emu.getTotalTime() - start;
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    s_perf << "Write latency with " << name << ": p50 " << latencies[writes / 2]
+           << " us, p99 " << latencies[writes * 99 / 100] << " us, max " << latencies.back()
+           << " us (flash), " << emu.getEraseOps() << " erases, " << idleTime << " us spent in compact" << std::endl;
+}
+
+TEST_CASE("benchmark write latency of page reclaim", "[nvs][bench]")
+{
+    benchmark_reclaim(false, "reclaim on write");
+    benchmark_reclaim(true, "idle compaction");
+}
+
 #if CONFIG_NVS_ENCRYPTION
 TEST_CASE("check underlying xts code for 32-byte size sector encryption", "[nvs]")
 {
@@ -2388,6 +3525,91 @@ TEST_CASE("test nvs apis for nvs partition generator utility with encryption ena
     TEST_ESP_OK(nvs_flash_deinit());
 
 }
+
+static void benchmark_encrypted_reads(nvs_sec_cfg_t* cfg, const char* name)
+{
+    const size_t sectors = 6;
+    const size_t rounds = 200;
+    SpiFlashEmulator emu(sectors);
+    TEST_ESP_OK( nvs_flash_secure_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors, cfg) );
+
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("bench", NVS_READWRITE, &handle) );
+    static uint8_t blob[1024];
+    for (size_t i = 0; i < sizeof(blob); ++i) {
+        blob[i] = static_cast<uint8_t>(i);
+    }
+    TEST_ESP_OK( nvs_set_blob(handle, "blob", blob, sizeof(blob)) );
+    const char* str = "a string which is too long for the value cache";
+    TEST_ESP_OK( nvs_set_str(handle, "str", str) );
+
+    size_t errors = 0;
+    emu.clearStats();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        static uint8_t blobOut[sizeof(blob)];
+        char strOut[64];
+        size_t size = sizeof(blobOut);
+        errors += (nvs_get_blob(handle, "blob", blobOut, &size) != ESP_OK || memcmp(blob, blobOut, sizeof(blob)) != 0);
+        size = sizeof(strOut);
+        errors += (nvs_get_str(handle, "str", strOut, &size) != ESP_OK || strcmp(str, strOut) != 0);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(errors == 0);
+    size_t bytes = rounds * (sizeof(blob) + strlen(str) + 1);
+    s_perf << "Time to read " << bytes << " bytes of blob and string data " << name << ": "
+           << elapsed << " us (host, " << bytes * 1000 / (elapsed + 1) << " kB/s), "
+           << emu.getReadOps() << " reads" << std::endl;
+
+    nvs_close(handle);
+    TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+}
+
+static void benchmark_encrypted_writes(nvs_sec_cfg_t* cfg, const char* name)
+{
+    const size_t sectors = 6;
+    const size_t rounds = 200;
+    SpiFlashEmulator emu(sectors);
+    TEST_ESP_OK( nvs_flash_secure_init_custom(NVS_DEFAULT_PART_NAME, 0, sectors, cfg) );
+
+    nvs_handle handle;
+    TEST_ESP_OK( nvs_open("bench", NVS_READWRITE, &handle) );
+    static uint8_t blob[1024];
+    for (size_t i = 0; i < sizeof(blob); ++i) {
+        blob[i] = static_cast<uint8_t>(i);
+    }
+    const char* str = "a string which is too long for the value cache";
+
+    size_t errors = 0;
+    emu.clearStats();
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < rounds; ++i) {
+        errors += (nvs_set_blob(handle, "blob", blob, sizeof(blob)) != ESP_OK);
+        errors += (nvs_set_str(handle, "str", str) != ESP_OK);
+    }
+    auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    CHECK(errors == 0);
+    size_t bytes = rounds * (sizeof(blob) + strlen(str) + 1);
+    s_perf << "Time to write " << bytes << " bytes of blob and string data " << name << ": "
+           << elapsed << " us (host, " << bytes * 1000 / (elapsed + 1) << " kB/s), "
+           << emu.getWriteOps() << " writes, " << emu.getEraseOps() << " erases" << std::endl;
+
+    nvs_close(handle);
+    TEST_ESP_OK( nvs_flash_deinit_partition(NVS_DEFAULT_PART_NAME) );
+}
+
+TEST_CASE("benchmark reads and writes of encrypted and plaintext data", "[nvs][bench]")
+{
+    nvs_sec_cfg_t xts_cfg;
+    for(int count = 0; count < NVS_KEY_SIZE; count++) {
+        xts_cfg.eky[count] = 0x11;
+        xts_cfg.tky[count] = 0x22;
+    }
+    benchmark_encrypted_reads(NULL, "without encryption");
+    benchmark_encrypted_reads(&xts_cfg, "with encryption");
+    benchmark_encrypted_writes(NULL, "without encryption");
+    benchmark_encrypted_writes(&xts_cfg, "with encryption");
+}
 #endif
 
 /* Add new tests above */
@@ -17,6 +17,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <fstream>
 #include <iostream>
 #include <vector>
@@ -29,9 +33,33 @@ using namespace std;
 
 #define DIV_AND_CEIL(x, y)              ((x) / (y) + ((x) % (y) > 0))
 
+static const spi_flash_sim_timing_t default_timing = {
+    .command_ns = 1000,
+    .bus_bytes_per_us = 10,
+    .program_page_size = 256,
+    .program_setup_us = 30,
+    .program_byte_ns = 2500,
+    .page_program_us = 700,
+    .sector_erase_us = 45000,
+    .block_erase_us = 150000,
+};
+
 SpiFlash::SpiFlash()
 {
-    return;
+    this->memory = NULL;
+    this->memory_mapped = false;
+    this->erase_cycles = NULL;
+    this->erase_states = NULL;
+
+    this->timing = default_timing;
+    memset(&this->stats, 0, sizeof(this->stats));
+
+    this->power_loss_armed = false;
+    this->power_lost = false;
+    this->power_loss_countdown = 0;
+    this->power_loss_random = 1;
+    this->power_loss_handler = NULL;
+    this->power_loss_arg = NULL;
 }
 
 SpiFlash::~SpiFlash()
@@ -39,11 +67,8 @@ SpiFlash::~SpiFlash()
     deinit();
 }
 
-void SpiFlash::init(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size, const char* partitions_bin)
+void SpiFlash::init_geometry(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size)
 {
-    // De-initialize first
-    deinit();
-
     // Initialize values and alloc memory
     this->chip_size = chip_size;
     this->block_size = block_size;
@@ -63,10 +88,15 @@ void SpiFlash::init(uint32_t chip_size, uint32_t block_size, uint32_t sector_siz
 
     this->total_erase_cycles = 0;
 
-    // Load partitions table bin
-    this->memory = (uint8_t *) malloc(this->chip_size);
-    memset(this->memory, 0xFF, this->chip_size);
+    this->reset_stats();
+
+    // Initializing is a power cycle
+    this->power_loss_armed = false;
+    this->power_lost = false;
+}
 
+void SpiFlash::load_partitions(const char* partitions_bin)
+{
     ifstream ifd(partitions_bin, ios::binary | ios::ate);
     int size = ifd.tellg();
 
@@ -80,13 +110,91 @@ void SpiFlash::init(uint32_t chip_size, uint32_t block_size, uint32_t sector_siz
     memcpy(&this->memory[CONFIG_PARTITION_TABLE_OFFSET], buffer.data(), buffer.size());
 }
 
+void SpiFlash::init(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size, const char* partitions_bin)
+{
+    // De-initialize first
+    deinit();
+
+    this->init_geometry(chip_size, block_size, sector_size, page_size);
+
+    // Load partitions table bin
+    this->memory = (uint8_t *) malloc(this->chip_size);
+    memset(this->memory, 0xFF, this->chip_size);
+
+    this->load_partitions(partitions_bin);
+}
+
+esp_err_t SpiFlash::init_image(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size,
+                               const char* image_file, const char* partitions_bin)
+{
+    // De-initialize first
+    deinit();
+
+    int fd = open(image_file, O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        return ESP_FAIL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    uint32_t image_size = st.st_size;
+    if (chip_size == 0) {
+        chip_size = image_size;
+    }
+    if (chip_size == 0) {
+        close(fd);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if (image_size < chip_size && ftruncate(fd, chip_size) != 0) {
+        close(fd);
+        return ESP_FAIL;
+    }
+
+    // The mapping stays valid after the file is closed
+    void* memory = mmap(NULL, chip_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (memory == MAP_FAILED) {
+        return ESP_FAIL;
+    }
+
+    this->init_geometry(chip_size, block_size, sector_size, page_size);
+
+    this->memory = (uint8_t *) memory;
+    this->memory_mapped = true;
+
+    // Flash which wasn't in the image yet is erased, anything else might not be
+    if (image_size < chip_size) {
+        memset(&this->memory[image_size], 0xFF, chip_size - image_size);
+    }
+    memset(this->erase_states, 0, this->sectors * sizeof(bool));
+
+    if (image_size == 0 && partitions_bin != NULL) {
+        this->load_partitions(partitions_bin);
+    }
+
+    return ESP_OK;
+}
+
 void SpiFlash::deinit()
 {
     // Free all allocated memory
-    free(this->memory);
+    if (this->memory_mapped) {
+        munmap(this->memory, this->chip_size);
+    } else {
+        free(this->memory);
+    }
+    this->memory = NULL;
+    this->memory_mapped = false;
 
     free(this->erase_cycles);
     free(this->erase_states);
+    this->erase_cycles = NULL;
+    this->erase_states = NULL;
 }
 
 uint32_t SpiFlash::get_chip_size()
@@ -114,14 +222,55 @@ esp_rom_spiflash_result_t SpiFlash::erase_block(uint32_t block)
     uint32_t sectors_per_block = (this->block_size / this->sector_size);
     uint32_t start_sector = block * sectors_per_block;
 
+    if (this->power_lost) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
+    if (this->interrupt_operation()) {
+        // Sectors are erased one after the other, up to the one being erased when power is lost
+        uint32_t cut = start_sector + this->power_loss_random % sectors_per_block;
+        for (int i = start_sector; i < cut; i++) {
+            this->erase_sector_internal(i);
+        }
+        this->erase_sector_partially(cut);
+        this->lose_power();
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     for (int i = start_sector; i < start_sector + sectors_per_block; i++) {
-        this->erase_sector(i);
+        this->erase_sector_internal(i);
     }
 
+    this->stats.erase_block_ops++;
+    this->stats.elapsed_ns += this->timing.command_ns + this->timing.block_erase_us * 1000ULL;
+
     return ESP_ROM_SPIFLASH_RESULT_OK;
 }
 
 esp_rom_spiflash_result_t SpiFlash::erase_sector(uint32_t sector)
+{
+    if (this->power_lost) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
+    if (this->interrupt_operation()) {
+        this->erase_sector_partially(sector);
+        this->lose_power();
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
+    esp_rom_spiflash_result_t result = this->erase_sector_internal(sector);
+
+    if (result == ESP_ROM_SPIFLASH_RESULT_OK) {
+        // The chip takes as long to erase a sector whether or not it was already erased
+        this->stats.erase_sector_ops++;
+        this->stats.elapsed_ns += this->timing.command_ns + this->timing.sector_erase_us * 1000ULL;
+    }
+
+    return result;
+}
+
+esp_rom_spiflash_result_t SpiFlash::erase_sector_internal(uint32_t sector)
 {
     if (this->total_erase_cycles_limit != 0 && 
         this->total_erase_cycles >= this->total_erase_cycles_limit) {
@@ -155,16 +304,51 @@ out:
 
 esp_rom_spiflash_result_t SpiFlash::erase_page(uint32_t page)
 {
+    if (this->power_lost) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     memset(&this->memory[page * this->page_size], 0xFF, this->page_size);
     return ESP_ROM_SPIFLASH_RESULT_OK;
 }
 
+void SpiFlash::account_read(uint32_t size)
+{
+    this->stats.read_ops++;
+    this->stats.read_bytes += size;
+    this->stats.elapsed_ns += this->timing.command_ns + size * 1000ULL / this->timing.bus_bytes_per_us;
+}
+
+void SpiFlash::account_write(uint32_t dest_addr, uint32_t size)
+{
+    this->stats.write_ops++;
+    this->stats.write_bytes += size;
+
+    // The data is programmed one program page at a time, each taking one command
+    uint32_t page_size = this->timing.program_page_size;
+    uint32_t addr = dest_addr;
+    uint32_t end = dest_addr + size;
+    while (addr < end) {
+        uint32_t chunk = min(end, (addr / page_size + 1) * page_size) - addr;
+        uint64_t program_ns = (uint64_t)this->timing.program_setup_us * 1000 + (uint64_t)(chunk - 1) * this->timing.program_byte_ns;
+        program_ns = min(program_ns, (uint64_t)this->timing.page_program_us * 1000);
+
+        this->stats.program_pages++;
+        this->stats.elapsed_ns += this->timing.command_ns + chunk * 1000ULL / this->timing.bus_bytes_per_us + program_ns;
+        addr += chunk;
+    }
+}
+
 esp_rom_spiflash_result_t SpiFlash::write(uint32_t dest_addr, const void *src, uint32_t size)
 {
     // Update reset states and check for failure
     int start = 0;
     int end = 0;
 
+    if (this->power_lost) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     if (this->total_erase_cycles_limit != 0 && 
         this->total_erase_cycles >= this->total_erase_cycles_limit) {
         return ESP_ROM_SPIFLASH_RESULT_ERR;
@@ -182,6 +366,22 @@ esp_rom_spiflash_result_t SpiFlash::write(uint32_t dest_addr, const void *src, u
         this->erase_states[i] = false;
     }
 
+    if (this->interrupt_operation()) {
+        // Bytes up to a random point are programmed, and some of the bits of the rest of that program page
+        uint32_t program_page_size = this->timing.program_page_size;
+        uint32_t cut = size > 0 ? this->power_loss_random % size : 0;
+        uint32_t page_end = min(dest_addr + size, ((dest_addr + cut) / program_page_size + 1) * program_page_size) - dest_addr;
+        for (uint32_t ctr = 0; ctr < page_end; ctr++) {
+            uint8_t data = ((uint8_t*)src)[ctr];
+            if (ctr >= cut) {
+                data |= this->random_bits();
+            }
+            this->memory[dest_addr + ctr] &= data;
+        }
+        this->lose_power();
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     // Do the write
     for(uint32_t ctr = 0; ctr < size; ctr++)
     {
@@ -194,6 +394,8 @@ esp_rom_spiflash_result_t SpiFlash::write(uint32_t dest_addr, const void *src, u
         this->memory[dest_addr + ctr] = data;
     }
 
+    this->account_write(dest_addr, size);
+
     return ESP_ROM_SPIFLASH_RESULT_OK;
 }
 
@@ -203,6 +405,10 @@ esp_rom_spiflash_result_t SpiFlash::read(uint32_t src_addr, void *dest, uint32_t
     int start = 0;
     int end = 0;
 
+    if (this->power_lost) {
+        return ESP_ROM_SPIFLASH_RESULT_ERR;
+    }
+
     if (this->total_erase_cycles_limit != 0 && 
         this->total_erase_cycles >= this->total_erase_cycles_limit) {
         return ESP_ROM_SPIFLASH_RESULT_ERR;
@@ -220,6 +426,9 @@ esp_rom_spiflash_result_t SpiFlash::read(uint32_t src_addr, void *dest, uint32_t
 
     // Do the read
     memcpy(dest, &this->memory[src_addr], size);
+
+    this->account_read(size);
+
     return ESP_ROM_SPIFLASH_RESULT_OK;
 }
 
@@ -256,4 +465,117 @@ void SpiFlash::reset_erase_cycles()
 void SpiFlash::reset_total_erase_cycles()
 {
     this->total_erase_cycles = 0;
-}
\ No newline at end of file
+}
+
+void SpiFlash::set_timing(const spi_flash_sim_timing_t* timing)
+{
+    this->timing = *timing;
+}
+
+void SpiFlash::get_timing(spi_flash_sim_timing_t* timing)
+{
+    *timing = this->timing;
+}
+
+void SpiFlash::get_stats(spi_flash_sim_stats_t* stats)
+{
+    *stats = this->stats;
+}
+
+uint64_t SpiFlash::get_elapsed_ns()
+{
+    return this->stats.elapsed_ns;
+}
+
+void SpiFlash::reset_stats()
+{
+    memset(&this->stats, 0, sizeof(this->stats));
+}
+
+void SpiFlash::print_stats(const char* label, uint64_t data_bytes)
+{
+    double elapsed_ms = this->stats.elapsed_ns / 1e6;
+    printf("%s: %llu reads (%llu bytes), %llu writes (%llu bytes), %llu sector erases, %llu block erases, "
+           "%.1f ms estimated on device",
+           label, (unsigned long long) this->stats.read_ops, (unsigned long long) this->stats.read_bytes,
+           (unsigned long long) this->stats.write_ops, (unsigned long long) this->stats.write_bytes,
+           (unsigned long long) this->stats.erase_sector_ops, (unsigned long long) this->stats.erase_block_ops,
+           elapsed_ms);
+    if (data_bytes > 0 && elapsed_ms > 0) {
+        printf(", %.1f kB/s", data_bytes / elapsed_ms * 1000 / 1024);
+    }
+    printf("\n");
+}
+
+void SpiFlash::set_power_loss_after(uint32_t operations, uint32_t seed)
+{
+    this->power_loss_armed = true;
+    this->power_loss_countdown = operations;
+    this->power_loss_random = seed != 0 ? seed : 1;
+}
+
+void SpiFlash::set_power_loss_handler(spi_flash_sim_power_loss_cb_t handler, void* arg)
+{
+    this->power_loss_handler = handler;
+    this->power_loss_arg = arg;
+}
+
+bool SpiFlash::get_power_lost()
+{
+    return this->power_lost;
+}
+
+void SpiFlash::restore_power()
+{
+    this->power_loss_armed = false;
+    this->power_lost = false;
+}
+
+bool SpiFlash::interrupt_operation()
+{
+    if (!this->power_loss_armed) {
+        return false;
+    }
+    if (this->power_loss_countdown > 0) {
+        this->power_loss_countdown--;
+        return false;
+    }
+    this->power_loss_armed = false;
+    this->random_bits();
+    return true;
+}
+
+uint8_t SpiFlash::random_bits()
+{
+    // xorshift32
+    uint32_t x = this->power_loss_random;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    this->power_loss_random = x;
+    return x >> 24;
+}
+
+void SpiFlash::erase_sector_partially(uint32_t sector)
+{
+    uint32_t start = sector * this->sector_size;
+    for (uint32_t ctr = 0; ctr < this->sector_size; ctr++) {
+        this->memory[start + ctr] |= this->random_bits();
+    }
+
+    this->erase_cycles[sector]++;
+    this->total_erase_cycles++;
+
+    this->erase_states[sector] = false;
+}
+
+void SpiFlash::lose_power()
+{
+    this->power_lost = true;
+    if (this->memory_mapped) {
+        msync(this->memory, this->chip_size, MS_SYNC);
+    }
+    if (this->power_loss_handler != NULL) {
+        this->power_loss_handler(this->power_loss_arg);
+    }
+}
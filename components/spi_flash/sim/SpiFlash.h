@@ -20,6 +20,45 @@
 #include "esp_err.h"
 #include "rom/spi_flash.h"
 
+/**
+* @brief Timing model used to estimate how long each operation would take on a real flash chip.
+*
+* The defaults are typical values from SPI NOR flash datasheets (W25Q32 class chips), with the flash
+* bus running at 40 MHz DIO as it does by default on ESP32.
+*/
+typedef struct {
+    uint32_t command_ns;            ///< Fixed overhead of each read, program or erase command
+    uint32_t bus_bytes_per_us;      ///< Data rate of the flash bus, for reads and for data sent to be programmed
+    uint32_t program_page_size;     ///< Size of the chip's program page, program commands can't cross it
+    uint32_t program_setup_us;      ///< Time to program the first byte of a page
+    uint32_t program_byte_ns;       ///< Time to program each further byte of a page
+    uint32_t page_program_us;       ///< Maximum time to program a page (a full page takes this long)
+    uint32_t sector_erase_us;       ///< Time to erase a sector
+    uint32_t block_erase_us;        ///< Time to erase a block
+} spi_flash_sim_timing_t;
+
+/**
+* @brief Operation counters, and the time the operations would have taken according to the timing model.
+*/
+typedef struct {
+    uint64_t read_ops;
+    uint64_t read_bytes;
+    uint64_t write_ops;
+    uint64_t write_bytes;
+    uint64_t program_pages;         ///< Program page operations, a write spanning several program pages counts each
+    uint64_t erase_sector_ops;      ///< Sector erases, not counting those done for block erases. Page erases aren't counted or timed
+    uint64_t erase_block_ops;
+    uint64_t elapsed_ns;            ///< Virtual clock, total estimated time of all operations
+} spi_flash_sim_stats_t;
+
+/**
+* @brief Called after a simulated power loss has interrupted a program or erase operation.
+*
+* See SpiFlash::set_power_loss_after(). The handler can, for example, exit the process to test recovery of
+* a flash image in a new process.
+*/
+typedef void (*spi_flash_sim_power_loss_cb_t)(void* arg);
+
 /**
 * @brief This class is used to emulate flash devices.
 *
@@ -33,6 +72,20 @@ public:
 
     void init(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size, const char* partitions_bin);
 
+    /**
+    * @brief Use a flash image file as the contents of the flash.
+    *
+    * The file is mapped into memory, so changes are written back to it and survive the process, and
+    * get_memory_ptr() points into the image. A file which doesn't exist is created. If the image is smaller
+    * than chip_size it is extended with erased (0xFF) bytes, and if it was empty the partition table is
+    * loaded from partitions_bin (if not NULL). Passing 0 as chip_size uses the size of the image.
+    *
+    * @return ESP_OK, ESP_ERR_INVALID_SIZE if the image is empty and chip_size is 0, or ESP_FAIL if the
+    *         image can't be opened or mapped.
+    */
+    esp_err_t init_image(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size,
+                         const char* image_file, const char* partitions_bin);
+
     uint32_t get_chip_size();
     uint32_t get_block_size();
     uint32_t get_sector_size();
@@ -56,6 +109,28 @@ public:
 
     uint8_t* get_memory_ptr(uint32_t src_address);
 
+    void set_timing(const spi_flash_sim_timing_t* timing);
+    void get_timing(spi_flash_sim_timing_t* timing);
+
+    void get_stats(spi_flash_sim_stats_t* stats);
+    uint64_t get_elapsed_ns();
+    void reset_stats();
+    void print_stats(const char* label, uint64_t data_bytes);
+
+    /**
+    * @brief Simulate a power loss during a program or erase operation.
+    *
+    * After 'operations' more writes and erases have completed, the next one is interrupted: a write
+    * programs a random number of bytes, and only some of the bits of the rest of that program page,
+    * and an erase sets only some of the bits of the sector being erased. The handler set with
+    * set_power_loss_handler() is called, and this and every later operation fails until restore_power()
+    * or init() is called. 'seed' selects where the operation is interrupted and which bits are affected.
+    */
+    void set_power_loss_after(uint32_t operations, uint32_t seed);
+    void set_power_loss_handler(spi_flash_sim_power_loss_cb_t handler, void* arg);
+    bool get_power_lost();
+    void restore_power();
+
 private:
     uint32_t chip_size;
     uint32_t block_size;
@@ -67,6 +142,7 @@ private:
     uint32_t pages;
 
     uint8_t* memory;
+    bool memory_mapped;
 
     bool* erase_states;
 
@@ -75,7 +151,26 @@ private:
     uint32_t total_erase_cycles;
     uint32_t total_erase_cycles_limit;
 
+    spi_flash_sim_timing_t timing;
+    spi_flash_sim_stats_t stats;
+
+    bool power_loss_armed;
+    bool power_lost;
+    uint32_t power_loss_countdown;
+    uint32_t power_loss_random;
+    spi_flash_sim_power_loss_cb_t power_loss_handler;
+    void* power_loss_arg;
+
+    void init_geometry(uint32_t chip_size, uint32_t block_size, uint32_t sector_size, uint32_t page_size);
+    void load_partitions(const char* partitions_bin);
     void deinit();
+    bool interrupt_operation();
+    uint8_t random_bits();
+    void erase_sector_partially(uint32_t sector);
+    void lose_power();
+    esp_rom_spiflash_result_t erase_sector_internal(uint32_t sector);
+    void account_read(uint32_t size);
+    void account_write(uint32_t dest_addr, uint32_t size);
 };
 
 #endif // _SpiFlash_H_
@@ -9,6 +9,8 @@
 #include "esp_err.h"
 #include "rom/spi_flash.h"
 
+#include "flash_mock.h"
+
 SpiFlash spiflash = SpiFlash();
 
 esp_rom_spiflash_chip_t g_rom_flashchip;
@@ -51,6 +53,27 @@ extern "C" void _spi_flash_init(const char* chip_size, size_t block_size, size_t
     g_rom_flashchip.page_size = page_size;
 }
 
+extern "C" esp_err_t _spi_flash_init_image(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size,
+                                           const char* image_file, const char* partitions_bin)
+{
+    // With no chip size, the size of the image is used
+    size_t size = chip_size != NULL ? convert_chip_size_string(chip_size) : 0;
+
+    assert(chip_size == NULL || size != 0);
+
+    esp_err_t err = spiflash.init_image(size, block_size, sector_size, page_size, image_file, partitions_bin);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    g_rom_flashchip.chip_size = spiflash.get_chip_size();
+    g_rom_flashchip.block_size = block_size;
+    g_rom_flashchip.sector_size = sector_size;
+    g_rom_flashchip.page_size = page_size;
+
+    return ESP_OK;
+}
+
 extern "C" esp_err_t spi_flash_mmap(size_t src_addr, size_t size, spi_flash_mmap_memory_t memory,
                          const void** out_ptr, spi_flash_mmap_handle_t* out_handle)
 {
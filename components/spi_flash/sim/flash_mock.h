@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stddef.h>
+#include "esp_err.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Set up the simulated flash, implemented in flash_mock.cpp */
+void _spi_flash_init(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin);
+
+/* Same, with the flash contents loaded from image_file. With no chip_size, the size of the image is used. */
+esp_err_t _spi_flash_init_image(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* image_file, const char* partition_bin);
+
+/* Wrappers of the above for the tests, implemented in flash_mock_util.c */
+esp_err_t spi_flash_init_image(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* image_file, const char* partition_bin);
+
+#ifdef __cplusplus
+}
+#endif
@@ -4,13 +4,18 @@
 #include "esp_err.h"
 #include "rom/spi_flash.h"
 
-extern void _spi_flash_init(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin);
+#include "flash_mock.h"
 
 void spi_flash_init(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin)
 {
     _spi_flash_init(chip_size, block_size, sector_size, page_size, partition_bin);
 }
 
+esp_err_t spi_flash_init_image(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* image_file, const char* partition_bin)
+{
+    return _spi_flash_init_image(chip_size, block_size, sector_size, page_size, image_file, partition_bin);
+}
+
 void spi_flash_mark_modified_region(size_t start_addr, size_t length)
 {
     return;
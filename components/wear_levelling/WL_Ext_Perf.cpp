@@ -13,6 +13,7 @@
 
 #include "WL_Ext_Perf.h"
 #include <stdlib.h>
+#include <string.h>
 #include "esp_log.h"
 
 static const char *TAG = "wl_ext_perf";
@@ -23,6 +24,8 @@ static const char *TAG = "wl_ext_perf";
         return (result); \
     }
 
+#define WL_EXT_CACHE_EMPTY ((size_t) -1)
+
 WL_Ext_Perf::WL_Ext_Perf(): WL_Flash()
 {
     this->sector_buffer = NULL;
@@ -31,6 +34,17 @@ WL_Ext_Perf::WL_Ext_Perf(): WL_Flash()
 WL_Ext_Perf::~WL_Ext_Perf()
 {
     free(this->sector_buffer);
+    if (this->cache != NULL) {
+        for (size_t i = 0; i < this->cache_size; i++) {
+            free(this->cache[i].data);
+        }
+        free(this->cache);
+    }
+}
+
+void WL_Ext_Perf::set_cache_size(size_t count)
+{
+    this->cache_size = count;
 }
 
 esp_err_t WL_Ext_Perf::config(WL_Config_s *cfg, Flash_Access *flash_drv)
@@ -50,6 +64,20 @@ esp_err_t WL_Ext_Perf::config(WL_Config_s *cfg, Flash_Access *flash_drv)
         return ESP_ERR_INVALID_ARG;
     }
 
+    if (this->cache_size > 0 && this->cache == NULL) {
+        this->cache = (cache_entry_t *)calloc(this->cache_size, sizeof(cache_entry_t));
+        if (this->cache == NULL) {
+            return ESP_ERR_NO_MEM;
+        }
+        for (size_t i = 0; i < this->cache_size; i++) {
+            this->cache[i].sector = WL_EXT_CACHE_EMPTY;
+            this->cache[i].data = (uint32_t *)malloc(cfg->sector_size);
+            if (this->cache[i].data == NULL) {
+                return ESP_ERR_NO_MEM;
+            }
+        }
+    }
+
     return WL_Flash::config(cfg, flash_drv);
 }
 
@@ -80,6 +108,15 @@ esp_err_t WL_Ext_Perf::erase_sector_fit(uint32_t start_sector, uint32_t count)
 
     uint32_t pre_check_start = start_sector % this->size_factor;
 
+    if (this->cache_size > 0) {
+        // Erase the FAT sectors in RAM, the flash sector is erased when the entry is written back
+        cache_entry_t *entry;
+        result = this->cache_load(start_sector / this->size_factor, &entry);
+        WL_EXT_RESULT_CHECK(result);
+        memset(&entry->data[pre_check_start * this->fat_sector_size / sizeof(uint32_t)], 0xff, count * this->fat_sector_size);
+        entry->dirty = true;
+        return ESP_OK;
+    }
 
     for (int i = 0; i < this->size_factor; i++) {
         if ((i < pre_check_start) || (i >= count + pre_check_start)) {
@@ -156,6 +193,12 @@ esp_err_t WL_Ext_Perf::erase_range(size_t start_address, size_t size)
         rest_check_count = rest_check_count / this->size_factor;
         size_t start_sector = rest_check_start / this->flash_sector_size;
         for (size_t i = 0; i < rest_check_count; i++) {
+            cache_entry_t *entry = this->cache_find(start_sector + i);
+            if (entry != NULL) {
+                memset(entry->data, 0xff, this->flash_sector_size);
+                entry->dirty = true;
+                continue;
+            }
             result = WL_Flash::erase_sector(start_sector + i);
             WL_EXT_RESULT_CHECK(result);
         }
@@ -166,3 +209,152 @@ esp_err_t WL_Ext_Perf::erase_range(size_t start_address, size_t size)
     }
     return ESP_OK;
 }
+
+esp_err_t WL_Ext_Perf::write(size_t dest_addr, const void *src, size_t size)
+{
+    esp_err_t result = ESP_OK;
+    if (this->cache_size == 0) {
+        return WL_Flash::write(dest_addr, src, size);
+    }
+    // Data of cached sectors goes to RAM, the rest is written in as few calls as possible
+    const uint8_t *data = (const uint8_t *)src;
+    size_t uncached_start = 0;
+    size_t done = 0;
+    while (done < size) {
+        size_t addr = dest_addr + done;
+        size_t offset = addr % this->flash_sector_size;
+        size_t chunk = this->flash_sector_size - offset;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        cache_entry_t *entry = this->cache_find(addr / this->flash_sector_size);
+        if (entry != NULL) {
+            if (uncached_start < done) {
+                result = WL_Flash::write(dest_addr + uncached_start, &data[uncached_start], done - uncached_start);
+                WL_EXT_RESULT_CHECK(result);
+            }
+            // Like the flash, writing can only clear bits
+            uint8_t *cached = (uint8_t *)entry->data + offset;
+            for (size_t i = 0; i < chunk; i++) {
+                cached[i] &= data[done + i];
+            }
+            entry->dirty = true;
+            uncached_start = done + chunk;
+        }
+        done += chunk;
+    }
+    if (uncached_start < size) {
+        result = WL_Flash::write(dest_addr + uncached_start, &data[uncached_start], size - uncached_start);
+        WL_EXT_RESULT_CHECK(result);
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::read(size_t src_addr, void *dest, size_t size)
+{
+    esp_err_t result = ESP_OK;
+    if (this->cache_size == 0) {
+        return WL_Flash::read(src_addr, dest, size);
+    }
+    uint8_t *data = (uint8_t *)dest;
+    size_t uncached_start = 0;
+    size_t done = 0;
+    while (done < size) {
+        size_t addr = src_addr + done;
+        size_t offset = addr % this->flash_sector_size;
+        size_t chunk = this->flash_sector_size - offset;
+        if (chunk > size - done) {
+            chunk = size - done;
+        }
+        cache_entry_t *entry = this->cache_find(addr / this->flash_sector_size);
+        if (entry != NULL) {
+            if (uncached_start < done) {
+                result = WL_Flash::read(src_addr + uncached_start, &data[uncached_start], done - uncached_start);
+                WL_EXT_RESULT_CHECK(result);
+            }
+            memcpy(&data[done], (uint8_t *)entry->data + offset, chunk);
+            uncached_start = done + chunk;
+        }
+        done += chunk;
+    }
+    if (uncached_start < size) {
+        result = WL_Flash::read(src_addr + uncached_start, &data[uncached_start], size - uncached_start);
+        WL_EXT_RESULT_CHECK(result);
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::sync()
+{
+    esp_err_t result = ESP_OK;
+    for (size_t i = 0; i < this->cache_size; i++) {
+        result = this->cache_write_back(&this->cache[i]);
+        WL_EXT_RESULT_CHECK(result);
+    }
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::flush()
+{
+    esp_err_t result = this->sync();
+    WL_EXT_RESULT_CHECK(result);
+    return WL_Flash::flush();
+}
+
+WL_Ext_Perf::cache_entry_t *WL_Ext_Perf::cache_find(size_t sector)
+{
+    for (size_t i = 0; i < this->cache_size; i++) {
+        if (this->cache[i].sector == sector) {
+            this->cache[i].last_use = ++this->cache_clock;
+            return &this->cache[i];
+        }
+    }
+    return NULL;
+}
+
+esp_err_t WL_Ext_Perf::cache_load(size_t sector, cache_entry_t **out_entry)
+{
+    esp_err_t result = ESP_OK;
+    cache_entry_t *entry = this->cache_find(sector);
+    if (entry != NULL) {
+        *out_entry = entry;
+        return ESP_OK;
+    }
+    // Take an empty entry, or evict the least recently used one
+    entry = &this->cache[0];
+    for (size_t i = 0; i < this->cache_size; i++) {
+        if (this->cache[i].sector == WL_EXT_CACHE_EMPTY) {
+            entry = &this->cache[i];
+            break;
+        }
+        if (this->cache_clock - this->cache[i].last_use > this->cache_clock - entry->last_use) {
+            entry = &this->cache[i];
+        }
+    }
+    result = this->cache_write_back(entry);
+    WL_EXT_RESULT_CHECK(result);
+    entry->sector = WL_EXT_CACHE_EMPTY;
+    result = WL_Flash::read(sector * this->flash_sector_size, entry->data, this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    ESP_LOGV(TAG, "%s - sector= 0x%08x", __func__, (uint32_t) sector);
+    entry->sector = sector;
+    entry->dirty = false;
+    entry->last_use = ++this->cache_clock;
+    *out_entry = entry;
+    return ESP_OK;
+}
+
+esp_err_t WL_Ext_Perf::cache_write_back(cache_entry_t *entry)
+{
+    esp_err_t result = ESP_OK;
+    if (entry->sector == WL_EXT_CACHE_EMPTY || !entry->dirty) {
+        return ESP_OK;
+    }
+    ESP_LOGV(TAG, "%s - sector= 0x%08x", __func__, (uint32_t) entry->sector);
+    result = WL_Flash::erase_sector(entry->sector);
+    WL_EXT_RESULT_CHECK(result);
+    result = WL_Flash::write(entry->sector * this->flash_sector_size, entry->data, this->flash_sector_size);
+    WL_EXT_RESULT_CHECK(result);
+    entry->dirty = false;
+    return ESP_OK;
+}
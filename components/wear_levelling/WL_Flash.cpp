@@ -25,6 +25,11 @@ static const char *TAG = "wl_flash";
 #define WL_CFG_CRC_CONST UINT32_MAX
 #endif // WL_CFG_CRC_CONST 
 
+// Swap records that a map area has room for at least, before the body is written again
+#ifndef WL_MAP_MIN_RECORDS
+#define WL_MAP_MIN_RECORDS 64
+#endif // WL_MAP_MIN_RECORDS
+
 #define WL_RESULT_CHECK(result) \
     if (result != ESP_OK) { \
         ESP_LOGE(TAG,"%s(%d): result = 0x%08x", __FUNCTION__, __LINE__, result); \
@@ -43,6 +48,7 @@ WL_Flash::WL_Flash()
 WL_Flash::~WL_Flash()
 {
     free(this->temp_buff);
+    free(this->map_body);
 }
 
 esp_err_t WL_Flash::config(wl_config_t *cfg, Flash_Access *flash_drv)
@@ -87,12 +93,25 @@ esp_err_t WL_Flash::config(wl_config_t *cfg, Flash_Access *flash_drv)
     this->cfg_size = (sizeof(wl_config_t) + this->cfg.sector_size - 1) / this->cfg.sector_size;
     this->cfg_size = cfg_size * this->cfg.sector_size;
 
+    this->map_size = 0;
+    if (this->swap_threshold != 0 && this->cfg.page_size == this->cfg.sector_size) {
+        // The body holds the erase count of every physical page and the virtual page of every logical page
+        size_t max_pages = this->cfg.full_mem_size / this->cfg.page_size;
+        this->map_body_size = (max_pages * (sizeof(uint32_t) + sizeof(uint16_t)) + 15) / 16 * 16;
+        this->map_log_offset = sizeof(wl_map_header_t) + this->map_body_size;
+        this->map_size = (this->map_log_offset + WL_MAP_MIN_RECORDS * sizeof(wl_map_record_t) + this->cfg.sector_size - 1) / this->cfg.sector_size;
+        this->map_size = this->map_size * this->cfg.sector_size;
+        this->map_records = (this->map_size - this->map_log_offset) / sizeof(wl_map_record_t);
+    }
+
     this->addr_cfg = this->cfg.start_addr + this->cfg.full_mem_size - this->cfg_size;
     this->addr_state1 = this->cfg.start_addr + this->cfg.full_mem_size - this->state_size * 2 - this->cfg_size; // allocate data at the end of memory
     this->addr_state2 = this->cfg.start_addr + this->cfg.full_mem_size - this->state_size * 1 - this->cfg_size; // allocate data at the end of memory
+    this->addr_map[0] = this->addr_state1 - this->map_size * 2;
+    this->addr_map[1] = this->addr_state1 - this->map_size * 1;
 
-    ptrdiff_t flash_sz = ((this->cfg.full_mem_size - this->state_size * 2 - this->cfg_size) / this->cfg.page_size - 1) * this->cfg.page_size; // -1 remove dummy block
-    this->flash_size = ((this->cfg.full_mem_size - this->state_size * 2 - this->cfg_size) / this->cfg.page_size - 1) * this->cfg.page_size; // -1 remove dummy block
+    ptrdiff_t flash_sz = ((this->cfg.full_mem_size - this->state_size * 2 - this->cfg_size - this->map_size * 2) / this->cfg.page_size - 1) * this->cfg.page_size; // -1 remove dummy block
+    this->flash_size = ((this->cfg.full_mem_size - this->state_size * 2 - this->cfg_size - this->map_size * 2) / this->cfg.page_size - 1) * this->cfg.page_size; // -1 remove dummy block
 
     ESP_LOGD(TAG, "%s - config result: state_size=0x%08x, cfg_size=0x%08x, addr_cfg=0x%08x, addr_state1=0x%08x, addr_state2=0x%08x, flash_size=0x%08x", __func__,
              (uint32_t) this->state_size,
@@ -112,6 +131,24 @@ esp_err_t WL_Flash::config(wl_config_t *cfg, Flash_Access *flash_drv)
         result = ESP_ERR_NO_MEM;
     }
     WL_RESULT_CHECK(result);
+
+    free(this->map_body);
+    this->map_body = NULL;
+    this->erase_counts = NULL;
+    this->page_map = NULL;
+    if (this->map_size != 0) {
+        if (this->flash_size / this->cfg.page_size > UINT16_MAX) {
+            result = ESP_ERR_INVALID_ARG;
+        }
+        WL_RESULT_CHECK(result);
+        this->map_body = (uint8_t *)malloc(this->map_body_size);
+        if (this->map_body == NULL) {
+            result = ESP_ERR_NO_MEM;
+        }
+        WL_RESULT_CHECK(result);
+        this->erase_counts = (uint32_t *)this->map_body;
+        this->page_map = (uint16_t *)&this->erase_counts[this->flash_size / this->cfg.page_size + 1];
+    }
     this->configured = true;
     return ESP_OK;
 }
@@ -125,6 +162,8 @@ esp_err_t WL_Flash::init()
     }
     // If flow will be interrupted by error, then this flag will be false
     this->initialized = false;
+    // A move that was not committed has to be started over
+    this->move_pending = false;
     // Init states if it is first time...
     this->flash_drv->read(this->addr_state1, &this->state, sizeof(wl_state_t));
     wl_state_t sa_copy;
@@ -234,6 +273,16 @@ esp_err_t WL_Flash::init()
             WL_RESULT_CHECK(result);
         }
     }
+    // The layout of the flash depends on the features. Formatting it because the configuration
+    // changed would lose all data, so this is left to the application (by erasing the partition).
+    if ((result == ESP_OK) && (this->state.features != this->stateFeatures())) {
+        ESP_LOGE(TAG, "%s: partition was formatted with features 0x%08x, configuration needs 0x%08x, erase the partition to format it again",
+                 __func__, this->state.features, this->stateFeatures());
+        result = ESP_ERR_INVALID_VERSION;
+    }
+    if ((result == ESP_OK) && (this->map_body != NULL)) {
+        result = this->loadMap();
+    }
     if (result != ESP_OK) {
         this->initialized = false;
         ESP_LOGE(TAG, "%s: returned 0x%08x", __func__, (uint32_t)result);
@@ -284,6 +333,7 @@ esp_err_t WL_Flash::initSections()
     this->state.version = this->cfg.version;
     this->state.block_size = this->cfg.page_size;
     this->state.device_id = esp_random();
+    this->state.features = this->stateFeatures();
     memset(this->state.reserved, 0, sizeof(this->state.reserved));
 
     this->state.max_pos = 1 + this->flash_size / this->cfg.page_size;
@@ -305,6 +355,12 @@ esp_err_t WL_Flash::initSections()
     result = this->flash_drv->write(this->addr_cfg, &this->cfg, sizeof(wl_config_t));
     WL_RESULT_CHECK(result);
 
+    // Pages are mapped 1:1 again, loadMap() will write a new map
+    if (this->map_size != 0) {
+        result = this->flash_drv->erase_range(this->addr_map[0], this->map_size * 2);
+        WL_RESULT_CHECK(result);
+    }
+
     ESP_LOGD(TAG, "%s - this->state->max_count= 0x%08x, this->state->max_pos= 0x%08x", __func__, this->state.max_count, this->state.max_pos);
     ESP_LOGD(TAG, "%s - result= 0x%08x", __func__, result);
     return result;
@@ -366,6 +422,7 @@ esp_err_t WL_Flash::updateV1_V2()
         this->state.version = 2;
         this->state.pos = 0;
         this->state.device_id = esp_random();
+        this->state.features = 0;
         memset(this->state.reserved, 0, sizeof(this->state.reserved));
         this->state.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&this->state, WL_STATE_CRC_LEN_V2);
 
@@ -429,10 +486,29 @@ esp_err_t WL_Flash::updateWL()
 {
     esp_err_t result = ESP_OK;
     this->state.access_count++;
-    if (this->state.access_count < this->state.max_count) {
+    if (!this->move_pending) {
+        if (this->state.access_count < this->state.max_count) {
+            return result;
+        }
+        // Here we have to move the block and increase the state
+        this->startMove();
+    } else if (this->state.access_count >= this->state.max_count) {
+        // The move was started a whole update period ago and still is not done,
+        // so complete it now rather than letting the wear levelling fall behind
+        return this->moveBlock(0);
+    }
+    if (!this->incremental_rotation) {
+        return this->moveBlock(0);
+    }
+    if (this->rotation_step == 0) {
+        // Only wl_maintenance advances the move
         return result;
     }
-    // Here we have to move the block and increase the state
+    return this->moveBlock(this->rotation_step);
+}
+
+void WL_Flash::startMove()
+{
     this->state.access_count = 0;
     ESP_LOGV(TAG, "%s - access_count= 0x%08x, pos= 0x%08x", __func__, this->state.access_count, this->state.pos);
     // copy data to dummy block
@@ -440,29 +516,55 @@ esp_err_t WL_Flash::updateWL()
     if (data_addr >= this->state.max_pos) {
         data_addr = 0;
     }
-    data_addr = this->cfg.start_addr + data_addr * this->cfg.page_size;
-    this->dummy_addr = this->cfg.start_addr + this->state.pos * this->cfg.page_size;
-    result = this->flash_drv->erase_range(this->dummy_addr, this->cfg.page_size);
-    if (result != ESP_OK) {
-        ESP_LOGE(TAG, "%s - erase wl dummy sector result= 0x%08x", __func__, result);
-        this->state.access_count = this->state.max_count - 1; // we will update next time
+    this->move_src = data_addr * this->cfg.page_size;
+    this->move_erased = false;
+    this->move_copied = 0;
+    this->move_pending = true;
+}
+
+esp_err_t WL_Flash::moveBlock(size_t max_bytes)
+{
+    esp_err_t result = ESP_OK;
+    if (!this->move_pending) {
         return result;
     }
+    size_t data_addr = this->cfg.start_addr + this->move_src;
+    this->dummy_addr = this->cfg.start_addr + this->state.pos * this->cfg.page_size;
+    if (!this->move_erased) {
+        result = this->flash_drv->erase_range(this->dummy_addr, this->cfg.page_size);
+        if (result != ESP_OK) {
+            ESP_LOGE(TAG, "%s - erase wl dummy sector result= 0x%08x", __func__, result);
+            return result; // we will update next time
+        }
+        this->countErase(this->dummy_addr - this->cfg.start_addr);
+        this->move_erased = true;
+        if (max_bytes != 0) {
+            // the erase is a step of its own
+            return result;
+        }
+    }
 
-    size_t copy_count = this->cfg.page_size / this->cfg.temp_buff_size;
-    for (size_t i = 0; i < copy_count; i++) {
-        result = this->flash_drv->read(data_addr + i * this->cfg.temp_buff_size, this->temp_buff, this->cfg.temp_buff_size);
+    size_t copied = 0;
+    while (this->move_copied < this->cfg.page_size && (max_bytes == 0 || copied < max_bytes)) {
+        result = this->flash_drv->read(data_addr + this->move_copied, this->temp_buff, this->cfg.temp_buff_size);
         if (result != ESP_OK) {
             ESP_LOGE(TAG, "%s - not possible to read buffer, will try next time, result= 0x%08x", __func__, result);
-            this->state.access_count = this->state.max_count - 1; // we will update next time
+            this->move_erased = false; // start over with the erase next time
+            this->move_copied = 0;
             return result;
         }
-        result = this->flash_drv->write(this->dummy_addr + i * this->cfg.temp_buff_size, this->temp_buff, this->cfg.temp_buff_size);
+        result = this->flash_drv->write(this->dummy_addr + this->move_copied, this->temp_buff, this->cfg.temp_buff_size);
         if (result != ESP_OK) {
             ESP_LOGE(TAG, "%s - not possible to write buffer, will try next time, result= 0x%08x", __func__, result);
-            this->state.access_count = this->state.max_count - 1; // we will update next time
+            this->move_erased = false;
+            this->move_copied = 0;
             return result;
         }
+        this->move_copied += this->cfg.temp_buff_size;
+        copied += this->cfg.temp_buff_size;
+    }
+    if (this->move_copied < this->cfg.page_size) {
+        return result;
     }
     // done... block moved.
     // Here we will update structures...
@@ -473,16 +575,19 @@ esp_err_t WL_Flash::updateWL()
     result |= this->flash_drv->write(this->addr_state1 + sizeof(wl_state_t) + byte_pos, this->temp_buff, this->cfg.wr_size);
     if (result != ESP_OK) {
         ESP_LOGE(TAG, "%s - update position 1 result= 0x%08x", __func__, result);
-        this->state.access_count = this->state.max_count - 1; // we will update next time
+        this->move_erased = false; // we will update next time
+        this->move_copied = 0;
         return result;
     }
     this->fillOkBuff(this->state.pos);
     result |= this->flash_drv->write(this->addr_state2 + sizeof(wl_state_t) + byte_pos, this->temp_buff, this->cfg.wr_size);
     if (result != ESP_OK) {
         ESP_LOGE(TAG, "%s - update position 2 result= 0x%08x", __func__, result);
-        this->state.access_count = this->state.max_count - 1; // we will update next time
+        this->move_erased = false; // we will update next time
+        this->move_copied = 0;
         return result;
     }
+    this->move_pending = false;
 
     this->state.pos++;
     if (this->state.pos >= this->state.max_pos) {
@@ -514,6 +619,34 @@ esp_err_t WL_Flash::updateWL()
     return result;
 }
 
+// The part of the moved page that was already copied to the dummy block must not
+// change before the move is committed, otherwise the copy would be stale.
+bool WL_Flash::moveConflicts(size_t real_addr, size_t size)
+{
+    return this->move_pending
+           && real_addr < this->move_src + this->move_copied
+           && real_addr + size > this->move_src;
+}
+
+void WL_Flash::set_incremental_rotation(bool enable, size_t step_size)
+{
+    this->incremental_rotation = enable;
+    this->rotation_step = step_size;
+}
+
+esp_err_t WL_Flash::maintenance(size_t max_bytes, bool *pending)
+{
+    esp_err_t result = ESP_OK;
+    if (!this->initialized) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    result = this->moveBlock(max_bytes);
+    if (pending != NULL) {
+        *pending = this->move_pending;
+    }
+    return result;
+}
+
 size_t WL_Flash::calcAddr(size_t addr)
 {
     size_t result = (this->flash_size - this->state.move_count * this->cfg.page_size + addr) % this->flash_size;
@@ -527,6 +660,258 @@ size_t WL_Flash::calcAddr(size_t addr)
 }
 
 
+// Translates addr like calcAddr, and returns how many of the following size bytes
+// are mapped to consecutive physical addresses. The mapping is only broken where
+// the rotated address wraps around the end of the flash and at the dummy block.
+size_t WL_Flash::calcSpan(size_t addr, size_t size, size_t *real_addr)
+{
+    if (this->page_map != NULL) {
+        // Logical pages are only contiguous as long as their virtual pages are
+        size_t pages = this->flash_size / this->cfg.page_size;
+        size_t page = addr / this->cfg.page_size;
+        size_t run = this->cfg.page_size - addr % this->cfg.page_size;
+        while (run < size && page + 1 < pages && this->page_map[page + 1] == this->page_map[page] + 1) {
+            run += this->cfg.page_size;
+            page++;
+        }
+        if (size > run) {
+            size = run;
+        }
+        addr = this->calcVirt(addr);
+    }
+    size_t result = (this->flash_size - this->state.move_count * this->cfg.page_size + addr) % this->flash_size;
+    size_t dummy_addr = this->state.pos * this->cfg.page_size;
+    size_t span = this->flash_size - result;
+    if (result < dummy_addr) {
+        if (dummy_addr - result < span) {
+            span = dummy_addr - result;
+        }
+        *real_addr = result;
+    } else {
+        *real_addr = result + this->cfg.page_size;
+    }
+    if (size < span) {
+        span = size;
+    }
+    ESP_LOGV(TAG, "%s - addr= 0x%08x -> result= 0x%08x, span= 0x%08x, dummy_addr= 0x%08x", __func__, (uint32_t) addr, (uint32_t) *real_addr, (uint32_t) span, (uint32_t)dummy_addr);
+    return span;
+}
+
+
+size_t WL_Flash::calcVirt(size_t addr)
+{
+    size_t page = addr / this->cfg.page_size;
+    if ((this->page_map == NULL) || (page >= this->flash_size / this->cfg.page_size)) {
+        return addr;
+    }
+    return this->page_map[page] * this->cfg.page_size + addr % this->cfg.page_size;
+}
+
+void WL_Flash::set_hot_cold_swap(size_t threshold)
+{
+    this->swap_threshold = threshold;
+}
+
+uint32_t WL_Flash::get_erase_count(size_t page)
+{
+    if ((this->erase_counts == NULL) || (page > this->flash_size / this->cfg.page_size)) {
+        return 0;
+    }
+    return this->erase_counts[page];
+}
+
+uint32_t WL_Flash::stateFeatures()
+{
+    return (this->map_size != 0) ? WL_STATE_FEATURE_SWAP : 0;
+}
+
+esp_err_t WL_Flash::loadMap()
+{
+    esp_err_t result = ESP_OK;
+    size_t pages = this->flash_size / this->cfg.page_size;
+    wl_map_header_t header[2];
+    bool valid[2];
+    for (int i = 0; i < 2; i++) {
+        result = this->flash_drv->read(this->addr_map[i], &header[i], sizeof(wl_map_header_t));
+        WL_RESULT_CHECK(result);
+        valid[i] = (header[i].magic == WL_MAP_MAGIC)
+                   && (header[i].pages == pages)
+                   && (header[i].crc == crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&header[i], offsetof(wl_map_header_t, crc)));
+    }
+    // Try the most recent area first
+    int order[2] = {0, 1};
+    if (valid[1] && (!valid[0] || (int32_t)(header[1].seq - header[0].seq) > 0)) {
+        order[0] = 1;
+        order[1] = 0;
+    }
+    for (int k = 0; k < 2; k++) {
+        int i = order[k];
+        if (!valid[i]) {
+            continue;
+        }
+        result = this->flash_drv->read(this->addr_map[i] + sizeof(wl_map_header_t), this->map_body, this->map_body_size);
+        WL_RESULT_CHECK(result);
+        if (crc32::crc32_le(WL_CFG_CRC_CONST, this->map_body, this->map_body_size) != header[i].body_crc) {
+            continue;
+        }
+        this->map_area = i;
+        this->map_seq = header[i].seq;
+        bool torn = false;
+        // Replay the swaps done since the body was written
+        for (this->map_log_next = 0; this->map_log_next < this->map_records; this->map_log_next++) {
+            wl_map_record_t record;
+            result = this->flash_drv->read(this->addr_map[i] + this->map_log_offset + this->map_log_next * sizeof(wl_map_record_t), &record, sizeof(wl_map_record_t));
+            WL_RESULT_CHECK(result);
+            if ((record.magic != WL_MAP_MAGIC)
+                    || (record.seq != this->map_seq)
+                    || (record.crc != crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&record, offsetof(wl_map_record_t, crc)))
+                    || (record.page_a >= pages) || (record.page_b >= pages)) {
+                // Either the free space, or a record that was not completely written. Both end the log,
+                // but the latter can not be written again, and would hide the records written after it.
+                uint32_t *words = (uint32_t *)&record;
+                for (size_t w = 0; w < sizeof(wl_map_record_t) / sizeof(uint32_t); w++) {
+                    torn = torn || (words[w] != UINT32_MAX);
+                }
+                break;
+            }
+            uint16_t temp = this->page_map[record.page_a];
+            this->page_map[record.page_a] = this->page_map[record.page_b];
+            this->page_map[record.page_b] = temp;
+        }
+        this->total_erases = 0;
+        for (size_t p = 0; p <= pages; p++) {
+            this->total_erases += this->erase_counts[p];
+        }
+        ESP_LOGD(TAG, "%s - area= %i, seq= 0x%08x, records= %i", __func__, i, this->map_seq, (uint32_t)this->map_log_next);
+        if (torn) {
+            // Start a clean map in the other area, the log continues there
+            ESP_LOGW(TAG, "%s - torn record= %i", __func__, (uint32_t)this->map_log_next);
+            return this->writeMap();
+        }
+        return ESP_OK;
+    }
+
+    // No map yet, pages are mapped 1:1
+    memset(this->map_body, 0, this->map_body_size);
+    for (size_t p = 0; p < pages; p++) {
+        this->page_map[p] = p;
+    }
+    this->total_erases = 0;
+    this->map_area = 1;
+    this->map_seq = 0;
+    return this->writeMap();
+}
+
+// Writes the body to the other map area, which becomes the current one once its header is written
+esp_err_t WL_Flash::writeMap()
+{
+    esp_err_t result = ESP_OK;
+    size_t area = 1 - this->map_area;
+    wl_map_header_t header;
+    memset(&header, 0, sizeof(wl_map_header_t));
+    header.magic = WL_MAP_MAGIC;
+    header.seq = this->map_seq + 1;
+    header.pages = this->flash_size / this->cfg.page_size;
+    header.body_crc = crc32::crc32_le(WL_CFG_CRC_CONST, this->map_body, this->map_body_size);
+    header.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&header, offsetof(wl_map_header_t, crc));
+
+    result = this->flash_drv->erase_range(this->addr_map[area], this->map_size);
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->write(this->addr_map[area] + sizeof(wl_map_header_t), this->map_body, this->map_body_size);
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->write(this->addr_map[area], &header, sizeof(wl_map_header_t));
+    WL_RESULT_CHECK(result);
+    this->map_area = area;
+    this->map_seq = header.seq;
+    this->map_log_next = 0;
+    return result;
+}
+
+esp_err_t WL_Flash::commitSwap(size_t page_a, size_t page_b)
+{
+    esp_err_t result = ESP_OK;
+    uint16_t temp = this->page_map[page_a];
+    this->page_map[page_a] = this->page_map[page_b];
+    this->page_map[page_b] = temp;
+    if (this->map_log_next < this->map_records) {
+        wl_map_record_t record;
+        record.page_a = page_a;
+        record.page_b = page_b;
+        record.seq = this->map_seq;
+        record.magic = WL_MAP_MAGIC;
+        record.crc = crc32::crc32_le(WL_CFG_CRC_CONST, (uint8_t *)&record, offsetof(wl_map_record_t, crc));
+        result = this->flash_drv->write(this->addr_map[this->map_area] + this->map_log_offset + this->map_log_next * sizeof(wl_map_record_t), &record, sizeof(wl_map_record_t));
+        this->map_log_next++;
+    } else {
+        result = this->writeMap();
+    }
+    if (result != ESP_OK) {
+        this->page_map[page_b] = this->page_map[page_a];
+        this->page_map[page_a] = temp;
+        ESP_LOGE(TAG, "%s - result= 0x%08x", __func__, result);
+        // A partly written record would end the replay on the next mount, and hide the records
+        // written after it. Continue in a clean map, which also drops the record if it was written.
+        if (this->writeMap() != ESP_OK) {
+            // try again with the next swap
+            this->map_log_next = this->map_records;
+        }
+    }
+    return result;
+}
+
+void WL_Flash::countErase(size_t real_addr)
+{
+    if (this->erase_counts == NULL) {
+        return;
+    }
+    this->erase_counts[real_addr / this->cfg.page_size]++;
+    this->total_erases++;
+}
+
+// Called after logical page was erased at real_addr. If that physical page is hot, the data of the
+// coldest physical page is copied there, and the logical page takes the place of that data.
+esp_err_t WL_Flash::swapHot(size_t page, size_t real_addr)
+{
+    esp_err_t result = ESP_OK;
+    size_t pages = this->flash_size / this->cfg.page_size;
+    uint32_t mean = this->total_erases / (pages + 1);
+    if (this->erase_counts[real_addr / this->cfg.page_size] < mean + this->swap_threshold) {
+        return result;
+    }
+    size_t cold_page = page;
+    size_t cold_addr = real_addr;
+    for (size_t i = 0; i < pages; i++) {
+        size_t addr = this->calcAddr(this->page_map[i] * this->cfg.page_size);
+        if (this->erase_counts[addr / this->cfg.page_size] < this->erase_counts[cold_addr / this->cfg.page_size]) {
+            cold_page = i;
+            cold_addr = addr;
+        }
+    }
+    if ((cold_page == page)
+            || this->moveConflicts(real_addr, this->cfg.page_size)
+            || this->moveConflicts(cold_addr, this->cfg.page_size)) {
+        // try again with the next erase
+        return result;
+    }
+    ESP_LOGD(TAG, "%s - page= 0x%08x, cold_page= 0x%08x, erase_count= %i, cold_erase_count= %i", __func__, (uint32_t)page, (uint32_t)cold_page,
+             this->erase_counts[real_addr / this->cfg.page_size], this->erase_counts[cold_addr / this->cfg.page_size]);
+
+    // Until the swap is committed, the cold data stays where it is, and the erased page only
+    // gets a copy of it, which is as good as an interrupted erase
+    for (size_t i = 0; i < this->cfg.page_size; i += this->cfg.temp_buff_size) {
+        result = this->flash_drv->read(this->cfg.start_addr + cold_addr + i, this->temp_buff, this->cfg.temp_buff_size);
+        WL_RESULT_CHECK(result);
+        result = this->flash_drv->write(this->cfg.start_addr + real_addr + i, this->temp_buff, this->cfg.temp_buff_size);
+        WL_RESULT_CHECK(result);
+    }
+    result = this->commitSwap(page, cold_page);
+    WL_RESULT_CHECK(result);
+    result = this->flash_drv->erase_range(this->cfg.start_addr + cold_addr, this->cfg.page_size);
+    WL_RESULT_CHECK(result);
+    this->countErase(cold_addr);
+    return result;
+}
+
 size_t WL_Flash::chip_size()
 {
     if (!this->configured) {
@@ -552,9 +937,18 @@ esp_err_t WL_Flash::erase_sector(size_t sector)
     ESP_LOGD(TAG, "%s - sector= 0x%08x", __func__, (uint32_t) sector);
     result = this->updateWL();
     WL_RESULT_CHECK(result);
-    size_t virt_addr = this->calcAddr(sector * this->cfg.sector_size);
+    size_t virt_addr = this->calcAddr(this->calcVirt(sector * this->cfg.sector_size));
+    if (this->moveConflicts(virt_addr, this->cfg.sector_size)) {
+        result = this->moveBlock(0);
+        WL_RESULT_CHECK(result);
+        virt_addr = this->calcAddr(this->calcVirt(sector * this->cfg.sector_size));
+    }
     result = this->flash_drv->erase_sector((this->cfg.start_addr + virt_addr) / this->cfg.sector_size);
     WL_RESULT_CHECK(result);
+    if (this->page_map != NULL) {
+        this->countErase(virt_addr);
+        result = this->swapHot(sector, virt_addr);
+    }
     return result;
 }
 esp_err_t WL_Flash::erase_range(size_t start_address, size_t size)
@@ -581,15 +975,19 @@ esp_err_t WL_Flash::write(size_t dest_addr, const void *src, size_t size)
         return ESP_ERR_INVALID_STATE;
     }
     ESP_LOGD(TAG, "%s - dest_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) dest_addr, (uint32_t) size);
-    uint32_t count = (size - 1) / this->cfg.page_size;
-    for (size_t i = 0; i < count; i++) {
-        size_t virt_addr = this->calcAddr(dest_addr + i * this->cfg.page_size);
-        result = this->flash_drv->write(this->cfg.start_addr + virt_addr, &((uint8_t *)src)[i * this->cfg.page_size], this->cfg.page_size);
+    size_t done = 0;
+    while (done < size) {
+        size_t real_addr;
+        size_t span = this->calcSpan(dest_addr + done, size - done, &real_addr);
+        if (this->moveConflicts(real_addr, span)) {
+            result = this->moveBlock(0);
+            WL_RESULT_CHECK(result);
+            span = this->calcSpan(dest_addr + done, size - done, &real_addr);
+        }
+        result = this->flash_drv->write(this->cfg.start_addr + real_addr, &((uint8_t *)src)[done], span);
         WL_RESULT_CHECK(result);
+        done += span;
     }
-    size_t virt_addr_last = this->calcAddr(dest_addr + count * this->cfg.page_size);
-    result = this->flash_drv->write(this->cfg.start_addr + virt_addr_last, &((uint8_t *)src)[count * this->cfg.page_size], size - count * this->cfg.page_size);
-    WL_RESULT_CHECK(result);
     return result;
 }
 
@@ -600,16 +998,15 @@ esp_err_t WL_Flash::read(size_t src_addr, void *dest, size_t size)
         return ESP_ERR_INVALID_STATE;
     }
     ESP_LOGD(TAG, "%s - src_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) src_addr, (uint32_t) size);
-    uint32_t count = (size - 1) / this->cfg.page_size;
-    for (size_t i = 0; i < count; i++) {
-        size_t virt_addr = this->calcAddr(src_addr + i * this->cfg.page_size);
-        ESP_LOGV(TAG, "%s - real_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) (this->cfg.start_addr + virt_addr), (uint32_t) size);
-        result = this->flash_drv->read(this->cfg.start_addr + virt_addr, &((uint8_t *)dest)[i * this->cfg.page_size], this->cfg.page_size);
+    size_t done = 0;
+    while (done < size) {
+        size_t real_addr;
+        size_t span = this->calcSpan(src_addr + done, size - done, &real_addr);
+        ESP_LOGV(TAG, "%s - real_addr= 0x%08x, size= 0x%08x", __func__, (uint32_t) (this->cfg.start_addr + real_addr), (uint32_t) span);
+        result = this->flash_drv->read(this->cfg.start_addr + real_addr, &((uint8_t *)dest)[done], span);
         WL_RESULT_CHECK(result);
+        done += span;
     }
-    size_t virt_addr_last = this->calcAddr(src_addr + count * this->cfg.page_size);
-    result = this->flash_drv->read(this->cfg.start_addr + virt_addr_last, &((uint8_t *)dest)[count * this->cfg.page_size], size - count * this->cfg.page_size);
-    WL_RESULT_CHECK(result);
     return result;
 }
 
@@ -622,11 +1019,20 @@ wl_config_t *WL_Flash::get_cfg()
     return &this->cfg;
 }
 
+esp_err_t WL_Flash::sync()
+{
+    return ESP_OK;
+}
+
 esp_err_t WL_Flash::flush()
 {
     esp_err_t result = ESP_OK;
     this->state.access_count = this->state.max_count - 1;
     result = this->updateWL();
+    if ((result == ESP_OK) && (this->page_map != NULL)) {
+        // keep the erase counts
+        result = this->writeMap();
+    }
     ESP_LOGD(TAG, "%s - result= 0x%08x, move_count= 0x%08x", __func__, result, this->state.move_count);
     return result;
 }
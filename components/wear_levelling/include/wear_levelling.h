@@ -39,6 +39,8 @@ typedef int32_t wl_handle_t;
 *       - ESP_OK, if the allocation was successfully;
 *       - ESP_ERR_INVALID_ARG, if WL allocation was unsuccessful;
 *       - ESP_ERR_NO_MEM, if there was no memory to allocate WL components;
+*       - ESP_ERR_INVALID_VERSION, if the partition was formatted with a different
+*         setting of CONFIG_WL_HOT_COLD_SWAP. Erase the partition to format it again.
 */
 esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle);
 
@@ -112,6 +114,20 @@ esp_err_t wl_write(wl_handle_t handle, size_t dest_addr, const void *src, size_t
 */
 esp_err_t wl_read(wl_handle_t handle, size_t src_addr, void *dest, size_t size);
 
+/**
+* @brief Write data cached in RAM to the WL storage
+*
+* Only needed with CONFIG_WL_SECTOR_CACHE_SIZE, otherwise the flash contents
+* are already consistent when wl_erase_range or wl_write return.
+*
+* @param handle WL module instance that was initialized before
+*
+* @return
+*       - ESP_OK, if the cached data was written successfully;
+*       - or one of error codes from lower-level flash driver.
+*/
+esp_err_t wl_sync(wl_handle_t handle);
+
 /**
 * @brief Get size of the WL storage
 *
@@ -128,6 +144,25 @@ size_t wl_size(wl_handle_t handle);
 */
 size_t wl_sector_size(wl_handle_t handle);
 
+/**
+* @brief Advance pending wear levelling work
+*
+* With CONFIG_WL_INCREMENTAL_ROTATION, moving the dummy block is split into
+* bounded steps instead of being done by a single erase operation. This function
+* performs the next step of a pending move, and is meant to be called from an
+* idle task, so that erase operations rarely have to do it.
+*
+* @param handle WL module handle that was initialized before
+* @param max_bytes Maximum number of bytes to copy in this call, or 0 to complete
+*                  the pending move. Erasing the dummy block is a step of its own.
+* @param out_pending If not NULL, set to true if the move still has work left.
+*
+* @return
+*       - ESP_OK, if the step was done or there was nothing to do;
+*       - or one of error codes from lower-level flash driver.
+*/
+esp_err_t wl_maintenance(wl_handle_t handle, size_t max_bytes, bool *out_pending);
+
 
 #ifdef __cplusplus
 } // extern "C"
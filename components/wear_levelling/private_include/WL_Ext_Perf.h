@@ -33,14 +33,41 @@ public:
     esp_err_t erase_sector(size_t sector) override;
     esp_err_t erase_range(size_t start_address, size_t size) override;
 
+    esp_err_t write(size_t dest_addr, const void *src, size_t size) override;
+    esp_err_t read(size_t src_addr, void *dest, size_t size) override;
+
+    esp_err_t flush() override;
+    esp_err_t sync() override;
+
+    /**
+    * @brief Keep up to count flash sectors in RAM, and write them back to the flash
+    * only on sync(), flush() or when they are evicted. Must be called before config().
+    */
+    void set_cache_size(size_t count);
+
 protected:
     uint32_t flash_sector_size;
     uint32_t fat_sector_size;
     uint32_t size_factor;
     uint32_t *sector_buffer;
 
+    typedef struct {
+        size_t sector;      /*!< flash sector held by this entry, WL_EXT_CACHE_EMPTY if none*/
+        bool dirty;         /*!< data differs from the flash sector*/
+        uint32_t last_use;  /*!< value of cache_clock at the last access, for LRU eviction*/
+        uint32_t *data;
+    } cache_entry_t;
+
+    size_t cache_size = 0;
+    cache_entry_t *cache = NULL;
+    uint32_t cache_clock = 0;
+
     virtual esp_err_t erase_sector_fit(uint32_t start_sector, uint32_t count);
 
+    cache_entry_t *cache_find(size_t sector);
+    esp_err_t cache_load(size_t sector, cache_entry_t **out_entry);
+    esp_err_t cache_write_back(cache_entry_t *entry);
+
 };
 
 #endif // _WL_Ext_Perf_H_
\ No newline at end of file
@@ -44,6 +44,47 @@ public :
 
     esp_err_t flush() override;
 
+    /**
+    * @brief Write data cached in RAM to the flash. WL_Flash itself does not cache
+    * anything, unlike flush() this does not advance the wear levelling.
+    */
+    virtual esp_err_t sync();
+
+    /**
+    * @brief Use incremental dummy block rotation
+    *
+    * By default the dummy block is moved in one go by the erase operation that
+    * reaches the update rate. In incremental mode the move is split in steps:
+    * the erase of the dummy block, then copies of at most step_size bytes, one
+    * step per erase operation. With step_size 0 the move is only advanced by
+    * maintenance(), unless it is still not done after another update period.
+    */
+    void set_incremental_rotation(bool enable, size_t step_size);
+
+    /**
+    * @brief Advance a pending dummy block move by one step of at most max_bytes,
+    * or complete it if max_bytes is 0. pending, if not NULL, is set to whether
+    * the move still has work left.
+    */
+    esp_err_t maintenance(size_t max_bytes, bool *pending);
+
+    /**
+    * @brief Swap hot logical pages onto cold physical pages
+    *
+    * The approximate erase count of every physical page is tracked, and when a
+    * page that was erased threshold times more than the mean is erased again, its
+    * logical page is moved to the least erased physical page, in exchange for the
+    * data held there. 0 disables swapping. Only used when page_size equals
+    * sector_size. The page map takes space of the flash, so enabling or disabling
+    * swapping formats the flash on the next init(). Must be called before config().
+    */
+    void set_hot_cold_swap(size_t threshold);
+
+    /**
+    * @brief Get the approximate erase count of a physical page, 0 if swapping is disabled
+    */
+    uint32_t get_erase_count(size_t page);
+
     Flash_Access *get_drv();
     wl_config_t *get_cfg();
 
@@ -67,10 +108,43 @@ protected:
     size_t dummy_addr;
     uint32_t pos_data[4];
 
+    bool incremental_rotation = false;
+    size_t rotation_step = 0;
+    bool move_pending = false;  // a dummy block move was started but not committed yet
+    bool move_erased = false;   // the dummy block of the pending move was erased
+    size_t move_src = 0;        // address of the page being moved, relative to start_addr
+    size_t move_copied = 0;     // bytes of the page already copied to the dummy block
+
+    size_t swap_threshold = 0;
+    size_t map_size = 0;        // size of one map area
+    size_t addr_map[2];
+    size_t map_log_offset;      // offset of the swap records in a map area
+    size_t map_records;         // amount of swap records that fit in a map area
+    size_t map_area = 0;        // map area with the current body
+    uint32_t map_seq = 0;
+    size_t map_log_next = 0;    // index of the next free swap record
+    uint8_t *map_body = NULL;
+    size_t map_body_size = 0;
+    uint32_t *erase_counts = NULL;  // approximate erase count of each physical page, part of map_body
+    uint16_t *page_map = NULL;      // virtual page of each logical page, part of map_body
+    uint32_t total_erases = 0;
+
     esp_err_t initSections();
     esp_err_t updateWL();
+    void startMove();
+    esp_err_t moveBlock(size_t max_bytes);
+    bool moveConflicts(size_t real_addr, size_t size);
     esp_err_t recoverPos();
     size_t calcAddr(size_t addr);
+    size_t calcSpan(size_t addr, size_t size, size_t *real_addr);
+    size_t calcVirt(size_t addr);
+
+    uint32_t stateFeatures();
+    esp_err_t loadMap();
+    esp_err_t writeMap();
+    esp_err_t commitSwap(size_t page_a, size_t page_b);
+    void countErase(size_t real_addr);
+    esp_err_t swapHot(size_t page, size_t real_addr);
 
     esp_err_t updateVersion();
     esp_err_t updateV1_V2();
@@ -37,7 +37,8 @@ public:
     uint32_t block_size;    /*!< size of move block*/
     uint32_t version;       /*!< state id used to identify the version of current libary implementaion*/
     uint32_t device_id;     /*!< ID of current WL instance*/
-    uint32_t reserved[7];   /*!< Reserved space for future use*/
+    uint32_t features;      /*!< optional features the flash was formatted with, WL_STATE_FEATURE_* bits*/
+    uint32_t reserved[6];   /*!< Reserved space for future use*/
     uint32_t crc;           /*!< CRC of structure*/
 } wl_state_t;
 
@@ -48,4 +49,40 @@ static_assert(sizeof(wl_state_t) % 16 == 0, "Size of wl_state_t structure should
 #define WL_STATE_CRC_LEN_V1 offsetof(wl_state_t, device_id)
 #define WL_STATE_CRC_LEN_V2 offsetof(wl_state_t, crc)
 
+#define WL_STATE_FEATURE_SWAP   0x00000001 /*!< page map and erase counts are stored in the map areas*/
+
+/**
+* @brief Header of a map area, used when hot and cold pages are swapped
+*
+* A map area holds this header, followed by the approximate erase count of every
+* physical page and the virtual page of every logical page (the body), and then
+* by records of the swaps done since the body was written.
+*/
+typedef struct ALIGNED_(32) WL_Map_Header_s {
+    uint32_t magic;         /*!< WL_MAP_MAGIC*/
+    uint32_t seq;           /*!< incremented each time the body is written, the area with the highest one is current*/
+    uint32_t pages;         /*!< amount of logical pages*/
+    uint32_t body_crc;      /*!< CRC of the body*/
+    uint32_t reserved[3];   /*!< Reserved space for future use*/
+    uint32_t crc;           /*!< CRC of structure*/
+} wl_map_header_t;
+
+/**
+* @brief Swap of the virtual pages of two logical pages, appended to the current map area
+*/
+typedef struct WL_Map_Record_s {
+    uint16_t page_a;        /*!< logical pages whose virtual pages are swapped*/
+    uint16_t page_b;
+    uint32_t seq;           /*!< seq of the map area header*/
+    uint32_t magic;         /*!< WL_MAP_MAGIC*/
+    uint32_t crc;           /*!< CRC of the fields above*/
+} wl_map_record_t;
+
+#define WL_MAP_MAGIC    0x574c4d50
+
+#ifndef _MSC_VER // MSVS has different format for this define
+static_assert(sizeof(wl_map_header_t) % 16 == 0, "Size of wl_map_header_t structure should be compatible with flash encryption");
+static_assert(sizeof(wl_map_record_t) % 16 == 0, "Size of wl_map_record_t structure should be compatible with flash encryption");
+#endif // _MSC_VER
+
 #endif // _WL_State_H_
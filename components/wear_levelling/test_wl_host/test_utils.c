@@ -1,7 +1,13 @@
 #include "esp_spi_flash.h"
 #include "esp_partition.h"
+#include "flash_mock.h"
 
 void init_spi_flash(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin)
 {
     spi_flash_init(chip_size, block_size, sector_size, page_size, partition_bin);
 }
+
+esp_err_t init_spi_flash_image(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* image_file, const char* partition_bin)
+{
+    return spi_flash_init_image(chip_size, block_size, sector_size, page_size, image_file, partition_bin);
+}
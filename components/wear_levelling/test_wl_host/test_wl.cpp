@@ -1,11 +1,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <chrono>
 
 #include "esp_spi_flash.h"
 #include "esp_partition.h"
 #include "wear_levelling.h"
 #include "WL_Flash.h"
+#include "WL_Ext_Perf.h"
+#include "Partition.h"
 #include "SpiFlash.h"
 
 #include "catch.hpp"
@@ -13,6 +17,7 @@
 #include "sdkconfig.h"
 
 extern "C" void init_spi_flash(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* partition_bin);
+extern "C" esp_err_t init_spi_flash_image(const char* chip_size, size_t block_size, size_t sector_size, size_t page_size, const char* image_file, const char* partition_bin);
 extern SpiFlash spiflash;
 
 #define TEST_COUNT_MAX 100
@@ -52,12 +57,16 @@ TEST_CASE("write and read back data", "[wear_levelling]")
     }
 
     // Write data
+    spiflash.reset_stats();
     result = wl_write(wl_handle, 0, data, partition->size);
     REQUIRE(result == ESP_OK);
+    spiflash.print_stats("wl write", partition->size);
 
     // Read data
+    spiflash.reset_stats();
     result = wl_read(wl_handle, 0, read, partition->size);
     REQUIRE(result == ESP_OK);
+    spiflash.print_stats("wl read", partition->size);
 
     // Verify that written and read data match
     REQUIRE(memcmp(data, read, partition->size));
@@ -90,6 +99,73 @@ TEST_CASE("write and read back data", "[wear_levelling]")
     free(read);
 }
 
+TEST_CASE("flash simulator estimates the time of each operation", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const uint32_t base = 0x80000;
+    uint8_t buf[1024];
+    memset(buf, 0x55, sizeof(buf));
+
+    spi_flash_sim_timing_t timing;
+    spiflash.get_timing(&timing);
+    timing.command_ns = 1000;
+    timing.bus_bytes_per_us = 10;
+    timing.program_page_size = 256;
+    timing.program_setup_us = 30;
+    timing.program_byte_ns = 2500;
+    timing.page_program_us = 700;
+    timing.sector_erase_us = 45000;
+    timing.block_erase_us = 150000;
+    spiflash.set_timing(&timing);
+
+    spi_flash_sim_stats_t stats;
+    spiflash.get_stats(&stats);
+    REQUIRE(stats.elapsed_ns == 0);
+
+    // Erasing takes as long whether or not the sector was already erased
+    REQUIRE(spiflash.erase_sector(base / CONFIG_WL_SECTOR_SIZE) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(spiflash.get_elapsed_ns() == 1000 + 45000000);
+
+    // A whole program page: setup time plus 255 more bytes, and sending 256 bytes over the bus
+    spiflash.reset_stats();
+    REQUIRE(spiflash.write(base, buf, 256) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(spiflash.get_elapsed_ns() == 1000 + 25600 + 30000 + 255 * 2500);
+
+    // Writes are split at program page boundaries, and a page takes at most page_program_us
+    timing.program_byte_ns = 10000;
+    spiflash.set_timing(&timing);
+    spiflash.reset_stats();
+    REQUIRE(spiflash.write(base + 256 + 200, buf, 300) == ESP_ROM_SPIFLASH_RESULT_OK);
+    spiflash.get_stats(&stats);
+    REQUIRE(stats.write_ops == 1);
+    REQUIRE(stats.write_bytes == 300);
+    REQUIRE(stats.program_pages == 2);
+    REQUIRE(stats.elapsed_ns == (1000 + 5600 + 30000 + 55 * 10000) + (1000 + 24400 + 700000));
+
+    spiflash.reset_stats();
+    REQUIRE(spiflash.read(base, buf, 1000) == ESP_ROM_SPIFLASH_RESULT_OK);
+    spiflash.get_stats(&stats);
+    REQUIRE(stats.read_ops == 1);
+    REQUIRE(stats.read_bytes == 1000);
+    REQUIRE(stats.elapsed_ns == 1000 + 100000);
+
+    // A block erase takes the block erase time, not that of its sectors
+    spiflash.reset_stats();
+    REQUIRE(spiflash.erase_block(base / (CONFIG_WL_SECTOR_SIZE * 16)) == ESP_ROM_SPIFLASH_RESULT_OK);
+    spiflash.get_stats(&stats);
+    REQUIRE(stats.erase_block_ops == 1);
+    REQUIRE(stats.erase_sector_ops == 0);
+    REQUIRE(stats.elapsed_ns == 1000 + 150000000ULL);
+
+    // Operations which fail don't count
+    spiflash.reset_stats();
+    spiflash.set_total_erase_cycles_limit(1);
+    REQUIRE(spiflash.read(base, buf, 16) == ESP_ROM_SPIFLASH_RESULT_ERR);
+    REQUIRE(spiflash.get_elapsed_ns() == 0);
+    spiflash.set_total_erase_cycles_limit(0);
+}
+
 TEST_CASE("power down test", "[wear_levelling]")
 {
     init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
@@ -207,4 +283,807 @@ TEST_CASE("power down test", "[wear_levelling]")
     // Unmount
     result = wl_unmount(wl_handle);
     REQUIRE(result == ESP_OK);
-}
\ No newline at end of file
+}
+// Forwards to another flash driver and counts the calls and bytes that reach it
+class Counting_Flash : public Flash_Access
+{
+public:
+    Counting_Flash(Flash_Access *drv) : drv(drv) {}
+
+    size_t chip_size() override
+    {
+        return drv->chip_size();
+    }
+    esp_err_t erase_sector(size_t sector) override
+    {
+        erase_bytes += drv->sector_size();
+        return drv->erase_sector(sector);
+    }
+    esp_err_t erase_range(size_t start_address, size_t size) override
+    {
+        erase_bytes += size;
+        return drv->erase_range(start_address, size);
+    }
+    esp_err_t write(size_t dest_addr, const void *src, size_t size) override
+    {
+        write_calls++;
+        write_bytes += size;
+        return drv->write(dest_addr, src, size);
+    }
+    esp_err_t read(size_t src_addr, void *dest, size_t size) override
+    {
+        read_calls++;
+        read_bytes += size;
+        return drv->read(src_addr, dest, size);
+    }
+    size_t sector_size() override
+    {
+        return drv->sector_size();
+    }
+    void reset()
+    {
+        write_calls = write_bytes = read_calls = read_bytes = erase_bytes = 0;
+    }
+
+    size_t erase_bytes = 0;
+    size_t write_calls = 0;
+    size_t write_bytes = 0;
+    size_t read_calls = 0;
+    size_t read_bytes = 0;
+
+protected:
+    Flash_Access *drv;
+};
+
+// Same configuration as wl_mount uses
+static void default_wl_config(wl_config_t *cfg, const esp_partition_t *partition)
+{
+    cfg->full_mem_size = partition->size;
+    cfg->start_addr = 0;
+    cfg->version = 2;
+    cfg->sector_size = SPI_FLASH_SEC_SIZE;
+    cfg->page_size = SPI_FLASH_SEC_SIZE;
+    cfg->updaterate = 16;
+    cfg->temp_buff_size = 32;
+    cfg->wr_size = 16;
+}
+
+TEST_CASE("multi-page requests are coalesced into contiguous flash accesses", "[wear_levelling][bench]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    Counting_Flash counting(&part);
+
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+
+    WL_Flash wl_flash;
+    REQUIRE(wl_flash.config(&cfg, &counting) == ESP_OK);
+    REQUIRE(wl_flash.init() == ESP_OK);
+
+    const size_t flash_size = wl_flash.chip_size();
+    const size_t request_sizes[] = {512, 4096, 16384, 65536};
+    const size_t max_request = 65536;
+    uint8_t *data = new uint8_t[max_request];
+    uint8_t *read = new uint8_t[max_request];
+
+    for (size_t request_size : request_sizes) {
+        size_t requests = 0;
+        size_t write_calls = 0;
+        size_t write_bytes = 0;
+        size_t read_calls = 0;
+        size_t read_bytes = 0;
+        std::chrono::microseconds::rep time_us = 0;
+
+        // Each round erases and rewrites the whole partition, which also moves the dummy
+        // block, so that requests straddle both the dummy block and the wrap around
+        for (int round = 0; round < 4; round++) {
+            for (size_t addr = 0; addr + request_size <= flash_size; addr += request_size) {
+                if (addr % cfg.sector_size == 0) {
+                    REQUIRE(wl_flash.erase_range(addr, request_size < cfg.sector_size ? cfg.sector_size : request_size) == ESP_OK);
+                }
+                for (size_t i = 0; i < request_size; i++) {
+                    data[i] = (uint8_t) (addr / request_size + i * 7 + round);
+                }
+
+                counting.reset();
+                auto start = std::chrono::steady_clock::now();
+                REQUIRE(wl_flash.write(addr, data, request_size) == ESP_OK);
+                REQUIRE(wl_flash.read(addr, read, request_size) == ESP_OK);
+                time_us += std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+                REQUIRE(memcmp(data, read, request_size) == 0);
+
+                // A request can only be split at the dummy block and at the wrap around
+                CHECK(counting.write_calls <= 1 + (request_size - 1) / cfg.page_size);
+                CHECK(counting.write_calls <= 3);
+                CHECK(counting.read_calls <= 3);
+                requests++;
+                write_calls += counting.write_calls;
+                write_bytes += counting.write_bytes;
+                read_calls += counting.read_calls;
+                read_bytes += counting.read_bytes;
+            }
+        }
+
+        printf("request_size=%6zu requests=%5zu write_calls=%5zu bytes/write_call=%8.1f read_calls=%5zu bytes/read_call=%8.1f throughput=%8.1f MB/s\n",
+               request_size, requests, write_calls, (double) write_bytes / write_calls, read_calls, (double) read_bytes / read_calls,
+               (double) (write_bytes + read_bytes) / (time_us + 1));
+    }
+
+    delete[] data;
+    delete[] read;
+}
+
+static void fill_sector(uint32_t *data, size_t sector_size, size_t sector, uint32_t version)
+{
+    for (size_t i = 0; i < sector_size / sizeof(uint32_t); i++) {
+        data[i] = (uint32_t) (sector * 0x10000 + i) ^ (version * 0x9e3779b9);
+    }
+}
+
+static void write_all_sectors(WL_Flash &wl_flash, const uint32_t *versions, size_t sectors)
+{
+    size_t sector_size = wl_flash.sector_size();
+    uint32_t *data = new uint32_t[sector_size / sizeof(uint32_t)];
+    for (size_t sector = 0; sector < sectors; sector++) {
+        fill_sector(data, sector_size, sector, versions[sector]);
+        REQUIRE(wl_flash.erase_sector(sector) == ESP_OK);
+        REQUIRE(wl_flash.write(sector * sector_size, data, sector_size) == ESP_OK);
+    }
+    delete[] data;
+}
+
+static void check_sectors(WL_Flash &wl_flash, const uint32_t *versions, size_t sectors)
+{
+    size_t sector_size = wl_flash.sector_size();
+    uint32_t *expected = new uint32_t[sector_size / sizeof(uint32_t)];
+    uint32_t *data = new uint32_t[sector_size / sizeof(uint32_t)];
+    for (size_t sector = 0; sector < sectors; sector++) {
+        fill_sector(expected, sector_size, sector, versions[sector]);
+        REQUIRE(wl_flash.read(sector * sector_size, data, sector_size) == ESP_OK);
+        REQUIRE(memcmp(expected, data, sector_size) == 0);
+    }
+    delete[] expected;
+    delete[] data;
+}
+
+// Rewrites random sectors, and returns how many of these rewrites made the flash driver
+// erase, read and write more than the sector and one page of the dummy block move
+static size_t rewrite_sectors(WL_Flash &wl_flash, Counting_Flash &counting, uint32_t *versions, size_t sectors,
+                              size_t ops, size_t maintenance_bytes)
+{
+    size_t sector_size = wl_flash.sector_size();
+    size_t spike_work = 2 * sector_size + wl_flash.get_cfg()->page_size;
+    uint32_t *data = new uint32_t[sector_size / sizeof(uint32_t)];
+    size_t spikes = 0;
+    uint32_t x = 12345;
+    for (size_t n = 0; n < ops; n++) {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        size_t sector = x % sectors;
+        fill_sector(data, sector_size, sector, ++versions[sector]);
+
+        counting.reset();
+        REQUIRE(wl_flash.erase_sector(sector) == ESP_OK);
+        REQUIRE(wl_flash.write(sector * sector_size, data, sector_size) == ESP_OK);
+        if (counting.erase_bytes + counting.read_bytes + counting.write_bytes > spike_work) {
+            spikes++;
+        }
+
+        if (maintenance_bytes != 0) {
+            REQUIRE(wl_flash.maintenance(maintenance_bytes, NULL) == ESP_OK);
+        }
+    }
+    delete[] data;
+    return spikes;
+}
+
+TEST_CASE("incremental rotation bounds the work done by erase operations", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    Counting_Flash counting(&part);
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+
+    const size_t ops = 2000;
+    const size_t moves = ops / cfg.updaterate;
+    const size_t step_sizes[] = {SIZE_MAX, 1024, 256, 0};
+    for (size_t step_size : step_sizes) {
+        WL_Flash wl_flash;
+        REQUIRE(wl_flash.config(&cfg, &counting) == ESP_OK);
+        if (step_size != SIZE_MAX) {
+            wl_flash.set_incremental_rotation(true, step_size);
+        }
+        REQUIRE(wl_flash.init() == ESP_OK);
+
+        size_t sector_size = wl_flash.sector_size();
+        size_t sectors = wl_flash.chip_size() / sector_size;
+        uint32_t *versions = new uint32_t[sectors]();
+        write_all_sectors(wl_flash, versions, sectors);
+        check_sectors(wl_flash, versions, sectors);
+
+        // Without maintenance, the erase operations do all the moves
+        size_t spikes = rewrite_sectors(wl_flash, counting, versions, sectors, ops, 0);
+        check_sectors(wl_flash, versions, sectors);
+        // With maintenance, they only complete a move when they write to its source page
+        size_t spikes_with_maintenance = rewrite_sectors(wl_flash, counting, versions, sectors, ops, 512);
+        check_sectors(wl_flash, versions, sectors);
+        printf("step_size=%5d moves=%zu spikes=%zu spikes_with_maintenance=%zu\n",
+               step_size == SIZE_MAX ? -1 : (int) step_size, moves, spikes, spikes_with_maintenance);
+
+        if (step_size == SIZE_MAX) {
+            CHECK(spikes >= moves - 1);
+            CHECK(spikes_with_maintenance >= moves - 1);
+        } else {
+            if (step_size != 0) {
+                CHECK(spikes < moves / 10);
+            }
+            CHECK(spikes_with_maintenance < moves / 10);
+        }
+        delete[] versions;
+    }
+}
+
+TEST_CASE("interrupted incremental rotation is started over after power on", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    Counting_Flash counting(&part);
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+
+    WL_Flash *wl_flash = new WL_Flash();
+    REQUIRE(wl_flash->config(&cfg, &counting) == ESP_OK);
+    wl_flash->set_incremental_rotation(true, 0);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    size_t sector_size = wl_flash->sector_size();
+    size_t sectors = wl_flash->chip_size() / sector_size;
+    uint32_t *versions = new uint32_t[sectors]();
+    write_all_sectors(*wl_flash, versions, sectors);
+
+    for (int k = 0; k < 50; k++) {
+        // Leave the move at a different step each time, then lose power
+        rewrite_sectors(*wl_flash, counting, versions, sectors, cfg.updaterate, 0);
+        bool pending = false;
+        for (int step = 0; step < k % 10; step++) {
+            REQUIRE(wl_flash->maintenance(512, &pending) == ESP_OK);
+        }
+        delete wl_flash;
+
+        wl_flash = new WL_Flash();
+        REQUIRE(wl_flash->config(&cfg, &counting) == ESP_OK);
+        wl_flash->set_incremental_rotation(true, 0);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        check_sectors(*wl_flash, versions, sectors);
+    }
+    delete wl_flash;
+    delete[] versions;
+}
+
+TEST_CASE("sector cache absorbs repeated FAT sector updates", "[wear_levelling][bench]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    wl_ext_cfg_t cfg;
+    default_wl_config(&cfg, partition);
+    cfg.fat_sector_size = 512;
+
+    const size_t fat_sector_size = cfg.fat_sector_size;
+    const size_t ops = 4000;
+    const size_t cache_sizes[] = {0, 2, 4, 8};
+    uint32_t erases_without_cache = 0;
+    for (size_t cache_size : cache_sizes) {
+        WL_Ext_Perf *wl_flash = new WL_Ext_Perf();
+        wl_flash->set_cache_size(cache_size);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+
+        size_t size = wl_flash->chip_size();
+        uint8_t *expected = new uint8_t[size];
+        uint8_t *data = new uint8_t[size];
+        memset(expected, 0xff, size);
+        REQUIRE(wl_flash->erase_range(0, size) == ESP_OK);
+        REQUIRE(wl_flash->sync() == ESP_OK);
+
+        // Like FAT: most updates go to the FAT table and to directory entries, the rest
+        // appends file data, and files are synced every now and then
+        spiflash.reset_total_erase_cycles();
+        uint32_t x = 4321;
+        size_t next_data_sector = 64;
+        auto start = std::chrono::steady_clock::now();
+        for (size_t n = 0; n < ops; n++) {
+            x ^= x << 13;
+            x ^= x >> 17;
+            x ^= x << 5;
+            size_t sector;
+            if (x % 10 < 5) {
+                sector = 1 + (x >> 8) % 4;
+            } else if (x % 10 < 7) {
+                sector = 32 + (x >> 8) % 4;
+            } else {
+                sector = next_data_sector++;
+            }
+            uint8_t *sector_data = &expected[sector * fat_sector_size];
+            for (size_t i = 0; i < fat_sector_size; i++) {
+                sector_data[i] = (uint8_t) (x + i);
+            }
+            REQUIRE(wl_flash->erase_range(sector * fat_sector_size, fat_sector_size) == ESP_OK);
+            REQUIRE(wl_flash->write(sector * fat_sector_size, sector_data, fat_sector_size) == ESP_OK);
+            if (n % 50 == 49) {
+                REQUIRE(wl_flash->sync() == ESP_OK);
+            }
+        }
+        REQUIRE(wl_flash->sync() == ESP_OK);
+        auto time_us = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+        uint32_t erases = spiflash.get_total_erase_cycles();
+
+        REQUIRE(wl_flash->read(0, data, size) == ESP_OK);
+        REQUIRE(memcmp(expected, data, size) == 0);
+
+        // What was synced is on the flash
+        delete wl_flash;
+        wl_flash = new WL_Ext_Perf();
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        REQUIRE(wl_flash->read(0, data, size) == ESP_OK);
+        REQUIRE(memcmp(expected, data, size) == 0);
+
+        printf("cache_size=%zu updates=%zu erases=%u erases/update=%.3f time=%.1f us/update\n",
+               cache_size, ops, erases, (double) erases / ops, (double) time_us / ops);
+        if (cache_size == 0) {
+            erases_without_cache = erases;
+        } else {
+            CHECK(erases * 2 < erases_without_cache);
+        }
+        delete wl_flash;
+        delete[] expected;
+        delete[] data;
+    }
+}
+
+static void write_tag(uint32_t *tag, size_t sector, uint32_t version)
+{
+    tag[0] = sector;
+    tag[1] = version;
+    tag[2] = ~sector;
+    tag[3] = 0x5441475f;
+}
+
+// Erases sectors with a skewed distribution like FAT does, and writes a tag to each of them.
+// Returns the sector whose erase or write failed, or -1.
+static int erase_hot_sectors(WL_Flash &wl_flash, uint32_t *versions, size_t sectors, size_t ops, uint32_t *seed)
+{
+    size_t sector_size = wl_flash.sector_size();
+    for (size_t n = 0; n < ops; n++) {
+        uint32_t x = *seed;
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        *seed = x;
+        // 90% of the erases go to 4 sectors
+        size_t sector = (x % 10 < 9) ? (x >> 8) % 4 : (x >> 8) % sectors;
+        uint32_t tag[4];
+        write_tag(tag, sector, versions[sector] + 1);
+        if (wl_flash.erase_sector(sector) != ESP_OK || wl_flash.write(sector * sector_size, tag, sizeof(tag)) != ESP_OK) {
+            return sector;
+        }
+        versions[sector]++;
+    }
+    return -1;
+}
+
+static void check_tags(WL_Flash &wl_flash, const uint32_t *versions, size_t sectors, int skip_sector)
+{
+    size_t sector_size = wl_flash.sector_size();
+    for (size_t sector = 0; sector < sectors; sector++) {
+        if ((int) sector == skip_sector) {
+            continue;
+        }
+        uint32_t tag[4];
+        uint32_t expected[4];
+        write_tag(expected, sector, versions[sector]);
+        REQUIRE(wl_flash.read(sector * sector_size, tag, sizeof(tag)) == ESP_OK);
+        REQUIRE(memcmp(tag, expected, sizeof(tag)) == 0);
+    }
+}
+
+TEST_CASE("hot/cold swapping evens out erase counts", "[wear_levelling][bench]")
+{
+    const size_t thresholds[] = {0, 64, 16};
+    const size_t ops = 100000;
+    double ratio_without_swap = 0;
+    for (size_t threshold : thresholds) {
+        init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+        const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+        Partition part(partition);
+        wl_config_t cfg;
+        default_wl_config(&cfg, partition);
+
+        WL_Flash *wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(threshold);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        size_t sectors = wl_flash->chip_size() / wl_flash->sector_size();
+        uint32_t *versions = new uint32_t[sectors]();
+        uint32_t seed = 777;
+        REQUIRE(erase_hot_sectors(*wl_flash, versions, sectors, sectors, &seed) == -1);
+        for (size_t sector = 0; sector < sectors; sector++) {
+            uint32_t tag[4];
+            write_tag(tag, sector, versions[sector]);
+            REQUIRE(wl_flash->erase_sector(sector) == ESP_OK);
+            REQUIRE(wl_flash->write(sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+        }
+
+        spiflash.reset_erase_cycles();
+        spiflash.reset_total_erase_cycles();
+        REQUIRE(erase_hot_sectors(*wl_flash, versions, sectors, ops, &seed) == -1);
+        check_tags(*wl_flash, versions, sectors, -1);
+        REQUIRE(wl_flash->flush() == ESP_OK);
+
+        // Include the sectors used for the state and the map
+        size_t first_sector = partition->address / SPI_FLASH_SEC_SIZE;
+        size_t partition_sectors = partition->size / SPI_FLASH_SEC_SIZE;
+        uint32_t max_erases = 0;
+        for (size_t i = 0; i < partition_sectors; i++) {
+            uint32_t erases = spiflash.get_erase_cycles(first_sector + i);
+            if (erases > max_erases) {
+                max_erases = erases;
+            }
+        }
+        double mean_erases = (double) spiflash.get_total_erase_cycles() / partition_sectors;
+        double ratio = max_erases / mean_erases;
+        printf("swap_threshold=%3zu erases=%u max=%u mean=%.1f max/mean=%.2f\n",
+               threshold, spiflash.get_total_erase_cycles(), max_erases, mean_erases, ratio);
+
+        // The page map survives a remount
+        delete wl_flash;
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(threshold);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        check_tags(*wl_flash, versions, sectors, -1);
+
+        if (threshold == 0) {
+            ratio_without_swap = ratio;
+        } else {
+            CHECK(ratio * 2 < ratio_without_swap);
+        }
+        delete wl_flash;
+        delete[] versions;
+    }
+}
+
+TEST_CASE("hot/cold swapping survives power loss", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+
+    WL_Flash *wl_flash = new WL_Flash();
+    wl_flash->set_hot_cold_swap(4);
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    size_t sectors = wl_flash->chip_size() / wl_flash->sector_size();
+    uint32_t *versions = new uint32_t[sectors]();
+    for (size_t sector = 0; sector < sectors; sector++) {
+        uint32_t tag[4];
+        write_tag(tag, sector, versions[sector]);
+        REQUIRE(wl_flash->erase_sector(sector) == ESP_OK);
+        REQUIRE(wl_flash->write(sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+    }
+
+    uint32_t seed = 99;
+    for (int k = 0; k < 200; k++) {
+        // Lose power after a different amount of erases each time
+        spiflash.reset_total_erase_cycles();
+        spiflash.set_total_erase_cycles_limit(1 + (k * 7) % 37);
+        int failed_sector = erase_hot_sectors(*wl_flash, versions, sectors, 1000, &seed);
+        REQUIRE(failed_sector >= 0);
+        spiflash.set_total_erase_cycles_limit(0);
+        delete wl_flash;
+
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(4);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        check_tags(*wl_flash, versions, sectors, failed_sector);
+
+        // Write the sector that was interrupted again
+        uint32_t tag[4];
+        write_tag(tag, failed_sector, ++versions[failed_sector]);
+        REQUIRE(wl_flash->erase_sector(failed_sector) == ESP_OK);
+        REQUIRE(wl_flash->write(failed_sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+    }
+    delete wl_flash;
+    delete[] versions;
+}
+
+static void count_power_loss(void *arg)
+{
+    (*(int *) arg)++;
+}
+
+TEST_CASE("flash simulator loses power during program and erase operations", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    uint32_t sector = partition->address / CONFIG_WL_SECTOR_SIZE;
+    uint32_t base = sector * CONFIG_WL_SECTOR_SIZE;
+    uint8_t *memory = spiflash.get_memory_ptr(base);
+
+    int power_losses = 0;
+    spiflash.set_power_loss_handler(count_power_loss, &power_losses);
+
+    uint8_t data[512];
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7 + 1;
+    }
+
+    // Two operations complete, the third is interrupted
+    spiflash.set_power_loss_after(2, 1234);
+    REQUIRE(spiflash.erase_sector(sector) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(spiflash.write(base, data, 16) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(power_losses == 0);
+    REQUIRE(spiflash.write(base + 16, data, sizeof(data)) == ESP_ROM_SPIFLASH_RESULT_ERR);
+    REQUIRE(power_losses == 1);
+    REQUIRE(spiflash.get_power_lost());
+
+    // Some bits are left unprogrammed, but no bit which should stay set was cleared
+    REQUIRE(memcmp(memory, data, 16) == 0);
+    int first_unprogrammed = -1;
+    for (int i = 0; i < sizeof(data); i++) {
+        REQUIRE((memory[16 + i] & data[i]) == data[i]);
+        if (memory[16 + i] != data[i] && first_unprogrammed < 0) {
+            first_unprogrammed = i;
+        }
+    }
+    REQUIRE(first_unprogrammed >= 0);
+    // The program pages after the one being programmed when power was lost are untouched
+    for (int i = (16 + first_unprogrammed) / 256 * 256 + 256 - 16; i < sizeof(data); i++) {
+        REQUIRE(memory[16 + i] == 0xFF);
+    }
+
+    // Nothing works until power is restored
+    uint8_t buf[16];
+    REQUIRE(spiflash.read(base, buf, sizeof(buf)) == ESP_ROM_SPIFLASH_RESULT_ERR);
+    REQUIRE(spiflash.erase_sector(sector) == ESP_ROM_SPIFLASH_RESULT_ERR);
+    spiflash.restore_power();
+    REQUIRE(spiflash.read(base, buf, sizeof(buf)) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(memcmp(buf, data, sizeof(buf)) == 0);
+
+    // An interrupted erase only sets some of the bits
+    uint8_t *before = new uint8_t[CONFIG_WL_SECTOR_SIZE];
+    memcpy(before, memory, CONFIG_WL_SECTOR_SIZE);
+    spiflash.set_power_loss_after(0, 5678);
+    REQUIRE(spiflash.erase_sector(sector) == ESP_ROM_SPIFLASH_RESULT_ERR);
+    REQUIRE(power_losses == 2);
+    int erased = 0;
+    for (int i = 0; i < CONFIG_WL_SECTOR_SIZE; i++) {
+        REQUIRE((memory[i] & before[i]) == before[i]);
+        erased += memory[i] == 0xFF;
+    }
+    REQUIRE(erased < CONFIG_WL_SECTOR_SIZE);
+    delete[] before;
+
+    // Initializing the flash again restores power
+    spiflash.set_power_loss_handler(NULL, NULL);
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    REQUIRE(!spiflash.get_power_lost());
+}
+
+TEST_CASE("flash simulator uses a flash image file", "[wear_levelling]")
+{
+    char image[] = "/tmp/test_wl_image_XXXXXX";
+    int fd = mkstemp(image);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    // A new image is erased, apart from the partition table
+    REQUIRE(init_spi_flash_image(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, image, "partition_table.bin") == ESP_OK);
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    uint32_t chip_size = spiflash.get_chip_size();
+    REQUIRE(*spiflash.get_memory_ptr(partition->address) == 0xFF);
+
+    const char data[] = "persistent flash data";
+    REQUIRE(spiflash.erase_sector(partition->address / CONFIG_WL_SECTOR_SIZE) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(spiflash.write(partition->address, data, sizeof(data)) == ESP_ROM_SPIFLASH_RESULT_OK);
+
+    // Written data goes straight to the file
+    FILE *f = fopen(image, "rb");
+    REQUIRE(f != NULL);
+    char buf[sizeof(data)];
+    REQUIRE(fseek(f, partition->address, SEEK_SET) == 0);
+    REQUIRE(fread(buf, 1, sizeof(buf), f) == sizeof(buf));
+    REQUIRE(memcmp(buf, data, sizeof(data)) == 0);
+    fseek(f, 0, SEEK_END);
+    REQUIRE(ftell(f) == chip_size);
+    fclose(f);
+
+    // Opening the image again, taking the size from the image, finds the data
+    REQUIRE(init_spi_flash_image(NULL, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, image, NULL) == ESP_OK);
+    REQUIRE(spiflash.get_chip_size() == chip_size);
+    REQUIRE(memcmp(spiflash.get_memory_ptr(partition->address), data, sizeof(data)) == 0);
+
+    // Erasing sectors of an existing image isn't skipped, as their contents are unknown
+    REQUIRE(spiflash.erase_sector(partition->address / CONFIG_WL_SECTOR_SIZE) == ESP_ROM_SPIFLASH_RESULT_OK);
+    REQUIRE(*spiflash.get_memory_ptr(partition->address) == 0xFF);
+
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    unlink(image);
+}
+
+TEST_CASE("wear levelling recovers from power loss with partially programmed bits", "[wear_levelling]")
+{
+    char image[] = "/tmp/test_wl_image_XXXXXX";
+    int fd = mkstemp(image);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    REQUIRE(init_spi_flash_image(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, image, "partition_table.bin") == ESP_OK);
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+
+    WL_Flash *wl_flash = new WL_Flash();
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    size_t sectors = wl_flash->chip_size() / wl_flash->sector_size();
+    uint32_t *versions = new uint32_t[sectors]();
+    for (size_t sector = 0; sector < sectors; sector++) {
+        uint32_t tag[4];
+        write_tag(tag, sector, versions[sector]);
+        REQUIRE(wl_flash->erase_sector(sector) == ESP_OK);
+        REQUIRE(wl_flash->write(sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+    }
+
+    uint32_t seed = 12345;
+    for (int k = 0; k < 200; k++) {
+        // Lose power in the middle of a different program or erase operation each time
+        spiflash.set_power_loss_after(k * 13 % 97, k + 1);
+        int failed_sector = erase_hot_sectors(*wl_flash, versions, sectors, 1000, &seed);
+        REQUIRE(failed_sector >= 0);
+        delete wl_flash;
+
+        // Start again from the image, as a new process would
+        REQUIRE(init_spi_flash_image(NULL, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, image, NULL) == ESP_OK);
+        wl_flash = new WL_Flash();
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        check_tags(*wl_flash, versions, sectors, failed_sector);
+
+        // Write the sector that was interrupted again
+        uint32_t tag[4];
+        write_tag(tag, failed_sector, ++versions[failed_sector]);
+        REQUIRE(wl_flash->erase_sector(failed_sector) == ESP_OK);
+        REQUIRE(wl_flash->write(failed_sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+    }
+    delete wl_flash;
+    delete[] versions;
+
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    unlink(image);
+}
+
+TEST_CASE("hot/cold swapping keeps the page map after power loss in a map record", "[wear_levelling]")
+{
+    char image[] = "/tmp/test_wl_image_XXXXXX";
+    int fd = mkstemp(image);
+    REQUIRE(fd >= 0);
+    close(fd);
+
+    REQUIRE(init_spi_flash_image(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, image, "partition_table.bin") == ESP_OK);
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+    // Copy a page with a single write, so that most of the operations of a swap are the map record writes
+    cfg.temp_buff_size = cfg.page_size;
+
+    WL_Flash *wl_flash = new WL_Flash();
+    wl_flash->set_hot_cold_swap(1);
+    REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+    REQUIRE(wl_flash->init() == ESP_OK);
+    size_t sectors = wl_flash->chip_size() / wl_flash->sector_size();
+    uint32_t *versions = new uint32_t[sectors]();
+    for (size_t sector = 0; sector < sectors; sector++) {
+        uint32_t tag[4];
+        write_tag(tag, sector, versions[sector]);
+        REQUIRE(wl_flash->erase_sector(sector) == ESP_OK);
+        REQUIRE(wl_flash->write(sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+    }
+
+    uint32_t seed = 4321;
+    for (int k = 0; k < 200; k++) {
+        // With a threshold of 1 most erases swap, so some of these interrupt the write of a map record
+        spiflash.set_power_loss_after(k * 7 % 23, k + 1);
+        int failed_sector = erase_hot_sectors(*wl_flash, versions, sectors, 1000, &seed);
+        REQUIRE(failed_sector >= 0);
+        delete wl_flash;
+
+        REQUIRE(init_spi_flash_image(NULL, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, image, NULL) == ESP_OK);
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(1);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        check_tags(*wl_flash, versions, sectors, failed_sector);
+        uint32_t tag[4];
+        write_tag(tag, failed_sector, ++versions[failed_sector]);
+        REQUIRE(wl_flash->erase_sector(failed_sector) == ESP_OK);
+        REQUIRE(wl_flash->write(failed_sector * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+
+        // The swaps done after the interrupted record are found on the next mount as well
+        REQUIRE(erase_hot_sectors(*wl_flash, versions, sectors, 50, &seed) == -1);
+        delete wl_flash;
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(1);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        check_tags(*wl_flash, versions, sectors, -1);
+    }
+    delete wl_flash;
+    delete[] versions;
+
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    unlink(image);
+}
+
+TEST_CASE("partition isn't formatted when the hot/cold swap setting changes", "[wear_levelling]")
+{
+    init_spi_flash(CONFIG_ESPTOOLPY_FLASHSIZE, CONFIG_WL_SECTOR_SIZE * 16, CONFIG_WL_SECTOR_SIZE, CONFIG_WL_SECTOR_SIZE, "partition_table.bin");
+    const esp_partition_t *partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, "storage");
+    Partition part(partition);
+    wl_config_t cfg;
+    default_wl_config(&cfg, partition);
+
+    for (size_t threshold : {0, 4}) {
+        size_t other_threshold = (threshold == 0) ? 4 : 0;
+        REQUIRE(esp_partition_erase_range(partition, 0, partition->size) == ESP_OK);
+
+        WL_Flash *wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(threshold);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        uint32_t tag[4];
+        write_tag(tag, 3, 1);
+        REQUIRE(wl_flash->erase_sector(3) == ESP_OK);
+        REQUIRE(wl_flash->write(3 * wl_flash->sector_size(), tag, sizeof(tag)) == ESP_OK);
+        delete wl_flash;
+
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(other_threshold);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_ERR_INVALID_VERSION);
+        delete wl_flash;
+
+        // The data is still there with the setting the partition was formatted with
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(threshold);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        uint32_t read_tag[4];
+        REQUIRE(wl_flash->read(3 * wl_flash->sector_size(), read_tag, sizeof(read_tag)) == ESP_OK);
+        REQUIRE(memcmp(tag, read_tag, sizeof(tag)) == 0);
+        delete wl_flash;
+
+        // Erasing the partition formats it with the new setting
+        REQUIRE(esp_partition_erase_range(partition, 0, partition->size) == ESP_OK);
+        wl_flash = new WL_Flash();
+        wl_flash->set_hot_cold_swap(other_threshold);
+        REQUIRE(wl_flash->config(&cfg, &part) == ESP_OK);
+        REQUIRE(wl_flash->init() == ESP_OK);
+        delete wl_flash;
+    }
+}
@@ -126,6 +126,9 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
         goto out;
     }
     wl_flash = new (wl_flash_ptr) WL_Ext_Perf();
+#ifdef CONFIG_WL_SECTOR_CACHE_SIZE
+    ((WL_Ext_Perf *)wl_flash)->set_cache_size(CONFIG_WL_SECTOR_CACHE_SIZE);
+#endif
 #endif // CONFIG_WL_SECTOR_MODE
 #endif // CONFIG_WL_SECTOR_SIZE
 #if CONFIG_WL_SECTOR_SIZE == 4096
@@ -139,11 +142,17 @@ esp_err_t wl_mount(const esp_partition_t *partition, wl_handle_t *out_handle)
     wl_flash = new (wl_flash_ptr) WL_Flash();
 #endif // CONFIG_WL_SECTOR_SIZE
 
+#ifdef CONFIG_WL_HOT_COLD_SWAP
+    wl_flash->set_hot_cold_swap(CONFIG_WL_SWAP_THRESHOLD);
+#endif
     result = wl_flash->config(&cfg, part);
     if (ESP_OK != result) {
         ESP_LOGE(TAG, "%s: config instance=0x%08x, result=0x%x", __func__, *out_handle, result);
         goto out;
     }
+#ifdef CONFIG_WL_INCREMENTAL_ROTATION
+    wl_flash->set_incremental_rotation(true, CONFIG_WL_ROTATION_STEP_SIZE);
+#endif
     result = wl_flash->init();
     if (ESP_OK != result) {
         ESP_LOGE(TAG, "%s: init instance=0x%08x, result=0x%x", __func__, *out_handle, result);
@@ -225,6 +234,18 @@ esp_err_t wl_read(wl_handle_t handle, size_t src_addr, void *dest, size_t size)
     return result;
 }
 
+esp_err_t wl_sync(wl_handle_t handle)
+{
+    esp_err_t result = check_handle(handle, __func__);
+    if (result != ESP_OK) {
+        return result;
+    }
+    _lock_acquire(&s_instances[handle].lock);
+    result = s_instances[handle].instance->sync();
+    _lock_release(&s_instances[handle].lock);
+    return result;
+}
+
 size_t wl_size(wl_handle_t handle)
 {
     esp_err_t err = check_handle(handle, __func__);
@@ -249,6 +270,18 @@ size_t wl_sector_size(wl_handle_t handle)
     return result;
 }
 
+esp_err_t wl_maintenance(wl_handle_t handle, size_t max_bytes, bool *out_pending)
+{
+    esp_err_t result = check_handle(handle, __func__);
+    if (result != ESP_OK) {
+        return result;
+    }
+    _lock_acquire(&s_instances[handle].lock);
+    result = s_instances[handle].instance->maintenance(max_bytes, out_pending);
+    _lock_release(&s_instances[handle].lock);
+    return result;
+}
+
 static esp_err_t check_handle(wl_handle_t handle, const char *func)
 {
     if (handle == WL_INVALID_HANDLE) {